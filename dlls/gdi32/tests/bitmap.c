@@ -3851,6 +3851,164 @@ static void test_GdiAlphaBlend(void)
     HeapFree(GetProcessHeap(), 0, bmi);
 }
 
+static BYTE ref_blend_channel( BYTE dst, BYTE src, DWORD alpha )
+{
+    return (src * alpha + dst * (255 - alpha) + 127) / 255;
+}
+
+static DWORD ref_blend_pixel( DWORD dst, DWORD src, BLENDFUNCTION blend )
+{
+    DWORD i, alpha, ret = 0;
+
+    if (!(blend.AlphaFormat & AC_SRC_ALPHA))
+    {
+        for (i = 0; i < 32; i += 8)
+            ret |= ref_blend_channel( dst >> i, src >> i, blend.SourceConstantAlpha ) << i;
+        return ret;
+    }
+    alpha = ((src >> 24) * blend.SourceConstantAlpha + 127) / 255;
+    for (i = 0; i < 32; i += 8)
+    {
+        BYTE comp = (i == 24) ? alpha : ((BYTE)(src >> i) * blend.SourceConstantAlpha + 127) / 255;
+        /* components of sources that aren't premultiplied overflow into the next one */
+        ret |= (DWORD)(comp + ((BYTE)(dst >> i) * (255 - alpha) + 127) / 255) << i;
+    }
+    return ret;
+}
+
+static void test_GdiAlphaBlend_pixels(void)
+{
+    static const BYTE const_alpha[] = { 255, 128, 1 };
+    static const char text[] = "WM#@ The quick brown fox";
+    const int width = 256, height = 64;
+    BLENDFUNCTION blend = { AC_SRC_OVER, 0, 0, 0 };
+    DWORD *src_bits, *dst_bits, *expect, seed = 12345;
+    HBITMAP src_bmp, dst_bmp, bmp24, old_src, old_dst, old_bmp24;
+    BYTE *bits24;
+    HDC src_dc, dst_dc, dc24;
+    BITMAPINFO bmi;
+    int i, j, w, x, y, errors;
+    BOOL premultiplied;
+    LOGFONTA lf;
+    HFONT font;
+    BOOL ret;
+
+    if (!pGdiAlphaBlend)
+    {
+        win_skip( "GdiAlphaBlend() is not implemented\n" );
+        return;
+    }
+
+    memset( &bmi, 0, sizeof(bmi) );
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    src_dc = CreateCompatibleDC( 0 );
+    dst_dc = CreateCompatibleDC( 0 );
+    dc24 = CreateCompatibleDC( 0 );
+    src_bmp = CreateDIBSection( src_dc, &bmi, DIB_RGB_COLORS, (void **)&src_bits, NULL, 0 );
+    dst_bmp = CreateDIBSection( dst_dc, &bmi, DIB_RGB_COLORS, (void **)&dst_bits, NULL, 0 );
+    bmi.bmiHeader.biBitCount = 24;
+    bmp24 = CreateDIBSection( dc24, &bmi, DIB_RGB_COLORS, (void **)&bits24, NULL, 0 );
+    old_src = SelectObject( src_dc, src_bmp );
+    old_dst = SelectObject( dst_dc, dst_bmp );
+    old_bmp24 = SelectObject( dc24, bmp24 );
+    expect = HeapAlloc( GetProcessHeap(), 0, width * height * sizeof(*expect) );
+
+    /* check all the row widths up to a few times the vector size against the per-pixel formulas,
+     * with premultiplied and non-premultiplied sources */
+    for (i = 0; i < ARRAY_SIZE(const_alpha) * 3; i++)
+    {
+        blend.SourceConstantAlpha = const_alpha[i / 3];
+        blend.AlphaFormat = (i % 3 != 2) ? AC_SRC_ALPHA : 0;
+        premultiplied = (i % 3 == 0);
+        errors = 0;
+
+        for (w = 1; w <= 67; w++)
+        {
+            for (j = 0; j < width * height; j++)
+            {
+                DWORD pixel = seed = seed * 1103515245 + 12345;
+                BYTE a = pixel >> 24;
+
+                if (premultiplied)
+                    src_bits[j] = a << 24 | ((pixel >> 16) & 0xff) * a / 255 << 16 |
+                                  ((pixel >> 8) & 0xff) * a / 255 << 8 | (pixel & 0xff) * a / 255;
+                else
+                    src_bits[j] = pixel;
+                dst_bits[j] = seed = seed * 1103515245 + 12345;
+            }
+            for (y = 0; y < height; y++)
+                for (x = 0; x < width; x++)
+                    expect[y * width + x] = (x >= 3 && x < 3 + w) ?
+                        ref_blend_pixel( dst_bits[y * width + x], src_bits[y * width + x - 3 + 1], blend ) :
+                        dst_bits[y * width + x];
+
+            ret = pGdiAlphaBlend( dst_dc, 3, 0, w, height, src_dc, 1, 0, w, height, blend );
+            ok( ret, "GdiAlphaBlend failed err %u\n", GetLastError() );
+            for (j = 0; j < width * height; j++) if (dst_bits[j] != expect[j]) errors++;
+            ok( !errors, "alpha %u format %x premultiplied %u width %u: %u pixels differ\n",
+                blend.SourceConstantAlpha, blend.AlphaFormat, premultiplied, w, errors );
+            if (errors) break;
+        }
+    }
+
+    /* antialiased and subpixel text on 32-bit dibs must match the 24-bit ones */
+    memset( &lf, 0, sizeof(lf) );
+    lf.lfHeight = -56;
+    lf.lfWeight = FW_BLACK;
+    strcpy( lf.lfFaceName, "Tahoma" );
+    for (i = 0; i < 2; i++)
+    {
+        for (y = 0; y < height; y++)
+            for (x = 0; x < width; x++)
+            {
+                dst_bits[y * width + x] = seed = seed * 1103515245 + 12345;
+                bits24[y * ((width * 3 + 3) & ~3) + x * 3] = dst_bits[y * width + x];
+                bits24[y * ((width * 3 + 3) & ~3) + x * 3 + 1] = dst_bits[y * width + x] >> 8;
+                bits24[y * ((width * 3 + 3) & ~3) + x * 3 + 2] = dst_bits[y * width + x] >> 16;
+            }
+
+        lf.lfQuality = i ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY;
+        font = CreateFontIndirectA( &lf );
+        SelectObject( dst_dc, font );
+        SelectObject( dc24, font );
+        SetBkMode( dst_dc, TRANSPARENT );
+        SetBkMode( dc24, TRANSPARENT );
+        SetTextColor( dst_dc, RGB( 0x12, 0xa0, 0xfe ));
+        SetTextColor( dc24, RGB( 0x12, 0xa0, 0xfe ));
+        TextOutA( dst_dc, 1, 0, text, strlen(text) );
+        TextOutA( dc24, 1, 0, text, strlen(text) );
+
+        errors = 0;
+        for (y = 0; y < height; y++)
+            for (x = 0; x < width; x++)
+            {
+                const BYTE *ptr = bits24 + y * ((width * 3 + 3) & ~3) + x * 3;
+                if ((dst_bits[y * width + x] & 0xffffff) != (ptr[0] | ptr[1] << 8 | ptr[2] << 16)) errors++;
+            }
+        ok( !errors, "quality %u: %u pixels differ\n", lf.lfQuality, errors );
+
+        SelectObject( dst_dc, GetStockObject( SYSTEM_FONT ));
+        SelectObject( dc24, GetStockObject( SYSTEM_FONT ));
+        DeleteObject( font );
+    }
+
+    HeapFree( GetProcessHeap(), 0, expect );
+    SelectObject( src_dc, old_src );
+    SelectObject( dst_dc, old_dst );
+    SelectObject( dc24, old_bmp24 );
+    DeleteObject( src_bmp );
+    DeleteObject( dst_bmp );
+    DeleteObject( bmp24 );
+    DeleteDC( src_dc );
+    DeleteDC( dst_dc );
+    DeleteDC( dc24 );
+}
+
 static void test_GdiGradientFill(void)
 {
     HDC hdc;
@@ -4007,6 +4165,123 @@ static void test_clipping(void)
     DeleteDC( hdcSrc );
 }
 
+/* operations larger than 512x512 are split into bands processed on several threads, check them
+ * against per-pixel references or the same operation done in strips too small to be split */
+static void test_large_operations(void)
+{
+    const int width = 800, height = 700, strip = 64;
+    BLENDFUNCTION blend = { AC_SRC_OVER, 0, 128, AC_SRC_ALPHA };
+    TRIVERTEX vt[4] = { { 0,     0,      0xff00, 0x0000, 0x0000, 0x8000 },
+                        { width, height, 0x0000, 0xff00, 0x4000, 0xff00 },
+                        { 0,     height, 0x0000, 0x0000, 0xff00, 0x0000 },
+                        { width, 0,      0x8000, 0x8000, 0x0000, 0x4000 } };
+    GRADIENT_RECT rect = { 0, 1 };
+    GRADIENT_TRIANGLE tri = { 0, 2, 3 };
+    DWORD *src_bits, *dst_bits, *ref_bits, *expect, seed = 54321;
+    HBITMAP src_bmp, dst_bmp, ref_bmp, old_src, old_dst, old_ref;
+    HDC src_dc, dst_dc, ref_dc;
+    BITMAPINFO bmi;
+    BYTE *bits24;
+    HRGN rgn;
+    int i, x, y, errors;
+    BOOL ret;
+
+    memset( &bmi, 0, sizeof(bmi) );
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    src_dc = CreateCompatibleDC( 0 );
+    dst_dc = CreateCompatibleDC( 0 );
+    ref_dc = CreateCompatibleDC( 0 );
+    src_bmp = CreateDIBSection( src_dc, &bmi, DIB_RGB_COLORS, (void **)&src_bits, NULL, 0 );
+    dst_bmp = CreateDIBSection( dst_dc, &bmi, DIB_RGB_COLORS, (void **)&dst_bits, NULL, 0 );
+    ref_bmp = CreateDIBSection( ref_dc, &bmi, DIB_RGB_COLORS, (void **)&ref_bits, NULL, 0 );
+    ok( src_bmp && dst_bmp && ref_bmp, "failed to create bitmaps\n" );
+    old_src = SelectObject( src_dc, src_bmp );
+    old_dst = SelectObject( dst_dc, dst_bmp );
+    old_ref = SelectObject( ref_dc, ref_bmp );
+    expect = HeapAlloc( GetProcessHeap(), 0, width * height * sizeof(*expect) );
+    bits24 = HeapAlloc( GetProcessHeap(), 0, width * 3 * height );
+
+    for (i = 0; i < width * height; i++)
+    {
+        DWORD pixel = seed = seed * 1103515245 + 12345;
+        BYTE a = pixel >> 24;
+
+        src_bits[i] = a << 24 | ((pixel >> 16) & 0xff) * a / 255 << 16 |
+                      ((pixel >> 8) & 0xff) * a / 255 << 8 | (pixel & 0xff) * a / 255;
+    }
+
+    /* StretchBlt doubling the top left quarter of the source */
+    SetStretchBltMode( dst_dc, COLORONCOLOR );
+    ret = StretchBlt( dst_dc, 0, 0, width, height, src_dc, 0, 0, width / 2, height / 2, SRCCOPY );
+    ok( ret, "StretchBlt failed err %u\n", GetLastError() );
+    for (y = errors = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            if (dst_bits[y * width + x] != src_bits[y / 2 * width + x / 2]) errors++;
+    ok( !errors, "StretchBlt: %u pixels differ\n", errors );
+
+    /* GdiAlphaBlend with a premultiplied source */
+    if (pGdiAlphaBlend)
+    {
+        for (i = 0; i < width * height; i++) dst_bits[i] = seed = seed * 1103515245 + 12345;
+        for (i = 0; i < width * height; i++) expect[i] = ref_blend_pixel( dst_bits[i], src_bits[i], blend );
+        ret = pGdiAlphaBlend( dst_dc, 0, 0, width, height, src_dc, 0, 0, width, height, blend );
+        ok( ret, "GdiAlphaBlend failed err %u\n", GetLastError() );
+        for (i = errors = 0; i < width * height; i++) if (dst_bits[i] != expect[i]) errors++;
+        ok( !errors, "GdiAlphaBlend: %u pixels differ\n", errors );
+    }
+    else win_skip( "GdiAlphaBlend() is not implemented\n" );
+
+    /* GdiGradientFill, compared with the same fill clipped to strips */
+    if (pGdiGradientFill)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            memset( dst_bits, 0, width * height * 4 );
+            memset( ref_bits, 0, width * height * 4 );
+            if (i) ret = pGdiGradientFill( dst_dc, vt, 4, &tri, 1, GRADIENT_FILL_TRIANGLE );
+            else ret = pGdiGradientFill( dst_dc, vt, 2, &rect, 1, GRADIENT_FILL_RECT_V );
+            ok( ret, "GdiGradientFill failed err %u\n", GetLastError() );
+            for (y = 0; y < height; y += strip)
+            {
+                rgn = CreateRectRgn( 0, y, width, min( y + strip, height ));
+                SelectClipRgn( ref_dc, rgn );
+                DeleteObject( rgn );
+                if (i) pGdiGradientFill( ref_dc, vt, 4, &tri, 1, GRADIENT_FILL_TRIANGLE );
+                else pGdiGradientFill( ref_dc, vt, 2, &rect, 1, GRADIENT_FILL_RECT_V );
+            }
+            SelectClipRgn( ref_dc, 0 );
+            for (x = errors = 0; x < width * height; x++) if (dst_bits[x] != ref_bits[x]) errors++;
+            ok( !errors, "GdiGradientFill mode %u: %u pixels differ\n", i, errors );
+        }
+    }
+    else win_skip( "GdiGradientFill is not implemented\n" );
+
+    /* GetDIBits converting to 24 bpp */
+    bmi.bmiHeader.biBitCount = 24;
+    ret = GetDIBits( src_dc, src_bmp, 0, height, bits24, &bmi, DIB_RGB_COLORS );
+    ok( ret == height, "GetDIBits returned %u\n", ret );
+    for (i = errors = 0; i < width * height; i++)
+        if (memcmp( bits24 + i * 3, src_bits + i, 3 )) errors++;
+    ok( !errors, "GetDIBits: %u pixels differ\n", errors );
+
+    HeapFree( GetProcessHeap(), 0, bits24 );
+    HeapFree( GetProcessHeap(), 0, expect );
+    SelectObject( src_dc, old_src );
+    SelectObject( dst_dc, old_dst );
+    SelectObject( ref_dc, old_ref );
+    DeleteObject( src_bmp );
+    DeleteObject( dst_bmp );
+    DeleteObject( ref_bmp );
+    DeleteDC( src_dc );
+    DeleteDC( dst_dc );
+    DeleteDC( ref_dc );
+}
+
 static void test_32bit_ddb(void)
 {
     char buffer[sizeof(BITMAPINFOHEADER) + sizeof(DWORD)];
@@ -5971,7 +6246,9 @@ START_TEST(bitmap)
     test_StretchBlt();
     test_StretchDIBits();
     test_GdiAlphaBlend();
+    test_GdiAlphaBlend_pixels();
     test_GdiGradientFill();
+    test_large_operations();
     test_32bit_ddb();
     test_bitmapinfoheadersize();
     test_get16dibits();
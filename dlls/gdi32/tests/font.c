@@ -7786,6 +7786,105 @@ static void test_select_object(void)
     DeleteObject(hfont);
 }
 
+#define TEXT_THREAD_FONTS 4
+#define TEXT_THREAD_WIDTH 256
+#define TEXT_THREAD_HEIGHT 64
+
+struct text_thread_params
+{
+    HFONT fonts[TEXT_THREAD_FONTS];
+    DWORD ref_bits[TEXT_THREAD_FONTS][TEXT_THREAD_WIDTH * TEXT_THREAD_HEIGHT];
+    LONG failures;
+};
+
+static HDC create_text_dc(DWORD **bits)
+{
+    BITMAPINFO bmi;
+    HDC hdc = CreateCompatibleDC(0);
+    HBITMAP bitmap;
+
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = TEXT_THREAD_WIDTH;
+    bmi.bmiHeader.biHeight = -TEXT_THREAD_HEIGHT;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    bitmap = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, (void **)bits, NULL, 0);
+    ok(bitmap != NULL, "CreateDIBSection failed\n");
+    SelectObject(hdc, bitmap);
+    return hdc;
+}
+
+static void delete_text_dc(HDC hdc)
+{
+    HBITMAP bitmap = GetCurrentObject(hdc, OBJ_BITMAP);
+
+    DeleteDC(hdc);
+    DeleteObject(bitmap);
+}
+
+static void draw_thread_text(HDC hdc, HFONT font, DWORD *bits)
+{
+    static const WCHAR text[] = L"The quick brown fox jumps over the lazy dog 0123456789";
+
+    memset(bits, 0xff, TEXT_THREAD_WIDTH * TEXT_THREAD_HEIGHT * sizeof(*bits));
+    SelectObject(hdc, font);
+    ExtTextOutW(hdc, 2, 2, 0, NULL, text, ARRAY_SIZE(text) - 1, NULL);
+    GdiFlush();
+}
+
+static DWORD WINAPI text_thread_proc(void *arg)
+{
+    struct text_thread_params *params = arg;
+    DWORD *bits;
+    HDC hdc = create_text_dc(&bits);
+    int i, j;
+
+    for (i = 0; i < 50; i++)
+    {
+        j = (i + GetCurrentThreadId()) % TEXT_THREAD_FONTS;
+        draw_thread_text(hdc, params->fonts[j], bits);
+        if (memcmp(bits, params->ref_bits[j], sizeof(params->ref_bits[j])))
+            InterlockedIncrement(&params->failures);
+    }
+    delete_text_dc(hdc);
+    return 0;
+}
+
+static void test_text_threads(void)
+{
+    struct text_thread_params *params;
+    HANDLE threads[8];
+    LOGFONTA lf;
+    DWORD *bits;
+    HDC hdc;
+    int i;
+
+    params = heap_alloc_zero(sizeof(*params));
+    hdc = create_text_dc(&bits);
+    for (i = 0; i < TEXT_THREAD_FONTS; i++)
+    {
+        memset(&lf, 0, sizeof(lf));
+        lf.lfHeight = -11 - 6 * i;
+        lf.lfQuality = (i & 1) ? ANTIALIASED_QUALITY : NONANTIALIASED_QUALITY;
+        strcpy(lf.lfFaceName, "Tahoma");
+        params->fonts[i] = CreateFontIndirectA(&lf);
+        draw_thread_text(hdc, params->fonts[i], bits);
+        memcpy(params->ref_bits[i], bits, sizeof(params->ref_bits[i]));
+    }
+
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+        threads[i] = CreateThread(NULL, 0, text_thread_proc, params, 0, NULL);
+    WaitForMultipleObjects(ARRAY_SIZE(threads), threads, TRUE, INFINITE);
+    for (i = 0; i < ARRAY_SIZE(threads); i++) CloseHandle(threads[i]);
+    ok(!params->failures, "got %d different images\n", params->failures);
+
+    delete_text_dc(hdc);
+    for (i = 0; i < TEXT_THREAD_FONTS; i++) DeleteObject(params->fonts[i]);
+    heap_free(params);
+}
+
 START_TEST(font)
 {
     static const char *test_names[] =
@@ -7873,6 +7972,7 @@ START_TEST(font)
     test_lang_names();
     test_char_width();
     test_select_object();
+    test_text_threads();
 
     /* These tests should be last test until RemoveFontResource
      * is properly implemented.
@@ -5620,6 +5620,100 @@ static void test_overlapped_read(void)
     ok(ret, "Unexpected error %u.\n", GetLastError());
 }
 
+static void test_overlapped_queue(void)
+{
+    static const char prefix[] = "pfx";
+    char temp_path[MAX_PATH];
+    char file_name[MAX_PATH];
+    static char buffers[64][4096];
+    OVERLAPPED ov[64], *pov;
+    HANDLE hfile, port, events[64];
+    ULONG_PTR key;
+    DWORD count;
+    BOOL ret;
+    int i, j;
+
+    ret = GetTempPathA(MAX_PATH, temp_path);
+    ok(ret, "Unexpected error %u.\n", GetLastError());
+    ret = GetTempFileNameA(temp_path, prefix, 0, file_name);
+    ok(ret, "Unexpected error %u.\n", GetLastError());
+
+    hfile = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_FLAG_OVERLAPPED, NULL);
+    ok(hfile != INVALID_HANDLE_VALUE, "Failed to create file, GetLastError() %u.\n", GetLastError());
+
+    /* queue many writes at once and wait for all of them */
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        memset(buffers[i], i, sizeof(buffers[i]));
+        memset(&ov[i], 0, sizeof(ov[i]));
+        S(U(ov[i])).Offset = i * sizeof(buffers[i]);
+        ov[i].hEvent = events[i] = CreateEventA(NULL, TRUE, FALSE, NULL);
+        ret = WriteFile(hfile, buffers[i], sizeof(buffers[i]), NULL, &ov[i]);
+        ok(ret || GetLastError() == ERROR_IO_PENDING, "%d: WriteFile failed, error %u.\n", i, GetLastError());
+    }
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        ret = GetOverlappedResult(hfile, &ov[i], &count, TRUE);
+        ok(ret, "%d: GetOverlappedResult failed, error %u.\n", i, GetLastError());
+        ok(count == sizeof(buffers[i]), "%d: got size %u.\n", i, count);
+        CloseHandle(events[i]);
+    }
+
+    /* queue many reads and get their completions from a port */
+    port = CreateIoCompletionPort(hfile, NULL, 0xdead, 0);
+    ok(port != NULL, "CreateIoCompletionPort failed, error %u.\n", GetLastError());
+
+    memset(buffers, 0xcc, sizeof(buffers));
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        memset(&ov[i], 0, sizeof(ov[i]));
+        S(U(ov[i])).Offset = i * sizeof(buffers[i]);
+        ret = ReadFile(hfile, buffers[i], sizeof(buffers[i]), NULL, &ov[i]);
+        ok(ret || GetLastError() == ERROR_IO_PENDING, "%d: ReadFile returned %d, error %u.\n",
+                i, ret, GetLastError());
+    }
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        key = 0;
+        pov = NULL;
+        ret = GetQueuedCompletionStatus(port, &count, &key, &pov, 5000);
+        ok(ret, "GetQueuedCompletionStatus failed, error %u.\n", GetLastError());
+        if (!ret) break;
+        ok(key == 0xdead, "got key %#x.\n", (DWORD)key);
+        ok(pov >= ov && pov < ov + ARRAY_SIZE(ov), "got overlapped %p.\n", pov);
+        ok(count == sizeof(buffers[0]), "got size %u.\n", count);
+    }
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        for (j = 0; j < sizeof(buffers[i]); j++) if (buffers[i][j] != (char)i) break;
+        ok(j == sizeof(buffers[i]), "%d: wrong data at %d.\n", i, j);
+    }
+
+    /* reading past the end of file */
+    memset(&ov[0], 0, sizeof(ov[0]));
+    S(U(ov[0])).Offset = sizeof(buffers);
+    ret = ReadFile(hfile, buffers[0], sizeof(buffers[0]), NULL, &ov[0]);
+    ok(!ret && (GetLastError() == ERROR_IO_PENDING || GetLastError() == ERROR_HANDLE_EOF),
+            "ReadFile returned %d, error %u.\n", ret, GetLastError());
+    if (GetLastError() == ERROR_IO_PENDING)
+    {
+        ret = GetOverlappedResult(hfile, &ov[0], &count, TRUE);
+        ok(!ret && GetLastError() == ERROR_HANDLE_EOF, "GetOverlappedResult returned %d, error %u.\n",
+                ret, GetLastError());
+        ok(!count, "got size %u.\n", count);
+        ret = GetQueuedCompletionStatus(port, &count, &key, &pov, 5000);
+        ok(!ret && GetLastError() == ERROR_HANDLE_EOF, "GetQueuedCompletionStatus returned %d, error %u.\n",
+                ret, GetLastError());
+        ok(pov == &ov[0], "got overlapped %p.\n", pov);
+    }
+
+    CloseHandle(port);
+    CloseHandle(hfile);
+    ret = DeleteFileA(file_name);
+    ok(ret, "Unexpected error %u.\n", GetLastError());
+}
+
 static void test_file_readonly_access(void)
 {
     static const DWORD default_sharing = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
@@ -6180,6 +6274,7 @@ START_TEST(file)
     test_GetFileAttributesExW();
     test_post_completion();
     test_overlapped_read();
+    test_overlapped_queue();
     test_file_readonly_access();
     test_find_file_stream();
     test_SetFileTime();
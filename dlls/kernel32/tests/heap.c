@@ -889,6 +889,97 @@ static void test_HeapQueryInformation(void)
     ok(info == 0 || info == 1 || info == 2, "expected 0, 1 or 2, got %u\n", info);
 }
 
+static void test_low_fragmentation_heap(void)
+{
+    BYTE *ptrs[200], **big;
+    PROCESS_HEAP_ENTRY entry;
+    unsigned int found;
+    HANDLE heap;
+    SIZE_T size;
+    ULONG info;
+    BOOL ret;
+    int i, j;
+
+    if (!pHeapQueryInformation) return;
+
+    heap = HeapCreate(HEAP_NO_SERIALIZE, 0, 0);
+    ok(heap != NULL, "HeapCreate failed\n");
+    info = 2;
+    ret = HeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info));
+    ok(!ret, "HeapSetInformation succeeded\n");
+    HeapDestroy(heap);
+
+    heap = HeapCreate(0, 0, 0);
+    ok(heap != NULL, "HeapCreate failed\n");
+    info = 2;
+    ret = HeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info));
+    ok(ret, "HeapSetInformation error %u\n", GetLastError());
+    info = 0xdeadbeef;
+    ret = pHeapQueryInformation(heap, HeapCompatibilityInformation, &info, sizeof(info), NULL);
+    ok(ret, "HeapQueryInformation error %u\n", GetLastError());
+    ok(info == 2, "expected 2, got %u\n", info);
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+    {
+        ptrs[i] = HeapAlloc(heap, HEAP_ZERO_MEMORY, i + 1);
+        ok(ptrs[i] != NULL, "HeapAlloc failed\n");
+        ok(!((ULONG_PTR)ptrs[i] % (2 * sizeof(void *))), "got unaligned block %p\n", ptrs[i]);
+        ok(!ptrs[i][i], "block %u not zeroed\n", i);
+        memset(ptrs[i], i, i + 1);
+    }
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+    {
+        ok(HeapValidate(heap, 0, ptrs[i]), "HeapValidate failed for block %u\n", i);
+        size = HeapSize(heap, 0, ptrs[i]);
+        ok(size == i + 1, "block %u: got size %lu\n", i, size);
+        ok(ptrs[i][0] == (BYTE)i && ptrs[i][i] == (BYTE)i, "block %u overwritten\n", i);
+    }
+    ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+
+    found = 0;
+    memset(&entry, 0, sizeof(entry));
+    while (HeapWalk(heap, &entry))
+    {
+        if (!(entry.wFlags & PROCESS_HEAP_ENTRY_BUSY)) continue;
+        for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+            if (entry.lpData == ptrs[i]) found++;
+    }
+    ok(GetLastError() == ERROR_NO_MORE_ITEMS, "got error %u\n", GetLastError());
+    ok(found == ARRAY_SIZE(ptrs), "HeapWalk found %u blocks\n", found);
+
+    ptrs[0] = HeapReAlloc(heap, HEAP_ZERO_MEMORY, ptrs[0], 300);
+    ok(ptrs[0] != NULL, "HeapReAlloc failed\n");
+    ok(ptrs[0][0] == 0 && ptrs[0][1] == 0 && ptrs[0][299] == 0, "wrong data after HeapReAlloc\n");
+    size = HeapSize(heap, 0, ptrs[0]);
+    ok(size == 300, "got size %lu\n", size);
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+    {
+        ret = HeapFree(heap, 0, ptrs[i]);
+        ok(ret, "HeapFree failed for block %u\n", i);
+    }
+    ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+
+    /* allocate and free enough small blocks to fill many groups */
+    big = HeapAlloc(heap, 0, 20000 * sizeof(*big));
+    ok(big != NULL, "HeapAlloc failed\n");
+    for (j = 0; j < 3; j++)
+    {
+        for (i = 0; i < 20000; i++)
+        {
+            big[i] = HeapAlloc(heap, 0, 32);
+            ok(big[i] != NULL, "HeapAlloc failed\n");
+            if (!big[i]) break;
+            memset(big[i], j, 32);
+        }
+        ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+        while (i--) HeapFree(heap, 0, big[i]);
+        ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+    }
+    HeapFree(heap, 0, big);
+    HeapDestroy(heap);
+}
+
 static void test_heap_checks( DWORD flags )
 {
     BYTE old, *p, *p2;
@@ -1296,6 +1387,7 @@ START_TEST(heap)
     test_sized_HeapReAlloc((1 << 20), 1);
 
     test_HeapQueryInformation();
+    test_low_fragmentation_heap();
     test_GetPhysicallyInstalledSystemMemory();
     test_GlobalMemoryStatus();
 
@@ -1345,6 +1345,97 @@ static void test_WaitForMultipleObjects(void)
     todo_wine ok(status == STATUS_INVALID_HANDLE, "expected STATUS_INVALID_HANDLE, got %08x\n", status);
 }
 
+static DWORD WINAPI wait_all_thread(void *arg)
+{
+    HANDLE *handles = arg;
+    return WaitForMultipleObjects(2, handles, TRUE, 5000);
+}
+
+static DWORD WINAPI grab_object_thread(void *arg)
+{
+    return WaitForSingleObject(arg, 0);
+}
+
+static DWORD WINAPI wait_object_thread(void *arg)
+{
+    return WaitForSingleObject(arg, 5000);
+}
+
+static void test_mixed_waits(void)
+{
+    HANDLE handles[2], thread, mutex;
+    DWORD ret, code;
+
+    handles[0] = CreateEventW(NULL, FALSE, FALSE, NULL);
+    handles[1] = CreateSemaphoreW(NULL, 0, 2, NULL);
+
+    /* a wait-all blocked in another thread must see state changes of each object */
+    thread = CreateThread(NULL, 0, wait_all_thread, handles, 0, NULL);
+    ret = WaitForSingleObject(thread, 100);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    SetEvent(handles[0]);
+    ret = WaitForSingleObject(thread, 100);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    ReleaseSemaphore(handles[1], 1, NULL);
+    ret = WaitForSingleObject(thread, 1000);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    GetExitCodeThread(thread, &code);
+    ok(code == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", code);
+    CloseHandle(thread);
+
+    /* both objects have been consumed */
+    ret = WaitForSingleObject(handles[0], 0);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    ret = WaitForSingleObject(handles[1], 0);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+
+    /* mixed with a thread handle */
+    thread = CreateThread(NULL, 0, grab_object_thread, handles[1], 0, NULL);
+    ret = WaitForSingleObject(thread, 1000);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    ReleaseSemaphore(handles[1], 1, NULL);
+    CloseHandle(handles[0]);
+    handles[0] = thread;
+    ret = WaitForMultipleObjects(2, handles, TRUE, 0);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    ret = WaitForSingleObject(handles[1], 0);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    CloseHandle(thread);
+    CloseHandle(handles[1]);
+
+    /* a mutex grabbed by a thread that exits is abandoned */
+    mutex = CreateMutexW(NULL, FALSE, NULL);
+    thread = CreateThread(NULL, 0, grab_object_thread, mutex, 0, NULL);
+    ret = WaitForSingleObject(thread, 1000);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    GetExitCodeThread(thread, &code);
+    ok(code == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", code);
+    ret = WaitForSingleObject(mutex, 0);
+    ok(ret == WAIT_ABANDONED, "expected WAIT_ABANDONED, got %u\n", ret);
+    ret = WaitForSingleObject(mutex, 0);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    ok(ReleaseMutex(mutex), "ReleaseMutex failed\n");
+    ok(ReleaseMutex(mutex), "ReleaseMutex failed\n");
+    ok(!ReleaseMutex(mutex), "ReleaseMutex succeeded\n");
+    CloseHandle(thread);
+    CloseHandle(mutex);
+
+    /* a pulse wakes up a thread already waiting on the event */
+    handles[0] = CreateEventW(NULL, FALSE, FALSE, NULL);
+    thread = CreateThread(NULL, 0, wait_object_thread, handles[0], 0, NULL);
+    ret = WaitForSingleObject(thread, 100);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    PulseEvent(handles[0]);
+    ret = WaitForSingleObject(thread, 1000);
+    ok(ret == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", ret);
+    GetExitCodeThread(thread, &code);
+    ok(code == WAIT_OBJECT_0, "expected WAIT_OBJECT_0, got %u\n", code);
+    ret = WaitForSingleObject(handles[0], 0);
+    ok(ret == WAIT_TIMEOUT, "expected WAIT_TIMEOUT, got %u\n", ret);
+    CloseHandle(thread);
+    CloseHandle(handles[0]);
+}
+
 static BOOL g_initcallback_ret, g_initcallback_called;
 static void *g_initctxt;
 
@@ -2834,6 +2925,7 @@ START_TEST(sync)
     test_timer_queue();
     test_WaitForSingleObject();
     test_WaitForMultipleObjects();
+    test_mixed_waits();
     test_initonce();
     test_condvars_base(&aligned_cv);
     test_condvars_base(&unaligned_cv.cv);
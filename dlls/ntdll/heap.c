@@ -127,6 +127,57 @@ typedef union
 
 struct tagHEAP;
 
+/* Low-fragmentation heap front end: small blocks are carved from fixed-size groups
+ * of blocks of the same size class, and free blocks are kept on lock-free lists
+ * indexed by size class and by an affinity slot derived from the thread id, so
+ * that allocating and freeing them doesn't need the heap critical section.
+ */
+
+#define ARENA_LFH_MAGIC        0x48464c    /* in-use block of the low-fragmentation heap */
+#define ARENA_LFH_FREE_MAGIC   0x66686c    /* free block of the low-fragmentation heap */
+#define LFH_GROUP_MAGIC        ((DWORD)('L' | ('F'<<8) | ('H'<<16) | ('G'<<24)))
+
+#define LFH_MIN_BLOCK_SIZE     ROUND_SIZE(sizeof(SLIST_ENTRY))
+#define LFH_MAX_BLOCK_SIZE     ROUND_SIZE(0x400)
+#define LFH_NB_BINS            ((LFH_MAX_BLOCK_SIZE - LFH_MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+#define LFH_NB_AFFINITY_SLOTS  8
+#define LFH_ACTIVATION_COUNT   0x10       /* number of allocations of a size class before using the LFH */
+#define LFH_GROUP_SIZE         0x4000     /* size of a group of blocks, must be a power of 2 */
+#define LFH_REGION_SIZE        0x400000   /* size of the reserved regions groups are allocated from */
+#define LFH_MAX_REGIONS        256
+#define LFH_REGION_GROUPS      (LFH_REGION_SIZE / LFH_GROUP_SIZE)
+#define LFH_MAX_EMPTY_GROUPS   2          /* number of empty groups per size class kept before releasing them */
+
+typedef struct tagLFH_GROUP
+{
+    DWORD               magic;      /* Magic number */
+    DWORD               bin;        /* Size class of the blocks */
+    DWORD               block_size; /* Size of the block data */
+    DWORD               count;      /* Number of blocks in the group */
+    LONG                free_count; /* Number of free blocks, counted before they are put in a free list */
+    DWORD               found;      /* Number of free blocks found by lfh_release_empty_groups */
+    struct tagLFH_GROUP *next;      /* Next group to release in lfh_release_empty_groups */
+} LFH_GROUP;
+
+#define LFH_GROUP_HEADER_SIZE  ROUND_SIZE(sizeof(LFH_GROUP))
+
+typedef struct
+{
+    char               *base;       /* Base address of the reserved region */
+    SIZE_T              used;       /* Size used by the groups, including the released ones */
+    BYTE                released[LFH_REGION_GROUPS / 8]; /* Bitmap of the groups given back to the system */
+} LFH_REGION;
+
+typedef struct tagLFH
+{
+    SLIST_HEADER        free[LFH_NB_AFFINITY_SLOTS][LFH_NB_BINS]; /* Free blocks per affinity slot */
+    BOOL                enabled[LFH_NB_BINS];                     /* Size classes using the LFH */
+    LONG                empty_groups[LFH_NB_BINS];                /* Groups with only free blocks */
+    LFH_REGION          regions[LFH_MAX_REGIONS];                 /* Regions containing the groups */
+    LONG                nb_regions;                               /* Number of regions in use */
+    LONG                nb_released;                              /* Number of released groups */
+} LFH;
+
 typedef struct tagSUBHEAP
 {
     void               *base;       /* Base address of the sub-heap memory block */
@@ -163,6 +214,8 @@ typedef struct tagHEAP
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     FREE_LIST_ENTRY *freeList;      /* Free lists */
+    LFH             *lfh;           /* Low-fragmentation heap front end */
+    BYTE             lfh_counts[LFH_NB_BINS]; /* Allocations per size class before enabling the LFH */
 } HEAP;
 
 #define HEAP_MAGIC       ((DWORD)('H' | ('E'<<8) | ('A'<<16) | ('P'<<24)))
@@ -177,6 +230,11 @@ typedef struct tagHEAP
 #define HEAP_VALIDATE_ALL     0x20000000
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
+/* flags that prevent using the low-fragmentation heap */
+#define HEAP_LFH_EXCLUDED_FLAGS (HEAP_NO_SERIALIZE | HEAP_SHARED | HEAP_PAGE_ALLOCS | HEAP_VALIDATE | \
+                                 HEAP_VALIDATE_ALL | HEAP_VALIDATE_PARAMS | HEAP_TAIL_CHECKING_ENABLED | \
+                                 HEAP_FREE_CHECKING_ENABLED | HEAP_DISABLE_COALESCE_ON_FREE)
+
 static HEAP *processHeap;  /* main process heap */
 
 static BOOL HEAP_IsRealArena( HEAP *heapPtr, DWORD flags, LPCVOID block, BOOL quiet );
@@ -869,6 +927,494 @@ static BOOL validate_large_arena( HEAP *heap, const ARENA_LARGE *arena, BOOL qui
 }
 
 
+/* check whether the low-fragmentation heap can be used with the given heap flags */
+static inline BOOL lfh_allowed( DWORD flags )
+{
+    return (flags & HEAP_GROWABLE) && !(flags & HEAP_LFH_EXCLUDED_FLAGS) && !RUNNING_ON_VALGRIND;
+}
+
+/* get the size class of a block, or -1 if it's too large for the LFH */
+static inline int lfh_get_bin( SIZE_T size )
+{
+    SIZE_T block_size = max( ROUND_SIZE(size), LFH_MIN_BLOCK_SIZE );
+
+    if (block_size > LFH_MAX_BLOCK_SIZE) return -1;
+    return (block_size - LFH_MIN_BLOCK_SIZE) / ALIGNMENT;
+}
+
+/* get the affinity slot of the current thread */
+static inline unsigned int lfh_get_affinity(void)
+{
+    return (HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) / 4) % LFH_NB_AFFINITY_SLOTS;
+}
+
+
+/***********************************************************************
+ *           lfh_create
+ *
+ * Create the low-fragmentation heap front end. Must be called with the heap lock held.
+ */
+static LFH *lfh_create( HEAP *heap )
+{
+    unsigned int i, j;
+    LFH *lfh;
+
+    if (heap->lfh) return heap->lfh;
+    if (!(lfh = RtlAllocateHeap( heap, HEAP_ZERO_MEMORY, sizeof(*lfh) ))) return NULL;
+    for (i = 0; i < LFH_NB_AFFINITY_SLOTS; i++)
+        for (j = 0; j < LFH_NB_BINS; j++) RtlInitializeSListHead( &lfh->free[i][j] );
+    InterlockedExchangePointer( (void **)&heap->lfh, lfh );
+    TRACE( "heap %p: enabled low-fragmentation heap\n", heap );
+    return lfh;
+}
+
+
+/***********************************************************************
+ *           lfh_destroy
+ */
+static void lfh_destroy( HEAP *heap )
+{
+    LFH *lfh = heap->lfh;
+    SIZE_T size;
+    void *addr;
+    LONG i;
+
+    if (!lfh) return;
+    for (i = 0; i < lfh->nb_regions; i++)
+    {
+        size = 0;
+        addr = lfh->regions[i].base;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
+}
+
+
+static inline BOOL lfh_group_released( const LFH_REGION *region, SIZE_T index )
+{
+    return (region->released[index / 8] >> (index % 8)) & 1;
+}
+
+
+/***********************************************************************
+ *           lfh_find_region
+ *
+ * Find the region containing a given address, and the offset of the address in it.
+ * This doesn't need the heap lock, regions are only ever added.
+ */
+static LONG lfh_find_region( const LFH *lfh, const void *ptr, SIZE_T *offset )
+{
+    LONG i;
+
+    for (i = lfh->nb_regions - 1; i >= 0; i--)
+    {
+        *offset = (const char *)ptr - lfh->regions[i].base;
+        if (*offset < lfh->regions[i].used) return i;
+    }
+    return -1;
+}
+
+
+/***********************************************************************
+ *           lfh_find_group
+ *
+ * Find the group containing a given block, or NULL if it's not a LFH block.
+ */
+static LFH_GROUP *lfh_find_group( const HEAP *heap, const ARENA_INUSE *arena )
+{
+    const LFH *lfh = heap->lfh;
+    SIZE_T offset;
+    LONG i;
+
+    if (!lfh || (i = lfh_find_region( lfh, arena, &offset )) < 0) return NULL;
+    if (lfh_group_released( &lfh->regions[i], offset / LFH_GROUP_SIZE )) return NULL;
+    return (LFH_GROUP *)(lfh->regions[i].base + (offset & ~(SIZE_T)(LFH_GROUP_SIZE - 1)));
+}
+
+
+/***********************************************************************
+ *           lfh_walk_next
+ *
+ * Find the next block of the low-fragmentation heap after the given address,
+ * or the first block if NULL. Must be called with the heap lock held.
+ */
+static ARENA_INUSE *lfh_walk_next( const HEAP *heap, const void *ptr, LFH_GROUP **ret_group,
+                                   LONG *ret_region )
+{
+    const LFH *lfh = heap->lfh;
+    const LFH_GROUP *group;
+    SIZE_T offset = 0;
+    LONG i = 0;
+
+    if (!lfh) return NULL;
+    if (ptr)
+    {
+        if ((i = lfh_find_region( lfh, ptr, &offset )) < 0) return NULL;
+        if (!lfh_group_released( &lfh->regions[i], offset / LFH_GROUP_SIZE ))
+        {
+            SIZE_T stride, index;
+
+            group = (const LFH_GROUP *)(lfh->regions[i].base + (offset & ~(SIZE_T)(LFH_GROUP_SIZE - 1)));
+            stride = sizeof(ARENA_INUSE) + group->block_size;
+            index = (offset % LFH_GROUP_SIZE - LFH_GROUP_HEADER_SIZE) / stride + 1;
+            if (offset % LFH_GROUP_SIZE >= LFH_GROUP_HEADER_SIZE && index < group->count)
+            {
+                *ret_group = (LFH_GROUP *)group;
+                *ret_region = i;
+                return (ARENA_INUSE *)((char *)group + LFH_GROUP_HEADER_SIZE + index * stride);
+            }
+        }
+        offset = (offset & ~(SIZE_T)(LFH_GROUP_SIZE - 1)) + LFH_GROUP_SIZE;
+    }
+
+    for ( ; i < lfh->nb_regions; i++, offset = 0)
+    {
+        for ( ; offset < lfh->regions[i].used; offset += LFH_GROUP_SIZE)
+        {
+            if (lfh_group_released( &lfh->regions[i], offset / LFH_GROUP_SIZE )) continue;
+            group = (const LFH_GROUP *)(lfh->regions[i].base + offset);
+            *ret_group = (LFH_GROUP *)group;
+            *ret_region = i;
+            return (ARENA_INUSE *)((char *)group + LFH_GROUP_HEADER_SIZE);
+        }
+    }
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           lfh_validate_block
+ */
+static BOOL lfh_validate_block( const HEAP *heap, const LFH_GROUP *group, const ARENA_INUSE *arena )
+{
+    SIZE_T offset = (const char *)arena - (const char *)group;
+    SIZE_T stride = sizeof(ARENA_INUSE) + group->block_size;
+
+    if (group->magic != LFH_GROUP_MAGIC)
+        ERR( "Heap %p: invalid group magic %08x for %p\n", heap, group->magic, group );
+    else if (offset < LFH_GROUP_HEADER_SIZE || (offset - LFH_GROUP_HEADER_SIZE) % stride ||
+             (offset - LFH_GROUP_HEADER_SIZE) / stride >= group->count)
+        WARN( "Heap %p: invalid block pointer %p in group %p\n", heap, arena + 1, group );
+    else if (arena->magic == ARENA_LFH_FREE_MAGIC)
+        WARN( "Heap %p: block %p used after free\n", heap, arena + 1 );
+    else if (arena->magic != ARENA_LFH_MAGIC)
+        WARN( "Heap %p: invalid in-use arena magic %08x for %p\n", heap, arena->magic, arena );
+    else if ((arena->size & ARENA_SIZE_MASK) != group->block_size || arena->unused_bytes > group->block_size)
+        ERR( "Heap %p: bad size %08x/%08x for in-use arena %p\n",
+             heap, arena->size & ARENA_SIZE_MASK, arena->unused_bytes, arena );
+    else
+        return TRUE;
+
+    return FALSE;
+}
+
+
+/***********************************************************************
+ *           lfh_validate
+ *
+ * Validate all the groups of the low-fragmentation heap.
+ */
+static BOOL lfh_validate( const HEAP *heap, BOOL quiet )
+{
+    const LFH *lfh = heap->lfh;
+    LONG i;
+
+    if (!lfh) return TRUE;
+    for (i = 0; i < lfh->nb_regions; i++)
+    {
+        const char *ptr, *end = lfh->regions[i].base + lfh->regions[i].used;
+
+        for (ptr = lfh->regions[i].base; ptr < end; ptr += LFH_GROUP_SIZE)
+        {
+            const LFH_GROUP *group = (const LFH_GROUP *)ptr;
+            const char *block = ptr + LFH_GROUP_HEADER_SIZE;
+            DWORD j;
+
+            if (lfh_group_released( &lfh->regions[i], (ptr - lfh->regions[i].base) / LFH_GROUP_SIZE )) continue;
+            if (group->magic != LFH_GROUP_MAGIC || group->bin >= LFH_NB_BINS)
+            {
+                if (quiet == NOISY) ERR( "Heap %p: invalid group %p\n", heap, group );
+                return FALSE;
+            }
+            for (j = 0; j < group->count; j++, block += sizeof(ARENA_INUSE) + group->block_size)
+            {
+                const ARENA_INUSE *arena = (const ARENA_INUSE *)block;
+
+                if (arena->magic == ARENA_LFH_FREE_MAGIC) continue;
+                if (!lfh_validate_block( heap, group, arena )) return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           lfh_allocate_group
+ *
+ * Allocate a new group of blocks for a size class, and put all of them but
+ * the returned one in the free list of the affinity slot.
+ */
+static SLIST_ENTRY *lfh_allocate_group( HEAP *heap, LFH *lfh, unsigned int bin, unsigned int slot )
+{
+    SIZE_T size = LFH_GROUP_SIZE;
+    LFH_REGION *region;
+    LFH_GROUP *group;
+    ARENA_INUSE *arena;
+    SLIST_ENTRY *ret = NULL;
+    DWORD i;
+    void *addr;
+
+    RtlEnterCriticalSection( &heap->critSection );
+
+    /* another thread may have refilled the list in the meantime */
+    if ((ret = RtlInterlockedPopEntrySList( &lfh->free[slot][bin] ))) goto done;
+
+    if (lfh->nb_released)
+    {
+        SIZE_T index = 0;
+
+        for (region = lfh->regions; ; region++)
+        {
+            for (index = 0; index < region->used / LFH_GROUP_SIZE; index++)
+                if (lfh_group_released( region, index )) break;
+            if (index < region->used / LFH_GROUP_SIZE) break;
+        }
+        addr = region->base + index * LFH_GROUP_SIZE;
+        if (NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                     MEM_COMMIT, get_protection_type( heap->flags )))
+        {
+            WARN( "Could not commit %08lx bytes at %p for heap %p\n", size, addr, heap );
+            goto done;
+        }
+        region->released[index / 8] &= ~(1 << (index % 8));
+        lfh->nb_released--;
+        group = addr;
+        goto init_group;
+    }
+
+    region = lfh->nb_regions ? &lfh->regions[lfh->nb_regions - 1] : NULL;
+    if (!region || region->used == LFH_REGION_SIZE)
+    {
+        SIZE_T region_size = LFH_REGION_SIZE;
+
+        if (lfh->nb_regions == LFH_MAX_REGIONS) goto done;
+        addr = NULL;
+        if (NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &region_size,
+                                     MEM_RESERVE, get_protection_type( heap->flags )))
+        {
+            WARN( "Could not reserve %08lx bytes for heap %p\n", region_size, heap );
+            goto done;
+        }
+        region = &lfh->regions[lfh->nb_regions];
+        region->base = addr;
+        region->used = 0;
+        InterlockedIncrement( &lfh->nb_regions );
+    }
+
+    addr = region->base + region->used;
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                 MEM_COMMIT, get_protection_type( heap->flags )))
+    {
+        WARN( "Could not commit %08lx bytes at %p for heap %p\n", size, addr, heap );
+        goto done;
+    }
+
+    group = addr;
+    /* make the group visible to lfh_find_group before any of its blocks can be freed */
+    region->used += LFH_GROUP_SIZE;
+
+init_group:
+    group->magic = LFH_GROUP_MAGIC;
+    group->bin = bin;
+    group->block_size = LFH_MIN_BLOCK_SIZE + bin * ALIGNMENT;
+    group->count = (LFH_GROUP_SIZE - LFH_GROUP_HEADER_SIZE) / (sizeof(ARENA_INUSE) + group->block_size);
+    /* the group starts empty, the returned block is accounted for in lfh_allocate_block */
+    group->free_count = group->count;
+    InterlockedIncrement( &lfh->empty_groups[bin] );
+
+    arena = (ARENA_INUSE *)((char *)group + LFH_GROUP_HEADER_SIZE);
+    for (i = 0; i < group->count; i++)
+    {
+        arena->size = group->block_size;
+        arena->magic = ARENA_LFH_FREE_MAGIC;
+        arena->unused_bytes = 0;
+        if (i) RtlInterlockedPushEntrySList( &lfh->free[slot][bin], (SLIST_ENTRY *)(arena + 1) );
+        else ret = (SLIST_ENTRY *)(arena + 1);
+        arena = (ARENA_INUSE *)((char *)(arena + 1) + group->block_size);
+    }
+
+done:
+    RtlLeaveCriticalSection( &heap->critSection );
+    return ret;
+}
+
+
+/***********************************************************************
+ *           lfh_release_empty_groups
+ *
+ * Give the groups of a size class that only contain free blocks back to the system.
+ */
+static void lfh_release_empty_groups( HEAP *heap, LFH *lfh, unsigned int bin )
+{
+    SLIST_ENTRY *lists[LFH_NB_AFFINITY_SLOTS], *entry, *next;
+    LFH_GROUP *group, *released = NULL;
+    SIZE_T size, offset = 0;
+    unsigned int slot;
+    LONG i;
+    void *addr;
+
+    RtlEnterCriticalSection( &heap->critSection );
+
+    /* take all the free blocks of the size class, so that none of them can be allocated meanwhile */
+    for (slot = 0; slot < LFH_NB_AFFINITY_SLOTS; slot++)
+        lists[slot] = RtlInterlockedFlushSList( &lfh->free[slot][bin] );
+
+    for (slot = 0; slot < LFH_NB_AFFINITY_SLOTS; slot++)
+        for (entry = lists[slot]; entry; entry = entry->Next)
+            lfh_find_group( heap, (ARENA_INUSE *)entry - 1 )->found = 0;
+    for (slot = 0; slot < LFH_NB_AFFINITY_SLOTS; slot++)
+        for (entry = lists[slot]; entry; entry = entry->Next)
+            lfh_find_group( heap, (ARENA_INUSE *)entry - 1 )->found++;
+
+    /* give back the blocks of the groups that aren't completely free */
+    for (slot = 0; slot < LFH_NB_AFFINITY_SLOTS; slot++)
+    {
+        for (entry = lists[slot]; entry; entry = next)
+        {
+            next = entry->Next;
+            group = lfh_find_group( heap, (ARENA_INUSE *)entry - 1 );
+            if (group->found < group->count)
+                RtlInterlockedPushEntrySList( &lfh->free[slot][bin], entry );
+            else if (group->found == group->count)
+            {
+                group->found++;  /* only add it once */
+                group->next = released;
+                released = group;
+            }
+        }
+    }
+
+    while ((group = released))
+    {
+        released = group->next;
+        i = lfh_find_region( lfh, group, &offset );
+        addr = group;
+        size = LFH_GROUP_SIZE;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_DECOMMIT );
+        lfh->regions[i].released[offset / LFH_GROUP_SIZE / 8] |= 1 << (offset / LFH_GROUP_SIZE % 8);
+        lfh->nb_released++;
+        InterlockedDecrement( &lfh->empty_groups[bin] );
+    }
+
+    RtlLeaveCriticalSection( &heap->critSection );
+}
+
+
+/***********************************************************************
+ *           lfh_enable_bin
+ *
+ * Count the allocations of a size class, and enable the LFH for it once it's used often enough.
+ */
+static LFH *lfh_enable_bin( HEAP *heap, unsigned int bin )
+{
+    LFH *lfh;
+
+    RtlEnterCriticalSection( &heap->critSection );
+    if (heap->lfh_counts[bin] < LFH_ACTIVATION_COUNT)
+    {
+        heap->lfh_counts[bin]++;
+        lfh = NULL;
+    }
+    else if ((lfh = lfh_create( heap ))) lfh->enabled[bin] = TRUE;
+    RtlLeaveCriticalSection( &heap->critSection );
+    return lfh;
+}
+
+
+/***********************************************************************
+ *           lfh_allocate_block
+ *
+ * Allocate a block from the low-fragmentation heap, return NULL if the
+ * regular heap should be used instead.
+ */
+static void *lfh_allocate_block( HEAP *heap, DWORD flags, SIZE_T size )
+{
+    LFH *lfh = heap->lfh;
+    unsigned int i, slot;
+    LFH_GROUP *group;
+    ARENA_INUSE *arena;
+    SLIST_ENTRY *entry;
+    int bin;
+
+    if (!lfh_allowed( flags ) || (bin = lfh_get_bin( size )) < 0) return NULL;
+    if ((!lfh || !lfh->enabled[bin]) && !(lfh = lfh_enable_bin( heap, bin ))) return NULL;
+
+    slot = lfh_get_affinity();
+    if (!(entry = RtlInterlockedPopEntrySList( &lfh->free[slot][bin] )))
+    {
+        /* try to reuse the blocks freed by threads with another affinity */
+        for (i = 1; i < LFH_NB_AFFINITY_SLOTS; i++)
+            if ((entry = RtlInterlockedPopEntrySList( &lfh->free[(slot + i) % LFH_NB_AFFINITY_SLOTS][bin] )))
+                break;
+        if (!entry && !(entry = lfh_allocate_group( heap, lfh, bin, slot ))) return NULL;
+    }
+
+    arena = (ARENA_INUSE *)entry - 1;
+    group = (LFH_GROUP *)((ULONG_PTR)arena & ~(ULONG_PTR)(LFH_GROUP_SIZE - 1));
+    if (InterlockedDecrement( &group->free_count ) == group->count - 1)
+        InterlockedDecrement( &lfh->empty_groups[bin] );
+    arena->magic = ARENA_LFH_MAGIC;
+    arena->unused_bytes = (arena->size & ARENA_SIZE_MASK) - size;
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+
+/***********************************************************************
+ *           lfh_free_block
+ */
+static void lfh_free_block( HEAP *heap, LFH_GROUP *group, ARENA_INUSE *arena )
+{
+    LFH *lfh = heap->lfh;
+    unsigned int bin = group->bin;
+    BOOL empty;
+
+    arena->magic = ARENA_LFH_FREE_MAGIC;
+    /* count the block before it can be found in a list, so that the group isn't released under us;
+     * the group must not be accessed anymore once the block has been pushed */
+    empty = (InterlockedIncrement( &group->free_count ) == group->count);
+    RtlInterlockedPushEntrySList( &lfh->free[lfh_get_affinity()][bin], (SLIST_ENTRY *)(arena + 1) );
+    if (empty && InterlockedIncrement( &lfh->empty_groups[bin] ) > LFH_MAX_EMPTY_GROUPS)
+        lfh_release_empty_groups( heap, lfh, bin );
+}
+
+
+/***********************************************************************
+ *           lfh_realloc_block
+ */
+static void *lfh_realloc_block( HEAP *heap, DWORD flags, LFH_GROUP *group, ARENA_INUSE *arena, SIZE_T size )
+{
+    SIZE_T old_size = group->block_size - arena->unused_bytes;
+    void *ret;
+
+    /* the unused size has to fit in the arena */
+    if (size <= group->block_size && group->block_size - size <= 0xff)
+    {
+        arena->unused_bytes = group->block_size - size;
+        if (size > old_size)
+            initialize_block( (char *)(arena + 1) + old_size, size - old_size, arena->unused_bytes, flags );
+        else
+            mark_block_tail( (char *)(arena + 1) + size, arena->unused_bytes, flags );
+        return arena + 1;
+    }
+    if (flags & HEAP_REALLOC_IN_PLACE_ONLY) return NULL;
+    if (!(ret = RtlAllocateHeap( heap, flags & ~HEAP_GENERATE_EXCEPTIONS, size ))) return NULL;
+    memcpy( ret, arena + 1, min( old_size, size ) );
+    lfh_free_block( heap, group, arena );
+    return ret;
+}
+
+
 /***********************************************************************
  *           HEAP_CreateSubHeap
  */
@@ -1333,6 +1879,7 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
     SUBHEAP *subheap;
     BOOL ret = FALSE;
     const ARENA_LARGE *large_arena;
+    const LFH_GROUP *group;
 
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
@@ -1344,8 +1891,10 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
     {
         const ARENA_INUSE *arena = (const ARENA_INUSE *)block - 1;
 
-        if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
-            ((const char *)arena < (char *)subheap->base + subheap->headerSize))
+        if ((group = lfh_find_group( heapPtr, arena )))
+            ret = lfh_validate_block( heapPtr, group, arena );
+        else if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
+                 ((const char *)arena < (char *)subheap->base + subheap->headerSize))
         {
             if (!(large_arena = find_large_block( heapPtr, block )))
             {
@@ -1381,7 +1930,7 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
     LIST_FOR_EACH_ENTRY( large_arena, &heapPtr->large_list, ARENA_LARGE, entry )
         if (!validate_large_arena( heapPtr, large_arena, quiet )) goto done;
 
-    ret = TRUE;
+    ret = lfh_validate( heapPtr, quiet );
 
 done:
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
@@ -1606,6 +2155,7 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
     heapPtr->critSection.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &heapPtr->critSection );
 
+    lfh_destroy( heapPtr );
     LIST_FOR_EACH_ENTRY_SAFE( arena, arena_next, &heapPtr->large_list, ARENA_LARGE, entry )
     {
         list_remove( &arena->entry );
@@ -1655,6 +2205,7 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
     SIZE_T rounded_size;
+    void *ret;
 
     /* Validate the parameters */
 
@@ -1669,11 +2220,17 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
+    if ((ret = lfh_allocate_block( heapPtr, flags, size )))
+    {
+        TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
-        void *ret = allocate_large_block( heap, flags, size );
+        ret = allocate_large_block( heap, flags, size );
         if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
         if (!ret && (flags & HEAP_GENERATE_EXCEPTIONS)) RtlRaiseStatus( STATUS_NO_MEMORY );
         TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
@@ -1737,6 +2294,7 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
 {
     ARENA_INUSE *pInUse;
     SUBHEAP *subheap;
+    LFH_GROUP *group;
     HEAP *heapPtr;
 
     /* Validate the parameters */
@@ -1750,6 +2308,21 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
         return FALSE;
     }
 
+    /* blocks of the low-fragmentation heap are freed without taking the heap lock */
+    pInUse = (ARENA_INUSE *)ptr - 1;
+    if ((group = lfh_find_group( heapPtr, pInUse )))
+    {
+        if (!lfh_validate_block( heapPtr, group, pInUse ))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            TRACE("(%p,%08x,%p): returning FALSE\n", heap, flags, ptr );
+            return FALSE;
+        }
+        lfh_free_block( heapPtr, group, pInUse );
+        TRACE("(%p,%08x,%p): returning TRUE\n", heap, flags, ptr );
+        return TRUE;
+    }
+
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
@@ -1758,7 +2331,6 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
     notify_free( ptr );
 
     /* Some sanity checks */
-    pInUse  = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pInUse )) goto error;
 
     if (!subheap)
@@ -1798,6 +2370,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     ARENA_INUSE *pArena;
     HEAP *heapPtr;
     SUBHEAP *subheap;
+    LFH_GROUP *group;
     SIZE_T oldBlockSize, oldActualSize, rounded_size;
     void *ret;
 
@@ -1820,6 +2393,12 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
     pArena = (ARENA_INUSE *)ptr - 1;
+    if ((group = lfh_find_group( heapPtr, pArena )))
+    {
+        if (!lfh_validate_block( heapPtr, group, pArena )) goto error;
+        if (!(ret = lfh_realloc_block( heapPtr, flags, group, pArena, size ))) goto oom;
+        goto done;
+    }
     if (!validate_block_pointer( heapPtr, &subheap, pArena )) goto error;
     if (!subheap)
     {
@@ -2013,6 +2592,7 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     SIZE_T ret;
     const ARENA_INUSE *pArena;
     SUBHEAP *subheap;
+    LFH_GROUP *group;
     HEAP *heapPtr = HEAP_GetPtr( heap );
 
     if (!heapPtr)
@@ -2020,11 +2600,24 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
         RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_HANDLE );
         return ~(SIZE_T)0;
     }
+
+    pArena = (const ARENA_INUSE *)ptr - 1;
+    if ((group = lfh_find_group( heapPtr, pArena )))
+    {
+        if (!lfh_validate_block( heapPtr, group, pArena ))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            ret = ~(SIZE_T)0;
+        }
+        else ret = group->block_size - pArena->unused_bytes;
+        TRACE("(%p,%08x,%p): returning %08lx\n", heap, flags, ptr, ret );
+        return ret;
+    }
+
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
-    pArena = (const ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pArena ))
     {
         RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
@@ -2068,6 +2661,31 @@ BOOLEAN WINAPI RtlValidateHeap( HANDLE heap, ULONG flags, LPCVOID ptr )
 }
 
 
+/***********************************************************************
+ *           HEAP_WalkLFH
+ *
+ * Fill the heap entry with the low-fragmentation heap block following ptr.
+ */
+static NTSTATUS HEAP_WalkLFH( HEAP *heap, PROCESS_HEAP_ENTRY *entry, const void *ptr )
+{
+    LFH_GROUP *group;
+    ARENA_INUSE *arena;
+    LONG region;
+
+    if (!(arena = lfh_walk_next( heap, ptr, &group, &region )))
+    {
+        TRACE("end reached.\n");
+        return STATUS_NO_MORE_ENTRIES;
+    }
+    entry->lpData = arena + 1;
+    entry->cbData = group->block_size;
+    entry->cbOverhead = sizeof(ARENA_INUSE);
+    entry->wFlags = (arena->magic == ARENA_LFH_MAGIC) ? PROCESS_HEAP_ENTRY_BUSY : 0;
+    entry->iRegionIndex = list_count( &heap->subheap_list ) + region;
+    return STATUS_SUCCESS;
+}
+
+
 /***********************************************************************
  *           RtlWalkHeap    (NTDLL.@)
  *
@@ -2082,6 +2700,7 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
     SUBHEAP *sub, *currentheap = NULL;
     NTSTATUS ret;
     char *ptr;
+    SIZE_T offset;
     int region_index = 0;
 
     if (!heapPtr || !entry) return STATUS_INVALID_PARAMETER;
@@ -2098,6 +2717,11 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
         currentheap = &heapPtr->subheap;
         ptr = (char*)currentheap->base + currentheap->headerSize;
     }
+    else if (heapPtr->lfh && lfh_find_region( heapPtr->lfh, entry->lpData, &offset ) >= 0)
+    {
+        ret = HEAP_WalkLFH( heapPtr, entry, entry->lpData );
+        goto HW_end;
+    }
     else
     {
         ptr = entry->lpData;
@@ -2136,9 +2760,8 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
         {   /* proceed with next subheap */
             struct list *next = list_next( &heapPtr->subheap_list, &currentheap->entry );
             if (!next)
-            {  /* successfully finished */
-                TRACE("end reached.\n");
-                ret = STATUS_NO_MORE_ENTRIES;
+            {  /* continue with the low-fragmentation heap blocks */
+                ret = HEAP_WalkLFH( heapPtr, entry, NULL );
                 goto HW_end;
             }
             currentheap = LIST_ENTRY( next, SUBHEAP, entry );
@@ -2232,6 +2855,8 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
+    HEAP *heapPtr;
+
     switch (info_class)
     {
     case HeapCompatibilityInformation:
@@ -2240,7 +2865,8 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+        *(ULONG *)info = heapPtr->lfh ? 2 /* low-fragmentation heap */ : 0 /* standard heap */;
         return STATUS_SUCCESS;
 
     default:
@@ -2254,6 +2880,42 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
  */
 NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class, PVOID info, SIZE_T size)
 {
-    FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
-    return STATUS_SUCCESS;
+    NTSTATUS status = STATUS_SUCCESS;
+    HEAP *heapPtr;
+
+    switch (info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        switch (*(ULONG *)info)
+        {
+        case 0:  /* standard heap, the LFH can't be disabled once enabled */
+            if (heapPtr->lfh) status = STATUS_UNSUCCESSFUL;
+            break;
+        case 2:  /* low-fragmentation heap */
+            if (!lfh_allowed( heapPtr->flags )) return STATUS_UNSUCCESSFUL;
+            RtlEnterCriticalSection( &heapPtr->critSection );
+            if (lfh_create( heapPtr ))
+            {
+                unsigned int i;
+                for (i = 0; i < LFH_NB_BINS; i++) heapPtr->lfh->enabled[i] = TRUE;
+            }
+            else status = STATUS_NO_MEMORY;
+            RtlLeaveCriticalSection( &heapPtr->critSection );
+            break;
+        case 1:  /* look-aside lists are not supported since Vista */
+            status = STATUS_UNSUCCESSFUL;
+            break;
+        default:
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        return status;
+
+    default:
+        FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
+        return STATUS_SUCCESS;
+    }
 }
@@ -2071,6 +2071,64 @@ static DWORD WINAPI keyed_event_thread( void *arg )
     return 0;
 }
 
+static void test_many_named_objects(void)
+{
+    static const unsigned int count = 10000;
+    HANDLE *handles, event;
+    OBJECT_ATTRIBUTES attr;
+    UNICODE_STRING str;
+    WCHAR name[64];
+    NTSTATUS status;
+    unsigned int i;
+
+    handles = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, count * sizeof(*handles) );
+
+    for (i = 0; i < count; i++)
+    {
+        swprintf( name, ARRAY_SIZE(name), L"\\BaseNamedObjects\\wine_test_event_%u", i );
+        pRtlInitUnicodeString( &str, name );
+        InitializeObjectAttributes( &attr, &str, 0, 0, NULL );
+        status = pNtCreateEvent( &handles[i], EVENT_ALL_ACCESS, &attr, NotificationEvent, FALSE );
+        if (status)
+        {
+            ok( 0, "%u: NtCreateEvent failed %08x\n", i, status );
+            break;
+        }
+    }
+
+    for (i = 0; i < count && handles[i]; i++)
+    {
+        /* open with a different case to go through the case-insensitive lookup */
+        swprintf( name, ARRAY_SIZE(name), L"\\BaseNamedObjects\\WINE_TEST_EVENT_%u", i );
+        pRtlInitUnicodeString( &str, name );
+        InitializeObjectAttributes( &attr, &str, OBJ_CASE_INSENSITIVE, 0, NULL );
+        status = pNtOpenEvent( &event, EVENT_ALL_ACCESS, &attr );
+        if (status)
+        {
+            ok( 0, "%u: NtOpenEvent failed %08x\n", i, status );
+            break;
+        }
+        status = pNtSetEvent( event, NULL );
+        ok( !status, "NtSetEvent failed %08x\n", status );
+        pNtClose( event );
+        if (WaitForSingleObject( handles[i], 0 ))
+        {
+            ok( 0, "%u: opened the wrong event\n", i );
+            break;
+        }
+    }
+
+    for (i = 0; i < count && handles[i]; i++) pNtClose( handles[i] );
+
+    /* the names are gone once the last handle is closed */
+    pRtlInitUnicodeString( &str, L"\\BaseNamedObjects\\wine_test_event_0" );
+    InitializeObjectAttributes( &attr, &str, 0, 0, NULL );
+    status = pNtOpenEvent( &event, EVENT_ALL_ACCESS, &attr );
+    ok( status == STATUS_OBJECT_NAME_NOT_FOUND, "NtOpenEvent returned %08x\n", status );
+
+    HeapFree( GetProcessHeap(), 0, handles );
+}
+
 static void test_keyed_events(void)
 {
     OBJECT_ATTRIBUTES attr;
@@ -3010,6 +3068,7 @@ START_TEST(om)
     test_query_object();
     test_type_mismatch();
     test_event();
+    test_many_named_objects();
     test_mutant();
     test_semaphore();
     test_keyed_events();
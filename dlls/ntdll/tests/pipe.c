@@ -2562,6 +2562,111 @@ static void test_empty_name(void)
     CloseHandle(hwrite2);
 }
 
+static void test_reconnect(void)
+{
+    IO_STATUS_BLOCK iosb, read_iosb;
+    HANDLE server, client, event;
+    NTSTATUS status;
+    char buf[16];
+    DWORD size;
+    BOOL res;
+    int i;
+
+    /* large quotas, so that Wine transfers the data directly between the ends */
+    server = CreateNamedPipeW(testpipe, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_WAIT,
+                              1, 0x10000, 0x10000, 0, NULL);
+    ok(server != INVALID_HANDLE_VALUE, "CreateNamedPipe failed: %u\n", GetLastError());
+    event = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    for (i = 0; i < 3; i++)
+    {
+        client = connect_pipe(server);
+
+        res = WriteFile(client, "test", 4, &size, NULL);
+        ok(res, "%u: WriteFile failed: %u\n", i, GetLastError());
+        memset(buf, 0, sizeof(buf));
+        res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+        ok(res, "%u: ReadFile failed: %u\n", i, GetLastError());
+        ok(size == 4 && !memcmp(buf, "test", 4), "%u: got %u %s\n", i, size, debugstr_an(buf, size));
+
+        /* zero-length reads complete once some data is available */
+        ResetEvent(event);
+        status = NtReadFile(server, event, NULL, NULL, &read_iosb, buf, 0, NULL, NULL);
+        ok(status == STATUS_PENDING, "%u: NtReadFile returned %x\n", i, status);
+        res = WriteFile(client, "data", 4, &size, NULL);
+        ok(res, "%u: WriteFile failed: %u\n", i, GetLastError());
+        ok(!WaitForSingleObject(event, 1000), "%u: read not completed\n", i);
+        ok(!read_iosb.Status, "%u: Status = %x\n", i, read_iosb.Status);
+        ok(!read_iosb.Information, "%u: Information = %lu\n", i, read_iosb.Information);
+        res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+        ok(res, "%u: ReadFile failed: %u\n", i, GetLastError());
+        ok(size == 4 && !memcmp(buf, "data", 4), "%u: got %u %s\n", i, size, debugstr_an(buf, size));
+
+        res = WriteFile(server, "reply", 5, &size, NULL);
+        ok(res, "%u: WriteFile failed: %u\n", i, GetLastError());
+        status = pNtFsControlFile(server, NULL, NULL, NULL, &iosb, FSCTL_PIPE_DISCONNECT, NULL, 0, NULL, 0);
+        ok(!status, "%u: FSCTL_PIPE_DISCONNECT returned %x\n", i, status);
+
+        /* data is lost on disconnect */
+        SetLastError(0xdeadbeef);
+        res = ReadFile(client, buf, sizeof(buf), &size, NULL);
+        ok(!res && GetLastError() == ERROR_PIPE_NOT_CONNECTED, "%u: ReadFile returned %x %u\n",
+           i, res, GetLastError());
+        SetLastError(0xdeadbeef);
+        res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+        ok(!res && GetLastError() == ERROR_PIPE_NOT_CONNECTED, "%u: ReadFile returned %x %u\n",
+           i, res, GetLastError());
+        CloseHandle(client);
+
+        status = listen_pipe(server, event, &iosb, FALSE);
+        ok(status == STATUS_PENDING, "%u: listen_pipe returned %x\n", i, status);
+        SetLastError(0xdeadbeef);
+        res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+        ok(!res && GetLastError() == ERROR_PIPE_LISTENING, "%u: ReadFile returned %x %u\n",
+           i, res, GetLastError());
+    }
+
+    CloseHandle(server);
+    CloseHandle(event);
+}
+
+static void test_nowait_completion(void)
+{
+    static char big_buffer[0x40000];
+    HANDLE server, client, port;
+    OVERLAPPED overlapped, *povl;
+    ULONG_PTR key;
+    DWORD size, written, mode;
+    BOOL res;
+
+    server = CreateNamedPipeW(testpipe, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_NOWAIT,
+                              1, 0x10000, 0x10000, 0, NULL);
+    ok(server != INVALID_HANDLE_VALUE, "CreateNamedPipe failed: %u\n", GetLastError());
+    client = connect_pipe(server);
+    mode = PIPE_READMODE_BYTE | PIPE_NOWAIT;
+    res = SetNamedPipeHandleState(client, &mode, NULL, NULL);
+    ok(res, "SetNamedPipeHandleState failed: %u\n", GetLastError());
+    port = CreateIoCompletionPort(client, NULL, 0xdead, 0);
+    ok(port != NULL, "CreateIoCompletionPort failed: %u\n", GetLastError());
+
+    /* a non-blocking overlapped write larger than the quota completes at once
+     * with what fits and posts a completion packet */
+    memset(&overlapped, 0, sizeof(overlapped));
+    res = WriteFile(client, big_buffer, sizeof(big_buffer), &written, &overlapped);
+    ok(res, "WriteFile failed: %u\n", GetLastError());
+    ok(written <= sizeof(big_buffer), "got size %u\n", written);
+    povl = NULL;
+    res = GetQueuedCompletionStatus(port, &size, &key, &povl, 1000);
+    ok(res, "GetQueuedCompletionStatus failed: %u\n", GetLastError());
+    ok(povl == &overlapped, "got overlapped %p\n", povl);
+    ok(key == 0xdead, "got key %lx\n", key);
+    ok(size == written, "got size %u, expected %u\n", size, written);
+
+    CloseHandle(port);
+    CloseHandle(client);
+    CloseHandle(server);
+}
+
 START_TEST(pipe)
 {
     if (!init_func_ptrs())
@@ -2616,6 +2721,8 @@ START_TEST(pipe)
     test_file_info();
     test_security_info();
     test_empty_name();
+    test_reconnect();
+    test_nowait_completion();
 
     pipe_for_each_state(create_pipe_server, connect_pipe, test_pipe_state);
     pipe_for_each_state(create_pipe_server, connect_and_write_pipe, test_pipe_with_data_state);
@@ -848,6 +848,63 @@ static void test_NtQueryValueKey(void)
     pNtClose(key);
 }
 
+static void test_value_cache(void)
+{
+    HANDLE key, key2, key3;
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES attr;
+    UNICODE_STRING ValName;
+    KEY_VALUE_PARTIAL_INFORMATION *info;
+    char buffer[FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data[sizeof(DWORD)])];
+    DWORD len, data;
+
+    info = (KEY_VALUE_PARTIAL_INFORMATION *)buffer;
+    pRtlCreateUnicodeStringFromAsciiz(&ValName, "cachetest");
+
+    InitializeObjectAttributes(&attr, &winetestpath, 0, 0, 0);
+    status = pNtOpenKey(&key, KEY_READ, &attr);
+    ok(status == STATUS_SUCCESS, "NtOpenKey Failed: 0x%08x\n", status);
+    status = pNtOpenKey(&key2, KEY_READ|KEY_SET_VALUE, &attr);
+    ok(status == STATUS_SUCCESS, "NtOpenKey Failed: 0x%08x\n", status);
+
+    status = pNtQueryValueKey(key, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_OBJECT_NAME_NOT_FOUND, "got 0x%08x\n", status);
+
+    /* changes made through another handle are visible right away */
+    data = 1;
+    status = pNtSetValueKey(key2, &ValName, 0, REG_DWORD, &data, sizeof(data));
+    ok(status == STATUS_SUCCESS, "NtSetValueKey Failed: 0x%08x\n", status);
+    status = pNtQueryValueKey(key, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_SUCCESS, "got 0x%08x\n", status);
+    ok(*(DWORD *)info->Data == 1, "got %u\n", *(DWORD *)info->Data);
+    status = pNtQueryValueKey(key, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_SUCCESS, "got 0x%08x\n", status);
+    ok(*(DWORD *)info->Data == 1, "got %u\n", *(DWORD *)info->Data);
+
+    data = 2;
+    status = pNtSetValueKey(key2, &ValName, 0, REG_DWORD, &data, sizeof(data));
+    ok(status == STATUS_SUCCESS, "NtSetValueKey Failed: 0x%08x\n", status);
+    status = pNtQueryValueKey(key, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_SUCCESS, "got 0x%08x\n", status);
+    ok(*(DWORD *)info->Data == 2, "got %u\n", *(DWORD *)info->Data);
+
+    /* access rights are still checked for cached values */
+    status = pNtOpenKey(&key3, KEY_SET_VALUE, &attr);
+    ok(status == STATUS_SUCCESS, "NtOpenKey Failed: 0x%08x\n", status);
+    status = pNtQueryValueKey(key3, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_ACCESS_DENIED, "got 0x%08x\n", status);
+    pNtClose(key3);
+
+    status = pNtDeleteValueKey(key2, &ValName);
+    ok(status == STATUS_SUCCESS, "NtDeleteValueKey Failed: 0x%08x\n", status);
+    status = pNtQueryValueKey(key, &ValName, KeyValuePartialInformation, info, sizeof(buffer), &len);
+    ok(status == STATUS_OBJECT_NAME_NOT_FOUND, "got 0x%08x\n", status);
+
+    pRtlFreeUnicodeString(&ValName);
+    pNtClose(key2);
+    pNtClose(key);
+}
+
 static void test_NtDeleteKey(void)
 {
     UNICODE_STRING string;
@@ -2119,6 +2176,7 @@ START_TEST(reg)
     test_NtQueryKey();
     test_NtQueryLicenseKey();
     test_NtQueryValueKey();
+    test_value_cache();
     test_long_value_name();
     test_notify();
     test_RtlCreateRegistryKey();
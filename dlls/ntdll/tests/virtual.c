@@ -1089,6 +1089,84 @@ static void test_syscalls(void)
     UnmapViewOfFile( ptr );
 }
 
+static DWORD WINAPI concurrent_virtual_thread( void *arg )
+{
+    LONG *stop = arg;
+    MEMORY_BASIC_INFORMATION info;
+    NTSTATUS status;
+    unsigned int i;
+    SIZE_T size;
+    ULONG old;
+    void *addr;
+
+    for (i = 0; i < 200 && !*stop; i++)
+    {
+        addr = NULL;
+        size = 16 * page_size;
+        status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size, MEM_RESERVE, PAGE_NOACCESS );
+        ok( !status, "NtAllocateVirtualMemory failed %x\n", status );
+        if (status) break;
+
+        size = 4 * page_size;
+        status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size, MEM_COMMIT, PAGE_READWRITE );
+        ok( !status, "NtAllocateVirtualMemory failed %x\n", status );
+        *(volatile DWORD *)addr = i;
+
+        status = NtQueryVirtualMemory( NtCurrentProcess(), addr, MemoryBasicInformation, &info, sizeof(info), NULL );
+        ok( !status, "NtQueryVirtualMemory failed %x\n", status );
+        ok( info.AllocationBase == addr, "wrong allocation base %p / %p\n", info.AllocationBase, addr );
+        ok( info.RegionSize == 4 * page_size, "wrong region size %I64x\n", (UINT64)info.RegionSize );
+        ok( info.State == MEM_COMMIT, "wrong state %#x\n", info.State );
+        ok( info.Protect == PAGE_READWRITE, "wrong protect %#x\n", info.Protect );
+        ok( info.Type == MEM_PRIVATE, "wrong type %#x\n", info.Type );
+
+        size = page_size;
+        status = NtProtectVirtualMemory( NtCurrentProcess(), &addr, &size, PAGE_READONLY, &old );
+        ok( !status, "NtProtectVirtualMemory failed %x\n", status );
+        ok( old == PAGE_READWRITE, "wrong old protect %#x\n", old );
+
+        status = NtQueryVirtualMemory( NtCurrentProcess(), (char *)addr + page_size, MemoryBasicInformation,
+                                       &info, sizeof(info), NULL );
+        ok( !status, "NtQueryVirtualMemory failed %x\n", status );
+        ok( info.AllocationBase == addr, "wrong allocation base %p / %p\n", info.AllocationBase, addr );
+        ok( info.RegionSize == 3 * page_size, "wrong region size %I64x\n", (UINT64)info.RegionSize );
+        ok( info.Protect == PAGE_READWRITE, "wrong protect %#x\n", info.Protect );
+
+        status = NtQueryVirtualMemory( NtCurrentProcess(), (char *)addr + 4 * page_size, MemoryBasicInformation,
+                                       &info, sizeof(info), NULL );
+        ok( !status, "NtQueryVirtualMemory failed %x\n", status );
+        ok( info.RegionSize == 12 * page_size, "wrong region size %I64x\n", (UINT64)info.RegionSize );
+        ok( info.State == MEM_RESERVE, "wrong state %#x\n", info.State );
+
+        size = 0;
+        status = NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+        ok( !status, "NtFreeVirtualMemory failed %x\n", status );
+    }
+    return 0;
+}
+
+static void test_concurrent_virtual_memory(void)
+{
+    HANDLE threads[16];
+    LONG stop = 0;
+    unsigned int i;
+    DWORD ret;
+
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        threads[i] = CreateThread( NULL, 0, concurrent_virtual_thread, &stop, 0, NULL );
+        ok( threads[i] != NULL, "CreateThread failed %u\n", GetLastError() );
+    }
+    ret = WaitForMultipleObjects( ARRAY_SIZE(threads), threads, TRUE, 60000 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    if (ret) InterlockedExchange( &stop, 1 );
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        WaitForSingleObject( threads[i], INFINITE );
+        CloseHandle( threads[i] );
+    }
+}
+
 START_TEST(virtual)
 {
     HMODULE mod;
@@ -1128,4 +1206,5 @@ START_TEST(virtual)
     test_NtMapViewOfSection();
     test_user_shared_data();
     test_syscalls();
+    test_concurrent_virtual_memory();
 }
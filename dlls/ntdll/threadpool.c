@@ -98,6 +98,7 @@ struct timer_queue
  */
 
 #define THREADPOOL_WORKER_TIMEOUT 5000
+#define THREADPOOL_SPIN_COUNT     4000
 #define MAXIMUM_WAITQUEUE_OBJECTS (MAXIMUM_WAIT_OBJECTS - 1)
 
 /* internal threadpool representation */
@@ -109,16 +110,30 @@ struct threadpool
     CRITICAL_SECTION        cs;
     /* Pools of work items, locked via .cs, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
     struct list             pools[3];
+    /* worker threads with their own queues, locked via .cs */
+    struct list             workers;
     RTL_CONDITION_VARIABLE  update_event;
     /* information about worker threads, locked via .cs */
     int                     max_workers;
     int                     min_workers;
     int                     num_workers;
     int                     num_busy_workers;
+    int                     num_spinning_workers;
+    /* incremented each time a work item is queued, read without the lock by spinning workers */
+    LONG                    work_serial;
     HANDLE                  compl_port;
     TP_POOL_STACK_INFORMATION stack_info;
 };
 
+/* per-worker queues of work items, for the items queued from the worker itself */
+struct threadpool_worker
+{
+    struct list             entry;
+    DWORD                   tid;
+    /* locked via pool->cs, same order as the pool queues */
+    struct list             queues[3];
+};
+
 enum threadpool_objtype
 {
     TP_OBJECT_TYPE_SIMPLE,
@@ -1668,12 +1683,15 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
 
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
         list_init( &pool->pools[i] );
+    list_init( &pool->workers );
     RtlInitializeConditionVariable( &pool->update_event );
 
     pool->max_workers             = 500;
     pool->min_workers             = 0;
     pool->num_workers             = 0;
     pool->num_busy_workers        = 0;
+    pool->num_spinning_workers    = 0;
+    pool->work_serial             = 0;
     pool->stack_info.StackReserve = nt->OptionalHeader.SizeOfStackReserve;
     pool->stack_info.StackCommit  = nt->OptionalHeader.SizeOfStackCommit;
 
@@ -1716,6 +1734,7 @@ static BOOL tp_threadpool_release( struct threadpool *pool )
     assert( !pool->objcount );
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
         assert( list_empty( &pool->pools[i] ) );
+    assert( list_empty( &pool->workers ) );
 
     pool->cs.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &pool->cs );
@@ -1955,10 +1974,31 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
         tp_object_release( object );
 }
 
-static void tp_object_prio_queue( struct threadpool_object *object )
+/* find the worker structure of the current thread, if it's one of the pool workers */
+static struct threadpool_worker *threadpool_get_current_worker( const struct threadpool *pool )
+{
+    struct threadpool_worker *worker;
+    DWORD tid = GetCurrentThreadId();
+
+    /* only a worker running a callback can submit work */
+    if (!pool->num_busy_workers) return NULL;
+
+    LIST_FOR_EACH_ENTRY( worker, &pool->workers, struct threadpool_worker, entry )
+        if (worker->tid == tid) return worker;
+    return NULL;
+}
+
+/* Queue an object in the queue of the current worker, so that work submitted from a
+ * callback stays on the same thread unless another worker steals it, or in the shared
+ * pool queue if the current thread isn't a worker. */
+static void tp_object_prio_queue( struct threadpool_object *object, struct threadpool_worker *worker )
 {
-    ++object->pool->num_busy_workers;
-    list_add_tail( &object->pool->pools[object->priority], &object->pool_entry );
+    struct threadpool *pool = object->pool;
+
+    ++pool->num_busy_workers;
+    if (worker) list_add_tail( &worker->queues[object->priority], &object->pool_entry );
+    else list_add_tail( &pool->pools[object->priority], &object->pool_entry );
+    InterlockedIncrement( &pool->work_serial );
 }
 
 /***********************************************************************
@@ -1971,6 +2011,7 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 {
     struct threadpool *pool = object->pool;
     NTSTATUS status = STATUS_UNSUCCESSFUL;
+    BOOL wake = FALSE;
 
     assert( !object->shutdown );
     assert( !pool->shutdown );
@@ -1985,20 +2026,24 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
     /* Queue work item and increment refcount. */
     InterlockedIncrement( &object->refcount );
     if (!object->num_pending_callbacks++)
-        tp_object_prio_queue( object );
+        tp_object_prio_queue( object, threadpool_get_current_worker( pool ) );
 
     /* Count how often the object was signaled. */
     if (object->type == TP_OBJECT_TYPE_WAIT && signaled)
         object->u.wait.signaled++;
 
-    /* No new thread started - wake up one existing thread. */
+    /* No new thread started - wake up one existing thread, unless one is
+     * already spinning and will pick up the work item on its own. */
     if (status != STATUS_SUCCESS)
     {
         assert( pool->num_workers > 0 );
-        RtlWakeConditionVariable( &pool->update_event );
+        wake = !pool->num_spinning_workers;
     }
 
     RtlLeaveCriticalSection( &pool->cs );
+
+    /* Wake up outside of the lock, so that the worker doesn't immediately block on it. */
+    if (wake) RtlWakeConditionVariable( &pool->update_event );
 }
 
 /***********************************************************************
@@ -2140,18 +2185,60 @@ static BOOL tp_object_release( struct threadpool_object *object )
     return TRUE;
 }
 
-static struct list *threadpool_get_next_item( const struct threadpool *pool )
+/***********************************************************************
+ *           threadpool_get_next_item    (internal)
+ *
+ * Returns the next work item for a worker: for each priority, the items of
+ * its own queue come first, then the shared queue, then the items stolen
+ * from the queues of other workers. worker is NULL to check all queues.
+ */
+static struct list *threadpool_get_next_item( const struct threadpool *pool,
+                                              const struct threadpool_worker *worker )
 {
+    struct threadpool_worker *other;
     struct list *ptr;
     unsigned int i;
 
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
     {
-        if ((ptr = list_head( &pool->pools[i] )))
-            break;
+        if (worker && (ptr = list_head( &worker->queues[i] ))) return ptr;
+        if ((ptr = list_head( &pool->pools[i] ))) return ptr;
+        LIST_FOR_EACH_ENTRY( other, &pool->workers, struct threadpool_worker, entry )
+        {
+            if (other != worker && (ptr = list_head( &other->queues[i] ))) return ptr;
+        }
     }
 
-    return ptr;
+    return NULL;
+}
+
+/***********************************************************************
+ *           threadpool_spin_for_work    (internal)
+ *
+ * Spins for a short while waiting for new work items before the worker
+ * goes to sleep, so that short work items submitted in quick succession
+ * don't pay for a wakeup. pool->cs has to be held, it is released while
+ * spinning.
+ *
+ */
+static BOOL threadpool_spin_for_work( struct threadpool *pool )
+{
+    LONG serial = pool->work_serial;
+    unsigned int i;
+
+    if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) return FALSE;
+
+    pool->num_spinning_workers++;
+    RtlLeaveCriticalSection( &pool->cs );
+    for (i = 0; i < THREADPOOL_SPIN_COUNT; i++)
+    {
+        if (*(volatile LONG *)&pool->work_serial != serial || pool->shutdown) break;
+        YieldProcessor();
+    }
+    RtlEnterCriticalSection( &pool->cs );
+    pool->num_spinning_workers--;
+
+    return threadpool_get_next_item( pool, NULL ) != NULL;
 }
 
 /***********************************************************************
@@ -2319,24 +2406,36 @@ skip_cleanup:
 static void CALLBACK threadpool_worker_proc( void *param )
 {
     struct threadpool *pool = param;
+    struct threadpool_worker worker;
     LARGE_INTEGER timeout;
     struct list *ptr;
+    unsigned int i;
 
     TRACE( "starting worker thread for pool %p\n", pool );
 
+    worker.tid = GetCurrentThreadId();
+    for (i = 0; i < ARRAY_SIZE(worker.queues); ++i)
+        list_init( &worker.queues[i] );
+
     RtlEnterCriticalSection( &pool->cs );
+    list_add_tail( &pool->workers, &worker.entry );
     for (;;)
     {
-        while ((ptr = threadpool_get_next_item( pool )))
+        while ((ptr = threadpool_get_next_item( pool, &worker )))
         {
             struct threadpool_object *object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
             assert( object->num_pending_callbacks > 0 );
 
             /* If further pending callbacks are queued, move the work item to
-             * the end of the pool list. Otherwise remove it from the pool. */
+             * the end of the worker queue. Otherwise remove it from the pool. */
             list_remove( &object->pool_entry );
             if (object->num_pending_callbacks > 1)
-                tp_object_prio_queue( object );
+                tp_object_prio_queue( object, &worker );
+
+            /* Submitters don't wake up a worker when one is spinning, so pass on
+             * the remaining work to another worker before running the callback. */
+            if (threadpool_get_next_item( pool, NULL ) && !pool->num_spinning_workers)
+                RtlWakeConditionVariable( &pool->update_event );
 
             tp_object_execute( object, FALSE );
 
@@ -2350,6 +2449,11 @@ static void CALLBACK threadpool_worker_proc( void *param )
         if (pool->shutdown)
             break;
 
+        if (threadpool_spin_for_work( pool ))
+            continue;
+        if (pool->shutdown)
+            break;
+
         /* Wait for new tasks or until the timeout expires. A thread only terminates
          * when no new tasks are available, and the number of threads can be
          * decreased without violating the min_workers limit. An exception is when
@@ -2357,12 +2461,16 @@ static void CALLBACK threadpool_worker_proc( void *param )
          * can be terminated. */
         timeout.QuadPart = (ULONGLONG)THREADPOOL_WORKER_TIMEOUT * -10000;
         if (RtlSleepConditionVariableCS( &pool->update_event, &pool->cs, &timeout ) == STATUS_TIMEOUT &&
-            !threadpool_get_next_item( pool ) && (pool->num_workers > max( pool->min_workers, 1 ) ||
+            !threadpool_get_next_item( pool, NULL ) && (pool->num_workers > max( pool->min_workers, 1 ) ||
             (!pool->min_workers && !pool->objcount)))
         {
             break;
         }
     }
+    /* hand over anything left in our queue to the other workers */
+    for (i = 0; i < ARRAY_SIZE(worker.queues); ++i)
+        list_move_tail( &pool->pools[i], &worker.queues[i] );
+    list_remove( &worker.entry );
     pool->num_workers--;
     RtlLeaveCriticalSection( &pool->cs );
 
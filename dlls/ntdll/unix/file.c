@@ -96,6 +96,10 @@
 #ifdef HAVE_LINUX_MAJOR_H
 # include <linux/major.h>
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+# include <sys/mman.h>
+# include <linux/io_uring.h>
+#endif
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
 #endif
@@ -213,6 +217,7 @@ struct dir_data_names
     const WCHAR *long_name;          /* long file name in Unicode */
     const WCHAR *short_name;         /* short file name in Unicode */
     const char  *unix_name;          /* Unix file name in host encoding */
+    unsigned char type;              /* dirent file type, 0 if unknown */
 };
 
 struct dir_data
@@ -223,15 +228,49 @@ struct dir_data
     struct file_identity    id;      /* directory file identity */
     struct dir_data_names  *names;   /* directory file names */
     struct dir_data_buffer *buffer;  /* head of data buffers list */
+    DIR                    *dir;     /* directory stream, only kept open for streaming enumeration */
+    BOOL                    eof;     /* whether the directory stream has been read entirely */
+    unsigned int            batch;   /* index of the current batch of entries in streaming mode */
+    UNICODE_STRING          mask;    /* file mask for streaming enumeration */
 };
 
 static const unsigned int dir_data_buffer_initial_size = 4096;
 static const unsigned int dir_data_cache_initial_size  = 256;
 static const unsigned int dir_data_names_initial_size  = 64;
+static const unsigned int dir_data_batch_size          = 4096;
 
 static struct dir_data **dir_data_cache;
 static unsigned int dir_data_cache_size;
 
+/* case-insensitive index of the contents of a directory */
+struct dir_index_entry
+{
+    int           next;              /* next entry in hash chain, -1 for none */
+    unsigned int  hash;              /* hash of the upcased name */
+    unsigned int  name_pos;          /* position of the upcased name in the names buffer */
+    unsigned int  name_len;          /* length of the upcased name */
+    unsigned int  unix_pos;          /* position of the Unix name in the unix names buffer */
+};
+
+struct dir_index
+{
+    struct list             entry;       /* entry in the list of cached indexes */
+    dev_t                   dev;         /* directory device */
+    ino_t                   ino;         /* directory inode */
+    struct timespec         mtime;       /* directory modification time when indexed */
+    unsigned int            count;       /* number of entries */
+    unsigned int            hash_size;   /* size of the hash table, a power of 2 */
+    int                    *hash_table;  /* first entry of each hash chain */
+    struct dir_index_entry *entries;     /* directory entries */
+    WCHAR                  *names;       /* upcased Unicode names */
+    char                   *unix_names;  /* Unix names in host encoding */
+};
+
+#define MAX_DIR_INDEXES 32
+
+static struct list dir_indexes = LIST_INIT( dir_indexes );
+static unsigned int dir_indexes_count;
+
 static BOOL show_dot_files;
 static mode_t start_umask;
 
@@ -240,6 +279,7 @@ static const BOOL is_case_sensitive = FALSE;
 
 static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t mnt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dir_index_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* check if a given Unicode char is OK in a DOS short name */
 static inline BOOL is_invalid_dos_char( WCHAR ch )
@@ -429,22 +469,33 @@ static BOOL add_dir_data_names( struct dir_data *data, const WCHAR *long_name,
 
     if (!(names[data->count].long_name = add_dir_data_nameW( data, long_name ))) return FALSE;
     if (!(names[data->count].unix_name = add_dir_data_nameA( data, unix_name ))) return FALSE;
+    names[data->count].type = 0;
     data->count++;
     return TRUE;
 }
 
-/* free the complete directory data structure */
-static void free_dir_data( struct dir_data *data )
+/* free the directory entries, keeping the names array */
+static void free_dir_data_entries( struct dir_data *data )
 {
     struct dir_data_buffer *buffer, *next;
 
-    if (!data) return;
-
     for (buffer = data->buffer; buffer; buffer = next)
     {
         next = buffer->next;
         free( buffer );
     }
+    data->buffer = NULL;
+    data->count = data->pos = 0;
+}
+
+/* free the complete directory data structure */
+static void free_dir_data( struct dir_data *data )
+{
+    if (!data) return;
+
+    free_dir_data_entries( data );
+    if (data->dir) closedir( data->dir );
+    free( data->mask.Buffer );
     free( data->names );
     free( data );
 }
@@ -2001,6 +2052,17 @@ static NTSTATUS get_mountmgr_fs_info( HANDLE handle, int fd, struct mountmgr_uni
 }
 
 
+/* check if a directory entry is known to be a regular file without calling stat() */
+static inline BOOL is_dir_data_regular_file( const struct dir_data_names *names )
+{
+#ifdef DT_REG
+    return names->type == DT_REG;
+#else
+    return FALSE;
+#endif
+}
+
+
 /***********************************************************************
  *           get_dir_data_entry
  *
@@ -2015,15 +2077,19 @@ static NTSTATUS get_dir_data_entry( struct dir_data *dir_data, void *info_ptr, I
     struct stat st;
     ULONG name_len, start, dir_size, attributes;
 
-    if (get_file_info( names->unix_name, &st, &attributes ) == -1)
+    /* names don't need any file information, and only directories can be ignored */
+    if (class != FileNamesInformation || !is_dir_data_regular_file( names ))
     {
-        TRACE( "file no longer exists %s\n", names->unix_name );
-        return STATUS_SUCCESS;
-    }
-    if (is_ignored_file( &st ))
-    {
-        TRACE( "ignoring file %s\n", names->unix_name );
-        return STATUS_SUCCESS;
+        if (get_file_info( names->unix_name, &st, &attributes ) == -1)
+        {
+            TRACE( "file no longer exists %s\n", names->unix_name );
+            return STATUS_SUCCESS;
+        }
+        if (is_ignored_file( &st ))
+        {
+            TRACE( "ignoring file %s\n", names->unix_name );
+            return STATUS_SUCCESS;
+        }
     }
     start = dir_info_align( io->Information );
     dir_size = dir_info_size( class, 0 );
@@ -2222,6 +2288,78 @@ static NTSTATUS read_directory_data_stat( struct dir_data *data, const char *uni
 }
 
 
+/***********************************************************************
+ *           read_directory_data_batch
+ *
+ * Read the next batch of entries from the directory stream; helper for
+ * streaming enumeration. "." and ".." are added first for the first batch.
+ */
+static NTSTATUS read_directory_data_batch( struct dir_data *data, const UNICODE_STRING *mask )
+{
+    unsigned int count;
+    struct dirent *de;
+
+    if (!data->batch)
+    {
+        if (!append_entry( data, ".", NULL, mask )) return STATUS_NO_MEMORY;
+        if (!append_entry( data, "..", NULL, mask )) return STATUS_NO_MEMORY;
+    }
+    while (data->count < dir_data_batch_size)
+    {
+        if (!(de = readdir( data->dir )))
+        {
+            data->eof = TRUE;
+            break;
+        }
+        if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
+        count = data->count;
+        if (!append_entry( data, de->d_name, NULL, mask )) return STATUS_NO_MEMORY;
+#ifdef DT_REG
+        if (data->count > count) data->names[count].type = de->d_type;
+#endif
+    }
+    return STATUS_SUCCESS;
+}
+
+
+/***********************************************************************
+ *           next_dir_data_batch
+ *
+ * Replace the consumed directory entries by the next batch in streaming mode.
+ */
+static BOOL next_dir_data_batch( struct dir_data *data )
+{
+    NTSTATUS status;
+
+    if (!data->dir || data->eof) return FALSE;
+
+    free_dir_data_entries( data );
+    data->batch++;
+    if ((status = read_directory_data_batch( data, data->mask.Buffer ? &data->mask : NULL )))
+        WARN( "failed to read directory entries: %x\n", status );
+    TRACE( "read %u more files\n", data->count );
+    return data->count > 0;
+}
+
+
+/***********************************************************************
+ *           restart_dir_data
+ *
+ * Restart the directory enumeration from the first entry.
+ */
+static void restart_dir_data( struct dir_data *data )
+{
+    data->pos = 0;
+    if (!data->dir || !data->batch) return;
+
+    free_dir_data_entries( data );
+    rewinddir( data->dir );
+    data->eof = FALSE;
+    data->batch = 0;
+    read_directory_data_batch( data, data->mask.Buffer ? &data->mask : NULL );
+}
+
+
 /***********************************************************************
  *           read_directory_readdir
  *
@@ -2229,23 +2367,25 @@ static NTSTATUS read_directory_data_stat( struct dir_data *data, const char *uni
  */
 static NTSTATUS read_directory_data_readdir( struct dir_data *data, const UNICODE_STRING *mask )
 {
-    struct dirent *de;
-    NTSTATUS status = STATUS_NO_MEMORY;
-    DIR *dir = opendir( "." );
+    NTSTATUS status;
 
-    if (!dir) return STATUS_NO_SUCH_FILE;
+    if (!(data->dir = opendir( "." ))) return STATUS_NO_SUCH_FILE;
 
-    if (!append_entry( data, ".", NULL, mask )) goto done;
-    if (!append_entry( data, "..", NULL, mask )) goto done;
-    while ((de = readdir( dir )))
+    if (!(status = read_directory_data_batch( data, mask )) && !data->eof)
     {
-        if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
-        if (!append_entry( data, de->d_name, NULL, mask )) goto done;
+        /* the directory is too large to be read at once, keep the stream open
+         * and return the entries as they are read */
+        if (!mask || !mask->Length) return STATUS_SUCCESS;
+        if ((data->mask.Buffer = malloc( mask->Length )))
+        {
+            memcpy( data->mask.Buffer, mask->Buffer, mask->Length );
+            data->mask.Length = data->mask.MaximumLength = mask->Length;
+            return STATUS_SUCCESS;
+        }
+        status = STATUS_NO_MEMORY;
     }
-    status = STATUS_SUCCESS;
-
-done:
-    closedir( dir );
+    closedir( data->dir );
+    data->dir = NULL;
     return status;
 }
 
@@ -2314,11 +2454,12 @@ static NTSTATUS init_cached_dir_data( struct dir_data **data_ret, int fd, const
         return status;
     }
 
-    /* sort filenames, but not "." and ".." */
+    /* sort filenames, but not "." and "..", unless the entries are returned as they are read */
     i = 0;
     if (i < data->count && !strcmp( data->names[i].unix_name, "." )) i++;
     if (i < data->count && !strcmp( data->names[i].unix_name, ".." )) i++;
-    if (i < data->count) qsort( data->names + i, data->count - i, sizeof(*data->names), name_compare );
+    if (i < data->count && !data->dir)
+        qsort( data->names + i, data->count - i, sizeof(*data->names), name_compare );
 
     if (data->count)
     {
@@ -2458,9 +2599,9 @@ NTSTATUS WINAPI NtQueryDirectoryFile( HANDLE handle, HANDLE event, PIO_APC_ROUTI
         {
             union file_directory_info *last_info = NULL;
 
-            if (restart_scan) data->pos = 0;
+            if (restart_scan) restart_dir_data( data );
 
-            while (!status && data->pos < data->count)
+            while (!status && (data->pos < data->count || next_dir_data_batch( data )))
             {
                 status = get_dir_data_entry( data, buffer, io, length, info_class, &last_info );
                 if (!status || status == STATUS_BUFFER_OVERFLOW) data->pos++;
@@ -2485,6 +2626,237 @@ NTSTATUS WINAPI NtQueryDirectoryFile( HANDLE handle, HANDLE event, PIO_APC_ROUTI
 }
 
 
+/***********************************************************************
+ *           get_dir_mtime
+ */
+static struct timespec get_dir_mtime( const struct stat *st )
+{
+    struct timespec ret;
+
+    ret.tv_sec = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    ret.tv_nsec = st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    ret.tv_nsec = st->st_mtimespec.tv_nsec;
+#else
+    ret.tv_nsec = 0;
+#endif
+    return ret;
+}
+
+
+/***********************************************************************
+ *           hash_dir_index_name
+ */
+static unsigned int hash_dir_index_name( const WCHAR *name, unsigned int len )
+{
+    unsigned int hash = 0;
+
+    while (len--) hash = hash * 31 + *name++;
+    return hash;
+}
+
+
+/***********************************************************************
+ *           free_dir_index
+ */
+static void free_dir_index( struct dir_index *index )
+{
+    free( index->hash_table );
+    free( index->entries );
+    free( index->names );
+    free( index->unix_names );
+    free( index );
+}
+
+
+/***********************************************************************
+ *           build_dir_index
+ *
+ * Read the whole contents of a directory into a case-insensitive index.
+ */
+static struct dir_index *build_dir_index( const char *unix_name, const struct stat *st )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    struct dir_index *index;
+    struct dirent *de;
+    unsigned int i, size = 64, names_size = 1024, unix_size = 1024, names_pos = 0, unix_pos = 0;
+    DIR *dir;
+    int len;
+
+    if (!(dir = opendir( unix_name ))) return NULL;
+    if (!(index = calloc( 1, sizeof(*index) ))) goto error;
+    index->dev   = st->st_dev;
+    index->ino   = st->st_ino;
+    index->mtime = get_dir_mtime( st );
+    if (!(index->entries = malloc( size * sizeof(*index->entries) ))) goto error;
+    if (!(index->names = malloc( names_size * sizeof(WCHAR) ))) goto error;
+    if (!(index->unix_names = malloc( unix_size ))) goto error;
+
+    while ((de = readdir( dir )))
+    {
+        struct dir_index_entry *entry;
+        size_t unix_len = strlen( de->d_name ) + 1;
+
+        if ((len = ntdll_umbstowcs( de->d_name, unix_len - 1, buffer, MAX_DIR_ENTRY_LEN )) <= 0) continue;
+
+        if (index->count == size)
+        {
+            void *new_entries = realloc( index->entries, size * 2 * sizeof(*index->entries) );
+            if (!new_entries) goto error;
+            index->entries = new_entries;
+            size *= 2;
+        }
+        if (names_pos + len > names_size)
+        {
+            void *new_names = realloc( index->names, (names_size * 2 + len) * sizeof(WCHAR) );
+            if (!new_names) goto error;
+            index->names = new_names;
+            names_size = names_size * 2 + len;
+        }
+        if (unix_pos + unix_len > unix_size)
+        {
+            void *new_unix_names = realloc( index->unix_names, unix_size * 2 + unix_len );
+            if (!new_unix_names) goto error;
+            index->unix_names = new_unix_names;
+            unix_size = unix_size * 2 + unix_len;
+        }
+
+        for (i = 0; i < len; i++) index->names[names_pos + i] = towupper( buffer[i] );
+        memcpy( index->unix_names + unix_pos, de->d_name, unix_len );
+
+        entry = &index->entries[index->count++];
+        entry->hash     = hash_dir_index_name( index->names + names_pos, len );
+        entry->name_pos = names_pos;
+        entry->name_len = len;
+        entry->unix_pos = unix_pos;
+        names_pos += len;
+        unix_pos += unix_len;
+    }
+    closedir( dir );
+
+    for (index->hash_size = 16; index->hash_size < index->count; index->hash_size *= 2) ;
+    if (!(index->hash_table = malloc( index->hash_size * sizeof(*index->hash_table) )))
+    {
+        free_dir_index( index );
+        return NULL;
+    }
+    memset( index->hash_table, 0xff, index->hash_size * sizeof(*index->hash_table) );
+    /* insert in reverse order so that chains keep the readdir order */
+    for (i = index->count; i > 0; i--)
+    {
+        struct dir_index_entry *entry = &index->entries[i - 1];
+        entry->next = index->hash_table[entry->hash & (index->hash_size - 1)];
+        index->hash_table[entry->hash & (index->hash_size - 1)] = i - 1;
+    }
+    return index;
+
+error:
+    closedir( dir );
+    if (index) free_dir_index( index );
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           lookup_dir_index
+ *
+ * Look for a file name in a directory index, and append it to unix_name at pos.
+ */
+static BOOL lookup_dir_index( const struct dir_index *index, char *unix_name, int pos,
+                              const WCHAR *name, int length )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    unsigned int hash;
+    int i;
+
+    for (i = 0; i < length; i++) buffer[i] = towupper( name[i] );
+    hash = hash_dir_index_name( buffer, length );
+
+    for (i = index->hash_table[hash & (index->hash_size - 1)]; i != -1; i = index->entries[i].next)
+    {
+        const struct dir_index_entry *entry = &index->entries[i];
+
+        if (entry->hash != hash || entry->name_len != length) continue;
+        if (memcmp( index->names + entry->name_pos, buffer, length * sizeof(WCHAR) )) continue;
+        unix_name[pos - 1] = '/';
+        strcpy( unix_name + pos, index->unix_names + entry->unix_pos );
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+/***********************************************************************
+ *           find_file_in_dir_index
+ *
+ * Look for a file in the cached case-insensitive index of a directory,
+ * building the index if necessary. The index is keyed on the directory
+ * identity and invalidated when its modification time changes.
+ * Returns 1 if found, 0 if not found, -1 if the directory can't be indexed.
+ */
+static int find_file_in_dir_index( char *unix_name, int pos, const WCHAR *name, int length )
+{
+    struct dir_index *index, *new_index;
+    struct timespec mtime;
+    struct stat st;
+    int ret = -1;
+
+    if (length > MAX_DIR_ENTRY_LEN) return -1;
+    if (stat( unix_name, &st ) == -1) return -1;
+    mtime = get_dir_mtime( &st );
+
+    mutex_lock( &dir_index_mutex );
+    LIST_FOR_EACH_ENTRY( index, &dir_indexes, struct dir_index, entry )
+    {
+        if (index->dev != st.st_dev || index->ino != st.st_ino) continue;
+        if (index->mtime.tv_sec == mtime.tv_sec && index->mtime.tv_nsec == mtime.tv_nsec)
+        {
+            ret = lookup_dir_index( index, unix_name, pos, name, length );
+            list_remove( &index->entry );
+            list_add_head( &dir_indexes, &index->entry );
+        }
+        else  /* directory has changed */
+        {
+            list_remove( &index->entry );
+            dir_indexes_count--;
+            free_dir_index( index );
+        }
+        break;
+    }
+    mutex_unlock( &dir_index_mutex );
+    if (ret != -1) return ret;
+
+    /* don't cache directories that have just been modified, since further
+     * changes may not be reflected in the modification time */
+    if (mtime.tv_sec >= time( NULL ) - 1) return -1;
+
+    if (!(new_index = build_dir_index( unix_name, &st ))) return -1;
+    ret = lookup_dir_index( new_index, unix_name, pos, name, length );
+
+    mutex_lock( &dir_index_mutex );
+    LIST_FOR_EACH_ENTRY( index, &dir_indexes, struct dir_index, entry )
+    {
+        if (index->dev != st.st_dev || index->ino != st.st_ino) continue;
+        /* another thread indexed it in the meantime */
+        list_remove( &index->entry );
+        dir_indexes_count--;
+        free_dir_index( index );
+        break;
+    }
+    list_add_head( &dir_indexes, &new_index->entry );
+    if (++dir_indexes_count > MAX_DIR_INDEXES)
+    {
+        index = LIST_ENTRY( list_tail( &dir_indexes ), struct dir_index, entry );
+        list_remove( &index->entry );
+        dir_indexes_count--;
+        free_dir_index( index );
+    }
+    mutex_unlock( &dir_index_mutex );
+    return ret;
+}
+
+
 /***********************************************************************
  *           find_file_in_dir
  *
@@ -2525,6 +2897,17 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
 
     if (!is_name_8_dot_3 && !get_dir_case_sensitivity( unix_name )) goto not_found;
 
+    /* look for it in the cached directory index, short names are not indexed */
+
+    switch (find_file_in_dir_index( unix_name, pos, name, length ))
+    {
+    case 1:
+        return STATUS_SUCCESS;
+    case 0:
+        if (!is_name_8_dot_3) goto not_found;
+        break;
+    }
+
     /* now look for it through the directory */
 
 #ifdef VFAT_IOCTL_READDIR_BOTH
@@ -4107,6 +4490,7 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE handle, IO_STATUS_BLOCK *io,
     int fd, needs_close = FALSE;
     ULONG attr;
     unsigned int options;
+    enum server_fd_type type;
     NTSTATUS status;
 
     TRACE( "(%p,%p,%p,0x%08x,0x%08x)\n", handle, io, ptr, len, class);
@@ -4120,11 +4504,16 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE handle, IO_STATUS_BLOCK *io,
     if (len < info_sizes[class])
         return io->u.Status = STATUS_INFO_LENGTH_MISMATCH;
 
-    if ((status = server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, &options )))
+    if ((status = server_get_unix_fd( handle, 0, &fd, &needs_close, &type, &options )))
     {
         if (status != STATUS_BAD_DEVICE_TYPE) return io->u.Status = status;
         return server_get_file_info( handle, io, ptr, len, class );
     }
+    if (type == FD_TYPE_PIPE)  /* the unix fd of a pipe is only used for its data */
+    {
+        if (needs_close) close( fd );
+        return server_get_file_info( handle, io, ptr, len, class );
+    }
 
     switch (class)
     {
@@ -4456,6 +4845,7 @@ NTSTATUS WINAPI NtSetInformationFile( HANDLE handle, IO_STATUS_BLOCK *io,
                 status = wine_server_call( req );
             }
             SERVER_END_REQ;
+            if (!status) set_completion_handle( handle, COMPLETION_HANDLE_PORT );
         }
         else status = STATUS_INVALID_PARAMETER_3;
         break;
@@ -4475,6 +4865,8 @@ NTSTATUS WINAPI NtSetInformationFile( HANDLE handle, IO_STATUS_BLOCK *io,
                 status = wine_server_call( req );
             }
             SERVER_END_REQ;
+            if (!status && (info->Flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))
+                set_completion_handle( handle, COMPLETION_HANDLE_SKIP_ON_SUCCESS );
         }
         else status = STATUS_INFO_LENGTH_MISMATCH;
         break;
@@ -4713,20 +5105,31 @@ static BOOL irp_completion( void *user, ULONG_PTR *info, NTSTATUS *status )
     return TRUE;
 }
 
+/* zero-length reads on pipes wait for some data to be available */
+static int peek_pipe_data( int fd )
+{
+    char dummy;
+    return recv( fd, &dummy, 1, MSG_PEEK | MSG_DONTWAIT );
+}
+
 static BOOL async_read_proc( void *user, ULONG_PTR *info, NTSTATUS *status )
 {
     struct async_fileio_read *fileio = user;
     int fd, needs_close, result;
+    enum server_fd_type type;
 
     switch (*status)
     {
     case STATUS_ALERTED: /* got some new data */
         /* check to see if the data is ready (non-blocking) */
         if ((*status = server_get_unix_fd( fileio->io.handle, FILE_READ_DATA, &fd,
-                                          &needs_close, NULL, NULL )))
+                                          &needs_close, &type, NULL )))
             break;
 
-        result = virtual_locked_read(fd, &fileio->buffer[fileio->already], fileio->count-fileio->already);
+        if (!fileio->count && type == FD_TYPE_PIPE)
+            result = peek_pipe_data( fd );
+        else
+            result = virtual_locked_read(fd, &fileio->buffer[fileio->already], fileio->count-fileio->already);
         if (needs_close) close( fd );
 
         if (result < 0)
@@ -4741,6 +5144,10 @@ static BOOL async_read_proc( void *user, ULONG_PTR *info, NTSTATUS *status )
         {
             *status = fileio->already ? STATUS_SUCCESS : STATUS_PIPE_BROKEN;
         }
+        else if (!fileio->count)
+        {
+            *status = STATUS_SUCCESS;
+        }
         else
         {
             fileio->already += result;
@@ -5001,6 +5408,18 @@ static NTSTATUS get_io_timeouts( HANDLE handle, enum server_fd_type type, ULONG
     case FD_TYPE_CHAR:
         if (is_read) timeouts->interval = 0;  /* return as soon as we got something */
         break;
+    case FD_TYPE_PIPE:
+    {
+        FILE_PIPE_INFORMATION info;
+        IO_STATUS_BLOCK io;
+
+        if (!NtQueryInformationFile( handle, &io, &info, sizeof(info), FilePipeInformation ) &&
+            info.CompletionMode == FILE_PIPE_COMPLETE_OPERATION)
+            timeouts->interval = timeouts->total = 0;  /* non-blocking pipe */
+        else if (is_read)
+            timeouts->interval = 0;  /* return as soon as we got something */
+        break;
+    }
     default:
         break;
     }
@@ -5051,6 +5470,7 @@ static NTSTATUS get_io_avail_mode( HANDLE handle, enum server_fd_type type, BOOL
     case FD_TYPE_MAILSLOT:
     case FD_TYPE_SOCKET:
     case FD_TYPE_CHAR:
+    case FD_TYPE_PIPE:
         *avail_mode = TRUE;
         break;
     default:
@@ -5092,6 +5512,9 @@ static NTSTATUS register_async_file_read( HANDLE handle, HANDLE event,
 
 void add_completion( HANDLE handle, ULONG_PTR value, NTSTATUS status, ULONG info, BOOL async )
 {
+    /* the server would drop the packet anyway, don't bother asking it */
+    if (!async && is_completion_skipped_on_success( handle )) return;
+
     SERVER_START_REQ( add_fd_completion )
     {
         req->handle      = wine_server_obj_handle( handle );
@@ -5119,6 +5542,313 @@ static NTSTATUS set_pending_write( HANDLE device )
 }
 
 
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+
+/* Overlapped I/O on regular files is submitted to a per-process io_uring. The
+ * completions are reaped by an internal thread that fills the IO_STATUS_BLOCK and
+ * signals the event, APC or completion port directly, so the I/O doesn't block the
+ * calling thread and doesn't need an async object in the server. */
+
+#define URING_ENTRIES 256
+
+struct uring_io
+{
+    HANDLE           handle;    /* duplicated file handle, for the completion port */
+    int              fd;        /* unix fd owned by the I/O */
+    BOOL             write;     /* write or read operation */
+    char            *buffer;
+    ULONG            length;
+    ULONG            total;     /* size transferred so far */
+    ULONGLONG        offset;
+    HANDLE           event;     /* duplicated event handle */
+    PIO_APC_ROUTINE  apc;
+    void            *apc_user;
+    HANDLE           thread;    /* thread to queue the APC to */
+    client_ptr_t     iosb;
+    ULONG_PTR        cvalue;
+};
+
+static pthread_mutex_t uring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int uring_fd = -1;
+static int uring_state;           /* 0: not initialized, 1: usable, -1: unavailable */
+static unsigned int uring_inflight;
+static unsigned int uring_max_inflight;
+static unsigned int *uring_sq_tail, *uring_sq_mask, *uring_sq_array;
+static unsigned int *uring_cq_head, *uring_cq_tail, *uring_cq_mask;
+static struct io_uring_sqe *uring_sqes;
+static struct io_uring_cqe *uring_cqes;
+
+static void uring_thread( void *arg );
+
+/* check that the kernel supports the operations we need */
+static BOOL uring_check_ops( int fd )
+{
+    static const unsigned int nb_ops = 64;
+    struct io_uring_probe *probe;
+    BOOL ret = FALSE;
+
+    if (!(probe = calloc( 1, offsetof( struct io_uring_probe, ops[nb_ops] )))) return FALSE;
+    if (!syscall( __NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nb_ops ))
+        ret = probe->last_op >= IORING_OP_WRITE &&
+              (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+              (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free( probe );
+    return ret;
+}
+
+/* create the io_uring, called with uring_mutex held */
+static BOOL uring_init(void)
+{
+    struct io_uring_params params;
+    const char *env = getenv( "WINEIOURING" );
+    size_t sq_size, cq_size;
+    char *ring;
+    void *sqes;
+    int fd;
+
+    if (env && !atoi( env )) return FALSE;
+
+    memset( &params, 0, sizeof(params) );
+    if ((fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &params )) == -1) return FALSE;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !uring_check_ops( fd )) goto failed;
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring = mmap( NULL, max( sq_size, cq_size ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd, IORING_OFF_SQ_RING );
+    if (ring == MAP_FAILED) goto failed;
+    sqes = mmap( NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if (sqes == MAP_FAILED)
+    {
+        munmap( ring, max( sq_size, cq_size ));
+        goto failed;
+    }
+
+    uring_sq_tail  = (unsigned int *)(ring + params.sq_off.tail);
+    uring_sq_mask  = (unsigned int *)(ring + params.sq_off.ring_mask);
+    uring_sq_array = (unsigned int *)(ring + params.sq_off.array);
+    uring_cq_head  = (unsigned int *)(ring + params.cq_off.head);
+    uring_cq_tail  = (unsigned int *)(ring + params.cq_off.tail);
+    uring_cq_mask  = (unsigned int *)(ring + params.cq_off.ring_mask);
+    uring_cqes     = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+    uring_sqes     = sqes;
+    /* never have more I/Os in flight than the completion queue can hold */
+    uring_max_inflight = min( params.sq_entries, params.cq_entries );
+    uring_fd = fd;
+
+    if (!create_system_thread( uring_thread, NULL )) return TRUE;
+
+    WARN( "failed to create the io_uring thread\n" );
+    munmap( sqes, params.sq_entries * sizeof(struct io_uring_sqe) );
+    munmap( ring, max( sq_size, cq_size ));
+    uring_fd = -1;
+failed:
+    close( fd );
+    return FALSE;
+}
+
+/* queue the next part of an I/O to the kernel, called with uring_mutex held */
+static BOOL uring_queue( struct uring_io *io )
+{
+    unsigned int tail = *uring_sq_tail, index = tail & *uring_sq_mask;
+    struct io_uring_sqe *sqe = &uring_sqes[index];
+    int ret;
+
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->opcode    = io->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd        = io->fd;
+    sqe->addr      = (ULONG_PTR)(io->buffer + io->total);
+    sqe->len       = io->length - io->total;
+    sqe->off       = io->offset + io->total;
+    sqe->user_data = (ULONG_PTR)io;
+    uring_sq_array[index] = index;
+    __atomic_store_n( uring_sq_tail, tail + 1, __ATOMIC_RELEASE );
+
+    while ((ret = syscall( __NR_io_uring_enter, uring_fd, 1, 0, 0, NULL, 0 )) == -1 && errno == EINTR);
+    if (ret == 1) return TRUE;
+    /* the kernel only consumes entries in io_uring_enter, so the entry can be taken back */
+    __atomic_store_n( uring_sq_tail, tail, __ATOMIC_RELEASE );
+    return FALSE;
+}
+
+/* transfer the rest of an I/O synchronously, returns the last result */
+static int uring_finish_sync( struct uring_io *io )
+{
+    ssize_t ret;
+
+    while (io->total < io->length)
+    {
+        if (io->write)
+            ret = pwrite( io->fd, io->buffer + io->total, io->length - io->total, io->offset + io->total );
+        else
+            ret = virtual_locked_pread( io->fd, io->buffer + io->total, io->length - io->total,
+                                        io->offset + io->total );
+        if (ret == -1)
+        {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (!ret) break;
+        io->total += ret;
+        if (!io->write) break;
+    }
+    return 0;
+}
+
+/* process the result of an I/O, called from the io_uring thread */
+static void uring_complete( struct uring_io *io, int res )
+{
+    NTSTATUS status;
+    BOOL done;
+
+    if (res == -EINTR || res == -EAGAIN) done = FALSE;
+    else if (res == -EFAULT && !io->write)
+    {
+        /* the buffer may contain write watches, let the read fault them in */
+        res = uring_finish_sync( io );
+        done = TRUE;
+    }
+    else if (res > 0)
+    {
+        io->total += res;
+        done = !io->write || io->total == io->length;  /* short reads only happen at end of file */
+    }
+    else done = TRUE;
+
+    if (!done)
+    {
+        pthread_mutex_lock( &uring_mutex );
+        done = !uring_queue( io );
+        pthread_mutex_unlock( &uring_mutex );
+        if (!done) return;
+        res = uring_finish_sync( io );
+    }
+
+    if (res < 0) status = (res == -EFAULT) ? STATUS_INVALID_USER_BUFFER : errno_to_status( -res );
+    else if (!io->write && !io->total && io->length) status = STATUS_END_OF_FILE;
+    else status = STATUS_SUCCESS;
+
+    TRACE( "%s %p done, status %#x size %u\n", io->write ? "write" : "read", io->handle, status, io->total );
+    set_async_iosb( io->iosb, status, io->total );
+    if (io->event) NtSetEvent( io->event, NULL );
+    if (io->apc)
+    {
+        NtQueueApcThread( io->thread, (PNTAPCFUNC)io->apc, (ULONG_PTR)io->apc_user, io->iosb, 0 );
+        NtClose( io->thread );
+    }
+    if (io->cvalue) add_completion( io->handle, io->cvalue, status, io->total, TRUE );
+    if (io->event) NtClose( io->event );
+    NtClose( io->handle );
+    close( io->fd );
+    free( io );
+
+    pthread_mutex_lock( &uring_mutex );
+    uring_inflight--;
+    pthread_mutex_unlock( &uring_mutex );
+}
+
+/* io_uring thread, reaps the completed I/Os */
+static void uring_thread( void *arg )
+{
+    for (;;)
+    {
+        unsigned int head = *uring_cq_head;
+        struct io_uring_cqe *cqe;
+        struct uring_io *io;
+        int res;
+
+        if (head == __atomic_load_n( uring_cq_tail, __ATOMIC_ACQUIRE ))
+        {
+            syscall( __NR_io_uring_enter, uring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+            continue;
+        }
+        cqe = &uring_cqes[head & *uring_cq_mask];
+        io = (struct uring_io *)(ULONG_PTR)cqe->user_data;
+        res = cqe->res;
+        __atomic_store_n( uring_cq_head, head + 1, __ATOMIC_RELEASE );
+        uring_complete( io, res );
+    }
+}
+
+/***********************************************************************
+ *           uring_submit
+ *
+ * Submit an overlapped read or write on a regular file to the io_uring.
+ * Returns STATUS_PENDING on success; on failure the caller should do the I/O itself.
+ */
+static NTSTATUS uring_submit( HANDLE handle, int unix_fd, int needs_close, BOOL write, void *buffer,
+                              ULONG length, ULONGLONG offset, HANDLE event, PIO_APC_ROUTINE apc,
+                              void *apc_user, client_ptr_t iosb, ULONG_PTR cvalue )
+{
+    struct uring_io *io;
+    BOOL queued = FALSE;
+
+    if (uring_state == -1 || !length) return STATUS_NOT_SUPPORTED;
+    /* without an event the caller may wait on the file handle, which is only reset by the server */
+    if (!event && !apc && !is_completion_handle( handle )) return STATUS_NOT_SUPPORTED;
+    if (!(io = malloc( sizeof(*io) ))) return STATUS_NO_MEMORY;
+
+    io->handle   = 0;
+    io->write    = write;
+    io->buffer   = buffer;
+    io->length   = length;
+    io->total    = 0;
+    io->offset   = offset;
+    io->event    = 0;
+    io->apc      = apc;
+    io->apc_user = apc_user;
+    io->thread   = 0;
+    io->iosb     = iosb;
+    io->cvalue   = cvalue;
+    /* the fd may be closed by the fd cache before the I/O completes */
+    if ((io->fd = needs_close ? unix_fd : dup( unix_fd )) == -1) goto failed;
+    /* the handles may be closed by the application before the I/O completes */
+    if (NtDuplicateObject( NtCurrentProcess(), handle, NtCurrentProcess(),
+                           &io->handle, 0, 0, DUPLICATE_SAME_ACCESS ))
+        goto failed;
+    if (event && NtDuplicateObject( NtCurrentProcess(), event, NtCurrentProcess(),
+                                    &io->event, 0, 0, DUPLICATE_SAME_ACCESS ))
+        goto failed;
+    if (apc && NtDuplicateObject( NtCurrentProcess(), GetCurrentThread(), NtCurrentProcess(),
+                                  &io->thread, 0, 0, DUPLICATE_SAME_ACCESS ))
+        goto failed;
+    if (event) NtResetEvent( event, NULL );
+
+    pthread_mutex_lock( &uring_mutex );
+    if (!uring_state) uring_state = uring_init() ? 1 : -1;
+    if (uring_state == 1 && uring_inflight < uring_max_inflight && (queued = uring_queue( io )))
+        uring_inflight++;
+    pthread_mutex_unlock( &uring_mutex );
+
+    if (queued)
+    {
+        TRACE( "%s %p queued, size %u offset %s\n", write ? "write" : "read", handle, length,
+               wine_dbgstr_longlong( offset ));
+        return STATUS_PENDING;
+    }
+
+failed:
+    if (io->thread) NtClose( io->thread );
+    if (io->event) NtClose( io->event );
+    if (io->handle) NtClose( io->handle );
+    if (io->fd != -1 && io->fd != unix_fd) close( io->fd );
+    free( io );
+    return STATUS_NOT_SUPPORTED;
+}
+
+#else  /* HAVE_LINUX_IO_URING_H */
+
+static NTSTATUS uring_submit( HANDLE handle, int unix_fd, int needs_close, BOOL write, void *buffer,
+                              ULONG length, ULONGLONG offset, HANDLE event, PIO_APC_ROUTINE apc,
+                              void *apc_user, client_ptr_t iosb, ULONG_PTR cvalue )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+
+#endif  /* HAVE_LINUX_IO_URING_H */
+
+
 /******************************************************************************
  *              NtReadFile   (NTDLL.@)
  */
@@ -5161,7 +5891,12 @@ NTSTATUS WINAPI NtReadFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, vo
 
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
         {
-            /* async I/O doesn't make sense on regular files */
+            if (async_read && uring_submit( handle, unix_handle, needs_close, FALSE, buffer, length,
+                                            offset->QuadPart, event, apc, apc_user, iosb_ptr,
+                                            cvalue ) == STATUS_PENDING)
+                return STATUS_PENDING;
+
+            /* otherwise async I/O doesn't make sense on regular files */
             while ((result = virtual_locked_pread( unix_handle, buffer, length, offset->QuadPart )) == -1)
             {
                 if (errno != EINTR)
@@ -5203,7 +5938,17 @@ NTSTATUS WINAPI NtReadFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, vo
 
     for (;;)
     {
-        if ((result = virtual_locked_read( unix_handle, (char *)buffer + total, length - total )) >= 0)
+        if (!length && type == FD_TYPE_PIPE)
+        {
+            if ((result = peek_pipe_data( unix_handle )) > 0)
+            {
+                status = STATUS_SUCCESS;
+                goto done;
+            }
+        }
+        else result = virtual_locked_read( unix_handle, (char *)buffer + total, length - total );
+
+        if (result >= 0)
         {
             total += result;
             if (!result || total == length)
@@ -5227,12 +5972,23 @@ NTSTATUS WINAPI NtReadFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, vo
                         goto done;
                     }
                     break;
+                case FD_TYPE_PIPE:
+                    /* the pipe socket has been replaced or shut down, either retry with
+                     * the new socket or let the server return the pipe status */
+                    if (server_refresh_unix_fd( handle, unix_handle, needs_close ))
+                        return NtReadFile( handle, event, apc, apc_user, io, buffer, length, offset, key );
+                    return server_read_file( handle, event, apc, apc_user, io, buffer, length, offset, key );
                 default:
                     status = STATUS_PIPE_BROKEN;
                     goto err;
                 }
             }
             else if (type == FD_TYPE_FILE) continue;  /* no async I/O on regular files */
+            else if (type == FD_TYPE_PIPE)  /* return as soon as we got something */
+            {
+                status = STATUS_SUCCESS;
+                goto done;
+            }
         }
         else if (errno != EAGAIN)
         {
@@ -5275,6 +6031,8 @@ NTSTATUS WINAPI NtReadFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, vo
             {
                 if (total)  /* return with what we got so far */
                     status = STATUS_SUCCESS;
+                else if (type == FD_TYPE_PIPE)  /* non-blocking pipe */
+                    status = STATUS_PIPE_EMPTY;
                 else
                     status = (type == FD_TYPE_MAILSLOT) ? STATUS_IO_TIMEOUT : STATUS_TIMEOUT;
                 goto done;
@@ -5473,7 +6231,12 @@ NTSTATUS WINAPI NtWriteFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, v
                 goto done;
             }
 
-            /* async I/O doesn't make sense on regular files */
+            if (async_write && offset->QuadPart >= 0 &&
+                uring_submit( handle, unix_handle, needs_close, TRUE, (void *)buffer, length, off,
+                              event, apc, apc_user, iosb_ptr, cvalue ) == STATUS_PENDING)
+                return STATUS_PENDING;
+
+            /* otherwise async I/O doesn't make sense on regular files */
             while ((result = pwrite( unix_handle, buffer, length, off )) == -1)
             {
                 if (errno != EINTR)
@@ -5523,6 +6286,14 @@ NTSTATUS WINAPI NtWriteFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, v
         else if (errno != EAGAIN)
         {
             if (errno == EINTR) continue;
+            if (errno == EPIPE && type == FD_TYPE_PIPE && !total)
+            {
+                /* the pipe socket has been replaced or shut down, either retry with
+                 * the new socket or let the server return the pipe status */
+                if (server_refresh_unix_fd( handle, unix_handle, needs_close ))
+                    return NtWriteFile( handle, event, apc, apc_user, io, buffer, length, offset, key );
+                return server_write_file( handle, event, apc, apc_user, io, buffer, length, offset, key );
+            }
             if (!total)
             {
                 if (errno == EFAULT) status = STATUS_INVALID_USER_BUFFER;
@@ -5555,6 +6326,8 @@ NTSTATUS WINAPI NtWriteFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, v
             SERVER_END_REQ;
 
             if (status != STATUS_PENDING) free( fileio );
+            /* non-blocking pipes complete with what was written so far */
+            if (status == STATUS_SUCCESS && type == FD_TYPE_PIPE) goto done;
             goto err;
         }
         else  /* synchronous write, wait for the fd to become ready */
@@ -5576,8 +6349,8 @@ NTSTATUS WINAPI NtWriteFile( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, v
 
             if (!timeout || !(ret = poll( &pfd, 1, timeout )))
             {
-                /* return with what we got so far */
-                status = total ? STATUS_SUCCESS : STATUS_TIMEOUT;
+                /* return with what we got so far; non-blocking pipes don't time out */
+                status = (total || type == FD_TYPE_PIPE) ? STATUS_SUCCESS : STATUS_TIMEOUT;
                 goto done;
             }
             if (ret == -1 && errno != EINTR)
@@ -5940,6 +6713,8 @@ NTSTATUS WINAPI NtCancelIoFile( HANDLE handle, IO_STATUS_BLOCK *io_status )
 
     TRACE( "%p %p\n", handle, io_status );
 
+    sock_cancel_io( handle, NULL, TRUE );
+
     SERVER_START_REQ( cancel_async )
     {
         req->handle      = wine_server_obj_handle( handle );
@@ -5962,14 +6737,19 @@ NTSTATUS WINAPI NtCancelIoFile( HANDLE handle, IO_STATUS_BLOCK *io_status )
 NTSTATUS WINAPI NtCancelIoFileEx( HANDLE handle, IO_STATUS_BLOCK *io, IO_STATUS_BLOCK *io_status )
 {
     NTSTATUS status;
+    ULONG count;
 
     TRACE( "%p %p %p\n", handle, io, io_status );
 
+    count = sock_cancel_io( handle, io, FALSE );
+
     SERVER_START_REQ( cancel_async )
     {
         req->handle = wine_server_obj_handle( handle );
         req->iosb   = wine_server_client_ptr( io );
-        if (!(status = wine_server_call( req )))
+        status = wine_server_call( req );
+        if (status == STATUS_NOT_FOUND && count) status = STATUS_SUCCESS;
+        if (!status)
         {
             io_status->u.Status = status;
             io_status->Information = 0;
@@ -6402,10 +7182,16 @@ NTSTATUS WINAPI NtQueryVolumeInformationFile( HANDLE handle, IO_STATUS_BLOCK *io
                                               FS_INFORMATION_CLASS info_class )
 {
     int fd, needs_close;
+    enum server_fd_type type;
     struct stat st;
     NTSTATUS status;
 
-    status = server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, NULL );
+    status = server_get_unix_fd( handle, 0, &fd, &needs_close, &type, NULL );
+    if (!status && type == FD_TYPE_PIPE)  /* the unix fd of a pipe is only used for its data */
+    {
+        if (needs_close) close( fd );
+        status = STATUS_BAD_DEVICE_TYPE;
+    }
     if (status == STATUS_BAD_DEVICE_TYPE)
     {
         struct async_irp *async;
@@ -27,12 +27,17 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <signal.h>
+#include <time.h>
 #ifdef HAVE_LINK_H
 # include <link.h>
 #endif
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
 #ifdef HAVE_PWD_H
 # include <pwd.h>
 #endif
@@ -51,9 +56,18 @@
 #ifdef HAVE_SYS_RESOURCE_H
 # include <sys/resource.h>
 #endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+# include <sys/un.h>
+#endif
 #ifdef HAVE_SYS_WAIT_H
 #include <sys/wait.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 #ifdef __APPLE__
 # include <CoreFoundation/CoreFoundation.h>
 # define LoadResource MacLoadResource
@@ -675,24 +689,38 @@ static NTSTATUS loader_exec( const char *loader, char **argv, WORD machine )
 
 
 /***********************************************************************
- *           exec_wineloader
+ *           get_preload_reserve
  *
- * argv[0] and argv[1] must be reserved for the preloader and loader respectively.
+ * Get the machine of the loader needed for an image, and the preloader
+ * environment variable for the address range to reserve for it.
  */
-NTSTATUS exec_wineloader( char **argv, int socketfd, const pe_image_info_t *pe_info )
+static WORD get_preload_reserve( const pe_image_info_t *pe_info, char *preloader_reserve )
 {
     WORD machine = pe_info->machine;
     ULONGLONG res_start = pe_info->base;
     ULONGLONG res_end = pe_info->base + pe_info->map_size;
-    const char *loader = argv0;
-    const char *loader_env = getenv( "WINELOADER" );
-    char preloader_reserve[64], socket_env[64];
-    BOOL is_child_64bit;
 
     if (pe_info->image_flags & IMAGE_FLAGS_WineFakeDll) res_start = res_end = 0;
     if (pe_info->image_flags & IMAGE_FLAGS_ComPlusNativeReady) machine = native_machine;
 
-    is_child_64bit = is_machine_64bit( machine );
+    sprintf( preloader_reserve, "WINEPRELOADRESERVE=%x%08x-%x%08x",
+             (ULONG)(res_start >> 32), (ULONG)res_start, (ULONG)(res_end >> 32), (ULONG)res_end );
+    return machine;
+}
+
+
+/***********************************************************************
+ *           exec_wineloader
+ *
+ * argv[0] and argv[1] must be reserved for the preloader and loader respectively.
+ */
+NTSTATUS exec_wineloader( char **argv, int socketfd, const pe_image_info_t *pe_info )
+{
+    const char *loader = argv0;
+    const char *loader_env = getenv( "WINELOADER" );
+    char preloader_reserve[64], socket_env[64];
+    WORD machine = get_preload_reserve( pe_info, preloader_reserve );
+    BOOL is_child_64bit = is_machine_64bit( machine );
 
     if (!is_win64 ^ !is_child_64bit)
     {
@@ -723,8 +751,6 @@ NTSTATUS exec_wineloader( char **argv, int socketfd, const pe_image_info_t *pe_i
     signal( SIGPIPE, SIG_DFL );
 
     sprintf( socket_env, "WINESERVERSOCKET=%u", socketfd );
-    sprintf( preloader_reserve, "WINEPRELOADRESERVE=%x%08x-%x%08x",
-             (ULONG)(res_start >> 32), (ULONG)res_start, (ULONG)(res_end >> 32), (ULONG)res_end );
 
     putenv( preloader_reserve );
     putenv( socket_env );
@@ -733,6 +759,483 @@ NTSTATUS exec_wineloader( char **argv, int socketfd, const pe_image_info_t *pe_i
 }
 
 
+#ifdef __linux__
+
+/* process zygote support */
+
+#define ZYGOTE_TIMEOUT   30000       /* idle time before the zygote exits, in ms */
+#define ZYGOTE_MAX_DATA  0x1000000   /* maximum size of the strings of a request */
+
+enum zygote_fd
+{
+    ZYGOTE_FD_SOCKET,   /* server socket of the new process */
+    ZYGOTE_FD_STDIN,
+    ZYGOTE_FD_STDOUT,
+    ZYGOTE_FD_STDERR,
+    ZYGOTE_FD_CWD,      /* current directory */
+    ZYGOTE_FD_COUNT
+};
+
+struct zygote_request
+{
+    unsigned int  argc;         /* number of arguments */
+    unsigned int  envc;         /* number of environment variables */
+    unsigned int  size;         /* size of the argument and environment strings that follow */
+    unsigned int  fds;          /* mask of the zygote_fd descriptors passed with the request */
+    int           new_session;  /* start a new session instead of joining the process group */
+    int           pgid;         /* process group to join */
+    unsigned int  umask;        /* file creation mask, ~0u if unknown */
+};
+
+static pthread_mutex_t zygote_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sockaddr_un zygote_addr;
+static int zygote_enabled = -1;
+static time_t zygote_start_time;
+
+
+/***********************************************************************
+ *           zygote_init_addr
+ *
+ * Build the address of the zygote socket for the current architecture, in the server directory.
+ */
+static BOOL zygote_init_addr( const char *server_dir )
+{
+    int len;
+
+    zygote_addr.sun_family = AF_UNIX;
+    len = snprintf( zygote_addr.sun_path, sizeof(zygote_addr.sun_path), "%s/zygote%u-%u",
+                    server_dir, is_win64 ? 64 : 32, SERVER_PROTOCOL_VERSION );
+    return len > 0 && len < sizeof(zygote_addr.sun_path);
+}
+
+
+/***********************************************************************
+ *           zygote_start
+ *
+ * Start a zygote process listening on the zygote socket. It becomes usable
+ * once it has reached __wine_main, so the caller doesn't wait for it.
+ */
+static void zygote_start(void)
+{
+    char *argv[3] = { NULL, NULL, NULL };
+    char *socket_env;
+    pid_t pid;
+    time_t now = time( NULL );
+
+    if (now - zygote_start_time < 10) return;  /* don't restart a failing zygote too often */
+    zygote_start_time = now;
+
+    if (!(socket_env = malloc( sizeof("WINEZYGOTESOCKET=") + strlen( zygote_addr.sun_path ) ))) return;
+    strcpy( socket_env, "WINEZYGOTESOCKET=" );
+    strcat( socket_env, zygote_addr.sun_path );
+
+    if (!(pid = fork()))  /* child */
+    {
+        if (!(pid = fork()))  /* grandchild */
+        {
+            putenv( socket_env );
+            unsetenv( "WINEPRELOADRESERVE" );
+            signal( SIGPIPE, SIG_DFL );
+            loader_exec( argv0, argv, current_machine );
+            _exit(1);
+        }
+        _exit(pid == -1);
+    }
+
+    if (pid != -1)
+    {
+        /* reap child */
+        pid_t wret;
+        do {
+            wret = waitpid(pid, NULL, 0);
+        } while (wret < 0 && errno == EINTR);
+    }
+    free( socket_env );
+}
+
+
+/***********************************************************************
+ *           zygote_connect
+ */
+static int zygote_connect(void)
+{
+    int fd = -1;
+
+    pthread_mutex_lock( &zygote_mutex );
+    if (zygote_enabled == -1)
+    {
+        const char *env = getenv( "WINEZYGOTE" );
+        const char *dir = get_server_dir();
+
+        zygote_enabled = env && atoi( env ) && dir && zygote_init_addr( dir );
+    }
+    if (zygote_enabled && (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) != -1)
+    {
+        fcntl( fd, F_SETFD, FD_CLOEXEC );
+        if (connect( fd, (struct sockaddr *)&zygote_addr, sizeof(zygote_addr) ) == -1)
+        {
+            close( fd );
+            fd = -1;
+            if (errno == ENOENT || errno == ECONNREFUSED) zygote_start();
+        }
+    }
+    pthread_mutex_unlock( &zygote_mutex );
+    return fd;
+}
+
+
+/***********************************************************************
+ *           get_umask
+ *
+ * Get the file creation mask without changing it, since other threads may be creating files.
+ */
+static unsigned int get_umask(void)
+{
+    unsigned int mask = ~0u;
+    char buffer[128];
+    FILE *f;
+
+    if (!(f = fopen( "/proc/self/status", "r" ))) return mask;
+    while (fgets( buffer, sizeof(buffer), f ))
+        if (sscanf( buffer, "Umask: %o", &mask ) == 1) break;
+    fclose( f );
+    return mask;
+}
+
+
+/***********************************************************************
+ *           zygote_spawn
+ *
+ * Create a new process by forking the zygote of the prefix. argv[0] and argv[1] are reserved.
+ * Returns STATUS_NOT_SUPPORTED if the process should be started with exec_wineloader instead.
+ */
+NTSTATUS zygote_spawn( char **argv, int socketfd, int unixdir, int stdin_fd, int stdout_fd,
+                       BOOL new_session, const char *winedebug, const pe_image_info_t *pe_info )
+{
+    struct zygote_request req;
+    char preloader_reserve[64], *data, *p;
+    char cmsg_buffer[CMSG_SPACE( ZYGOTE_FD_COUNT * sizeof(int) )];
+    int fds[ZYGOTE_FD_COUNT], count = 0, fd, cwd_fd = unixdir, ack = -1;
+    const char *env[2];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec vec;
+    unsigned int i, size;
+    ssize_t ret;
+
+    if (is_machine_64bit( get_preload_reserve( pe_info, preloader_reserve )) != is_win64)
+        return STATUS_NOT_SUPPORTED;
+    if ((fd = zygote_connect()) == -1) return STATUS_NOT_SUPPORTED;
+
+    memset( &req, 0, sizeof(req) );
+    env[0] = preloader_reserve;
+    env[1] = winedebug;
+
+    for (i = 2; argv[i]; i++, req.argc++) req.size += strlen( argv[i] ) + 1;
+    for (i = 0; i < ARRAY_SIZE(env) && env[i]; i++, req.envc++) req.size += strlen( env[i] ) + 1;
+    for (i = 0; environ[i]; i++)
+    {
+        if (winedebug && !strncmp( environ[i], "WINEDEBUG=", 10 )) continue;
+        if (!strncmp( environ[i], "WINEPRELOADRESERVE=", 19 )) continue;
+        req.size += strlen( environ[i] ) + 1;
+        req.envc++;
+    }
+    if (!(data = malloc( req.size )))
+    {
+        close( fd );
+        return STATUS_NOT_SUPPORTED;
+    }
+    p = data;
+    for (i = 2; argv[i]; i++) p += strlen( strcpy( p, argv[i] )) + 1;
+    for (i = 0; i < ARRAY_SIZE(env) && env[i]; i++) p += strlen( strcpy( p, env[i] )) + 1;
+    for (i = 0; environ[i]; i++)
+    {
+        if (winedebug && !strncmp( environ[i], "WINEDEBUG=", 10 )) continue;
+        if (!strncmp( environ[i], "WINEPRELOADRESERVE=", 19 )) continue;
+        p += strlen( strcpy( p, environ[i] )) + 1;
+    }
+
+    if (cwd_fd == -1) cwd_fd = open( ".", O_RDONLY );
+
+    req.fds |= 1 << ZYGOTE_FD_SOCKET;
+    fds[count++] = socketfd;
+    if (stdin_fd != -1)
+    {
+        req.fds |= 1 << ZYGOTE_FD_STDIN;
+        fds[count++] = stdin_fd;
+    }
+    if (stdout_fd != -1)
+    {
+        req.fds |= 1 << ZYGOTE_FD_STDOUT;
+        fds[count++] = stdout_fd;
+    }
+    req.fds |= 1 << ZYGOTE_FD_STDERR;
+    fds[count++] = 2;
+    if (cwd_fd != -1)
+    {
+        req.fds |= 1 << ZYGOTE_FD_CWD;
+        fds[count++] = cwd_fd;
+    }
+    req.new_session = new_session;
+    req.pgid = getpgrp();
+    req.umask = get_umask();
+
+    vec.iov_base = &req;
+    vec.iov_len = sizeof(req);
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &vec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buffer;
+    msg.msg_controllen = CMSG_SPACE( count * sizeof(int) );
+    cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( count * sizeof(int) );
+    memcpy( CMSG_DATA(cmsg), fds, count * sizeof(int) );
+
+    ret = sendmsg( fd, &msg, MSG_NOSIGNAL );
+    for (size = 0; ret > 0 && size < req.size; size += ret)
+        ret = send( fd, data + size, req.size - size, MSG_NOSIGNAL );
+    free( data );
+    if (cwd_fd != unixdir) close( cwd_fd );
+
+    if (ret <= 0)  /* the zygote went away before getting the request */
+    {
+        close( fd );
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    /* once the request has been received, the new process may already exist */
+    while ((ret = read( fd, &ack, sizeof(ack) )) == -1 && errno == EINTR);
+    close( fd );
+    if (ret != sizeof(ack)) return STATUS_INTERNAL_ERROR;
+    return ack ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
+}
+
+
+/***********************************************************************
+ *           zygote_read_request
+ */
+static char *zygote_read_request( int client, struct zygote_request *req, int fds[ZYGOTE_FD_COUNT] )
+{
+    char cmsg_buffer[CMSG_SPACE( ZYGOTE_FD_COUNT * sizeof(int) )];
+    int received[ZYGOTE_FD_COUNT];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec vec;
+    unsigned int i, count = 0, size;
+    char *data = NULL;
+    ssize_t ret;
+
+    for (i = 0; i < ZYGOTE_FD_COUNT; i++) fds[i] = -1;
+
+    vec.iov_base = req;
+    vec.iov_len = sizeof(*req);
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &vec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buffer;
+    msg.msg_controllen = sizeof(cmsg_buffer);
+
+    while ((ret = recvmsg( client, &msg, MSG_WAITALL )) == -1 && errno == EINTR);
+
+    if (ret > 0 && (cmsg = CMSG_FIRSTHDR( &msg )) &&
+        cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        count = min( (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int), ZYGOTE_FD_COUNT );
+        memcpy( received, CMSG_DATA(cmsg), count * sizeof(int) );
+    }
+    if (ret == sizeof(*req))
+    {
+        /* the descriptors are sent in zygote_fd order */
+        for (i = size = 0; i < ZYGOTE_FD_COUNT && size < count; i++)
+            if (req->fds & (1 << i)) fds[i] = received[size++];
+        if (size < count || fds[ZYGOTE_FD_SOCKET] == -1) ret = 0;
+    }
+    if (ret != sizeof(*req))
+    {
+        for (i = 0; i < count; i++) close( received[i] );
+        return NULL;
+    }
+    if (!req->size || req->size > ZYGOTE_MAX_DATA) goto failed;
+    if (!(data = malloc( req->size ))) goto failed;
+
+    for (size = 0; size < req->size; size += ret)
+    {
+        if ((ret = read( client, data + size, req->size - size )) > 0) continue;
+        if (ret == -1 && errno == EINTR) ret = 0;
+        else goto failed;
+    }
+    if (data[req->size - 1]) goto failed;
+    return data;
+
+failed:
+    for (i = 0; i < ZYGOTE_FD_COUNT; i++) if (fds[i] != -1) close( fds[i] );
+    free( data );
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           zygote_fork
+ *
+ * Fork a new process for a zygote request. Returns TRUE in the new process.
+ */
+static BOOL zygote_fork( int client, int *argc, char **argv[], char **envp[] )
+{
+    struct zygote_request req;
+    int fds[ZYGOTE_FD_COUNT], ack = -1, null_fd;
+    char **new_argv = NULL, **new_env = NULL, *data, *p, *end;
+    unsigned int i;
+    pid_t pid;
+
+    if (!(data = zygote_read_request( client, &req, fds ))) goto done;
+    if (!(new_argv = malloc( (req.argc + 2) * sizeof(*new_argv) ))) goto done;
+    if (!(new_env = malloc( (req.envc + 2) * sizeof(*new_env) + 32 ))) goto done;
+
+    new_argv[0] = (*argv)[0];
+    for (i = 0, p = data, end = data + req.size; i < req.argc + req.envc; i++)
+    {
+        if (p == end) goto done;
+        if (i < req.argc) new_argv[i + 1] = p;
+        else new_env[i - req.argc] = p;
+        p += strlen( p ) + 1;
+    }
+    new_argv[req.argc + 1] = NULL;
+    new_env[req.envc] = (char *)(new_env + req.envc + 2);
+    new_env[req.envc + 1] = NULL;
+    sprintf( new_env[req.envc], "WINESERVERSOCKET=%u", fds[ZYGOTE_FD_SOCKET] );
+
+    if (!(pid = fork()))  /* child */
+    {
+        if (!(pid = fork()))  /* grandchild */
+        {
+            close( client );
+            null_fd = open( "/dev/null", O_RDWR );
+            if (req.new_session)
+            {
+                setsid();
+                dup2( null_fd, 0 );
+                dup2( null_fd, 1 );
+            }
+            else
+            {
+                setpgid( 0, req.pgid );  /* fails if the zygote is in another session */
+                dup2( fds[ZYGOTE_FD_STDIN] != -1 ? fds[ZYGOTE_FD_STDIN] : null_fd, 0 );
+                dup2( fds[ZYGOTE_FD_STDOUT] != -1 ? fds[ZYGOTE_FD_STDOUT] : null_fd, 1 );
+            }
+            dup2( fds[ZYGOTE_FD_STDERR] != -1 ? fds[ZYGOTE_FD_STDERR] : null_fd, 2 );
+            if (fds[ZYGOTE_FD_CWD] != -1) fchdir( fds[ZYGOTE_FD_CWD] );
+            if (req.umask != ~0u) umask( req.umask );
+            for (i = ZYGOTE_FD_STDIN; i < ZYGOTE_FD_COUNT; i++) if (fds[i] != -1) close( fds[i] );
+            if (null_fd != -1) close( null_fd );
+
+            environ = *envp = new_env;
+            *argv = new_argv;
+            *argc = req.argc + 1;
+            return TRUE;
+        }
+        _exit(pid == -1);
+    }
+
+    if (pid != -1)
+    {
+        /* reap child */
+        int status;
+        pid_t wret;
+        do {
+            wret = waitpid(pid, &status, 0);
+        } while (wret < 0 && errno == EINTR);
+        if (wret == pid && WIFEXITED(status) && !WEXITSTATUS(status)) ack = 0;
+    }
+
+done:
+    send( client, &ack, sizeof(ack), MSG_NOSIGNAL );
+    close( client );
+    if (data) for (i = 0; i < ZYGOTE_FD_COUNT; i++) if (fds[i] != -1) close( fds[i] );
+    free( new_argv );
+    free( new_env );
+    free( data );
+    return FALSE;
+}
+
+
+/***********************************************************************
+ *           zygote_main
+ *
+ * Main loop of the zygote process, forking new processes on request. It only returns
+ * in the new processes, with their own arguments and environment.
+ */
+static void zygote_main( const char *path, int *argc, char **argv[], char **envp[] )
+{
+    struct pollfd pfd;
+    int fd, client, null_fd, ret;
+
+    if (strlen( path ) >= sizeof(zygote_addr.sun_path)) exit(1);
+    zygote_addr.sun_family = AF_UNIX;
+    strcpy( zygote_addr.sun_path, path );
+
+    if ((fd = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1) exit(1);
+    if (bind( fd, (struct sockaddr *)&zygote_addr, sizeof(zygote_addr) ) == -1)
+    {
+        if (errno != EADDRINUSE) exit(1);
+        if ((client = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1) exit(1);
+        /* another zygote is already running */
+        if (!connect( client, (struct sockaddr *)&zygote_addr, sizeof(zygote_addr) )) exit(0);
+        close( client );
+        unlink( path );
+        if (bind( fd, (struct sockaddr *)&zygote_addr, sizeof(zygote_addr) ) == -1) exit(1);
+    }
+    if (listen( fd, 64 ) == -1) exit(1);
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    /* don't keep the files and directory of the process that started us */
+    if ((null_fd = open( "/dev/null", O_RDWR )) != -1)
+    {
+        dup2( null_fd, 0 );
+        dup2( null_fd, 1 );
+        dup2( null_fd, 2 );
+        if (null_fd > 2) close( null_fd );
+    }
+    if (chdir( "/" ) == -1) exit(1);
+    signal( SIGCHLD, SIG_DFL );
+
+    for (;;)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if ((ret = poll( &pfd, 1, ZYGOTE_TIMEOUT )) == -1) continue;
+        if (!ret)
+        {
+            /* stop accepting new clients, then serve the ones that already connected */
+            unlink( path );
+            fcntl( fd, F_SETFL, O_NONBLOCK );
+            while ((client = accept( fd, NULL, NULL )) != -1)
+            {
+                fcntl( client, F_SETFL, 0 );
+                if (zygote_fork( client, argc, argv, envp )) break;
+            }
+            if (client == -1) exit(0);
+        }
+        else if ((client = accept( fd, NULL, NULL )) == -1) continue;
+        else if (!zygote_fork( client, argc, argv, envp )) continue;
+
+        close( fd );
+        return;
+    }
+}
+
+#else  /* __linux__ */
+
+NTSTATUS zygote_spawn( char **argv, int socketfd, int unixdir, int stdin_fd, int stdout_fd,
+                       BOOL new_session, const char *winedebug, const pe_image_info_t *pe_info )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+
+#endif  /* __linux__ */
+
+
 /***********************************************************************
  *           exec_wineserver
  *
@@ -2530,6 +3033,14 @@ void __wine_main( int argc, char *argv[], char *envp[] )
     set_max_limit( RLIMIT_AS );
 #endif
 
+#ifdef __linux__
+    if (getenv( "WINEZYGOTESOCKET" ))
+    {
+        zygote_main( getenv( "WINEZYGOTESOCKET" ), &argc, &argv, &envp );
+        init_paths( argv );  /* the new process may use a different environment */
+    }
+#endif
+
     virtual_init();
     init_environment( argc, argv, envp );
 
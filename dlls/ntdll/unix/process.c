@@ -75,15 +75,19 @@ static UINT process_error_mode;
 
 static char **build_argv( const UNICODE_STRING *cmdline, int reserved )
 {
-    char **argv, *arg, *src, *dst;
+    char **argv, *arg, *str, *src, *dst;
     int argc, in_quotes = 0, bcount = 0, len = cmdline->Length / sizeof(WCHAR);
 
-    if (!(src = malloc( len * 3 + 1 ))) return NULL;
+    if (!(str = src = malloc( len * 3 + 1 ))) return NULL;
     len = ntdll_wcstoumbs( cmdline->Buffer, len, src, len * 3, FALSE );
     src[len++] = 0;
 
     argc = reserved + 2 + len / 2;
-    argv = malloc( argc * sizeof(*argv) + len );
+    if (!(argv = malloc( argc * sizeof(*argv) + len )))
+    {
+        free( str );
+        return NULL;
+    }
     arg = dst = (char *)(argv + argc);
     argc = reserved;
     while (*src)
@@ -136,6 +140,7 @@ static char **build_argv( const UNICODE_STRING *cmdline, int reserved )
     *dst = 0;
     argv[argc++] = arg;
     argv[argc] = NULL;
+    free( str );
     return argv;
 }
 
@@ -422,6 +427,7 @@ static NTSTATUS spawn_process( const RTL_USER_PROCESS_PARAMETERS *params, int so
 {
     NTSTATUS status = STATUS_SUCCESS;
     int stdin_fd = -1, stdout_fd = -1;
+    BOOL new_session;
     pid_t pid;
     char **argv;
 
@@ -433,13 +439,26 @@ static NTSTATUS spawn_process( const RTL_USER_PROCESS_PARAMETERS *params, int so
         isatty(1) && is_unix_console_handle( params->hStdOutput ))
         stdout_fd = 1;
 
+    new_session = (params->ConsoleFlags ||
+                   params->ConsoleHandle == (HANDLE)1 /* KERNEL32_CONSOLE_ALLOC */ ||
+                   (params->hStdInput == INVALID_HANDLE_VALUE && params->hStdOutput == INVALID_HANDLE_VALUE));
+
+    if (!(argv = build_argv( &params->CommandLine, 2 )))
+    {
+        status = STATUS_NO_MEMORY;
+        goto done;
+    }
+
+    if ((status = zygote_spawn( argv, socketfd, unixdir, stdin_fd, stdout_fd,
+                                new_session, winedebug, pe_info )) != STATUS_NOT_SUPPORTED)
+        goto done;
+    status = STATUS_SUCCESS;
+
     if (!(pid = fork()))  /* child */
     {
         if (!(pid = fork()))  /* grandchild */
         {
-            if (params->ConsoleFlags ||
-                params->ConsoleHandle == (HANDLE)1 /* KERNEL32_CONSOLE_ALLOC */ ||
-                (params->hStdInput == INVALID_HANDLE_VALUE && params->hStdOutput == INVALID_HANDLE_VALUE))
+            if (new_session)
             {
                 setsid();
                 set_stdio_fd( -1, -1 );  /* close stdin and stdout */
@@ -455,7 +474,6 @@ static NTSTATUS spawn_process( const RTL_USER_PROCESS_PARAMETERS *params, int so
                 fchdir( unixdir );
                 close( unixdir );
             }
-            argv = build_argv( &params->CommandLine, 2 );
 
             exec_wineloader( argv, socketfd, pe_info );
             _exit(1);
@@ -474,8 +492,10 @@ static NTSTATUS spawn_process( const RTL_USER_PROCESS_PARAMETERS *params, int so
     }
     else status = STATUS_NO_MEMORY;
 
+done:
     if (stdin_fd != -1 && stdin_fd != 0) close( stdin_fd );
     if (stdout_fd != -1 && stdout_fd != 1) close( stdout_fd );
+    free( argv );
     return status;
 }
 
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ntstatus.h"
@@ -39,6 +40,76 @@ WINE_DEFAULT_DEBUG_CHANNEL(reg);
 /* maximum length of a value name in bytes (without terminating null) */
 #define MAX_VALUE_LENGTH (16383 * sizeof(WCHAR))
 
+/* cache of recently queried values, validated against the modification serial
+ * that the server maintains for each key in the in-process shared memory */
+
+#define VALUE_CACHE_SIZE     256
+#define VALUE_CACHE_MAX_DATA 4096
+
+struct value_cache_entry
+{
+    unsigned int index;    /* index of the key state in the shared memory, 0 if unused */
+    int          serial;   /* modification serial of the key when the value was cached */
+    int          type;     /* value type, -1 if the value doesn't exist */
+    DWORD        len;      /* length of value data */
+    USHORT       namelen;  /* length of value name */
+    WCHAR       *name;     /* value name, followed by the value data */
+};
+
+static struct value_cache_entry value_cache[VALUE_CACHE_SIZE];
+static pthread_mutex_t value_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int value_cache_hash( unsigned int index, const UNICODE_STRING *name )
+{
+    unsigned int i, hash = index;
+
+    for (i = 0; i < name->Length / sizeof(WCHAR); i++) hash = hash * 31 + name->Buffer[i];
+    return hash % VALUE_CACHE_SIZE;
+}
+
+/* look up a value in the cache; fails if it's not cached or the key has changed */
+static BOOL get_cached_value( unsigned int index, int serial, const UNICODE_STRING *name,
+                              void *data, DWORD size, int *type, DWORD *total )
+{
+    struct value_cache_entry *entry = &value_cache[value_cache_hash( index, name )];
+    BOOL ret = FALSE;
+
+    mutex_lock( &value_cache_mutex );
+    if (entry->index == index && entry->serial == serial && entry->namelen == name->Length &&
+        !memcmp( entry->name, name->Buffer, name->Length ))
+    {
+        *type  = entry->type;
+        *total = entry->len;
+        if (data) memcpy( data, (char *)entry->name + entry->namelen, min( size, entry->len ));
+        ret = TRUE;
+    }
+    mutex_unlock( &value_cache_mutex );
+    return ret;
+}
+
+/* store a value in the cache, replacing any entry with the same hash */
+static void cache_value( unsigned int index, int serial, const UNICODE_STRING *name,
+                         int type, const void *data, DWORD len )
+{
+    struct value_cache_entry *entry = &value_cache[value_cache_hash( index, name )];
+    WCHAR *ptr;
+
+    if (len > VALUE_CACHE_MAX_DATA) return;
+    if (!(ptr = malloc( name->Length + len + 1 ))) return;
+    memcpy( ptr, name->Buffer, name->Length );
+    if (len) memcpy( (char *)ptr + name->Length, data, len );
+
+    mutex_lock( &value_cache_mutex );
+    free( entry->name );
+    entry->index   = index;
+    entry->serial  = serial;
+    entry->type    = type;
+    entry->len     = len;
+    entry->namelen = name->Length;
+    entry->name    = ptr;
+    mutex_unlock( &value_cache_mutex );
+}
+
 
 NTSTATUS open_hkcu_key( const char *path, HANDLE *key )
 {
@@ -78,6 +149,7 @@ NTSTATUS WINAPI NtCreateKey( HANDLE *key, ACCESS_MASK access, const OBJECT_ATTRI
     NTSTATUS ret;
     data_size_t len;
     struct object_attributes *objattr;
+    unsigned int inproc_index = 0, granted = 0;
 
     *key = 0;
     if (attr->Length != sizeof(OBJECT_ATTRIBUTES)) return STATUS_INVALID_PARAMETER;
@@ -95,8 +167,11 @@ NTSTATUS WINAPI NtCreateKey( HANDLE *key, ACCESS_MASK access, const OBJECT_ATTRI
         ret = wine_server_call( req );
         *key = wine_server_ptr_handle( reply->hkey );
         if (dispos && !ret) *dispos = reply->created ? REG_CREATED_NEW_KEY : REG_OPENED_EXISTING_KEY;
+        inproc_index = reply->inproc_index;
+        granted = reply->access;
     }
     SERVER_END_REQ;
+    if (!ret) server_set_inproc_sync( *key, inproc_index, granted );
 
     TRACE( "<- %p\n", *key );
     free( objattr );
@@ -123,6 +198,7 @@ NTSTATUS WINAPI NtCreateKeyTransacted( HANDLE *key, ACCESS_MASK access, const OB
 NTSTATUS WINAPI NtOpenKeyEx( HANDLE *key, ACCESS_MASK access, const OBJECT_ATTRIBUTES *attr, ULONG options )
 {
     NTSTATUS ret;
+    unsigned int inproc_index = 0, granted = 0;
 
     *key = 0;
     if (attr->Length != sizeof(*attr)) return STATUS_INVALID_PARAMETER;
@@ -140,8 +216,11 @@ NTSTATUS WINAPI NtOpenKeyEx( HANDLE *key, ACCESS_MASK access, const OBJECT_ATTRI
         wine_server_add_data( req, attr->ObjectName->Buffer, attr->ObjectName->Length );
         ret = wine_server_call( req );
         *key = wine_server_ptr_handle( reply->hkey );
+        inproc_index = reply->inproc_index;
+        granted = reply->access;
     }
     SERVER_END_REQ;
+    if (!ret) server_set_inproc_sync( *key, inproc_index, granted );
     TRACE("<- %p\n", *key);
     return ret;
 }
@@ -460,7 +539,10 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
 {
     NTSTATUS ret;
     UCHAR *data_ptr;
-    unsigned int fixed_size, min_size;
+    unsigned int fixed_size, min_size, index;
+    int type, serial;
+    DWORD total, size;
+    BOOL cached;
 
     TRACE( "(%p,%s,%d,%p,%d)\n", handle, debugstr_us(name), info_class, info, length );
 
@@ -501,21 +583,37 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
         return STATUS_INVALID_PARAMETER;
     }
 
-    SERVER_START_REQ( get_key_value )
+    size = (length > fixed_size && data_ptr) ? length - fixed_size : 0;
+    cached = !get_inproc_key_serial( handle, KEY_QUERY_VALUE, &index, &serial );
+
+    if (cached && get_cached_value( index, serial, name, data_ptr, size, &type, &total ))
     {
-        req->hkey = wine_server_obj_handle( handle );
-        wine_server_add_data( req, name->Buffer, name->Length );
-        if (length > fixed_size && data_ptr) wine_server_set_reply( req, data_ptr, length - fixed_size );
-        if (!(ret = wine_server_call( req )))
+        if (type == -1) return STATUS_OBJECT_NAME_NOT_FOUND;
+        ret = STATUS_SUCCESS;
+    }
+    else
+    {
+        SERVER_START_REQ( get_key_value )
         {
-            copy_key_value_info( info_class, info, length, reply->type,
-                                 name->Length, reply->total );
-            *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : reply->total);
-            if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
-            else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
+            req->hkey = wine_server_obj_handle( handle );
+            wine_server_add_data( req, name->Buffer, name->Length );
+            if (size) wine_server_set_reply( req, data_ptr, size );
+            ret = wine_server_call( req );
+            type = reply->type;
+            total = reply->total;
+            /* only cache complete data */
+            if (cached && !ret && data_ptr && wine_server_reply_size( reply ) == total)
+                cache_value( index, serial, name, type, data_ptr, total );
         }
+        SERVER_END_REQ;
+        if (ret == STATUS_OBJECT_NAME_NOT_FOUND && cached) cache_value( index, serial, name, -1, NULL, 0 );
+        if (ret) return ret;
     }
-    SERVER_END_REQ;
+
+    copy_key_value_info( info_class, info, length, type, name->Length, total );
+    *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : total);
+    if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
+    else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
     return ret;
 }
 
@@ -35,6 +35,9 @@
 #ifdef HAVE_PTHREAD_NP_H
 # include <pthread_np.h>
 #endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 #ifdef HAVE_PWD_H
 # include <pwd.h>
 #endif
@@ -264,6 +267,105 @@ static inline unsigned int wait_reply( struct __server_request_info *req )
 }
 
 
+#ifdef __linux__
+
+#define FUTEX_WAIT 0
+
+C_ASSERT( sizeof(((struct request_shm *)0)->reply) == sizeof(union generic_reply) );
+
+/***********************************************************************
+ *           send_request_shm
+ *
+ * Send a request to the server, passing the data through the thread shared memory.
+ */
+static unsigned int send_request_shm( const struct __server_request_info *req, struct request_shm *shm )
+{
+    unsigned int status = STATUS_SUCCESS;
+    int ret;
+
+    __TRY
+    {
+        char *ptr = (char *)(shm + 1);
+        unsigned int i;
+
+        for (i = 0; i < req->data_count; i++)
+        {
+            memcpy( ptr, req->data[i].ptr, req->data[i].size );
+            ptr += req->data[i].size;
+        }
+    }
+    __EXCEPT
+    {
+        status = STATUS_ACCESS_VIOLATION;
+    }
+    __ENDTRY
+    if (status) return status;
+
+    /* the request header written to the pipe wakes up the server */
+    shm->state = REQUEST_SHM_PENDING;
+    if ((ret = write( ntdll_get_thread_data()->request_fd, &req->u.req,
+                      sizeof(req->u.req) )) == sizeof(req->u.req)) return STATUS_SUCCESS;
+
+    if (ret >= 0) server_protocol_error( "partial write %d\n", ret );
+    if (errno == EPIPE) abort_thread(0);
+    server_protocol_perror( "write" );
+}
+
+
+/***********************************************************************
+ *           wait_reply_shm
+ *
+ * Wait for a reply from the server in the thread shared memory.
+ */
+static unsigned int wait_reply_shm( struct __server_request_info *req, struct request_shm *shm )
+{
+    unsigned int status = STATUS_SUCCESS;
+    struct timespec timeout;
+    struct pollfd pfd;
+    int i, state;
+
+    /* most replies come quickly, spin a bit before sleeping */
+    for (i = 0; i < 100; i++)
+    {
+        if (*(volatile int *)&shm->state != REQUEST_SHM_PENDING) break;
+        YieldProcessor();
+    }
+
+    while ((state = InterlockedCompareExchange( (LONG *)&shm->state, REQUEST_SHM_WAITING,
+                                                REQUEST_SHM_PENDING )) != REQUEST_SHM_REPLIED)
+    {
+        if (state == REQUEST_SHM_CLOSED) abort_thread(0);  /* the server killed us */
+        timeout.tv_sec = 1;
+        timeout.tv_nsec = 0;
+        if (!syscall( __NR_futex, &shm->state, FUTEX_WAIT, REQUEST_SHM_WAITING, &timeout, 0, 0 )) continue;
+        if (errno != ETIMEDOUT) continue;
+        /* make sure that the server is still around */
+        pfd.fd = ntdll_get_thread_data()->reply_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll( &pfd, 1, 0 ) == 1 && (pfd.revents & (POLLHUP | POLLERR))) abort_thread(0);
+    }
+
+    memcpy( &req->u.reply, &shm->reply, sizeof(req->u.reply) );
+    if (req->u.reply.reply_header.reply_size)
+    {
+        __TRY
+        {
+            memcpy( req->reply_data, shm + 1, req->u.reply.reply_header.reply_size );
+        }
+        __EXCEPT
+        {
+            status = STATUS_ACCESS_VIOLATION;
+        }
+        __ENDTRY
+    }
+    shm->state = REQUEST_SHM_IDLE;
+    return status ? status : req->u.reply.reply_header.error;
+}
+
+#endif  /* __linux__ */
+
+
 /***********************************************************************
  *           server_call_unlocked
  */
@@ -272,6 +374,17 @@ unsigned int server_call_unlocked( void *req_ptr )
     struct __server_request_info * const req = req_ptr;
     unsigned int ret;
 
+#ifdef __linux__
+    struct request_shm *shm = ntdll_get_thread_data()->request_shm;
+
+    /* the server uses the same rule to decide where to find the data */
+    if (shm && req->u.req.request_header.request_size <= REQUEST_SHM_DATA_SIZE &&
+        req->u.req.request_header.reply_size <= REQUEST_SHM_DATA_SIZE)
+    {
+        if ((ret = send_request_shm( req, shm ))) return ret;
+        return wait_reply_shm( req, shm );
+    }
+#endif
     if ((ret = send_request( req ))) return ret;
     return wait_reply( req );
 }
@@ -998,6 +1111,228 @@ static int remove_fd_from_cache( HANDLE handle )
 }
 
 
+/* completion flags of the handles, as set from this process */
+static BYTE *completion_handles[FD_CACHE_ENTRIES];
+
+/***********************************************************************
+ *           set_completion_handle
+ *
+ * Remember that a handle is associated with a completion port, or that its
+ * completion mode has been changed. Flags can only be added.
+ */
+void set_completion_handle( HANDLE handle, BYTE flags )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    sigset_t sigset;
+
+    if (entry >= FD_CACHE_ENTRIES) return;
+
+    server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+    if (!completion_handles[entry])
+    {
+        void *ptr = anon_mmap_alloc( FD_CACHE_BLOCK_SIZE, PROT_READ | PROT_WRITE );
+        if (ptr != MAP_FAILED) completion_handles[entry] = ptr;
+    }
+    if (completion_handles[entry]) completion_handles[entry][idx] |= flags;
+    server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+}
+
+
+/***********************************************************************
+ *           is_completion_handle
+ *
+ * Check if the completion of an I/O on the handle is reported to a completion port.
+ * Only the associations made by this process are known.
+ */
+BOOL is_completion_handle( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    return entry < FD_CACHE_ENTRIES && completion_handles[entry] &&
+           (completion_handles[entry][idx] & COMPLETION_HANDLE_PORT);
+}
+
+
+/***********************************************************************
+ *           is_completion_skipped_on_success
+ *
+ * Check if FILE_SKIP_COMPLETION_PORT_ON_SUCCESS has been set on the handle by this process.
+ */
+BOOL is_completion_skipped_on_success( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    return entry < FD_CACHE_ENTRIES && completion_handles[entry] &&
+           (completion_handles[entry][idx] & COMPLETION_HANDLE_SKIP_ON_SUCCESS);
+}
+
+
+/***********************************************************************
+ *           remove_completion_handle
+ *
+ * Caller must hold fd_cache_mutex.
+ */
+static void remove_completion_handle( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    if (entry < FD_CACHE_ENTRIES && completion_handles[entry]) completion_handles[entry][idx] = 0;
+}
+
+
+/***********************************************************************/
+/* in-process synchronization objects support */
+
+union inproc_sync_cache_entry
+{
+    LONG64 data;
+    struct
+    {
+        unsigned int index;   /* index of the object state, ~0u if the object has none */
+        unsigned int access;  /* handle access rights */
+    } s;
+};
+
+C_ASSERT( sizeof(union inproc_sync_cache_entry) == sizeof(LONG64) );
+
+static union inproc_sync_cache_entry *inproc_sync_cache[FD_CACHE_ENTRIES];
+static int inproc_sync_fd = -2;  /* shared memory file, -2 if not retrieved yet */
+
+
+/***********************************************************************
+ *           add_inproc_sync_to_cache
+ *
+ * Caller must hold fd_cache_mutex.
+ */
+static void add_inproc_sync_to_cache( HANDLE handle, unsigned int index, unsigned int access )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    union inproc_sync_cache_entry cache;
+
+    if (!inproc_sync_cache[entry])  /* do we need to allocate a new block of entries? */
+    {
+        void *ptr = anon_mmap_alloc( FD_CACHE_BLOCK_SIZE * sizeof(union inproc_sync_cache_entry),
+                                     PROT_READ | PROT_WRITE );
+        if (ptr == MAP_FAILED) return;
+        inproc_sync_cache[entry] = ptr;
+    }
+
+    cache.s.index = index;
+    cache.s.access = access;
+    interlocked_xchg64( &inproc_sync_cache[entry][idx].data, cache.data );
+}
+
+
+/***********************************************************************
+ *           remove_inproc_sync_from_cache
+ */
+static void remove_inproc_sync_from_cache( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    if (entry < FD_CACHE_ENTRIES && inproc_sync_cache[entry])
+        interlocked_xchg64( &inproc_sync_cache[entry][idx].data, 0 );
+}
+
+
+/***********************************************************************
+ *           server_get_inproc_sync_fd
+ *
+ * Retrieve the shared memory file holding the state of in-process
+ * synchronization objects, or -1 if the server doesn't support them.
+ */
+int server_get_inproc_sync_fd(void)
+{
+    sigset_t sigset;
+    obj_handle_t handle;
+    int fd = -1;
+
+    if (inproc_sync_fd != -2) return inproc_sync_fd;
+
+    server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+    if (inproc_sync_fd == -2)
+    {
+        SERVER_START_REQ( get_inproc_sync_shm )
+        {
+            if (!wine_server_call( req )) fd = receive_fd( &handle );
+        }
+        SERVER_END_REQ;
+        inproc_sync_fd = fd;
+    }
+    server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+    return inproc_sync_fd;
+}
+
+
+/***********************************************************************
+ *           server_get_inproc_sync
+ *
+ * Retrieve the index of the in-process synchronization state of an object.
+ * Returns STATUS_NOT_IMPLEMENTED if the object doesn't have one.
+ */
+unsigned int server_get_inproc_sync( HANDLE handle, unsigned int *index, unsigned int *access )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    union inproc_sync_cache_entry cache;
+    sigset_t sigset;
+    unsigned int ret = STATUS_SUCCESS;
+
+    if (entry >= FD_CACHE_ENTRIES) return STATUS_NOT_IMPLEMENTED;
+    if (server_get_inproc_sync_fd() == -1) return STATUS_NOT_IMPLEMENTED;
+
+    cache.data = 0;
+    if (inproc_sync_cache[entry])
+        cache.data = InterlockedCompareExchange64( &inproc_sync_cache[entry][idx].data, 0, 0 );
+
+    if (!cache.data)
+    {
+        server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+        SERVER_START_REQ( get_inproc_sync )
+        {
+            req->handle = wine_server_obj_handle( handle );
+            if (!(ret = wine_server_call( req )))
+            {
+                cache.s.index = reply->index;
+                cache.s.access = reply->access;
+            }
+            else if (ret == STATUS_OBJECT_TYPE_MISMATCH)
+            {
+                cache.s.index = ~0u;
+                cache.s.access = 0;
+            }
+        }
+        SERVER_END_REQ;
+        if (cache.data) add_inproc_sync_to_cache( handle, cache.s.index, cache.s.access );
+        server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+    }
+
+    if (!cache.data) return ret;
+    if (cache.s.index == ~0u) return STATUS_NOT_IMPLEMENTED;
+    *index = cache.s.index;
+    *access = cache.s.access;
+    return STATUS_SUCCESS;
+}
+
+
+/***********************************************************************
+ *           server_set_inproc_sync
+ *
+ * Store the in-process state index returned by the server along with a new handle.
+ */
+void server_set_inproc_sync( HANDLE handle, unsigned int index, unsigned int access )
+{
+    unsigned int entry;
+    sigset_t sigset;
+
+    handle_to_index( handle, &entry );
+    if (entry >= FD_CACHE_ENTRIES) return;
+
+    server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+    add_inproc_sync_to_cache( handle, index ? index : ~0u, access );
+    server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+}
+
+
 /***********************************************************************
  *           server_get_unix_fd
  *
@@ -1059,6 +1394,35 @@ done:
 }
 
 
+/***********************************************************************
+ *           server_refresh_unix_fd
+ *
+ * Drop the cached unix fd of an object whose fd can be replaced by the server,
+ * such as a named pipe end connected to a new client. The passed unix_fd is
+ * closed; returns TRUE if the server now uses a different file.
+ */
+BOOL server_refresh_unix_fd( HANDLE handle, int unix_fd, int needs_close )
+{
+    struct stat st, new_st;
+    int fd, ret;
+    sigset_t sigset;
+
+    ret = fstat( unix_fd, &st );
+    if (needs_close) close( unix_fd );
+    if (ret == -1) return FALSE;
+
+    server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+    fd = remove_fd_from_cache( handle );
+    server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+    if (fd != -1) close( fd );
+
+    if (server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, NULL )) return FALSE;
+    ret = !fstat( fd, &new_st ) && (new_st.st_dev != st.st_dev || new_st.st_ino != st.st_ino);
+    if (needs_close) close( fd );
+    return ret;
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle
  */
@@ -1158,6 +1522,20 @@ static const char *init_server_dir( dev_t dev, ino_t ino )
 }
 
 
+/***********************************************************************
+ *           get_server_dir
+ *
+ * Get the server directory of the prefix, which isn't set up in processes started by another one.
+ */
+const char *get_server_dir(void)
+{
+    struct stat st;
+
+    if (!server_dir && !stat( config_dir, &st )) server_dir = init_server_dir( st.st_dev, st.st_ino );
+    return server_dir;
+}
+
+
 /***********************************************************************
  *           setup_config_dir
  *
@@ -1423,6 +1801,37 @@ static int init_thread_pipe(void)
 }
 
 
+/***********************************************************************
+ *           init_request_shm
+ *
+ * Map the shared memory used to pass request data for the current thread.
+ */
+static void init_request_shm(void)
+{
+#ifdef __linux__
+    obj_handle_t handle;
+    sigset_t sigset;
+    void *ptr;
+    int fd = -1;
+
+    server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
+    SERVER_START_REQ( get_request_shm )
+    {
+        if (!wine_server_call( req )) fd = receive_fd( &handle );
+    }
+    SERVER_END_REQ;
+    server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
+
+    if (fd == -1) return;
+    /* the server now expects the data in shared memory, we can't fall back to the pipe */
+    ptr = mmap( NULL, REQUEST_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if (ptr == MAP_FAILED) server_protocol_perror( "mmap" );
+    close( fd );
+    ntdll_get_thread_data()->request_shm = ptr;
+#endif
+}
+
+
 /***********************************************************************
  *           process_exit_wrapper
  *
@@ -1556,6 +1965,7 @@ size_t server_init_process(void)
     }
 
     set_thread_id( NtCurrentTeb(), pid, tid );
+    init_request_shm();
 
     for (i = 0; i < supported_machines_count; i++)
         if (supported_machines[i] == current_machine) return info_size;
@@ -1640,6 +2050,7 @@ void server_init_thread( void *entry_point, BOOL *suspend )
     }
     SERVER_END_REQ;
     close( reply_pipe );
+    init_request_shm();
 }
 
 
@@ -1693,12 +2104,18 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source, HANDLE
         return result.dup_handle.status;
     }
 
+    if (options & DUPLICATE_CLOSE_SOURCE) sock_close_handle( source );
+
     server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
 
     /* always remove the cached fd; if the server request fails we'll just
      * retrieve it again */
     if (options & DUPLICATE_CLOSE_SOURCE)
+    {
         fd = remove_fd_from_cache( source );
+        remove_inproc_sync_from_cache( source );
+        remove_completion_handle( source );
+    }
 
     SERVER_START_REQ( dup_handle )
     {
@@ -1732,11 +2149,15 @@ NTSTATUS WINAPI NtClose( HANDLE handle )
     NTSTATUS ret;
     int fd;
 
+    sock_close_handle( handle );
+
     server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
 
     /* always remove the cached fd; if the server request fails we'll just
      * retrieve it again */
     fd = remove_fd_from_cache( handle );
+    remove_inproc_sync_from_cache( handle );
+    remove_completion_handle( handle );
 
     SERVER_START_REQ( close_handle )
     {
@@ -39,6 +39,9 @@
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 #ifdef HAVE_NETINET_IN_H
 # define __APPLE_USE_RFC_3542
 # include <netinet/in.h>
@@ -511,6 +514,447 @@ error:
 }
 #endif /* HAVE_STRUCT_MSGHDR_MSG_ACCRIGHTS */
 
+#ifdef HAVE_SYS_EPOLL_H
+
+/* Pending overlapped I/O on stream sockets is completed by a per-process epoll
+ * reactor: an internal thread waits for the sockets to become ready, retries the
+ * I/O through the async callbacks and signals the completion itself, so that the
+ * server neither polls the socket nor has to deliver the result. This is only done
+ * as long as the server doesn't need to see the I/O to track the socket state, that
+ * is until WSAEventSelect, WSAAsyncSelect or shutdown() is used on the socket. */
+
+struct reactor_op
+{
+    struct list          entry;
+    struct async_fileio *async;     /* async recv or send */
+    HANDLE               handle;
+    HANDLE               event;     /* duplicated event handle */
+    PIO_APC_ROUTINE      apc;
+    void                *apc_user;
+    HANDLE               thread;    /* thread to queue the APC to */
+    DWORD                tid;       /* thread that started the I/O, for NtCancelIoFile */
+    client_ptr_t         iosb;
+    NTSTATUS             status;
+    ULONG_PTR            info;
+};
+
+struct reactor_sock
+{
+    struct list  entry;             /* entry in the hash table */
+    HANDLE       handle;
+    unsigned int serial;            /* identifies the socket in epoll events */
+    int          fd;                /* unix fd registered with epoll, or -1 */
+    BOOL         server;            /* the I/O has to go through the server */
+    unsigned int completing;        /* number of reactor thread passes signaling completions */
+    struct list  read_q;
+    struct list  write_q;
+};
+
+#define REACTOR_HASH_SIZE 256
+
+static pthread_mutex_t reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reactor_cond = PTHREAD_COND_INITIALIZER;  /* signaled when completions are done */
+static struct list reactor_socks[REACTOR_HASH_SIZE];
+static LONG reactor_sock_count;
+static unsigned int reactor_serial;
+static int reactor_epoll = -1;
+static int reactor_state;  /* 0: not started, 1: running, -1: unavailable */
+
+static struct list *reactor_bucket( HANDLE handle )
+{
+    struct list *bucket = &reactor_socks[(wine_server_obj_handle( handle ) >> 2) % REACTOR_HASH_SIZE];
+
+    if (!bucket->next) list_init( bucket );
+    return bucket;
+}
+
+/* find the reactor state of a socket, called with reactor_mutex held */
+static struct reactor_sock *find_reactor_sock( HANDLE handle )
+{
+    struct reactor_sock *sock;
+
+    LIST_FOR_EACH_ENTRY( sock, reactor_bucket( handle ), struct reactor_sock, entry )
+        if (sock->handle == handle) return sock;
+    return NULL;
+}
+
+/* find or create the reactor state of a socket, called with reactor_mutex held */
+static struct reactor_sock *get_reactor_sock( HANDLE handle )
+{
+    struct reactor_sock *sock;
+    unsigned int options;
+    int fd, needs_close, type;
+    socklen_t len = sizeof(type);
+
+    if ((sock = find_reactor_sock( handle ))) return sock;
+
+    if (server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, &options )) return NULL;
+    if (!(sock = malloc( sizeof(*sock) )))
+    {
+        if (needs_close) close( fd );
+        return NULL;
+    }
+    sock->handle = handle;
+    sock->serial = ++reactor_serial;
+    sock->fd     = -1;
+    sock->completing = 0;
+    /* I/O on synchronous handles has to wait in the server, and datagram sockets
+     * are implicitly bound by the server on send */
+    sock->server = (options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)) ||
+                   getsockopt( fd, SOL_SOCKET, SO_TYPE, &type, &len ) || type != SOCK_STREAM;
+    list_init( &sock->read_q );
+    list_init( &sock->write_q );
+    list_add_head( reactor_bucket( handle ), &sock->entry );
+    InterlockedIncrement( &reactor_sock_count );
+    if (needs_close) close( fd );
+    return sock;
+}
+
+/* register a socket with epoll, called with reactor_mutex held */
+static BOOL reactor_register( struct reactor_sock *sock )
+{
+    struct epoll_event ev;
+    int fd, needs_close;
+
+    if (sock->fd != -1) return TRUE;
+    if (server_get_unix_fd( sock->handle, 0, &fd, &needs_close, NULL, NULL )) return FALSE;
+    /* keep our own fd, the cached one may be closed at any time */
+    if (!needs_close) fd = dup( fd );
+    if (fd == -1) return FALSE;
+
+    ev.events = EPOLLONESHOT;
+    ev.data.u64 = ((ULONG64)sock->serial << 32) | wine_server_obj_handle( sock->handle );
+    if (epoll_ctl( reactor_epoll, EPOLL_CTL_ADD, fd, &ev ) == -1)
+    {
+        WARN( "failed to add socket %p to epoll: %s\n", sock->handle, strerror( errno ));
+        close( fd );
+        sock->server = TRUE;
+        return FALSE;
+    }
+    sock->fd = fd;
+    return TRUE;
+}
+
+/* wait for the socket to be ready for the queued I/O, called with reactor_mutex held */
+static void reactor_arm( struct reactor_sock *sock )
+{
+    struct epoll_event ev;
+
+    ev.events = 0;
+    if (!list_empty( &sock->read_q )) ev.events |= EPOLLIN;
+    if (!list_empty( &sock->write_q )) ev.events |= EPOLLOUT;
+    if (!ev.events) return;
+    ev.events |= EPOLLONESHOT;
+    ev.data.u64 = ((ULONG64)sock->serial << 32) | wine_server_obj_handle( sock->handle );
+    epoll_ctl( reactor_epoll, EPOLL_CTL_MOD, sock->fd, &ev );
+}
+
+/* signal the completion of an I/O */
+static void reactor_notify( HANDLE handle, HANDLE thread, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
+                            client_ptr_t iosb, NTSTATUS status, ULONG_PTR info, BOOL async )
+{
+    set_async_iosb( iosb, status, info );
+    if (event) NtSetEvent( event, NULL );
+    if (apc) NtQueueApcThread( thread, (PNTAPCFUNC)apc, (ULONG_PTR)apc_user, iosb, 0 );
+    else if (apc_user) add_completion( handle, (ULONG_PTR)apc_user, status, info, async );
+}
+
+static void reactor_complete( struct list *ops )
+{
+    struct reactor_op *op, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( op, next, ops, struct reactor_op, entry )
+    {
+        TRACE( "socket %p iosb %s status %#x info %#lx\n", op->handle,
+               wine_dbgstr_longlong( op->iosb ), op->status, op->info );
+        reactor_notify( op->handle, op->thread, op->event, op->apc, op->apc_user,
+                        op->iosb, op->status, op->info, TRUE );
+        if (op->event) NtClose( op->event );
+        if (op->thread) NtClose( op->thread );
+        list_remove( &op->entry );
+        free( op );
+    }
+}
+
+/* retry the queued I/O in order, called with reactor_mutex held */
+static void reactor_retry( struct list *queue, struct list *done )
+{
+    struct reactor_op *op;
+    struct list *ptr;
+
+    while ((ptr = list_head( queue )))
+    {
+        op = LIST_ENTRY( ptr, struct reactor_op, entry );
+        op->status = STATUS_ALERTED;
+        op->info = 0;
+        if (!op->async->callback( op->async, &op->info, &op->status )) break;
+        list_remove( &op->entry );
+        list_add_tail( done, &op->entry );
+    }
+}
+
+/* cancel the matching queued I/O, called with reactor_mutex held */
+static ULONG reactor_cancel( struct list *queue, struct list *done, client_ptr_t iosb, DWORD tid )
+{
+    struct reactor_op *op, *next;
+    ULONG count = 0;
+
+    LIST_FOR_EACH_ENTRY_SAFE( op, next, queue, struct reactor_op, entry )
+    {
+        if (iosb && op->iosb != iosb) continue;
+        if (tid && op->tid != tid) continue;
+        op->status = STATUS_CANCELLED;
+        op->info = 0;
+        op->async->callback( op->async, &op->info, &op->status );
+        list_remove( &op->entry );
+        list_add_tail( done, &op->entry );
+        count++;
+    }
+    return count;
+}
+
+static void reactor_thread( void *arg )
+{
+    struct epoll_event events[64];
+    struct reactor_sock *sock;
+    sigset_t sigset;
+    int i, count;
+
+    for (;;)
+    {
+        if ((count = epoll_wait( reactor_epoll, events, ARRAY_SIZE(events), -1 )) == -1)
+        {
+            if (errno != EINTR) ERR( "epoll_wait failed: %s\n", strerror( errno ));
+            continue;
+        }
+        for (i = 0; i < count; i++)
+        {
+            HANDLE handle = wine_server_ptr_handle( (obj_handle_t)events[i].data.u64 );
+            unsigned int serial = events[i].data.u64 >> 32;
+            struct list done = LIST_INIT( done );
+
+            server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+            if ((sock = find_reactor_sock( handle )) && sock->serial == serial)
+            {
+                reactor_retry( &sock->read_q, &done );
+                reactor_retry( &sock->write_q, &done );
+                reactor_arm( sock );
+                if (list_empty( &done )) sock = NULL;
+                else sock->completing++;
+            }
+            else sock = NULL;
+            server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+            if (!sock) continue;
+
+            /* the completions are posted to the socket handle, so closing it waits for us */
+            reactor_complete( &done );
+            server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+            if (!--sock->completing) pthread_cond_broadcast( &reactor_cond );
+            server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+        }
+    }
+}
+
+static BOOL reactor_start(void)
+{
+    const char *env;
+    sigset_t sigset;
+
+    if (reactor_state) return reactor_state == 1;
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    if (!reactor_state)
+    {
+        reactor_state = -1;
+        if ((!(env = getenv( "WINESOCKETREACTOR" )) || atoi( env )) &&
+            (reactor_epoll = epoll_create1( EPOLL_CLOEXEC )) != -1)
+        {
+            if (!create_system_thread( reactor_thread, NULL )) reactor_state = 1;
+            else
+            {
+                close( reactor_epoll );
+                reactor_epoll = -1;
+            }
+        }
+    }
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+    return reactor_state == 1;
+}
+
+/***********************************************************************
+ *           reactor_submit
+ *
+ * Start an overlapped I/O on a socket, queuing it to the reactor if it can't complete
+ * right away. Returns STATUS_NOT_SUPPORTED if the I/O has to go through the server.
+ */
+static NTSTATUS reactor_submit( HANDLE handle, struct async_fileio *async, HANDLE event, PIO_APC_ROUTINE apc,
+                                void *apc_user, IO_STATUS_BLOCK *io, BOOL write )
+{
+    struct reactor_sock *sock;
+    struct reactor_op *op;
+    ULONG_PTR info = 0;
+    NTSTATUS status;
+    sigset_t sigset;
+    BOOL direct = FALSE, queued = FALSE;
+
+    if (!reactor_start()) return STATUS_NOT_SUPPORTED;
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    if ((sock = get_reactor_sock( handle )) && !sock->server && reactor_register( sock ))
+    {
+        direct = TRUE;
+        queued = !list_empty( write ? &sock->write_q : &sock->read_q );
+    }
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+    if (!direct) return STATUS_NOT_SUPPORTED;
+
+    if (!queued)  /* try it right away */
+    {
+        status = STATUS_ALERTED;
+        if (async->callback( async, &info, &status ))
+        {
+            if (!NT_ERROR( status ))
+                reactor_notify( handle, GetCurrentThread(), event, apc, apc_user,
+                                iosb_client_ptr( io ), status, info, FALSE );
+            return status;
+        }
+    }
+
+    /* without an event the caller may wait on the socket handle, which is only reset by the server */
+    if (!event && !apc && !is_completion_handle( handle )) return STATUS_NOT_SUPPORTED;
+
+    if (!(op = malloc( sizeof(*op) ))) return STATUS_NOT_SUPPORTED;
+    op->async    = async;
+    op->handle   = handle;
+    op->event    = 0;
+    op->apc      = apc;
+    op->apc_user = apc_user;
+    op->thread   = 0;
+    op->tid      = GetCurrentThreadId();
+    op->iosb     = iosb_client_ptr( io );
+    /* the event may be closed by the application before the I/O completes */
+    if ((event && NtDuplicateObject( NtCurrentProcess(), event, NtCurrentProcess(),
+                                     &op->event, 0, 0, DUPLICATE_SAME_ACCESS )) ||
+        (apc && NtDuplicateObject( NtCurrentProcess(), GetCurrentThread(), NtCurrentProcess(),
+                                   &op->thread, 0, 0, DUPLICATE_SAME_ACCESS )))
+    {
+        if (op->event) NtClose( op->event );
+        free( op );
+        return STATUS_NOT_SUPPORTED;
+    }
+    if (event) NtResetEvent( event, NULL );
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    /* the socket may have been closed or detached in the meantime */
+    if ((queued = (sock = find_reactor_sock( handle )) && !sock->server))
+    {
+        list_add_tail( write ? &sock->write_q : &sock->read_q, &op->entry );
+        reactor_arm( sock );
+    }
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+
+    if (queued) return STATUS_PENDING;
+    if (op->event) NtClose( op->event );
+    if (op->thread) NtClose( op->thread );
+    free( op );
+    return STATUS_NOT_SUPPORTED;
+}
+
+/* the server needs to see all further I/O on the socket */
+static void reactor_detach( HANDLE handle )
+{
+    struct reactor_sock *sock;
+    sigset_t sigset;
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    if ((sock = get_reactor_sock( handle ))) sock->server = TRUE;
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+}
+
+/***********************************************************************
+ *           sock_close_handle
+ *
+ * Cancel the I/O queued to the reactor before a socket handle is closed, and
+ * wait for the completions that the reactor thread is posting to the handle.
+ */
+void sock_close_handle( HANDLE handle )
+{
+    struct list done = LIST_INIT( done );
+    struct reactor_sock *sock;
+    sigset_t sigset;
+
+    if (!reactor_sock_count) return;
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    if ((sock = find_reactor_sock( handle )))
+    {
+        list_remove( &sock->entry );
+        InterlockedDecrement( &reactor_sock_count );
+        /* let the reactor thread post the completions it already retrieved */
+        while (sock->completing) pthread_cond_wait( &reactor_cond, &reactor_mutex );
+        reactor_cancel( &sock->read_q, &done, 0, 0 );
+        reactor_cancel( &sock->write_q, &done, 0, 0 );
+        if (sock->fd != -1)
+        {
+            epoll_ctl( reactor_epoll, EPOLL_CTL_DEL, sock->fd, NULL );
+            close( sock->fd );
+        }
+        free( sock );
+    }
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+    reactor_complete( &done );
+}
+
+/***********************************************************************
+ *           sock_cancel_io
+ *
+ * Cancel the I/O queued to the reactor, returns the number of cancelled requests.
+ */
+ULONG sock_cancel_io( HANDLE handle, IO_STATUS_BLOCK *io, BOOL only_thread )
+{
+    struct list done = LIST_INIT( done );
+    struct reactor_sock *sock;
+    client_ptr_t iosb = io ? iosb_client_ptr( io ) : 0;
+    DWORD tid = only_thread ? GetCurrentThreadId() : 0;
+    sigset_t sigset;
+    ULONG count = 0;
+
+    if (!reactor_sock_count) return 0;
+
+    server_enter_uninterrupted_section( &reactor_mutex, &sigset );
+    if ((sock = find_reactor_sock( handle )))
+    {
+        count += reactor_cancel( &sock->read_q, &done, iosb, tid );
+        count += reactor_cancel( &sock->write_q, &done, iosb, tid );
+    }
+    server_leave_uninterrupted_section( &reactor_mutex, &sigset );
+    reactor_complete( &done );
+    return count;
+}
+
+#else  /* HAVE_SYS_EPOLL_H */
+
+static NTSTATUS reactor_submit( HANDLE handle, struct async_fileio *async, HANDLE event, PIO_APC_ROUTINE apc,
+                                void *apc_user, IO_STATUS_BLOCK *io, BOOL write )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+
+static void reactor_detach( HANDLE handle )
+{
+}
+
+void sock_close_handle( HANDLE handle )
+{
+}
+
+ULONG sock_cancel_io( HANDLE handle, IO_STATUS_BLOCK *io, BOOL only_thread )
+{
+    return 0;
+}
+
+#endif  /* HAVE_SYS_EPOLL_H */
+
 static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *size )
 {
 #ifndef HAVE_STRUCT_MSGHDR_MSG_ACCRIGHTS
@@ -642,6 +1086,10 @@ static NTSTATUS sock_recv( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
     async->addr_len = addr_len;
     async->ret_flags = ret_flags;
 
+    if (force_async && !(unix_flags & MSG_OOB) &&
+        (status = reactor_submit( handle, &async->io, event, apc, apc_user, io, FALSE )) != STATUS_NOT_SUPPORTED)
+        return status;
+
     status = try_recv( fd, async, &information );
 
     if (status != STATUS_SUCCESS && status != STATUS_BUFFER_OVERFLOW && status != STATUS_DEVICE_NOT_READY)
@@ -940,6 +1388,10 @@ static NTSTATUS sock_send( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
     async->iov_cursor = 0;
     async->sent_len = 0;
 
+    if (force_async &&
+        (status = reactor_submit( handle, &async->io, event, apc, apc_user, io, TRUE )) != STATUS_NOT_SUPPORTED)
+        return status;
+
     status = try_send( fd, async );
 
     if (status != STATUS_SUCCESS && status != STATUS_DEVICE_NOT_READY)
@@ -1253,10 +1705,18 @@ NTSTATUS sock_ioctl( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc
             TRACE( "event %p, mask %#x\n", params->event, params->mask );
             if (out_size) FIXME( "unexpected output size %u\n", out_size );
 
+            /* the server needs to see the I/O to report the events */
+            reactor_detach( handle );
             status = STATUS_BAD_DEVICE_TYPE;
             break;
         }
 
+        case IOCTL_AFD_WINE_MESSAGE_SELECT:
+        case IOCTL_AFD_WINE_SHUTDOWN:
+            reactor_detach( handle );
+            status = STATUS_BAD_DEVICE_TYPE;
+            break;
+
         case IOCTL_AFD_GET_EVENTS:
             if (in_size) FIXME( "unexpected input size %u\n", in_size );
 
@@ -35,6 +35,9 @@
 #ifdef HAVE_SYS_SYSCALL_H
 #include <sys/syscall.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
@@ -183,6 +186,425 @@ static void timespec_from_timeout( struct timespec *timespec, const LARGE_INTEGE
 #endif
 
 
+#ifdef __linux__
+
+/* In-process synchronization: the state of events, semaphores and mutexes
+ * lives in memory shared with the server, so that uncontended operations
+ * and waits that can be satisfied or blocked on with futexes don't need a
+ * server round trip. Alertable waits, wait-all on several objects and waits
+ * involving other object types still go through the server. */
+
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+#define FUTEX2_SIZE_U32 0x02
+
+struct inproc_futex_waitv
+{
+    ULONG64 val;
+    ULONG64 uaddr;
+    ULONG   flags;
+    ULONG   reserved;
+};
+
+#define INPROC_SYNC_SLOTS_PER_BLOCK (INPROC_SYNC_BLOCK_SIZE / sizeof(struct inproc_sync))
+#define INPROC_SYNC_MAX_BLOCKS      1024
+
+static struct inproc_sync *inproc_sync_blocks[INPROC_SYNC_MAX_BLOCKS];
+
+/* futexes in the shared memory can't use the private flag */
+static inline int futex_wake_shared( int *addr, int val )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAKE, val, NULL, 0, 0 );
+}
+
+static inline int futex_wait_shared( int *addr, int val, const struct timespec *end )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAIT_BITSET, val, end, 0, ~0 );
+}
+
+static inline int futex_waitv( const struct inproc_futex_waitv *futexes, unsigned int count,
+                               const struct timespec *end )
+{
+    return syscall( __NR_futex_waitv, futexes, count, 0, end, CLOCK_MONOTONIC );
+}
+
+static BOOL have_futex_waitv(void)
+{
+    static int supported = -1;
+
+    if (supported == -1)
+    {
+        futex_waitv( NULL, 0, NULL );
+        supported = (errno != ENOSYS);
+    }
+    return supported;
+}
+
+static struct inproc_sync *get_inproc_sync_ptr( unsigned int index )
+{
+    unsigned int block = index / INPROC_SYNC_SLOTS_PER_BLOCK;
+    void *ptr;
+
+    if (block >= INPROC_SYNC_MAX_BLOCKS) return NULL;
+    if (!inproc_sync_blocks[block])
+    {
+        ptr = mmap( NULL, INPROC_SYNC_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    server_get_inproc_sync_fd(), (off_t)block * INPROC_SYNC_BLOCK_SIZE );
+        if (ptr == MAP_FAILED) return NULL;
+        if (InterlockedCompareExchangePointer( (void **)&inproc_sync_blocks[block], ptr, NULL ))
+            munmap( ptr, INPROC_SYNC_BLOCK_SIZE );
+    }
+    return &inproc_sync_blocks[block][index % INPROC_SYNC_SLOTS_PER_BLOCK];
+}
+
+static NTSTATUS get_inproc_sync( HANDLE handle, enum inproc_sync_type type, ACCESS_MASK desired_access,
+                                 struct inproc_sync **sync )
+{
+    unsigned int index, access;
+    NTSTATUS ret;
+
+    if ((ret = server_get_inproc_sync( handle, &index, &access ))) return ret;
+    if (!(*sync = get_inproc_sync_ptr( index ))) return STATUS_NOT_IMPLEMENTED;
+    if (type && (*sync)->type != type) return STATUS_OBJECT_TYPE_MISMATCH;
+    if ((access & desired_access) != desired_access) return STATUS_ACCESS_DENIED;
+    return STATUS_SUCCESS;
+}
+
+/* let the server wake up its own waiters, if any, after a state change */
+static void wake_inproc_sync_server_waiters( HANDLE handle, struct inproc_sync *sync )
+{
+    if (!InterlockedCompareExchange( &sync->waiters, 0, 0 )) return;
+
+    SERVER_START_REQ( wake_inproc_sync )
+    {
+        req->handle = wine_server_obj_handle( handle );
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+}
+
+static inline int get_inproc_sync_tid(void)
+{
+    return HandleToULong( NtCurrentTeb()->ClientId.UniqueThread );
+}
+
+static NTSTATUS inproc_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+    ULONG cur;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_SEMAPHORE, SEMAPHORE_MODIFY_STATE, &sync ))) return ret;
+
+    do
+    {
+        cur = sync->state;
+        if (count > sync->max - cur) return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+    } while (InterlockedCompareExchange( &sync->state, cur + count, cur ) != cur);
+
+    if (previous) *previous = cur;
+    if (!cur)
+    {
+        futex_wake_shared( &sync->state, INT_MAX );
+        wake_inproc_sync_server_waiters( handle, sync );
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_query_semaphore( HANDLE handle, SEMAPHORE_BASIC_INFORMATION *info )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_SEMAPHORE, SEMAPHORE_QUERY_STATE, &sync ))) return ret;
+
+    info->CurrentCount = InterlockedCompareExchange( &sync->state, 0, 0 );
+    info->MaximumCount = sync->max;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_set_event( HANDLE handle, LONG *prev_state )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+    LONG prev;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_EVENT, EVENT_MODIFY_STATE, &sync ))) return ret;
+
+    if (!(prev = InterlockedExchange( &sync->state, 1 )))
+    {
+        futex_wake_shared( &sync->state, INT_MAX );
+        wake_inproc_sync_server_waiters( handle, sync );
+    }
+    if (prev_state) *prev_state = prev;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_reset_event( HANDLE handle, LONG *prev_state )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+    LONG prev;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_EVENT, EVENT_MODIFY_STATE, &sync ))) return ret;
+
+    prev = InterlockedExchange( &sync->state, 0 );
+    if (prev_state) *prev_state = prev;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_query_event( HANDLE handle, EVENT_BASIC_INFORMATION *info )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_EVENT, EVENT_QUERY_STATE, &sync ))) return ret;
+
+    info->EventType  = sync->max ? NotificationEvent : SynchronizationEvent;
+    info->EventState = InterlockedCompareExchange( &sync->state, 0, 0 );
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+    unsigned int count;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_MUTEX, 0, &sync ))) return ret;
+
+    /* only the owner modifies the recursion count */
+    if (InterlockedCompareExchange( &sync->state, 0, 0 ) != get_inproc_sync_tid())
+        return STATUS_MUTANT_NOT_OWNED;
+
+    count = sync->count;
+    if (!--sync->count)
+    {
+        InterlockedExchange( &sync->state, 0 );
+        futex_wake_shared( &sync->state, INT_MAX );
+        wake_inproc_sync_server_waiters( handle, sync );
+    }
+    if (prev_count) *prev_count = 1 - count;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS inproc_query_mutex( HANDLE handle, MUTANT_BASIC_INFORMATION *info )
+{
+    struct inproc_sync *sync;
+    NTSTATUS ret;
+
+    if ((ret = get_inproc_sync( handle, INPROC_SYNC_MUTEX, MUTANT_QUERY_STATE, &sync ))) return ret;
+
+    info->OwnedByCaller  = (InterlockedCompareExchange( &sync->state, 0, 0 ) == get_inproc_sync_tid());
+    info->CurrentCount   = 1 - sync->count;
+    info->AbandonedState = sync->abandoned;
+    return STATUS_SUCCESS;
+}
+
+/* grab an unowned mutex; the server finds the mutexes owned by a thread from
+ * the owner id in the shared state, so it doesn't need to be told */
+static int inproc_grab_mutex( struct inproc_sync *sync, int tid, BOOL *abandoned )
+{
+    int cur;
+
+    if (!(cur = InterlockedCompareExchange( &sync->state, tid, 0 )))
+    {
+        sync->count = 1;
+        *abandoned = InterlockedExchange( &sync->abandoned, 0 );
+    }
+    return cur;
+}
+
+/* try to grab an object; on failure, return the futex value to wait for */
+static BOOL inproc_try_grab( struct inproc_sync *sync, int tid, int *value, BOOL *abandoned )
+{
+    int cur;
+
+    *abandoned = FALSE;
+    switch (sync->type)
+    {
+    case INPROC_SYNC_EVENT:
+        if (sync->max) *value = InterlockedCompareExchange( &sync->state, 0, 0 );
+        else *value = InterlockedCompareExchange( &sync->state, 0, 1 );
+        return *value != 0;
+
+    case INPROC_SYNC_SEMAPHORE:
+        while ((cur = InterlockedCompareExchange( &sync->state, 0, 0 )))
+            if (InterlockedCompareExchange( &sync->state, cur - 1, cur ) == cur) return TRUE;
+        *value = 0;
+        return FALSE;
+
+    case INPROC_SYNC_MUTEX:
+        if (!(cur = InterlockedCompareExchange( &sync->state, 0, 0 )) &&
+            !(cur = inproc_grab_mutex( sync, tid, abandoned )))
+            return TRUE;
+        if (cur == tid)
+        {
+            sync->count++;
+            return TRUE;
+        }
+        *value = cur;
+        return FALSE;
+    }
+    *value = 0;
+    return FALSE;
+}
+
+/* check if an event was pulsed since the last call, and take the pulse if it's still available */
+static BOOL inproc_take_pulse( struct inproc_sync *sync, int *serial )
+{
+    int cur;
+
+    if (sync->type != INPROC_SYNC_EVENT) return FALSE;
+    if ((cur = InterlockedCompareExchange( (LONG *)&sync->count, 0, 0 )) == *serial) return FALSE;
+    *serial = cur;
+    return sync->max || InterlockedCompareExchange( &sync->abandoned, 0, 1 );
+}
+
+static void get_inproc_timeout_end( const LARGE_INTEGER *timeout, struct timespec *end )
+{
+    LARGE_INTEGER now;
+    timeout_t diff;
+
+    if (timeout->QuadPart > 0)
+    {
+        NtQuerySystemTime( &now );
+        diff = max( timeout->QuadPart - now.QuadPart, 0 );
+    }
+    else diff = -timeout->QuadPart;
+
+    clock_gettime( CLOCK_MONOTONIC, end );
+    end->tv_sec += diff / TICKSPERSEC;
+    end->tv_nsec += (diff % TICKSPERSEC) * 100;
+    if (end->tv_nsec >= 1000000000)
+    {
+        end->tv_sec++;
+        end->tv_nsec -= 1000000000;
+    }
+}
+
+static NTSTATUS inproc_wait( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                             BOOLEAN alertable, const LARGE_INTEGER *timeout )
+{
+    struct inproc_sync *syncs[MAXIMUM_WAIT_OBJECTS];
+    struct inproc_futex_waitv futexes[MAXIMUM_WAIT_OBJECTS];
+    int values[MAXIMUM_WAIT_OBJECTS];
+    int serials[MAXIMUM_WAIT_OBJECTS];
+    int tid = get_inproc_sync_tid();
+    struct timespec end;
+    BOOL abandoned;
+    DWORD i;
+
+    if (alertable || (!wait_any && count > 1)) return STATUS_NOT_IMPLEMENTED;
+    if (count > 1 && !have_futex_waitv()) return STATUS_NOT_IMPLEMENTED;
+
+    for (i = 0; i < count; i++)
+    {
+        if (get_inproc_sync( handles[i], 0, SYNCHRONIZE, &syncs[i] )) return STATUS_NOT_IMPLEMENTED;
+        if (syncs[i]->type == INPROC_SYNC_KEY) return STATUS_NOT_IMPLEMENTED;
+        serials[i] = InterlockedCompareExchange( (LONG *)&syncs[i]->count, 0, 0 );
+    }
+
+    if (timeout && timeout->QuadPart) get_inproc_timeout_end( timeout, &end );
+
+    for (;;)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (inproc_try_grab( syncs[i], tid, &values[i], &abandoned ))
+                return (abandoned ? STATUS_ABANDONED_WAIT_0 : STATUS_WAIT_0) + i;
+            if (inproc_take_pulse( syncs[i], &serials[i] )) return STATUS_WAIT_0 + i;
+        }
+        if (timeout && !timeout->QuadPart) break;
+
+        if (count == 1)
+        {
+            if (futex_wait_shared( &syncs[0]->state, values[0], timeout ? &end : NULL ) == -1 &&
+                errno == ETIMEDOUT) break;
+            continue;
+        }
+        for (i = 0; i < count; i++)
+        {
+            futexes[i].val = values[i];
+            futexes[i].uaddr = (ULONG_PTR)&syncs[i]->state;
+            futexes[i].flags = FUTEX2_SIZE_U32;
+            futexes[i].reserved = 0;
+        }
+        if (futex_waitv( futexes, count, timeout ? &end : NULL ) == -1 && errno == ETIMEDOUT) break;
+    }
+
+    /* like server_wait(), yield when timing out */
+    NtYieldExecution();
+    return STATUS_TIMEOUT;
+}
+
+/* retrieve the modification serial of a registry key, to validate the client-side value cache */
+NTSTATUS get_inproc_key_serial( HANDLE handle, ACCESS_MASK access, unsigned int *index, int *serial )
+{
+    struct inproc_sync *sync;
+    unsigned int granted;
+    NTSTATUS ret;
+
+    if ((ret = server_get_inproc_sync( handle, index, &granted ))) return ret;
+    if (!(sync = get_inproc_sync_ptr( *index ))) return STATUS_NOT_IMPLEMENTED;
+    if (sync->type != INPROC_SYNC_KEY) return STATUS_OBJECT_TYPE_MISMATCH;
+    if ((granted & access) != access) return STATUS_ACCESS_DENIED;
+    *serial = InterlockedCompareExchange( &sync->state, 0, 0 );
+    return STATUS_SUCCESS;
+}
+
+#else  /* __linux__ */
+
+NTSTATUS get_inproc_key_serial( HANDLE handle, ACCESS_MASK access, unsigned int *index, int *serial )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_query_semaphore( HANDLE handle, SEMAPHORE_BASIC_INFORMATION *info )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_set_event( HANDLE handle, LONG *prev_state )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_reset_event( HANDLE handle, LONG *prev_state )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_query_event( HANDLE handle, EVENT_BASIC_INFORMATION *info )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_query_mutex( HANDLE handle, MUTANT_BASIC_INFORMATION *info )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS inproc_wait( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                             BOOLEAN alertable, const LARGE_INTEGER *timeout )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+#endif  /* __linux__ */
+
+
 static BOOL compare_addr( const void *addr, const void *cmp, SIZE_T size )
 {
     switch (size)
@@ -384,6 +806,12 @@ NTSTATUS WINAPI NtQuerySemaphore( HANDLE handle, SEMAPHORE_INFORMATION_CLASS cla
 
     if (len != sizeof(SEMAPHORE_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if ((ret = inproc_query_semaphore( handle, out )) != STATUS_NOT_IMPLEMENTED)
+    {
+        if (!ret && ret_len) *ret_len = sizeof(SEMAPHORE_BASIC_INFORMATION);
+        return ret;
+    }
+
     SERVER_START_REQ( query_semaphore )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -406,6 +834,9 @@ NTSTATUS WINAPI NtReleaseSemaphore( HANDLE handle, ULONG count, ULONG *previous
 {
     NTSTATUS ret;
 
+    if ((ret = inproc_release_semaphore( handle, count, previous )) != STATUS_NOT_IMPLEMENTED)
+        return ret;
+
     SERVER_START_REQ( release_semaphore )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -482,6 +913,8 @@ NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
 
+    if ((ret = inproc_set_event( handle, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -501,6 +934,8 @@ NTSTATUS WINAPI NtResetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
 
+    if ((ret = inproc_reset_event( handle, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -562,6 +997,12 @@ NTSTATUS WINAPI NtQueryEvent( HANDLE handle, EVENT_INFORMATION_CLASS class,
 
     if (len != sizeof(EVENT_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if ((ret = inproc_query_event( handle, out )) != STATUS_NOT_IMPLEMENTED)
+    {
+        if (!ret && ret_len) *ret_len = sizeof(EVENT_BASIC_INFORMATION);
+        return ret;
+    }
+
     SERVER_START_REQ( query_event )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -637,6 +1078,8 @@ NTSTATUS WINAPI NtReleaseMutant( HANDLE handle, LONG *prev_count )
 {
     NTSTATUS ret;
 
+    if ((ret = inproc_release_mutex( handle, prev_count )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( release_mutex )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -667,6 +1110,12 @@ NTSTATUS WINAPI NtQueryMutant( HANDLE handle, MUTANT_INFORMATION_CLASS class,
 
     if (len != sizeof(MUTANT_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if ((ret = inproc_query_mutex( handle, out )) != STATUS_NOT_IMPLEMENTED)
+    {
+        if (!ret && ret_len) *ret_len = sizeof(MUTANT_BASIC_INFORMATION);
+        return ret;
+    }
+
     SERVER_START_REQ( query_mutex )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -1462,9 +1911,13 @@ NTSTATUS WINAPI NtWaitForMultipleObjects( DWORD count, const HANDLE *handles, BO
 {
     select_op_t select_op;
     UINT i, flags = SELECT_INTERRUPTIBLE;
+    NTSTATUS ret;
 
     if (!count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_INVALID_PARAMETER_1;
 
+    if ((ret = inproc_wait( count, handles, wait_any, alertable, timeout )) != STATUS_NOT_IMPLEMENTED)
+        return ret;
+
     if (alertable) flags |= SELECT_ALERTABLE;
     select_op.wait.op = wait_any ? SELECT_WAIT : SELECT_WAIT_ALL;
     for (i = 0; i < count; i++) select_op.wait.handles[i] = wine_server_obj_handle( handles[i] );
@@ -1062,6 +1062,8 @@ static void pthread_exit_wrapper( int status )
     close( ntdll_get_thread_data()->wait_fd[1] );
     close( ntdll_get_thread_data()->reply_fd );
     close( ntdll_get_thread_data()->request_fd );
+    if (ntdll_get_thread_data()->request_shm)
+        munmap( ntdll_get_thread_data()->request_shm, REQUEST_SHM_SIZE );
     pthread_exit( UIntToPtr(status) );
 }
 
@@ -1373,6 +1375,103 @@ done:
 }
 
 
+/***********************************************************************
+ *           start_system_thread
+ *
+ * Startup routine for an internal thread.
+ */
+static void start_system_thread( TEB *teb )
+{
+    struct ntdll_thread_data *thread_data = (struct ntdll_thread_data *)&teb->GdiTebBatch;
+    void (*func)(void *) = (void (*)(void *))thread_data->start;
+    BOOL suspend;
+
+    thread_data->pthread_id = pthread_self();
+    signal_init_thread( teb );
+    server_init_thread( func, &suspend );
+    func( thread_data->param );
+}
+
+
+/***********************************************************************
+ *           create_system_thread
+ *
+ * Create an internal thread that only runs Unix code. The function must never return;
+ * the thread isn't counted for process termination, so it goes away with the process.
+ */
+NTSTATUS create_system_thread( void (*func)(void *), void *param )
+{
+    sigset_t sigset;
+    pthread_t pthread_id;
+    pthread_attr_t pthread_attr;
+    struct ntdll_thread_data *thread_data;
+    HANDLE handle = 0;
+    DWORD tid = 0;
+    int request_pipe[2];
+    TEB *teb;
+    NTSTATUS status;
+
+    if (server_pipe( request_pipe ) == -1) return STATUS_TOO_MANY_OPENED_FILES;
+    wine_server_send_fd( request_pipe[0] );
+
+    SERVER_START_REQ( new_thread )
+    {
+        req->process    = wine_server_obj_handle( NtCurrentProcess() );
+        req->access     = THREAD_ALL_ACCESS;
+        req->suspend    = 0;
+        req->request_fd = request_pipe[0];
+        if (!(status = wine_server_call( req )))
+        {
+            handle = wine_server_ptr_handle( reply->handle );
+            tid = reply->tid;
+        }
+        close( request_pipe[0] );
+    }
+    SERVER_END_REQ;
+
+    if (status)
+    {
+        close( request_pipe[1] );
+        return status;
+    }
+
+    pthread_sigmask( SIG_BLOCK, &server_block_set, &sigset );
+
+    if ((status = virtual_alloc_teb( &teb ))) goto done;
+
+    if ((status = init_thread_stack( teb, 0, 0, 0 )))
+    {
+        virtual_free_teb( teb );
+        goto done;
+    }
+
+    set_thread_id( teb, GetCurrentProcessId(), tid );
+
+    thread_data = (struct ntdll_thread_data *)&teb->GdiTebBatch;
+    thread_data->request_fd = request_pipe[1];
+    thread_data->start = (PRTL_THREAD_START_ROUTINE)func;
+    thread_data->param = param;
+
+    pthread_attr_init( &pthread_attr );
+    pthread_attr_setstack( &pthread_attr, teb->DeallocationStack,
+                           (char *)thread_data->kernel_stack + kernel_stack_size - (char *)teb->DeallocationStack );
+    pthread_attr_setguardsize( &pthread_attr, 0 );
+    pthread_attr_setscope( &pthread_attr, PTHREAD_SCOPE_SYSTEM ); /* force creating a kernel thread */
+    if (pthread_create( &pthread_id, &pthread_attr, (void * (*)(void *))start_system_thread, teb ))
+    {
+        virtual_free_teb( teb );
+        status = STATUS_NO_MEMORY;
+    }
+    pthread_attr_destroy( &pthread_attr );
+
+done:
+    pthread_sigmask( SIG_SETMASK, &sigset, NULL );
+    NtClose( handle );
+    if (status) close( request_pipe[1] );
+    return status;
+}
+
+
 /***********************************************************************
  *           abort_thread
  */
@@ -61,6 +61,7 @@ struct ntdll_thread_data
     PRTL_THREAD_START_ROUTINE start;  /* thread entry point */
     void              *param;         /* thread entry point parameter */
     void              *jmp_buf;       /* setjmp buffer for exception handling */
+    void              *request_shm;   /* shared memory for server request data */
 };
 
 C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) );
@@ -159,6 +160,9 @@ extern void *create_startup_info( const UNICODE_STRING *nt_image, const RTL_USER
                                   DWORD *info_size ) DECLSPEC_HIDDEN;
 extern char **build_envp( const WCHAR *envW ) DECLSPEC_HIDDEN;
 extern NTSTATUS exec_wineloader( char **argv, int socketfd, const pe_image_info_t *pe_info ) DECLSPEC_HIDDEN;
+extern NTSTATUS zygote_spawn( char **argv, int socketfd, int unixdir, int stdin_fd, int stdout_fd,
+                              BOOL new_session, const char *winedebug,
+                              const pe_image_info_t *pe_info ) DECLSPEC_HIDDEN;
 extern NTSTATUS load_builtin( const pe_image_info_t *image_info, WCHAR *filename,
                               void **addr_ptr, SIZE_T *size_ptr ) DECLSPEC_HIDDEN;
 extern BOOL is_builtin_path( const UNICODE_STRING *path, WORD *machine ) DECLSPEC_HIDDEN;
@@ -177,10 +181,21 @@ extern unsigned int server_wait( const select_op_t *select_op, data_size_t size,
                                  const LARGE_INTEGER *timeout ) DECLSPEC_HIDDEN;
 extern unsigned int server_queue_process_apc( HANDLE process, const apc_call_t *call,
                                               apc_result_t *result ) DECLSPEC_HIDDEN;
+extern int server_get_inproc_sync_fd(void) DECLSPEC_HIDDEN;
+extern unsigned int server_get_inproc_sync( HANDLE handle, unsigned int *index,
+                                            unsigned int *access ) DECLSPEC_HIDDEN;
+extern void server_set_inproc_sync( HANDLE handle, unsigned int index, unsigned int access ) DECLSPEC_HIDDEN;
+#define COMPLETION_HANDLE_PORT             0x01  /* associated with a completion port */
+#define COMPLETION_HANDLE_SKIP_ON_SUCCESS  0x02  /* FILE_SKIP_COMPLETION_PORT_ON_SUCCESS is set */
+extern void set_completion_handle( HANDLE handle, BYTE flags ) DECLSPEC_HIDDEN;
+extern BOOL is_completion_handle( HANDLE handle ) DECLSPEC_HIDDEN;
+extern BOOL is_completion_skipped_on_success( HANDLE handle ) DECLSPEC_HIDDEN;
 extern int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
                                int *needs_close, enum server_fd_type *type, unsigned int *options ) DECLSPEC_HIDDEN;
+extern BOOL server_refresh_unix_fd( HANDLE handle, int unix_fd, int needs_close ) DECLSPEC_HIDDEN;
 extern void wine_server_send_fd( int fd ) DECLSPEC_HIDDEN;
 extern void process_exit_wrapper( int status ) DECLSPEC_HIDDEN;
+extern const char *get_server_dir(void) DECLSPEC_HIDDEN;
 extern size_t server_init_process(void) DECLSPEC_HIDDEN;
 extern void server_init_process_done(void) DECLSPEC_HIDDEN;
 extern void server_init_thread( void *entry_point, BOOL *suspend ) DECLSPEC_HIDDEN;
@@ -191,6 +206,7 @@ extern void fpu_to_fpux( XSAVE_FORMAT *fpux, const I386_FLOATING_SAVE_AREA *fpu
 extern void *get_cpu_area( USHORT machine ) DECLSPEC_HIDDEN;
 extern void set_thread_id( TEB *teb, DWORD pid, DWORD tid ) DECLSPEC_HIDDEN;
 extern NTSTATUS init_thread_stack( TEB *teb, ULONG_PTR zero_bits, SIZE_T reserve_size, SIZE_T commit_size ) DECLSPEC_HIDDEN;
+extern NTSTATUS create_system_thread( void (*func)(void *), void *param ) DECLSPEC_HIDDEN;
 extern void DECLSPEC_NORETURN abort_thread( int status ) DECLSPEC_HIDDEN;
 extern void DECLSPEC_NORETURN abort_process( int status ) DECLSPEC_HIDDEN;
 extern void DECLSPEC_NORETURN exit_process( int status ) DECLSPEC_HIDDEN;
@@ -200,6 +216,8 @@ extern NTSTATUS set_thread_context( HANDLE handle, const void *context, BOOL *se
 extern NTSTATUS get_thread_context( HANDLE handle, void *context, BOOL *self, USHORT machine ) DECLSPEC_HIDDEN;
 extern NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                          data_size_t *ret_len ) DECLSPEC_HIDDEN;
+extern NTSTATUS get_inproc_key_serial( HANDLE handle, ACCESS_MASK access, unsigned int *index,
+                                       int *serial ) DECLSPEC_HIDDEN;
 
 extern void *anon_mmap_fixed( void *start, size_t size, int prot, int flags ) DECLSPEC_HIDDEN;
 extern void *anon_mmap_alloc( size_t size, int prot ) DECLSPEC_HIDDEN;
@@ -267,6 +285,8 @@ extern NTSTATUS serial_DeviceIoControl( HANDLE device, HANDLE event, PIO_APC_ROU
                                         IO_STATUS_BLOCK *io, ULONG code, void *in_buffer,
                                         ULONG in_size, void *out_buffer, ULONG out_size ) DECLSPEC_HIDDEN;
 extern NTSTATUS serial_FlushBuffersFile( int fd ) DECLSPEC_HIDDEN;
+extern void sock_close_handle( HANDLE handle ) DECLSPEC_HIDDEN;
+extern ULONG sock_cancel_io( HANDLE handle, IO_STATUS_BLOCK *io, BOOL only_thread ) DECLSPEC_HIDDEN;
 extern NTSTATUS sock_ioctl( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user, IO_STATUS_BLOCK *io,
                             ULONG code, void *in_buffer, ULONG in_size, void *out_buffer, ULONG out_size ) DECLSPEC_HIDDEN;
 extern NTSTATUS tape_DeviceIoControl( HANDLE device, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
@@ -49,6 +49,12 @@
 #ifdef HAVE_VALGRIND_VALGRIND_H
 # include <valgrind/valgrind.h>
 #endif
+#ifdef HAVE_LINUX_USERFAULTFD_H
+# include <fcntl.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/userfaultfd.h>
+#endif
 #if defined(__APPLE__)
 # include <mach/mach_init.h>
 # include <mach/mach_vm.h>
@@ -113,6 +119,7 @@ struct file_view
 #define VPROT_WRITEWATCH 0x40
 /* per-mapping protection flags */
 #define VPROT_SYSTEM     0x0200  /* system view (underlying mmap not under our control) */
+#define VPROT_KERNEL_WATCH 0x0400  /* write watches tracked by the kernel instead of page faults */
 
 /* Conversion from VPROT_* to Win32 flags */
 static const BYTE VIRTUAL_Win32Flags[16] =
@@ -137,6 +144,9 @@ static const BYTE VIRTUAL_Win32Flags[16] =
 
 static struct wine_rb_tree views_tree;
 static pthread_mutex_t virtual_mutex;
+/* sequence count for lockless readers, odd while the views or pages protections are modified */
+static LONG virtual_seq;
+static unsigned int virtual_write_depth;
 
 static const UINT page_shift = 12;
 static const UINT_PTR page_mask = 0xfff;
@@ -894,6 +904,46 @@ static inline int is_view_valloc( const struct file_view *view )
     return !(view->protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT));
 }
 
+/***********************************************************************
+ *           virtual_write_begin
+ *
+ * Start a modification of the views tree or the pages protections; virtual_mutex
+ * must be held. Lockless readers retry if the sequence count is odd or has changed.
+ */
+static inline void virtual_write_begin(void)
+{
+    if (!virtual_write_depth++) InterlockedIncrement( &virtual_seq );
+}
+
+static inline void virtual_write_end(void)
+{
+    if (!--virtual_write_depth) InterlockedIncrement( &virtual_seq );
+}
+
+/***********************************************************************
+ *           virtual_read_begin
+ *
+ * Start a lockless read of the views tree and pages protections.
+ */
+static inline LONG virtual_read_begin(void)
+{
+    LONG seq = *(volatile LONG *)&virtual_seq;
+    MemoryBarrier();
+    return seq;
+}
+
+/***********************************************************************
+ *           virtual_read_end
+ *
+ * Check that nothing was modified during a lockless read.
+ */
+static inline BOOL virtual_read_end( LONG seq )
+{
+    MemoryBarrier();
+    return !(seq & 1) && *(volatile LONG *)&virtual_seq == seq;
+}
+
+
 /***********************************************************************
  *           get_page_vprot
  *
@@ -977,6 +1027,7 @@ static void set_page_vprot( const void *addr, size_t size, BYTE vprot )
     size_t idx = (size_t)addr >> page_shift;
     size_t end = ((size_t)addr + size + page_mask) >> page_shift;
 
+    virtual_write_begin();
 #ifdef _WIN64
     while (idx >> pages_vprot_shift != end >> pages_vprot_shift)
     {
@@ -988,6 +1039,7 @@ static void set_page_vprot( const void *addr, size_t size, BYTE vprot )
 #else
     memset( pages_vprot + idx, vprot, end - idx );
 #endif
+    virtual_write_end();
 }
 
 
@@ -1001,6 +1053,7 @@ static void set_page_vprot_bits( const void *addr, size_t size, BYTE set, BYTE c
     size_t idx = (size_t)addr >> page_shift;
     size_t end = ((size_t)addr + size + page_mask) >> page_shift;
 
+    virtual_write_begin();
 #ifdef _WIN64
     for ( ; idx < end; idx++)
     {
@@ -1010,6 +1063,7 @@ static void set_page_vprot_bits( const void *addr, size_t size, BYTE set, BYTE c
 #else
     for ( ; idx < end; idx++) pages_vprot[idx] = (pages_vprot[idx] & ~clear) | set;
 #endif
+    virtual_write_end();
 }
 
 
@@ -1566,12 +1620,14 @@ static struct file_view *alloc_view(void)
 static void delete_view( struct file_view *view ) /* [in] View */
 {
     if (!(view->protect & VPROT_SYSTEM)) unmap_area( view->base, view->size );
+    virtual_write_begin();
     set_page_vprot( view->base, view->size, 0 );
     if (mmap_is_in_reserved_area( view->base, view->size ))
         free_ranges_remove_view( view );
     wine_rb_remove( &views_tree, &view->entry );
     *(struct file_view **)view = next_free_view;
     next_free_view = view;
+    virtual_write_end();
 }
 
 
@@ -1610,12 +1666,14 @@ static NTSTATUS create_view( struct file_view **view_ret, void *base, size_t siz
         return STATUS_NO_MEMORY;
     }
 
+    virtual_write_begin();
     view->base    = base;
     view->size    = size;
     view->protect = vprot;
     set_page_vprot( base, size, vprot );
 
     wine_rb_put( &views_tree, view->base, &view->entry );
+    virtual_write_end();
     if (mmap_is_in_reserved_area( view->base, view->size ))
         free_ranges_insert_view( view );
 
@@ -1784,6 +1842,182 @@ static NTSTATUS set_protection( struct file_view *view, void *base, SIZE_T size,
 }
 
 
+#if defined(HAVE_LINUX_USERFAULTFD_H) && defined(__NR_userfaultfd)
+
+/* Write watches can be tracked by the kernel with asynchronous userfaultfd
+ * write-protection: writes to protected pages are resolved by the kernel
+ * without any fault delivery, and the written pages can be queried and
+ * protected again in a single PAGEMAP_SCAN call (Linux 6.7 and later). */
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+#ifndef PAGEMAP_SCAN
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#define PAGE_IS_WRITTEN       (1 << 1)
+#define PM_SCAN_WP_MATCHING   (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region
+{
+    __u64 start;
+    __u64 end;
+    __u64 categories;
+};
+
+struct pm_scan_arg
+{
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+#endif
+
+static int uffd_fd = -1;
+static int pagemap_fd = -1;
+
+/***********************************************************************
+ *           kernel_writewatch_init
+ */
+static void kernel_writewatch_init(void)
+{
+    static const __u64 features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    struct uffdio_api api;
+    const char *env = getenv( "WINEKERNELWRITEWATCH" );
+
+    if (env && !atoi( env )) return;
+    if ((uffd_fd = syscall( __NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY )) == -1) return;
+    if ((pagemap_fd = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC )) == -1) goto failed;
+
+    api.api = UFFD_API;
+    api.features = features;
+    if (ioctl( uffd_fd, UFFDIO_API, &api ) || (api.features & features) != features) goto failed;
+    TRACE( "using kernel write watches\n" );
+    return;
+
+failed:
+    if (pagemap_fd != -1) close( pagemap_fd );
+    close( uffd_fd );
+    uffd_fd = pagemap_fd = -1;
+}
+
+/***********************************************************************
+ *           kernel_writewatch_reset
+ */
+static void kernel_writewatch_reset( void *base, SIZE_T size )
+{
+    struct uffdio_writeprotect wp;
+
+    wp.range.start = (UINT_PTR)base;
+    wp.range.len   = size;
+    wp.mode        = UFFDIO_WRITEPROTECT_MODE_WP;
+    if (ioctl( uffd_fd, UFFDIO_WRITEPROTECT, &wp ))
+        ERR( "failed to reset write watches %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+}
+
+/***********************************************************************
+ *           kernel_writewatch_register
+ *
+ * Register a range for kernel write tracking; all pages start unwritten.
+ */
+static BOOL kernel_writewatch_register( void *base, SIZE_T size )
+{
+    struct uffdio_register reg;
+
+    if (uffd_fd == -1) return FALSE;
+    reg.range.start = (UINT_PTR)base;
+    reg.range.len   = size;
+    reg.mode        = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl( uffd_fd, UFFDIO_REGISTER, &reg ))
+    {
+        WARN( "failed to register %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+        return FALSE;
+    }
+    kernel_writewatch_reset( base, size );
+    return TRUE;
+}
+
+/***********************************************************************
+ *           kernel_get_write_watches
+ *
+ * Retrieve the written pages of a range, optionally protecting them again.
+ */
+static void kernel_get_write_watches( void *base, SIZE_T size, void **addresses, ULONG_PTR *count,
+                                      BOOL reset )
+{
+    struct page_region regions[64];
+    struct pm_scan_arg arg;
+    ULONG_PTR pos = 0;
+    char *addr;
+    int i, ret;
+
+    memset( &arg, 0, sizeof(arg) );
+    arg.size          = sizeof(arg);
+    arg.start         = (UINT_PTR)base;
+    arg.end           = (UINT_PTR)base + size;
+    arg.vec           = (UINT_PTR)regions;
+    arg.vec_len       = ARRAY_SIZE(regions);
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask   = PAGE_IS_WRITTEN;
+    if (reset) arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+
+    for (;;)
+    {
+        arg.max_pages = *count - pos;
+        if ((ret = ioctl( pagemap_fd, PAGEMAP_SCAN, &arg )) == -1)
+        {
+            ERR( "failed to scan %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+            break;
+        }
+        for (i = 0; i < ret; i++)
+            for (addr = (char *)(UINT_PTR)regions[i].start; addr < (char *)(UINT_PTR)regions[i].end; addr += page_size)
+                addresses[pos++] = addr;
+        if (pos == *count || arg.walk_end >= arg.end) break;
+        arg.start = arg.walk_end;
+    }
+    *count = pos;
+}
+
+#else  /* HAVE_LINUX_USERFAULTFD_H */
+
+static void kernel_writewatch_init(void)
+{
+}
+
+static void kernel_writewatch_reset( void *base, SIZE_T size )
+{
+}
+
+static BOOL kernel_writewatch_register( void *base, SIZE_T size )
+{
+    return FALSE;
+}
+
+static void kernel_get_write_watches( void *base, SIZE_T size, void **addresses, ULONG_PTR *count,
+                                      BOOL reset )
+{
+    *count = 0;
+}
+
+#endif  /* HAVE_LINUX_USERFAULTFD_H */
+
+
 /***********************************************************************
  *           update_write_watches
  */
@@ -1802,8 +2036,13 @@ static void update_write_watches( void *base, size_t size, size_t accessed_size
  *
  * Reset write watches in a memory range.
  */
-static void reset_write_watches( void *base, SIZE_T size )
+static void reset_write_watches( struct file_view *view, void *base, SIZE_T size )
 {
+    if (view->protect & VPROT_KERNEL_WATCH)
+    {
+        kernel_writewatch_reset( base, size );
+        return;
+    }
     set_page_vprot_bits( base, size, VPROT_WRITEWATCH, 0 );
     mprotect_range( base, size, 0, 0 );
 }
@@ -2117,6 +2356,9 @@ static NTSTATUS decommit_pages( struct file_view *view, size_t start, size_t siz
     if (anon_mmap_fixed( (char *)view->base + start, size, PROT_NONE, 0 ) != MAP_FAILED)
     {
         set_page_vprot_bits( (char *)view->base + start, size, 0, VPROT_COMMITTED );
+        /* the new mapping isn't registered for write tracking */
+        if (view->protect & VPROT_KERNEL_WATCH)
+            kernel_writewatch_register( (char *)view->base + start, size );
         return STATUS_SUCCESS;
     }
     return STATUS_NO_MEMORY;
@@ -2215,10 +2457,13 @@ static NTSTATUS map_pe_header( void *ptr, size_t size, int fd, BOOL *removable )
  *           map_image_into_view
  *
  * Map an executable (PE format) image into an existing view.
+ * If reloc_fd is valid, it contains a copy of the image already laid out
+ * and relocated to the view address by the server.
  * virtual_mutex must be held by caller.
  */
 static NTSTATUS map_image_into_view( struct file_view *view, const WCHAR *filename, int fd, void *orig_base,
-                                     SIZE_T header_size, ULONG image_flags, int shared_fd, BOOL removable )
+                                     SIZE_T header_size, ULONG image_flags, int shared_fd, int reloc_fd,
+                                     BOOL removable )
 {
     IMAGE_DOS_HEADER *dos;
     IMAGE_NT_HEADERS *nt;
@@ -2239,13 +2484,19 @@ static NTSTATUS map_image_into_view( struct file_view *view, const WCHAR *filena
 
     fstat( fd, &st );
     header_size = min( header_size, st.st_size );
-    if ((status = map_pe_header( view->base, header_size, fd, &removable ))) return status;
+    if (reloc_fd != -1)
+    {
+        if ((status = map_file_into_view( view, reloc_fd, 0, total_size, 0,
+                                          VPROT_COMMITTED | VPROT_READ | VPROT_WRITECOPY, FALSE )))
+            return status;
+    }
+    else if ((status = map_pe_header( view->base, header_size, fd, &removable ))) return status;
 
     status = STATUS_INVALID_IMAGE_FORMAT;  /* generic error */
     dos = (IMAGE_DOS_HEADER *)ptr;
     nt = (IMAGE_NT_HEADERS *)(ptr + dos->e_lfanew);
     header_end = ptr + ROUND_SIZE( 0, header_size );
-    memset( ptr + header_size, 0, header_end - (ptr + header_size) );
+    if (reloc_fd == -1) memset( ptr + header_size, 0, header_end - (ptr + header_size) );
     if ((char *)(nt + 1) > header_end) return status;
     header_start = (char*)&nt->OptionalHeader+nt->FileHeader.SizeOfOptionalHeader;
     if (nt->FileHeader.NumberOfSections > ARRAY_SIZE( sections )) return status;
@@ -2285,9 +2536,9 @@ static NTSTATUS map_image_into_view( struct file_view *view, const WCHAR *filena
     }
 
 
-    /* map all the sections */
+    /* map all the sections, unless they are already mapped from the relocated copy */
 
-    for (i = pos = 0; i < nt->FileHeader.NumberOfSections; i++, sec++)
+    for (i = pos = 0; i < nt->FileHeader.NumberOfSections && reloc_fd == -1; i++, sec++)
     {
         static const SIZE_T sector_align = 0x1ff;
         SIZE_T map_size, file_start, file_size, end;
@@ -2459,6 +2710,43 @@ static NTSTATUS get_mapping_info( HANDLE handle, ACCESS_MASK access, unsigned in
 }
 
 
+/***********************************************************************
+ *             get_image_relocation
+ *
+ * Retrieve the file holding a copy of the image relocated by the server to
+ * the specified base, or to the base of an existing copy if it's NULL.
+ * If the copy is still being built, a handle to wait on is returned instead.
+ */
+static HANDLE get_image_relocation( HANDLE mapping, void **base, HANDLE *wait )
+{
+    HANDLE file = 0;
+
+    *wait = 0;
+    SERVER_START_REQ( get_image_relocation )
+    {
+        req->mapping = wine_server_obj_handle( mapping );
+        req->base    = wine_server_client_ptr( *base );
+        switch (wine_server_call( req ))
+        {
+        case STATUS_SUCCESS:
+            file = wine_server_ptr_handle( reply->file );
+            *base = wine_server_get_ptr( reply->base );
+            if (file && wine_server_client_ptr( *base ) != reply->base)
+            {
+                NtClose( file );
+                file = 0;
+            }
+            break;
+        case STATUS_PENDING:
+            *wait = wine_server_ptr_handle( reply->wait );
+            break;
+        }
+    }
+    SERVER_END_REQ;
+    return file;
+}
+
+
 /***********************************************************************
  *             virtual_map_image
  *
@@ -2471,11 +2759,17 @@ static NTSTATUS virtual_map_image( HANDLE mapping, ACCESS_MASK access, void **ad
     unsigned int vprot = SEC_IMAGE | SEC_FILE | VPROT_COMMITTED | VPROT_READ | VPROT_EXEC | VPROT_WRITECOPY;
     int unix_fd = -1, needs_close;
     int shared_fd = -1, shared_needs_close = 0;
+    int reloc_fd = -1, reloc_needs_close = 0;
     SIZE_T size = image_info->map_size;
     struct file_view *view;
+    HANDLE reloc_file = 0, wait;
     NTSTATUS status;
     sigset_t sigset;
-    void *base;
+    void *base, *reloc_base;
+    /* relocated copies of dlls are built by the server and shared between processes */
+    BOOL relocatable = (image_info->image_charact & IMAGE_FILE_DLL) &&
+                       !(image_info->image_charact & IMAGE_FILE_RELOCS_STRIPPED) &&
+                       !(image_info->image_flags & IMAGE_FLAGS_ImageMappedFlat) && !shared_file;
 
     if ((status = server_get_unix_fd( mapping, 0, &unix_fd, &needs_close, NULL, NULL )))
         return status;
@@ -2487,6 +2781,7 @@ static NTSTATUS virtual_map_image( HANDLE mapping, ACCESS_MASK access, void **ad
         return status;
     }
 
+retry:
     status = STATUS_INVALID_PARAMETER;
     server_enter_uninterrupted_section( &virtual_mutex, &sigset );
 
@@ -2496,11 +2791,43 @@ static NTSTATUS virtual_map_image( HANDLE mapping, ACCESS_MASK access, void **ad
     if ((char *)base >= (char *)address_space_start)  /* make sure the DOS area remains free */
         status = map_view( &view, base, size, alloc_type & MEM_TOP_DOWN, vprot, zero_bits );
 
+    /* try the base of an existing relocated copy first */
+    reloc_base = NULL;
+    if (status && relocatable && (reloc_file = get_image_relocation( mapping, &reloc_base, &wait )))
+    {
+        status = STATUS_CONFLICTING_ADDRESSES;
+        if ((char *)reloc_base >= (char *)address_space_start)
+            status = map_view( &view, reloc_base, size, alloc_type & MEM_TOP_DOWN, vprot, zero_bits );
+        if (status)
+        {
+            NtClose( reloc_file );
+            reloc_file = 0;
+        }
+    }
+
     if (status) status = map_view( &view, NULL, size, alloc_type & MEM_TOP_DOWN, vprot, zero_bits );
     if (status) goto done;
 
+    if (relocatable && !reloc_file && wine_server_client_ptr( view->base ) != image_info->base)
+    {
+        reloc_base = view->base;
+        reloc_file = get_image_relocation( mapping, &reloc_base, &wait );
+        if (wait)
+        {
+            /* the copy is being built by the server, wait for it without holding
+             * the lock and start again, the copy can then be mapped at its base */
+            delete_view( view );
+            server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+            NtWaitForSingleObject( wait, FALSE, NULL );
+            NtClose( wait );
+            goto retry;
+        }
+    }
+    if (reloc_file && server_get_unix_fd( reloc_file, FILE_READ_DATA, &reloc_fd, &reloc_needs_close, NULL, NULL ))
+        reloc_fd = -1;
+
     status = map_image_into_view( view, filename, unix_fd, base, image_info->header_size,
-                                  image_info->image_flags, shared_fd, needs_close );
+                                  image_info->image_flags, shared_fd, reloc_fd, needs_close );
     if (status == STATUS_SUCCESS)
     {
         SERVER_START_REQ( map_view )
@@ -2526,6 +2853,8 @@ done:
     server_leave_uninterrupted_section( &virtual_mutex, &sigset );
     if (needs_close) close( unix_fd );
     if (shared_needs_close) close( shared_fd );
+    if (reloc_needs_close) close( reloc_fd );
+    if (reloc_file) NtClose( reloc_file );
     return status;
 }
 
@@ -2747,6 +3076,8 @@ void virtual_init(void)
     size = (char *)address_space_start - (char *)0x10000;
     if (size && mmap_is_in_reserved_area( (void*)0x10000, size ) == 1)
         anon_mmap_fixed( (void *)0x10000, size, PROT_READ | PROT_WRITE, 0 );
+
+    kernel_writewatch_init();
 }
 
 
@@ -2961,6 +3292,7 @@ static TEB *init_teb( void *ptr, BOOL is_wow )
     thread_data->reply_fd   = -1;
     thread_data->wait_fd[0] = -1;
     thread_data->wait_fd[1] = -1;
+    thread_data->request_shm = NULL;
     list_add_head( &teb_list, &thread_data->entry );
     return teb;
 }
@@ -3176,12 +3508,14 @@ NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, ULONG_PTR zero_bits, SI
 
         /* shrink the first view and create a second one for the extra size */
         /* this allows the app to free the stack without freeing the thread start portion */
+        virtual_write_begin();
         view->size -= extra_size;
         status = create_view( &extra_view, (char *)view->base + view->size, extra_size,
                               VPROT_READ | VPROT_WRITE | VPROT_COMMITTED );
+        if (status != STATUS_SUCCESS) view->size += extra_size;
+        virtual_write_end();
         if (status != STATUS_SUCCESS)
         {
-            view->size += extra_size;
             delete_view( view );
             goto done;
         }
@@ -3301,6 +3635,16 @@ NTSTATUS virtual_handle_fault( void *addr, DWORD err, void *stack )
     NTSTATUS ret = STATUS_ACCESS_VIOLATION;
     char *page = ROUND_ADDR( addr, page_mask );
     BYTE vprot;
+    LONG seq;
+
+    /* plain access violations don't need the lock; if the page protections
+     * are being modified, take the lock to check the fault again */
+    seq = virtual_read_begin();
+    vprot = get_page_vprot( page );
+    if (!(vprot & (VPROT_GUARD | VPROT_WRITEWATCH)) &&
+        (!(err & EXCEPTION_WRITE_FAULT) || !(get_unix_prot( vprot ) & PROT_WRITE)) &&
+        virtual_read_end( seq ))
+        return ret;
 
     mutex_lock( &virtual_mutex );  /* no need for signal masking inside signal handler */
     vprot = get_page_vprot( page );
@@ -3860,6 +4204,17 @@ NTSTATUS WINAPI NtAllocateVirtualMemory( HANDLE process, PVOID *ret, ULONG_PTR z
             else status = map_view( &view, base, size, type & MEM_TOP_DOWN, vprot, zero_bits );
 
             if (status == STATUS_SUCCESS) base = view->base;
+
+            if (status == STATUS_SUCCESS && (vprot & VPROT_WRITEWATCH) &&
+                kernel_writewatch_register( view->base, view->size ))
+            {
+                /* no need to write-protect the pages anymore */
+                virtual_write_begin();
+                view->protect |= VPROT_KERNEL_WATCH;
+                set_page_vprot_bits( view->base, view->size, 0, VPROT_WRITEWATCH );
+                virtual_write_end();
+                mprotect_range( view->base, view->size, 0, 0 );
+            }
         }
     }
     else if (type & MEM_RESET)
@@ -4120,15 +4475,69 @@ static int get_free_mem_state_callback( void *start, SIZE_T size, void *arg )
     return 1;
 }
 
+/***********************************************************************
+ *           find_view_bounds
+ *
+ * Find the view containing an address, and the bounds of the view or of the
+ * free range between views. Without virtual_mutex the tree may be modified
+ * while walking it, so the walk is abandoned after max_depth steps.
+ */
+static BOOL find_view_bounds( char *base, struct file_view **ret, char **alloc_base, char **alloc_end,
+                              unsigned int max_depth )
+{
+    struct wine_rb_entry *ptr = views_tree.root;
+    struct file_view *view;
+
+    *ret = NULL;
+    *alloc_base = 0;
+    *alloc_end = working_set_limit;
+
+    for ( ; ptr; ptr = (char *)view->base > base ? ptr->left : ptr->right)
+    {
+        if (!max_depth--) return FALSE;
+        view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
+        if ((char *)view->base > base) *alloc_end = view->base;
+        else if ((char *)view->base + view->size <= base) *alloc_base = (char *)view->base + view->size;
+        else
+        {
+            *alloc_base = view->base;
+            *alloc_end = (char *)view->base + view->size;
+            *ret = view;
+            break;
+        }
+    }
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           fill_view_basic_info
+ */
+static void fill_view_basic_info( unsigned int protect, char *base, char *alloc_base, SIZE_T size,
+                                  BYTE vprot, MEMORY_BASIC_INFORMATION *info )
+{
+    info->AllocationBase = alloc_base;
+    info->BaseAddress    = base;
+    info->RegionSize = size;
+    info->State = (vprot & VPROT_COMMITTED) ? MEM_COMMIT : MEM_RESERVE;
+    info->Protect = (vprot & VPROT_COMMITTED) ? get_win32_prot( vprot, protect ) : 0;
+    info->AllocationProtect = get_win32_prot( protect, protect );
+    if (protect & SEC_IMAGE) info->Type = MEM_IMAGE;
+    else if (protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT)) info->Type = MEM_MAPPED;
+    else info->Type = MEM_PRIVATE;
+}
+
 /* get basic information about a memory block */
 static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
                                        MEMORY_BASIC_INFORMATION *info,
                                        SIZE_T len, SIZE_T *res_len )
 {
     struct file_view *view;
-    char *base, *alloc_base = 0, *alloc_end = working_set_limit;
-    struct wine_rb_entry *ptr;
+    char *base, *alloc_base, *alloc_end;
     sigset_t sigset;
+    SIZE_T size;
+    BYTE vprot;
+    LONG seq;
 
     if (len < sizeof(MEMORY_BASIC_INFORMATION))
         return STATUS_INFO_LENGTH_MISMATCH;
@@ -4166,39 +4575,46 @@ static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
 
     if (is_beyond_limit( base, 1, working_set_limit )) return STATUS_INVALID_PARAMETER;
 
-    /* Find the view containing the address */
+    /* Try first without holding the lock; views mapped through sections with
+     * SEC_RESERVE and free ranges need the lock to be queried. */
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
-    ptr = views_tree.root;
-    while (ptr)
+    seq = virtual_read_begin();
+    if (find_view_bounds( base, &view, &alloc_base, &alloc_end, 128 ) && view)
     {
-        view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
-        if ((char *)view->base > base)
-        {
-            alloc_end = view->base;
-            ptr = ptr->left;
-        }
-        else if ((char *)view->base + view->size <= base)
-        {
-            alloc_base = (char *)view->base + view->size;
-            ptr = ptr->right;
-        }
-        else
+        unsigned int protect = view->protect;
+        char *page = ROUND_ADDR( base, page_mask );
+
+        size = view->size - (page - (char *)view->base);
+        if (!(protect & SEC_RESERVE) && virtual_read_end( seq ))
         {
-            alloc_base = view->base;
-            alloc_end = (char *)view->base + view->size;
-            break;
+            size = get_vprot_range_size( page, size, ~VPROT_WRITEWATCH, &vprot );
+            if (virtual_read_end( seq ))
+            {
+                fill_view_basic_info( protect, base, alloc_base, size, vprot, info );
+                if (res_len) *res_len = sizeof(*info);
+                return STATUS_SUCCESS;
+            }
         }
     }
 
-    /* Fill the info structure */
+    /* Find the view containing the address */
 
-    info->AllocationBase = alloc_base;
-    info->BaseAddress    = base;
-    info->RegionSize     = alloc_end - base;
+    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    find_view_bounds( base, &view, &alloc_base, &alloc_end, ~0u );
+
+    /* Fill the info structure */
 
-    if (!ptr)
+    if (view)
+    {
+        size = get_committed_size( view, base, &vprot, ~VPROT_WRITEWATCH );
+        fill_view_basic_info( view->protect, base, alloc_base, size, vprot, info );
+    }
+    else
     {
+        info->AllocationBase = alloc_base;
+        info->BaseAddress    = base;
+        info->RegionSize     = alloc_end - base;
+
         if (!mmap_enum_reserved_areas( get_free_mem_state_callback, info, 0 ))
         {
             /* not in a reserved area at all, pretend it's allocated */
@@ -4221,18 +4637,6 @@ static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
             }
         }
     }
-    else
-    {
-        BYTE vprot;
-
-        info->RegionSize = get_committed_size( view, base, &vprot, ~VPROT_WRITEWATCH );
-        info->State = (vprot & VPROT_COMMITTED) ? MEM_COMMIT : MEM_RESERVE;
-        info->Protect = (vprot & VPROT_COMMITTED) ? get_win32_prot( vprot, view->protect ) : 0;
-        info->AllocationProtect = get_win32_prot( view->protect, view->protect );
-        if (view->protect & SEC_IMAGE) info->Type = MEM_IMAGE;
-        else if (view->protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT)) info->Type = MEM_MAPPED;
-        else info->Type = MEM_PRIVATE;
-    }
     server_leave_uninterrupted_section( &virtual_mutex, &sigset );
 
     if (res_len) *res_len = sizeof(*info);
@@ -4748,21 +5152,30 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
 
     if (is_write_watch_range( base, size ))
     {
+        struct file_view *view = find_view( base, size );
         ULONG_PTR pos = 0;
         char *addr = base;
         char *end = addr + size;
 
+        if (view->protect & VPROT_KERNEL_WATCH)
+        {
+            kernel_get_write_watches( base, size, addresses, count, flags & WRITE_WATCH_FLAG_RESET );
+            *granularity = page_size;
+            goto done;
+        }
+
         while (pos < *count && addr < end)
         {
             if (!(get_page_vprot( addr ) & VPROT_WRITEWATCH)) addresses[pos++] = addr;
             addr += page_size;
         }
-        if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( base, addr - (char *)base );
+        if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( view, base, addr - (char *)base );
         *count = pos;
         *granularity = page_size;
     }
     else status = STATUS_INVALID_PARAMETER;
 
+done:
     server_leave_uninterrupted_section( &virtual_mutex, &sigset );
     return status;
 }
@@ -4787,7 +5200,7 @@ NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
     server_enter_uninterrupted_section( &virtual_mutex, &sigset );
 
     if (is_write_watch_range( base, size ))
-        reset_write_watches( base, size );
+        reset_write_watches( find_view( base, size ), base, size );
     else
         status = STATUS_INVALID_PARAMETER;
 
@@ -23,6 +23,10 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "ntgdi_private.h"
 #include "dibdrv.h"
@@ -585,17 +589,227 @@ static void mask_rect( dib_info *dst, const RECT *dst_rect, const dib_info *src,
     }
 }
 
+/* Large operations are split into bands of rows that are processed in parallel by a pool of
+ * threads. The bands write to disjoint rows, so the result is the same as with a single band.
+ * The pool threads are not Wine threads: they block all signals and must not call into ntdll,
+ * so the memory they access is faulted in by the calling thread first, and nothing on the band
+ * path may print debug messages. A fault on a pool thread would kill the process, so this is
+ * only used for drawing on DCs, whose bitmaps are probed first; conversions of caller buffers
+ * such as convert_bitmapinfo() stay on the calling thread, where faults are caught. */
+
+#define MIN_BAND_PIXELS  (512 * 512)  /* don't split smaller operations */
+#define MAX_BAND_THREADS 16
+
+struct band_job
+{
+    void  (*func)( void *arg, int top, int bottom );
+    void   *arg;
+    int     top;         /* first row of the operation */
+    int     bottom;      /* last row of the operation */
+    int     nb_bands;    /* number of bands to process */
+    int     next;        /* next band to hand out */
+    int     done;        /* number of finished bands */
+};
+
+static pthread_mutex_t band_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t band_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t band_done_cond = PTHREAD_COND_INITIALIZER;
+static struct band_job *band_job;  /* job being processed, protected by band_mutex */
+static int band_threads = -1;      /* number of threads working on a job, including the caller */
+static int band_workers;           /* number of pool threads started */
+
+static int get_band_threads(void)
+{
+    if (band_threads == -1)
+    {
+        const char *env = getenv( "WINEDIBTHREADS" );
+        int count = env ? atoi( env ) : sysconf( _SC_NPROCESSORS_ONLN );
+        band_threads = max( 1, min( count, MAX_BAND_THREADS ));
+        TRACE( "using %u threads\n", band_threads );
+    }
+    return band_threads;
+}
+
+/* get the next band of a job; must be called with band_mutex held */
+static BOOL get_next_band( struct band_job *job, int *top, int *bottom )
+{
+    int rows = job->bottom - job->top;
+
+    if (job->next >= job->nb_bands) return FALSE;
+    *top = job->top + (LONGLONG)rows * job->next / job->nb_bands;
+    job->next++;
+    *bottom = job->top + (LONGLONG)rows * job->next / job->nb_bands;
+    return TRUE;
+}
+
+static void *band_worker( void *arg )
+{
+    struct band_job *job;
+    int top, bottom;
+
+    pthread_mutex_lock( &band_mutex );
+    for (;;)
+    {
+        while (!(job = band_job) || !get_next_band( job, &top, &bottom ))
+            pthread_cond_wait( &band_start_cond, &band_mutex );
+        pthread_mutex_unlock( &band_mutex );
+
+        job->func( job->arg, top, bottom );
+
+        pthread_mutex_lock( &band_mutex );
+        if (++job->done == job->nb_bands) pthread_cond_signal( &band_done_cond );
+    }
+    return NULL;
+}
+
+static inline void probe_byte( volatile BYTE *ptr, BOOL write )
+{
+    /* an atomic or doesn't lose the writes of other threads to the same word */
+    if (write) InterlockedOr( (LONG *)((ULONG_PTR)ptr & ~3), 0 );
+    else (void)*ptr;
+}
+
+/* touch every page of a dib rectangle, so that faults happen on the calling thread */
+static void probe_dib_rect( const dib_info *dib, const RECT *rect, BOOL write )
+{
+    volatile BYTE *ptr = (BYTE *)dib->bits.ptr + (dib->rect.top + rect->top) * dib->stride;
+    int x, y, start, end;
+
+    start = (dib->rect.left + rect->left) * dib->bit_count / 8;
+    end = ((dib->rect.left + rect->right) * dib->bit_count + 7) / 8;
+    if (start >= end) return;
+
+    for (y = rect->top; y < rect->bottom; y++, ptr += dib->stride)
+    {
+        for (x = start; x < end; x += 4096) probe_byte( ptr + x, write );
+        probe_byte( ptr + end - 1, write );
+    }
+}
+
+/* call func on the steps from top to bottom, split in bands when the destination rectangle
+ * is large enough; src is optional */
+void process_bands( void (*func)( void *arg, int top, int bottom ), void *arg, int top, int bottom,
+                    const dib_info *dst, const RECT *dst_rect, const dib_info *src, const RECT *src_rect )
+{
+    struct band_job job;
+    sigset_t sigset, old_sigset;
+    pthread_t thread;
+    int rows = bottom - top;
+
+    /* the null primitives print fixmes */
+    if ((LONGLONG)(dst_rect->right - dst_rect->left) * (dst_rect->bottom - dst_rect->top) < MIN_BAND_PIXELS ||
+        rows < 2 || dst->funcs == &funcs_null || get_band_threads() == 1)
+    {
+        func( arg, top, bottom );
+        return;
+    }
+
+    /* the destination may be application memory, such as a write-watched buffer */
+    if (src) probe_dib_rect( src, src_rect, FALSE );
+    probe_dib_rect( dst, dst_rect, TRUE );
+
+    pthread_mutex_lock( &band_mutex );
+    if (band_job)  /* the pool is busy with another thread's job */
+    {
+        pthread_mutex_unlock( &band_mutex );
+        func( arg, top, bottom );
+        return;
+    }
+
+    if (band_workers < band_threads - 1)
+    {
+        sigfillset( &sigset );
+        pthread_sigmask( SIG_SETMASK, &sigset, &old_sigset );
+        while (band_workers < band_threads - 1 && !pthread_create( &thread, NULL, band_worker, NULL ))
+        {
+            pthread_detach( thread );
+            band_workers++;
+        }
+        pthread_sigmask( SIG_SETMASK, &old_sigset, NULL );
+    }
+
+    job.func     = func;
+    job.arg      = arg;
+    job.top      = top;
+    job.bottom   = bottom;
+    job.nb_bands = min( rows, 4 * (band_workers + 1) );  /* smaller bands balance the load better */
+    job.next     = 0;
+    job.done     = 0;
+    band_job = &job;
+    pthread_cond_broadcast( &band_start_cond );
+
+    while (get_next_band( &job, &top, &bottom ))
+    {
+        pthread_mutex_unlock( &band_mutex );
+        func( arg, top, bottom );
+        pthread_mutex_lock( &band_mutex );
+        job.done++;
+    }
+    while (job.done < job.nb_bands) pthread_cond_wait( &band_done_cond, &band_mutex );
+    band_job = NULL;
+    pthread_mutex_unlock( &band_mutex );
+}
+
+/* get the bounding rectangle of a list of rectangles */
+static void get_rects_bounds( const RECT *rects, int count, RECT *bounds )
+{
+    int i;
+
+    *bounds = rects[0];
+    for (i = 1; i < count; i++)
+    {
+        bounds->left   = min( bounds->left, rects[i].left );
+        bounds->top    = min( bounds->top, rects[i].top );
+        bounds->right  = max( bounds->right, rects[i].right );
+        bounds->bottom = max( bounds->bottom, rects[i].bottom );
+    }
+}
+
+struct blend_band
+{
+    dib_info                   *dst;
+    const dib_info             *src;
+    const struct clipped_rects *clipped_rects;
+    POINT                       offset;
+    BLENDFUNCTION               blend;
+};
+
+static void blend_band( void *arg, int top, int bottom )
+{
+    struct blend_band *band = arg;
+    const struct clipped_rects *clipped_rects = band->clipped_rects;
+    RECT rect;
+    int i;
+
+    for (i = 0; i < clipped_rects->count; i++)
+    {
+        rect = clipped_rects->rects[i];
+        rect.top = max( rect.top, top );
+        rect.bottom = min( rect.bottom, bottom );
+        if (rect.top >= rect.bottom) continue;
+        band->dst->funcs->blend_rects( band->dst, 1, &rect, band->src, &band->offset, band->blend );
+    }
+}
+
 static DWORD blend_rect( dib_info *dst, const RECT *dst_rect, const dib_info *src, const RECT *src_rect,
                          HRGN clip, BLENDFUNCTION blend )
 {
-    POINT offset;
+    struct blend_band band;
     struct clipped_rects clipped_rects;
+    RECT bounds, src_bounds;
 
     if (!get_clipped_rects( dst, dst_rect, clip, &clipped_rects )) return ERROR_SUCCESS;
 
-    offset.x = src_rect->left - dst_rect->left;
-    offset.y = src_rect->top  - dst_rect->top;
-    dst->funcs->blend_rects( dst, clipped_rects.count, clipped_rects.rects, src, &offset, blend );
+    band.dst = dst;
+    band.src = src;
+    band.clipped_rects = &clipped_rects;
+    band.offset.x = src_rect->left - dst_rect->left;
+    band.offset.y = src_rect->top  - dst_rect->top;
+    band.blend = blend;
+    get_rects_bounds( clipped_rects.rects, clipped_rects.count, &bounds );
+    src_bounds = bounds;
+    offset_rect( &src_bounds, band.offset.x, band.offset.y );
+    process_bands( blend_band, &band, bounds.top, bounds.bottom, dst, &bounds, src, &src_bounds );
 
     free_clipped_rects( &clipped_rects );
     return ERROR_SUCCESS;
@@ -680,19 +894,52 @@ static void get_gradient_triangle_vertices( const GRADIENT_TRIANGLE *tri, const
     bounds->bottom = v[2].y;
 }
 
-static BOOL gradient_rect( dib_info *dib, TRIVERTEX *v, int mode, HRGN clip, const RECT *bounds )
+struct gradient_band
+{
+    dib_info                   *dib;
+    const TRIVERTEX            *v;
+    int                         mode;
+    const struct clipped_rects *clipped_rects;
+    BOOL                        failed;
+};
+
+static void gradient_band( void *arg, int top, int bottom )
 {
+    struct gradient_band *band = arg;
+    const struct clipped_rects *clipped_rects = band->clipped_rects;
+    RECT rect;
     int i;
-    struct clipped_rects clipped_rects;
-    BOOL ret = TRUE;
 
-    if (!get_clipped_rects( dib, bounds, clip, &clipped_rects )) return TRUE;
-    for (i = 0; i < clipped_rects.count; i++)
+    for (i = 0; i < clipped_rects->count; i++)
     {
-        if (!(ret = dib->funcs->gradient_rect( dib, &clipped_rects.rects[i], v, mode ))) break;
+        rect = clipped_rects->rects[i];
+        rect.top = max( rect.top, top );
+        rect.bottom = min( rect.bottom, bottom );
+        if (rect.top >= rect.bottom) continue;
+        if (band->dib->funcs->gradient_rect( band->dib, &rect, band->v, band->mode )) continue;
+        band->failed = TRUE;
+        break;
     }
+}
+
+static BOOL gradient_rect( dib_info *dib, TRIVERTEX *v, int mode, HRGN clip, const RECT *bounds )
+{
+    struct gradient_band band;
+    struct clipped_rects clipped_rects;
+    RECT rect;
+
+    if (!get_clipped_rects( dib, bounds, clip, &clipped_rects )) return TRUE;
+
+    band.dib = dib;
+    band.v = v;
+    band.mode = mode;
+    band.clipped_rects = &clipped_rects;
+    band.failed = FALSE;
+    get_rects_bounds( clipped_rects.rects, clipped_rects.count, &rect );
+    process_bands( gradient_band, &band, rect.top, rect.bottom, dib, &rect, NULL, NULL );
+
     free_clipped_rects( &clipped_rects );
-    return ret;
+    return !band.failed;
 }
 
 static DWORD copy_src_bits( dib_info *src, RECT *src_rect )
@@ -1198,6 +1445,98 @@ static DWORD calc_1d_stretch_params( INT dst_start, INT dst_length, INT dst_vis_
 }
 
 
+struct stretch_band
+{
+    dib_info              *dst_dib;
+    const dib_info        *src_dib;
+    POINT                  dst_start;  /* position of the first scan */
+    POINT                  src_start;
+    struct stretch_params  v_params;
+    struct stretch_params  h_params;
+    BOOL                   vstretch;
+    int                    mode;
+    int                    width;      /* width of the destination rows */
+    void (*row_fn)( const dib_info *dst_dib, const POINT *dst_start,
+                    const dib_info *src_dib, const POINT *src_start,
+                    const struct stretch_params *params, int mode, BOOL keep_dst );
+};
+
+/* process the vertical steps from first to last; when shrinking, a destination row
+ * belongs to the band that contains the first source row merged into it */
+static void stretch_band( void *arg, int first, int last )
+{
+    const struct stretch_band *band = arg;
+    const struct stretch_params *v_params = &band->v_params;
+    POINT dst_start = band->dst_start, src_start = band->src_start;
+    int i, err = v_params->err_start;
+
+    if (band->vstretch)
+    {
+        BOOL need_row = TRUE;
+        RECT last_row, this_row;
+
+        last_row.left = 0;
+        last_row.right = band->width;
+
+        for (i = 0; i < last; i++)
+        {
+            if (i == first) need_row = TRUE;  /* the previous row belongs to another band */
+            if (i >= first)
+            {
+                if (need_row)
+                {
+                    band->row_fn( band->dst_dib, &dst_start, band->src_dib, &src_start,
+                                  &band->h_params, band->mode, FALSE );
+                    need_row = FALSE;
+                }
+                else
+                {
+                    last_row.top = dst_start.y - v_params->dst_inc;
+                    last_row.bottom = last_row.top + 1;
+                    this_row = last_row;
+                    offset_rect( &this_row, 0, v_params->dst_inc );
+                    copy_rect( band->dst_dib, &this_row, band->dst_dib, &last_row, NULL, R2_COPYPEN );
+                }
+            }
+
+            if (err > 0)
+            {
+                src_start.y += v_params->src_inc;
+                need_row = TRUE;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            dst_start.y += v_params->dst_inc;
+        }
+    }
+    else
+    {
+        int merged_rows = 0, row_start = 0;
+
+        for (i = 0; i < v_params->length; i++)
+        {
+            if (!merged_rows)
+            {
+                if (i >= last) break;
+                row_start = i;
+            }
+            if (row_start >= first && (band->mode != STRETCH_DELETESCANS || !merged_rows))
+                band->row_fn( band->dst_dib, &dst_start, band->src_dib, &src_start,
+                              &band->h_params, band->mode, merged_rows != 0 );
+            merged_rows++;
+
+            if (err > 0)
+            {
+                dst_start.y += v_params->dst_inc;
+                merged_rows = 0;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            src_start.y += v_params->src_inc;
+        }
+    }
+}
+
 DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bitblt_coords *src,
                           const BITMAPINFO *dst_info, void *dst_bits, struct bitblt_coords *dst,
                           INT mode )
@@ -1207,11 +1546,8 @@ DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bit
     RECT rect;
     BOOL hstretch, vstretch;
     struct stretch_params v_params, h_params;
-    int err;
+    struct stretch_band band;
     DWORD ret;
-    void (* row_fn)(const dib_info *dst_dib, const POINT *dst_start,
-                    const dib_info *src_dib, const POINT *src_start,
-                    const struct stretch_params *params, int mode, BOOL keep_dst);
 
     TRACE("dst %d, %d - %d x %d visrect %s src %d, %d - %d x %d visrect %s\n",
           dst->x, dst->y, dst->width, dst->height, wine_dbgstr_rect(&dst->visrect),
@@ -1251,64 +1587,20 @@ DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bit
     dst_start.x -= dst->visrect.left;
     dst_start.y -= dst->visrect.top;
 
-    err = v_params.err_start;
-
-    row_fn = hstretch ? dst_dib.funcs->stretch_row : dst_dib.funcs->shrink_row;
-
-    if (vstretch)
-    {
-        BOOL need_row = TRUE;
-        RECT last_row, this_row;
-        if (hstretch) mode = STRETCH_DELETESCANS;
-        last_row.left = 0;
-        last_row.right = dst->visrect.right - dst->visrect.left;
-
-        while (v_params.length--)
-        {
-            if (need_row)
-            {
-                row_fn( &dst_dib, &dst_start, &src_dib, &src_start, &h_params, mode, FALSE );
-                need_row = FALSE;
-            }
-            else
-            {
-                last_row.top = dst_start.y - v_params.dst_inc;
-                last_row.bottom = last_row.top + 1;
-                this_row = last_row;
-                offset_rect( &this_row, 0, v_params.dst_inc );
-                copy_rect( &dst_dib, &this_row, &dst_dib, &last_row, NULL, R2_COPYPEN );
-            }
-
-            if (err > 0)
-            {
-                src_start.y += v_params.src_inc;
-                need_row = TRUE;
-                err += v_params.err_add_1;
-            }
-            else err += v_params.err_add_2;
-            dst_start.y += v_params.dst_inc;
-        }
-    }
-    else
-    {
-        int merged_rows = 0;
-
-        while (v_params.length--)
-        {
-            if (mode != STRETCH_DELETESCANS || !merged_rows)
-                row_fn( &dst_dib, &dst_start, &src_dib, &src_start, &h_params, mode, merged_rows != 0 );
-            merged_rows++;
-
-            if (err > 0)
-            {
-                dst_start.y += v_params.dst_inc;
-                merged_rows = 0;
-                err += v_params.err_add_1;
-            }
-            else err += v_params.err_add_2;
-            src_start.y += v_params.src_inc;
-        }
-    }
+    band.dst_dib = &dst_dib;
+    band.src_dib = &src_dib;
+    band.dst_start = dst_start;
+    band.src_start = src_start;
+    band.v_params = v_params;
+    band.h_params = h_params;
+    band.row_fn = hstretch ? dst_dib.funcs->stretch_row : dst_dib.funcs->shrink_row;
+    band.vstretch = vstretch;
+    band.width = dst->visrect.right - dst->visrect.left;
+    /* with vertical stretching, each scan is copied from the previous one when possible */
+    band.mode = (vstretch && hstretch) ? STRETCH_DELETESCANS : mode;
+    rect = dst->visrect;
+    offset_rect( &rect, -rect.left, -rect.top );
+    process_bands( stretch_band, &band, 0, v_params.length, &dst_dib, &rect, &src_dib, &src->visrect );
 
 done:
     /* update coordinates, the destination rectangle is always stored at 0,0 */
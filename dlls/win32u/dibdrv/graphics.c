@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include "ntgdi_private.h"
 #include "dibdrv.h"
 
@@ -49,8 +50,10 @@ enum glyph_type
 
 struct cached_font
 {
-    struct list           entry;
+    struct list           entry;      /* entry in the hash bucket */
     LONG                  ref;
+    LONG                  last_used;  /* cache clock at the last release */
+    LONG                  size;       /* memory used by the font and its glyphs */
     DWORD                 hash;
     LOGFONTW              lf;
     XFORM                 xform;
@@ -58,9 +61,21 @@ struct cached_font
     struct cached_glyph **glyphs[GLYPH_NBTYPES][GLYPH_CACHE_PAGES];
 };
 
-static struct list font_cache = LIST_INIT( font_cache );
+#define FONT_CACHE_BITS  6
+#define FONT_CACHE_LIMIT (16 * 1024 * 1024)
 
-static pthread_mutex_t font_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+struct font_cache_bucket
+{
+    pthread_rwlock_t lock;
+    struct list      fonts;
+};
+
+static struct font_cache_bucket font_cache[1 << FONT_CACHE_BITS];
+static pthread_once_t font_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t font_cache_trim_lock = PTHREAD_MUTEX_INITIALIZER;
+static LONG font_cache_size;   /* memory used by all the cached fonts */
+static LONG font_cache_limit;  /* memory above which unused fonts are freed */
+static LONG font_cache_clock;
 
 
 static BOOL brush_rect( dibdrv_physdev *pdev, dib_brush *brush, const RECT *rect, HRGN clip )
@@ -551,78 +566,166 @@ static int font_cache_cmp( const struct cached_font *p1, const struct cached_fon
     return ret;
 }
 
-static struct cached_font *add_cached_font( DC *dc, HFONT hfont, UINT aa_flags )
+static void init_font_cache(void)
 {
-    struct cached_font font, *ptr, *last_unused = NULL;
-    UINT i = 0, j, k;
+    const char *env = getenv( "WINEGLYPHCACHE" );
+    unsigned int i;
 
-    NtGdiExtGetObjectW( hfont, sizeof(font.lf), &font.lf );
-    font.xform = dc->xformWorld2Vport;
-    font.xform.eDx = font.xform.eDy = 0;  /* unused, would break hashing */
-    if (dc->attr->graphics_mode == GM_COMPATIBLE)
+    for (i = 0; i < ARRAY_SIZE(font_cache); i++)
     {
-        font.lf.lfOrientation = font.lf.lfEscapement;
-        if (font.xform.eM11 * font.xform.eM22 < 0)
-            font.lf.lfOrientation = -font.lf.lfOrientation;
+        pthread_rwlock_init( &font_cache[i].lock, NULL );
+        list_init( &font_cache[i].fonts );
     }
-    font.lf.lfWidth = abs( font.lf.lfWidth );
-    font.aa_flags = aa_flags;
-    font.hash = font_cache_hash( &font );
+    /* the variable is in kilobytes, up to 1Gb */
+    if (env) font_cache_limit = max( 0, min( atoi( env ), 0x100000 )) * 1024;
+    else font_cache_limit = FONT_CACHE_LIMIT;
+    TRACE( "using %d bytes\n", font_cache_limit );
+}
+
+static struct font_cache_bucket *get_font_cache_bucket( DWORD hash )
+{
+    return &font_cache[(hash * 0x9e3779b1) >> (32 - FONT_CACHE_BITS)];
+}
+
+/* find a font in its bucket and grab a reference to it; the bucket must be locked */
+static struct cached_font *find_cached_font( struct font_cache_bucket *bucket, const struct cached_font *font )
+{
+    struct cached_font *ptr;
 
-    pthread_mutex_lock( &font_cache_lock );
-    LIST_FOR_EACH_ENTRY( ptr, &font_cache, struct cached_font, entry )
+    LIST_FOR_EACH_ENTRY( ptr, &bucket->fonts, struct cached_font, entry )
     {
-        if (!font_cache_cmp( &font, ptr ))
-        {
-            InterlockedIncrement( &ptr->ref );
-            list_remove( &ptr->entry );
-            goto done;
-        }
-        if (!ptr->ref)
+        if (font_cache_cmp( font, ptr )) continue;
+        InterlockedIncrement( &ptr->ref );
+        return ptr;
+    }
+    return NULL;
+}
+
+static void free_cached_font( struct cached_font *font )
+{
+    UINT i, j, k;
+
+    for (i = 0; i < GLYPH_NBTYPES; i++)
+    {
+        for (j = 0; j < GLYPH_CACHE_PAGES; j++)
         {
-            i++;
-            last_unused = ptr;
+            if (!font->glyphs[i][j]) continue;
+            for (k = 0; k < GLYPH_CACHE_PAGE_SIZE; k++)
+                free( font->glyphs[i][j][k] );
+            free( font->glyphs[i][j] );
         }
     }
+    InterlockedExchangeAdd( &font_cache_size, -font->size );
+    free( font );
+}
+
+/* free the least recently used fonts until the cache fits in its limit */
+static void trim_font_cache(void)
+{
+    struct font_cache_bucket *bucket;
+    struct cached_font *ptr, *lru;
+    unsigned int i;
+
+    /* fonts are only freed here, so the candidate can't go away once the bucket is unlocked */
+    if (pthread_mutex_trylock( &font_cache_trim_lock )) return;
 
-    if (i > 5)  /* keep at least 5 of the most-recently used fonts around */
+    while (font_cache_size > font_cache_limit)
     {
-        ptr = last_unused;
-        for (i = 0; i < GLYPH_NBTYPES; i++)
+        lru = NULL;
+        for (i = 0; i < ARRAY_SIZE(font_cache); i++)
         {
-            for (j = 0; j < GLYPH_CACHE_PAGES; j++)
+            pthread_rwlock_rdlock( &font_cache[i].lock );
+            LIST_FOR_EACH_ENTRY( ptr, &font_cache[i].fonts, struct cached_font, entry )
             {
-                if (!ptr->glyphs[i][j]) continue;
-                for (k = 0; k < GLYPH_CACHE_PAGE_SIZE; k++)
-                    free( ptr->glyphs[i][j][k] );
-                free( ptr->glyphs[i][j] );
+                if (ptr->ref) continue;
+                if (!lru || ptr->last_used - lru->last_used < 0) lru = ptr;
             }
+            pthread_rwlock_unlock( &font_cache[i].lock );
+        }
+        if (!lru) break;
+
+        bucket = get_font_cache_bucket( lru->hash );
+        pthread_rwlock_wrlock( &bucket->lock );
+        if (lru->ref)  /* selected again in the meantime */
+        {
+            pthread_rwlock_unlock( &bucket->lock );
+            continue;
         }
-        list_remove( &ptr->entry );
+        list_remove( &lru->entry );
+        pthread_rwlock_unlock( &bucket->lock );
+        TRACE( "freeing %p, %d bytes\n", lru, lru->size );
+        free_cached_font( lru );
     }
-    else if (!(ptr = malloc( sizeof(*ptr) )))
+
+    pthread_mutex_unlock( &font_cache_trim_lock );
+}
+
+static void add_font_cache_size( struct cached_font *font, LONG size )
+{
+    InterlockedExchangeAdd( &font->size, size );
+    if (InterlockedExchangeAdd( &font_cache_size, size ) + size > font_cache_limit) trim_font_cache();
+}
+
+static struct cached_font *add_cached_font( DC *dc, HFONT hfont, UINT aa_flags )
+{
+    struct font_cache_bucket *bucket;
+    struct cached_font font, *ptr, *found;
+
+    pthread_once( &font_cache_once, init_font_cache );
+
+    NtGdiExtGetObjectW( hfont, sizeof(font.lf), &font.lf );
+    font.xform = dc->xformWorld2Vport;
+    font.xform.eDx = font.xform.eDy = 0;  /* unused, would break hashing */
+    if (dc->attr->graphics_mode == GM_COMPATIBLE)
     {
-        pthread_mutex_unlock( &font_cache_lock );
-        return NULL;
+        font.lf.lfOrientation = font.lf.lfEscapement;
+        if (font.xform.eM11 * font.xform.eM22 < 0)
+            font.lf.lfOrientation = -font.lf.lfOrientation;
     }
+    font.lf.lfWidth = abs( font.lf.lfWidth );
+    font.aa_flags = aa_flags;
+    font.hash = font_cache_hash( &font );
+    bucket = get_font_cache_bucket( font.hash );
 
+    pthread_rwlock_rdlock( &bucket->lock );
+    ptr = find_cached_font( bucket, &font );
+    pthread_rwlock_unlock( &bucket->lock );
+    if (ptr) goto done;
+
+    if (!(ptr = malloc( sizeof(*ptr) ))) return NULL;
     *ptr = font;
     ptr->ref = 1;
+    ptr->last_used = 0;
+    ptr->size = 0;
     memset( ptr->glyphs, 0, sizeof(ptr->glyphs) );
+
+    pthread_rwlock_wrlock( &bucket->lock );
+    if ((found = find_cached_font( bucket, &font )))  /* another thread added it in the meantime */
+    {
+        pthread_rwlock_unlock( &bucket->lock );
+        free( ptr );
+        ptr = found;
+        goto done;
+    }
+    list_add_head( &bucket->fonts, &ptr->entry );
+    pthread_rwlock_unlock( &bucket->lock );
+    add_font_cache_size( ptr, sizeof(*ptr) );
+
 done:
-    list_add_head( &font_cache, &ptr->entry );
-    pthread_mutex_unlock( &font_cache_lock );
     TRACE( "%d %s -> %p\n", ptr->lf.lfHeight, debugstr_w(ptr->lf.lfFaceName), ptr );
     return ptr;
 }
 
 void release_cached_font( struct cached_font *font )
 {
-    if (font) InterlockedDecrement( &font->ref );
+    if (!font) return;
+    /* the font may be freed as soon as the reference is gone */
+    font->last_used = InterlockedIncrement( &font_cache_clock );
+    InterlockedDecrement( &font->ref );
 }
 
 static struct cached_glyph *add_cached_glyph( struct cached_font *font, UINT index, UINT flags,
-                                              struct cached_glyph *glyph )
+                                              struct cached_glyph *glyph, DWORD size )
 {
     struct cached_glyph *ret;
     enum glyph_type type = (flags & ETO_GLYPH_INDEX) ? GLYPH_INDEX : GLYPH_WCHAR;
@@ -641,11 +744,17 @@ static struct cached_glyph *add_cached_glyph( struct cached_font *font, UINT ind
         }
         if (InterlockedCompareExchangePointer( (void **)&font->glyphs[type][page], ptr, NULL ))
             free( ptr );
+        else
+            add_font_cache_size( font, GLYPH_CACHE_PAGE_SIZE * sizeof(*ptr) );
     }
     ret = InterlockedCompareExchangePointer( (void **)&font->glyphs[type][page][entry], glyph, NULL );
-    if (!ret) ret = glyph;
-    else free( glyph );
-    return ret;
+    if (ret)
+    {
+        free( glyph );
+        return ret;
+    }
+    add_font_cache_size( font, FIELD_OFFSET( struct cached_glyph, bits[size] ));
+    return glyph;
 }
 
 static struct cached_glyph *get_cached_glyph( struct cached_font *font, UINT index, UINT flags )
@@ -804,7 +913,7 @@ static struct cached_glyph *cache_glyph_bitmap( DC *dc, struct cached_font *font
 
 done:
     glyph->metrics = metrics;
-    return add_cached_glyph( font, index, flags, glyph );
+    return add_cached_glyph( font, index, flags, glyph, size );
 }
 
 static void render_string( DC *dc, dib_info *dib, struct cached_font *font, INT x, INT y,
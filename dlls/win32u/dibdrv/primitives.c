@@ -23,6 +23,9 @@
 #endif
 
 #include <assert.h>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#endif
 
 #include "ntgdi_private.h"
 #include "dibdrv.h"
@@ -31,6 +34,52 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(dib);
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* The SSE2 and AVX2 row functions below handle the most frequently used 8888 primitives.
+ * They must give exactly the same results as the generic code, and they return the
+ * number of pixels processed, the remaining ones being left to the generic code. */
+
+#define SSE2_FUNC __attribute__((target("sse2")))
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+enum simd_level
+{
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+static enum simd_level get_simd_level(void)
+{
+    static int level = -1;
+
+    if (level == -1)
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports( "avx2" )) level = SIMD_AVX2;
+        else if (__builtin_cpu_supports( "sse2" )) level = SIMD_SSE2;
+        else level = SIMD_NONE;
+    }
+    return level;
+}
+
+/* (x + 127) / 255 for 16-bit values up to 255 * 255 */
+static inline SSE2_FUNC __m128i div255_sse2( __m128i x )
+{
+    x = _mm_add_epi16( x, _mm_set1_epi16( 127 ));
+    return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( x, _mm_set1_epi16( 1 )), _mm_srli_epi16( x, 8 )), 8 );
+}
+
+static inline AVX2_FUNC __m256i div255_avx2( __m256i x )
+{
+    x = _mm256_add_epi16( x, _mm256_set1_epi16( 127 ));
+    return _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( x, _mm256_set1_epi16( 1 )),
+                                                _mm256_srli_epi16( x, 8 )), 8 );
+}
+
+#endif  /* __GNUC__ && (__i386__ || __x86_64__) */
+
 /* Bayer matrices for dithering */
 
 static const BYTE bayer_4x4[4][4] =
@@ -4682,6 +4731,165 @@ static inline DWORD blend_rgb( BYTE dst_r, BYTE dst_g, BYTE dst_b, DWORD src, BL
             blend_color( dst_r, src >> 16, blend.SourceConstantAlpha ) << 16);
 }
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* blend_argb_alpha() on two pixels expanded to 16-bit components */
+static inline SSE2_FUNC __m128i blend_argb_alpha_sse2( __m128i dst, __m128i src, __m128i alpha, BOOL scale )
+{
+    __m128i src_alpha;
+
+    if (scale) src = div255_sse2( _mm_mullo_epi16( src, alpha ));
+    src_alpha = _mm_shufflehi_epi16( _mm_shufflelo_epi16( src, 0xff ), 0xff );
+    return _mm_add_epi16( src, div255_sse2( _mm_mullo_epi16( dst, _mm_sub_epi16( _mm_set1_epi16( 255 ), src_alpha ))));
+}
+
+static SSE2_FUNC int blend_argb_row_sse2( DWORD *dst, const DWORD *src, int count, DWORD alpha )
+{
+    const __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16( 255 ), alpha16 = _mm_set1_epi16( alpha );
+    __m128i s, d, lo, hi;
+    int x, i;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        s = _mm_loadu_si128( (const __m128i *)(src + x) );
+        d = _mm_loadu_si128( (const __m128i *)(dst + x) );
+        lo = blend_argb_alpha_sse2( _mm_unpacklo_epi8( d, zero ), _mm_unpacklo_epi8( s, zero ),
+                                    alpha16, alpha != 255 );
+        hi = blend_argb_alpha_sse2( _mm_unpackhi_epi8( d, zero ), _mm_unpackhi_epi8( s, zero ),
+                                    alpha16, alpha != 255 );
+        /* components of sources that aren't premultiplied carry into the next one */
+        if (_mm_movemask_epi8( _mm_or_si128( _mm_cmpgt_epi16( lo, max ), _mm_cmpgt_epi16( hi, max ))))
+        {
+            for (i = x; i < x + 4; i++) dst[i] = blend_argb_alpha( dst[i], src[i], alpha );
+            continue;
+        }
+        _mm_storeu_si128( (__m128i *)(dst + x), _mm_packus_epi16( lo, hi ));
+    }
+    return x;
+}
+
+static inline AVX2_FUNC __m256i blend_argb_alpha_avx2( __m256i dst, __m256i src, __m256i alpha, BOOL scale )
+{
+    __m256i src_alpha;
+
+    if (scale) src = div255_avx2( _mm256_mullo_epi16( src, alpha ));
+    src_alpha = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( src, 0xff ), 0xff );
+    return _mm256_add_epi16( src, div255_avx2( _mm256_mullo_epi16( dst, _mm256_sub_epi16( _mm256_set1_epi16( 255 ),
+                                                                                          src_alpha ))));
+}
+
+static AVX2_FUNC int blend_argb_row_avx2( DWORD *dst, const DWORD *src, int count, DWORD alpha )
+{
+    const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16( 255 ), alpha16 = _mm256_set1_epi16( alpha );
+    __m256i s, d, lo, hi;
+    int x, i;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        s = _mm256_loadu_si256( (const __m256i *)(src + x) );
+        d = _mm256_loadu_si256( (const __m256i *)(dst + x) );
+        lo = blend_argb_alpha_avx2( _mm256_unpacklo_epi8( d, zero ), _mm256_unpacklo_epi8( s, zero ),
+                                    alpha16, alpha != 255 );
+        hi = blend_argb_alpha_avx2( _mm256_unpackhi_epi8( d, zero ), _mm256_unpackhi_epi8( s, zero ),
+                                    alpha16, alpha != 255 );
+        if (_mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpgt_epi16( lo, max ), _mm256_cmpgt_epi16( hi, max ))))
+        {
+            for (i = x; i < x + 8; i++) dst[i] = blend_argb_alpha( dst[i], src[i], alpha );
+            continue;
+        }
+        _mm256_storeu_si256( (__m256i *)(dst + x), _mm256_packus_epi16( lo, hi ));
+    }
+    return x;
+}
+
+/* blend_argb_constant_alpha() on two pixels expanded to 16-bit components */
+static inline SSE2_FUNC __m128i blend_constant_alpha_sse2( __m128i dst, __m128i src, __m128i alpha, __m128i inv_alpha )
+{
+    return div255_sse2( _mm_add_epi16( _mm_mullo_epi16( src, alpha ), _mm_mullo_epi16( dst, inv_alpha )));
+}
+
+static SSE2_FUNC int blend_constant_alpha_row_sse2( DWORD *dst, const DWORD *src, int count,
+                                                    DWORD alpha, DWORD src_alpha_mask )
+{
+    const __m128i zero = _mm_setzero_si128(), mask = _mm_set1_epi32( src_alpha_mask );
+    const __m128i alpha16 = _mm_set1_epi16( alpha ), inv_alpha16 = _mm_set1_epi16( 255 - alpha );
+    __m128i s, d, lo, hi;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        s = _mm_or_si128( _mm_loadu_si128( (const __m128i *)(src + x) ), mask );
+        d = _mm_loadu_si128( (const __m128i *)(dst + x) );
+        lo = blend_constant_alpha_sse2( _mm_unpacklo_epi8( d, zero ), _mm_unpacklo_epi8( s, zero ), alpha16, inv_alpha16 );
+        hi = blend_constant_alpha_sse2( _mm_unpackhi_epi8( d, zero ), _mm_unpackhi_epi8( s, zero ), alpha16, inv_alpha16 );
+        _mm_storeu_si128( (__m128i *)(dst + x), _mm_packus_epi16( lo, hi ));
+    }
+    return x;
+}
+
+static inline AVX2_FUNC __m256i blend_constant_alpha_avx2( __m256i dst, __m256i src, __m256i alpha, __m256i inv_alpha )
+{
+    return div255_avx2( _mm256_add_epi16( _mm256_mullo_epi16( src, alpha ), _mm256_mullo_epi16( dst, inv_alpha )));
+}
+
+static AVX2_FUNC int blend_constant_alpha_row_avx2( DWORD *dst, const DWORD *src, int count,
+                                                    DWORD alpha, DWORD src_alpha_mask )
+{
+    const __m256i zero = _mm256_setzero_si256(), mask = _mm256_set1_epi32( src_alpha_mask );
+    const __m256i alpha16 = _mm256_set1_epi16( alpha ), inv_alpha16 = _mm256_set1_epi16( 255 - alpha );
+    __m256i s, d, lo, hi;
+    int x;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        s = _mm256_or_si256( _mm256_loadu_si256( (const __m256i *)(src + x) ), mask );
+        d = _mm256_loadu_si256( (const __m256i *)(dst + x) );
+        lo = blend_constant_alpha_avx2( _mm256_unpacklo_epi8( d, zero ), _mm256_unpacklo_epi8( s, zero ),
+                                        alpha16, inv_alpha16 );
+        hi = blend_constant_alpha_avx2( _mm256_unpackhi_epi8( d, zero ), _mm256_unpackhi_epi8( s, zero ),
+                                        alpha16, inv_alpha16 );
+        _mm256_storeu_si256( (__m256i *)(dst + x), _mm256_packus_epi16( lo, hi ));
+    }
+    return x;
+}
+
+static inline int blend_argb_row_simd( DWORD *dst, const DWORD *src, int count, DWORD alpha )
+{
+    switch (get_simd_level())
+    {
+    case SIMD_AVX2: return blend_argb_row_avx2( dst, src, count, alpha );
+    case SIMD_SSE2: return blend_argb_row_sse2( dst, src, count, alpha );
+    default: return 0;
+    }
+}
+
+/* src_alpha_mask is or'ed to the source pixels, to blend them as opaque */
+static inline int blend_constant_alpha_row_simd( DWORD *dst, const DWORD *src, int count,
+                                                 DWORD alpha, DWORD src_alpha_mask )
+{
+    switch (get_simd_level())
+    {
+    case SIMD_AVX2: return blend_constant_alpha_row_avx2( dst, src, count, alpha, src_alpha_mask );
+    case SIMD_SSE2: return blend_constant_alpha_row_sse2( dst, src, count, alpha, src_alpha_mask );
+    default: return 0;
+    }
+}
+
+#else  /* __GNUC__ && (__i386__ || __x86_64__) */
+
+static inline int blend_argb_row_simd( DWORD *dst, const DWORD *src, int count, DWORD alpha )
+{
+    return 0;
+}
+
+static inline int blend_constant_alpha_row_simd( DWORD *dst, const DWORD *src, int count,
+                                                 DWORD alpha, DWORD src_alpha_mask )
+{
+    return 0;
+}
+
+#endif  /* __GNUC__ && (__i386__ || __x86_64__) */
+
 static void blend_rects_8888(const dib_info *dst, int num, const RECT *rc,
                              const dib_info *src, const POINT *offset, BLENDFUNCTION blend)
 {
@@ -4696,20 +4904,26 @@ static void blend_rects_8888(const dib_info *dst, int num, const RECT *rc,
         {
             if (blend.SourceConstantAlpha == 255)
                 for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
-                    for (x = 0; x < rc->right - rc->left; x++)
+                    for (x = blend_argb_row_simd( dst_ptr, src_ptr, rc->right - rc->left, 255 );
+                         x < rc->right - rc->left; x++)
                         dst_ptr[x] = blend_argb( dst_ptr[x], src_ptr[x] );
             else
                 for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
-                    for (x = 0; x < rc->right - rc->left; x++)
+                    for (x = blend_argb_row_simd( dst_ptr, src_ptr, rc->right - rc->left, blend.SourceConstantAlpha );
+                         x < rc->right - rc->left; x++)
                         dst_ptr[x] = blend_argb_alpha( dst_ptr[x], src_ptr[x], blend.SourceConstantAlpha );
         }
         else if (src->compression == BI_RGB)
             for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
-                for (x = 0; x < rc->right - rc->left; x++)
+                for (x = blend_constant_alpha_row_simd( dst_ptr, src_ptr, rc->right - rc->left,
+                                                        blend.SourceConstantAlpha, 0 );
+                     x < rc->right - rc->left; x++)
                     dst_ptr[x] = blend_argb_constant_alpha( dst_ptr[x], src_ptr[x], blend.SourceConstantAlpha );
         else
             for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
-                for (x = 0; x < rc->right - rc->left; x++)
+                for (x = blend_constant_alpha_row_simd( dst_ptr, src_ptr, rc->right - rc->left,
+                                                        blend.SourceConstantAlpha, 0xff000000 );
+                     x < rc->right - rc->left; x++)
                     dst_ptr[x] = blend_argb_no_src_alpha( dst_ptr[x], src_ptr[x], blend.SourceConstantAlpha );
     }
 }
@@ -6133,6 +6347,55 @@ static inline DWORD aa_rgb( BYTE r_dst, BYTE g_dst, BYTE b_dst, DWORD text, cons
             aa_color( r_dst, text >> 16, range->r_min, range->r_max ) << 16);
 }
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* skip or fill runs of 16 glyph pixels that are all transparent or all opaque */
+static SSE2_FUNC int draw_glyph_row_sse2( DWORD *dst, const BYTE *glyph, int count, DWORD text_pixel,
+                                          const struct intensity_range *ranges )
+{
+    const __m128i one = _mm_set1_epi8( 1 ), sixteen = _mm_set1_epi8( 16 ), text = _mm_set1_epi32( text_pixel );
+    __m128i g;
+    int x, i;
+
+    for (x = 0; x + 16 <= count; x += 16)
+    {
+        g = _mm_loadu_si128( (const __m128i *)(glyph + x) );
+        if (_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_min_epu8( g, one ), g )) == 0xffff) continue;
+        if (_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( g, sixteen ), g )) == 0xffff)
+        {
+            _mm_storeu_si128( (__m128i *)(dst + x), text );
+            _mm_storeu_si128( (__m128i *)(dst + x + 4), text );
+            _mm_storeu_si128( (__m128i *)(dst + x + 8), text );
+            _mm_storeu_si128( (__m128i *)(dst + x + 12), text );
+            continue;
+        }
+        for (i = x; i < x + 16; i++)
+        {
+            if (glyph[i] <= 1) continue;
+            if (glyph[i] >= 16) { dst[i] = text_pixel; continue; }
+            dst[i] = aa_rgb( dst[i] >> 16, dst[i] >> 8, dst[i], text_pixel, ranges + glyph[i] );
+        }
+    }
+    return x;
+}
+
+static inline int draw_glyph_row_simd( DWORD *dst, const BYTE *glyph, int count, DWORD text_pixel,
+                                       const struct intensity_range *ranges )
+{
+    if (get_simd_level() == SIMD_NONE) return 0;
+    return draw_glyph_row_sse2( dst, glyph, count, text_pixel, ranges );
+}
+
+#else  /* __GNUC__ && (__i386__ || __x86_64__) */
+
+static inline int draw_glyph_row_simd( DWORD *dst, const BYTE *glyph, int count, DWORD text_pixel,
+                                       const struct intensity_range *ranges )
+{
+    return 0;
+}
+
+#endif  /* __GNUC__ && (__i386__ || __x86_64__) */
+
 static void draw_glyph_8888( const dib_info *dib, const RECT *rect, const dib_info *glyph,
                              const POINT *origin, DWORD text_pixel, const struct intensity_range *ranges )
 {
@@ -6142,7 +6405,8 @@ static void draw_glyph_8888( const dib_info *dib, const RECT *rect, const dib_in
 
     for (y = rect->top; y < rect->bottom; y++)
     {
-        for (x = 0; x < rect->right - rect->left; x++)
+        for (x = draw_glyph_row_simd( dst_ptr, glyph_ptr, rect->right - rect->left, text_pixel, ranges );
+             x < rect->right - rect->left; x++)
         {
             if (glyph_ptr[x] <= 1) continue;
             if (glyph_ptr[x] >= 16) { dst_ptr[x] = text_pixel; continue; }
@@ -6365,6 +6629,82 @@ static inline DWORD blend_subpixel( BYTE r, BYTE g, BYTE b, DWORD text, DWORD al
            blend_color( b, text,       (BYTE) alpha );
 }
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* blend_subpixel() without gamma correction; pixels with a zero glyph value are left alone */
+static SSE2_FUNC int draw_subpixel_glyph_row_sse2( DWORD *dst, const DWORD *glyph, int count, DWORD text_pixel )
+{
+    const __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16( 255 ), rgb = _mm_set1_epi32( 0x00ffffff );
+    const __m128i text = _mm_unpacklo_epi8( _mm_set1_epi32( text_pixel ), zero );
+    __m128i g, d, lo, hi, res, skip;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        g = _mm_loadu_si128( (const __m128i *)(glyph + x) );
+        d = _mm_loadu_si128( (const __m128i *)(dst + x) );
+        lo = _mm_unpacklo_epi8( g, zero );
+        hi = _mm_unpackhi_epi8( g, zero );
+        lo = div255_sse2( _mm_add_epi16( _mm_mullo_epi16( text, lo ),
+                                         _mm_mullo_epi16( _mm_unpacklo_epi8( d, zero ), _mm_sub_epi16( max, lo ))));
+        hi = div255_sse2( _mm_add_epi16( _mm_mullo_epi16( text, hi ),
+                                         _mm_mullo_epi16( _mm_unpackhi_epi8( d, zero ), _mm_sub_epi16( max, hi ))));
+        res = _mm_and_si128( _mm_packus_epi16( lo, hi ), rgb );
+        skip = _mm_cmpeq_epi32( g, zero );
+        _mm_storeu_si128( (__m128i *)(dst + x), _mm_or_si128( _mm_and_si128( skip, d ), _mm_andnot_si128( skip, res )));
+    }
+    return x;
+}
+
+static AVX2_FUNC int draw_subpixel_glyph_row_avx2( DWORD *dst, const DWORD *glyph, int count, DWORD text_pixel )
+{
+    const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16( 255 ), rgb = _mm256_set1_epi32( 0x00ffffff );
+    const __m256i text = _mm256_unpacklo_epi8( _mm256_set1_epi32( text_pixel ), zero );
+    __m256i g, d, lo, hi, res, skip;
+    int x;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        g = _mm256_loadu_si256( (const __m256i *)(glyph + x) );
+        d = _mm256_loadu_si256( (const __m256i *)(dst + x) );
+        lo = _mm256_unpacklo_epi8( g, zero );
+        hi = _mm256_unpackhi_epi8( g, zero );
+        lo = div255_avx2( _mm256_add_epi16( _mm256_mullo_epi16( text, lo ),
+                                            _mm256_mullo_epi16( _mm256_unpacklo_epi8( d, zero ),
+                                                                _mm256_sub_epi16( max, lo ))));
+        hi = div255_avx2( _mm256_add_epi16( _mm256_mullo_epi16( text, hi ),
+                                            _mm256_mullo_epi16( _mm256_unpackhi_epi8( d, zero ),
+                                                                _mm256_sub_epi16( max, hi ))));
+        res = _mm256_and_si256( _mm256_packus_epi16( lo, hi ), rgb );
+        skip = _mm256_cmpeq_epi32( g, zero );
+        _mm256_storeu_si256( (__m256i *)(dst + x), _mm256_blendv_epi8( res, d, skip ));
+    }
+    return x;
+}
+
+static inline int draw_subpixel_glyph_row_simd( DWORD *dst, const DWORD *glyph, int count, DWORD text_pixel,
+                                                const struct font_gamma_ramp *gamma_ramp )
+{
+    if (gamma_ramp != NULL && gamma_ramp->gamma != 1000) return 0;
+
+    switch (get_simd_level())
+    {
+    case SIMD_AVX2: return draw_subpixel_glyph_row_avx2( dst, glyph, count, text_pixel );
+    case SIMD_SSE2: return draw_subpixel_glyph_row_sse2( dst, glyph, count, text_pixel );
+    default: return 0;
+    }
+}
+
+#else  /* __GNUC__ && (__i386__ || __x86_64__) */
+
+static inline int draw_subpixel_glyph_row_simd( DWORD *dst, const DWORD *glyph, int count, DWORD text_pixel,
+                                                const struct font_gamma_ramp *gamma_ramp )
+{
+    return 0;
+}
+
+#endif  /* __GNUC__ && (__i386__ || __x86_64__) */
+
 static void draw_subpixel_glyph_8888( const dib_info *dib, const RECT *rect, const dib_info *glyph,
                                       const POINT *origin, DWORD text_pixel,
                                       const struct font_gamma_ramp *gamma_ramp )
@@ -6375,7 +6715,8 @@ static void draw_subpixel_glyph_8888( const dib_info *dib, const RECT *rect, con
 
     for (y = rect->top; y < rect->bottom; y++)
     {
-        for (x = 0; x < rect->right - rect->left; x++)
+        for (x = draw_subpixel_glyph_row_simd( dst_ptr, glyph_ptr, rect->right - rect->left, text_pixel, gamma_ramp );
+             x < rect->right - rect->left; x++)
         {
             if (glyph_ptr[x] == 0) continue;
             dst_ptr[x] = blend_subpixel( dst_ptr[x] >> 16, dst_ptr[x] >> 8, dst_ptr[x],
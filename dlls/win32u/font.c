@@ -6404,6 +6404,7 @@ UINT font_init(void)
         load_registry_fonts();
         load_font_list_from_cache();
     }
+    font_funcs->save_font_catalog();
 
     reorder_font_list();
     load_gdi_font_subst();
@@ -30,6 +30,7 @@
 
 #include <stdarg.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #ifdef HAVE_SYS_STAT_H
 # include <sys/stat.h>
 #endif
@@ -42,6 +43,9 @@
 #endif
 #include <stdio.h>
 #include <assert.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #ifdef HAVE_CARBON_CARBON_H
 #define LoadResource __carbon_LoadResource
@@ -295,6 +299,7 @@ static struct list mappings_list = LIST_INIT( mappings_list );
 static UINT default_aa_flags;
 static LCID system_lcid;
 
+static char *get_unix_file_name( LPCWSTR path );
 static BOOL CDECL freetype_set_outline_text_metrics( struct gdi_font *font );
 static BOOL CDECL freetype_set_bitmap_text_metrics( struct gdi_font *font );
 
@@ -1189,6 +1194,373 @@ struct unix_face
     struct bitmap_font_size size;
 };
 
+/* font catalog */
+
+/* The parsed properties of the font files are kept in a catalog file that is mapped by
+ * all the processes of a prefix, so that the font files only need to be opened when
+ * they are added or modified. The catalog is rewritten when a process finds faces that
+ * aren't in it, or that are no longer used at startup. */
+
+#define FONT_CATALOG_MAGIC    0x4e465757  /* "WWFN" */
+#define FONT_CATALOG_VERSION  1
+
+#define CATALOG_FACE_VALID        0x01  /* the file contains a usable face */
+#define CATALOG_FACE_SCALABLE     0x02
+#define CATALOG_FACE_ALLOW_BITMAP 0x04  /* the face was parsed with ADDFONT_ALLOW_BITMAP */
+
+enum catalog_name
+{
+    CATALOG_FILE_NAME,
+    CATALOG_FAMILY_NAME,
+    CATALOG_SECOND_NAME,
+    CATALOG_STYLE_NAME,
+    CATALOG_FULL_NAME,
+    CATALOG_NB_NAMES
+};
+
+struct font_catalog_header
+{
+    UINT   magic;
+    UINT   version;
+    UINT   lcid;        /* locale used to select the face names */
+    UINT   size;        /* total size of the catalog */
+    UINT   count;       /* number of faces */
+    UINT   hash_size;   /* number of hash buckets */
+    UINT   buckets[1];  /* offset of the first face of each bucket */
+};
+
+struct font_catalog_face
+{
+    UINT    next;          /* offset of the next face in the same bucket */
+    UINT    hash;          /* hash of the file name and face index */
+    UINT    size;          /* size of the face entry, including the names */
+    UINT    flags;         /* CATALOG_FACE_* flags */
+    ULONGLONG file_size;
+    LONGLONG  file_mtime;
+    UINT    face_index;
+    UINT    num_faces;
+    UINT    ntm_flags;
+    UINT    font_version;
+    FONTSIGNATURE fs;
+    struct bitmap_font_size bitmap_size;
+    USHORT  name_len[CATALOG_NB_NAMES];  /* length of the names including the null, 0 if missing */
+    /* followed by the unix file name in bytes and the face names in WCHARs */
+};
+
+#define CATALOG_RECORD_BUCKETS 256
+
+struct catalog_entry
+{
+    struct list               entry;
+    struct font_catalog_face *face;
+};
+
+static const struct font_catalog_header *font_catalog;
+static char *font_catalog_path;
+static struct list catalog_entries[CATALOG_RECORD_BUCKETS];  /* faces seen at startup */
+static UINT catalog_count;
+static BOOL catalog_recording;
+static BOOL catalog_modified;
+
+static UINT get_catalog_hash( const char *unix_name, UINT face_index )
+{
+    UINT hash = 0x811c9dc5 ^ face_index;
+
+    while (*unix_name) hash = (hash ^ (unsigned char)*unix_name++) * 0x01000193;
+    return hash;
+}
+
+static const char *get_catalog_file_name( const struct font_catalog_face *face )
+{
+    return (const char *)(face + 1);
+}
+
+static const WCHAR *get_catalog_name( const struct font_catalog_face *face, enum catalog_name name )
+{
+    const char *ptr = (const char *)(face + 1) + ((face->name_len[CATALOG_FILE_NAME] + 1) & ~1);
+    UINT i;
+
+    if (!face->name_len[name]) return NULL;
+    for (i = CATALOG_FAMILY_NAME; i < name; i++) ptr += face->name_len[i] * sizeof(WCHAR);
+    return (const WCHAR *)ptr;
+}
+
+static void map_font_catalog(void)
+{
+    static const WCHAR catalogW[] = {'\\','?','?','\\','C',':','\\','w','i','n','d','o','w','s','\\',
+                                     's','y','s','t','e','m','3','2','\\','f','n','t','c','a','c','h','e','.','d','a','t',0};
+    const struct font_catalog_header *header;
+    const char *env = getenv( "WINEFONTCATALOG" );
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    if (env && !atoi( env )) return;
+    if (!(font_catalog_path = get_unix_file_name( catalogW ))) return;
+    for (fd = 0; fd < CATALOG_RECORD_BUCKETS; fd++) list_init( &catalog_entries[fd] );
+    catalog_recording = TRUE;
+
+    if ((fd = open( font_catalog_path, O_RDONLY )) == -1) return;
+    if (fstat( fd, &st ) == -1 || st.st_size < sizeof(*header) || st.st_size > 0x40000000)
+    {
+        close( fd );
+        return;
+    }
+    ptr = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (ptr == MAP_FAILED) return;
+
+    header = ptr;
+    if (header->magic != FONT_CATALOG_MAGIC || header->version != FONT_CATALOG_VERSION ||
+        header->lcid != system_lcid || header->size != st.st_size || !header->hash_size ||
+        (header->hash_size & (header->hash_size - 1)) ||
+        header->hash_size > (header->size - offsetof( struct font_catalog_header, buckets )) / sizeof(UINT))
+    {
+        TRACE( "ignoring outdated catalog %s\n", debugstr_a(font_catalog_path) );
+        munmap( ptr, st.st_size );
+        return;
+    }
+    TRACE( "mapped %s, %u faces\n", debugstr_a(font_catalog_path), header->count );
+    font_catalog = header;
+}
+
+/* check that a face entry is entirely inside the catalog */
+static const struct font_catalog_face *get_catalog_face( UINT offset )
+{
+    const struct font_catalog_face *face;
+    UINT i, size;
+
+    if (!offset || offset % sizeof(UINT64) || offset > font_catalog->size - sizeof(*face)) return NULL;
+    face = (const struct font_catalog_face *)((const char *)font_catalog + offset);
+    if (face->size > font_catalog->size - offset) return NULL;
+    size = sizeof(*face) + ((face->name_len[CATALOG_FILE_NAME] + 1) & ~1);
+    for (i = CATALOG_FAMILY_NAME; i < CATALOG_NB_NAMES; i++) size += face->name_len[i] * sizeof(WCHAR);
+    if (size > face->size || !face->name_len[CATALOG_FILE_NAME]) return NULL;
+    if (get_catalog_file_name( face )[face->name_len[CATALOG_FILE_NAME] - 1]) return NULL;
+    for (i = CATALOG_FAMILY_NAME; i < CATALOG_NB_NAMES; i++)
+        if (face->name_len[i] && get_catalog_name( face, i )[face->name_len[i] - 1]) return NULL;
+    return face;
+}
+
+static BOOL is_same_catalog_face( const struct font_catalog_face *face1, const struct font_catalog_face *face2 )
+{
+    return face1->hash == face2->hash && face1->face_index == face2->face_index &&
+           (face1->flags & CATALOG_FACE_ALLOW_BITMAP) == (face2->flags & CATALOG_FACE_ALLOW_BITMAP) &&
+           !strcmp( get_catalog_file_name( face1 ), get_catalog_file_name( face2 ));
+}
+
+/* add a face to the list of faces to store in the catalog; takes ownership of the face */
+static void record_catalog_face( struct font_catalog_face *face )
+{
+    struct list *bucket = &catalog_entries[face->hash % CATALOG_RECORD_BUCKETS];
+    struct catalog_entry *entry;
+
+    LIST_FOR_EACH_ENTRY( entry, bucket, struct catalog_entry, entry )
+    {
+        if (!is_same_catalog_face( entry->face, face )) continue;
+        free( face );
+        return;
+    }
+    if (!(entry = malloc( sizeof(*entry) )))
+    {
+        free( face );
+        return;
+    }
+    entry->face = face;
+    list_add_tail( bucket, &entry->entry );
+    catalog_count++;
+}
+
+/* look for a face in the catalog; returns FALSE if it needs to be parsed from the file */
+static BOOL find_catalog_face( const char *unix_name, const struct stat *st, UINT face_index,
+                               DWORD flags, struct unix_face **ret )
+{
+    const struct font_catalog_face *face;
+    struct font_catalog_face *copy;
+    struct unix_face *This;
+    UINT hash, offset, count = 0;
+
+    if (!font_catalog) return FALSE;
+
+    hash = get_catalog_hash( unix_name, face_index );
+    offset = font_catalog->buckets[hash & (font_catalog->hash_size - 1)];
+    for (;;)
+    {
+        if (count++ >= font_catalog->count || !(face = get_catalog_face( offset ))) return FALSE;
+        if (face->hash == hash && face->face_index == face_index &&
+            !(face->flags & CATALOG_FACE_ALLOW_BITMAP) == !(flags & ADDFONT_ALLOW_BITMAP) &&
+            !strcmp( get_catalog_file_name( face ), unix_name )) break;
+        offset = face->next;
+    }
+    if (face->file_size != st->st_size || face->file_mtime != st->st_mtime) return FALSE;
+
+    *ret = NULL;
+    if (catalog_recording && (copy = malloc( face->size )))
+    {
+        memcpy( copy, face, face->size );
+        record_catalog_face( copy );
+    }
+    if (!(face->flags & CATALOG_FACE_VALID)) return TRUE;
+    if (!(This = calloc( 1, sizeof(*This) ))) return TRUE;
+
+    This->scalable     = !!(face->flags & CATALOG_FACE_SCALABLE);
+    This->num_faces    = face->num_faces;
+    This->ntm_flags    = face->ntm_flags;
+    This->font_version = face->font_version;
+    This->fs           = face->fs;
+    This->size         = face->bitmap_size;
+    if (face->name_len[CATALOG_FAMILY_NAME])
+        This->family_name = strdupW( get_catalog_name( face, CATALOG_FAMILY_NAME ));
+    if (face->name_len[CATALOG_SECOND_NAME])
+        This->second_name = strdupW( get_catalog_name( face, CATALOG_SECOND_NAME ));
+    if (face->name_len[CATALOG_STYLE_NAME])
+        This->style_name = strdupW( get_catalog_name( face, CATALOG_STYLE_NAME ));
+    if (face->name_len[CATALOG_FULL_NAME])
+        This->full_name = strdupW( get_catalog_name( face, CATALOG_FULL_NAME ));
+    *ret = This;
+    return TRUE;
+}
+
+/* remember a face parsed from its file, to be stored in the catalog */
+static void add_catalog_face( const char *unix_name, const struct stat *st, UINT face_index,
+                              DWORD flags, const struct unix_face *unix_face )
+{
+    const WCHAR *names[CATALOG_NB_NAMES];
+    struct font_catalog_face *face;
+    UINT i, len, size;
+    char *ptr;
+
+    if (!catalog_recording) return;
+    catalog_modified = TRUE;
+
+    if ((len = strlen( unix_name ) + 1) > 0xffff) return;
+    names[CATALOG_FILE_NAME] = NULL;
+    names[CATALOG_FAMILY_NAME] = unix_face ? unix_face->family_name : NULL;
+    names[CATALOG_SECOND_NAME] = unix_face ? unix_face->second_name : NULL;
+    names[CATALOG_STYLE_NAME] = unix_face ? unix_face->style_name : NULL;
+    names[CATALOG_FULL_NAME] = unix_face ? unix_face->full_name : NULL;
+
+    size = sizeof(*face) + ((len + 1) & ~1);
+    for (i = CATALOG_FAMILY_NAME; i < CATALOG_NB_NAMES; i++)
+        if (names[i]) size += (lstrlenW( names[i] ) + 1) * sizeof(WCHAR);
+    size = (size + sizeof(UINT64) - 1) & ~(sizeof(UINT64) - 1);
+
+    if (!(face = calloc( 1, size ))) return;
+    face->hash       = get_catalog_hash( unix_name, face_index );
+    face->size       = size;
+    face->file_size  = st->st_size;
+    face->file_mtime = st->st_mtime;
+    face->face_index = face_index;
+    if (flags & ADDFONT_ALLOW_BITMAP) face->flags |= CATALOG_FACE_ALLOW_BITMAP;
+    if (unix_face)
+    {
+        face->flags |= CATALOG_FACE_VALID;
+        if (unix_face->scalable) face->flags |= CATALOG_FACE_SCALABLE;
+        face->num_faces    = unix_face->num_faces;
+        face->ntm_flags    = unix_face->ntm_flags;
+        face->font_version = unix_face->font_version;
+        face->fs           = unix_face->fs;
+        face->bitmap_size  = unix_face->size;
+    }
+
+    face->name_len[CATALOG_FILE_NAME] = len;
+    memcpy( face + 1, unix_name, len );
+    ptr = (char *)(face + 1) + ((len + 1) & ~1);
+    for (i = CATALOG_FAMILY_NAME; i < CATALOG_NB_NAMES; i++)
+    {
+        if (!names[i]) continue;
+        len = min( lstrlenW( names[i] ) + 1, 0xffff );
+        face->name_len[i] = len;
+        memcpy( ptr, names[i], len * sizeof(WCHAR) );
+        ptr += len * sizeof(WCHAR);
+    }
+
+    record_catalog_face( face );
+}
+
+static void write_font_catalog(void)
+{
+    struct font_catalog_header *header;
+    struct font_catalog_face *face;
+    struct catalog_entry *entry;
+    UINT hash_size, size, pos, *bucket;
+    char *buffer, *tmp_path;
+    int i, fd, ret = -1;
+
+    for (hash_size = 16; hash_size < catalog_count; hash_size *= 2) ;
+    size = offsetof( struct font_catalog_header, buckets[hash_size] );
+    size = (size + sizeof(UINT64) - 1) & ~(sizeof(UINT64) - 1);
+    pos = size;
+    for (i = 0; i < CATALOG_RECORD_BUCKETS; i++)
+        LIST_FOR_EACH_ENTRY( entry, &catalog_entries[i], struct catalog_entry, entry )
+            size += entry->face->size;
+
+    if (!(buffer = calloc( 1, size ))) return;
+    header = (struct font_catalog_header *)buffer;
+    header->magic = FONT_CATALOG_MAGIC;
+    header->version = FONT_CATALOG_VERSION;
+    header->lcid = system_lcid;
+    header->size = size;
+    header->count = catalog_count;
+    header->hash_size = hash_size;
+    for (i = 0; i < CATALOG_RECORD_BUCKETS; i++)
+    {
+        LIST_FOR_EACH_ENTRY( entry, &catalog_entries[i], struct catalog_entry, entry )
+        {
+            face = (struct font_catalog_face *)(buffer + pos);
+            memcpy( face, entry->face, entry->face->size );
+            bucket = &header->buckets[face->hash & (hash_size - 1)];
+            face->next = *bucket;
+            *bucket = pos;
+            pos += face->size;
+        }
+    }
+
+    /* write a new file and rename it, processes that have the old one mapped keep using it */
+    if ((tmp_path = malloc( strlen( font_catalog_path ) + 16 )))
+    {
+        sprintf( tmp_path, "%s.%x", font_catalog_path, getpid() );
+        if ((fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666 )) != -1)
+        {
+            if (write( fd, buffer, size ) == size) ret = 0;
+            close( fd );
+            if (!ret) ret = rename( tmp_path, font_catalog_path );
+            if (ret) unlink( tmp_path );
+        }
+        free( tmp_path );
+    }
+    TRACE( "wrote %u faces to %s, ret %d\n", catalog_count, debugstr_a(font_catalog_path), ret );
+    free( buffer );
+}
+
+/*************************************************************
+ * freetype_save_font_catalog
+ *
+ * Called once the fonts loaded at startup have been added.
+ */
+static void CDECL freetype_save_font_catalog(void)
+{
+    struct catalog_entry *entry, *next;
+    UINT i;
+
+    if (!catalog_recording) return;
+    catalog_recording = FALSE;
+
+    /* rewrite the catalog if faces have been added or removed */
+    if (catalog_modified || !font_catalog || catalog_count != font_catalog->count)
+        write_font_catalog();
+
+    for (i = 0; i < CATALOG_RECORD_BUCKETS; i++)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( entry, next, &catalog_entries[i], struct catalog_entry, entry )
+        {
+            list_remove( &entry->entry );
+            free( entry->face );
+            free( entry );
+        }
+    }
+}
+
 static struct unix_face *unix_face_create( const char *unix_name, void *data_ptr, DWORD data_size,
                                            UINT face_index, DWORD flags )
 {
@@ -1206,6 +1578,8 @@ static struct unix_face *unix_face_create( const char *unix_name, void *data_ptr
 
     if (unix_name)
     {
+        if (stat( unix_name, &st ) == -1) return NULL;
+        if (find_catalog_face( unix_name, &st, face_index, flags, &This )) return This;
         if ((fd = open( unix_name, O_RDONLY )) == -1) return NULL;
         if (fstat( fd, &st ) == -1)
         {
@@ -1218,7 +1592,11 @@ static struct unix_face *unix_face_create( const char *unix_name, void *data_ptr
         if (data_ptr == MAP_FAILED) return NULL;
     }
 
-    if (!(This = calloc( 1, sizeof(*This) ))) goto done;
+    if (!(This = calloc( 1, sizeof(*This) )))
+    {
+        if (unix_name) munmap( data_ptr, data_size );
+        return NULL;
+    }
 
     if (opentype_get_ttc_sfnt_v1( data_ptr, data_size, face_index, &face_count, &ttc_sfnt_v1 ) &&
         opentype_get_tt_name_v0( data_ptr, data_size, ttc_sfnt_v1, &tt_name_v0 ) &&
@@ -1300,8 +1678,11 @@ static struct unix_face *unix_face_create( const char *unix_name, void *data_ptr
         This = NULL;
     }
 
-done:
-    if (unix_name) munmap( data_ptr, data_size );
+    if (unix_name)
+    {
+        munmap( data_ptr, data_size );
+        add_catalog_face( unix_name, &st, face_index, flags, This );
+    }
     return This;
 }
 
@@ -4271,6 +4652,7 @@ static DWORD CDECL freetype_get_kerning_pairs( struct gdi_font *font, KERNINGPAI
 static const struct font_backend_funcs font_funcs =
 {
     freetype_load_fonts,
+    freetype_save_font_catalog,
     fontconfig_enum_family_fallbacks,
     freetype_add_font,
     freetype_add_mem_font,
@@ -4295,6 +4677,7 @@ const struct font_backend_funcs *init_freetype_lib(void)
     init_fontconfig();
 #endif
     NtQueryDefaultLocale( FALSE, &system_lcid );
+    map_font_catalog();
     return &font_funcs;
 }
 
@@ -306,6 +306,7 @@ struct gdi_font
 struct font_backend_funcs
 {
     void  (CDECL *load_fonts)(void);
+    void  (CDECL *save_font_catalog)(void);
     BOOL  (CDECL *enum_family_fallbacks)( DWORD pitch_and_family, int index, WCHAR buffer[LF_FACESIZE] );
     INT   (CDECL *add_font)( const WCHAR *file, DWORD flags );
     INT   (CDECL *add_mem_font)( void *ptr, SIZE_T size, DWORD flags );
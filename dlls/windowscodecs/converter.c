@@ -19,6 +19,9 @@
 
 #include <stdarg.h>
 #include <math.h>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#endif
 
 #define COBJMACROS
 
@@ -131,6 +134,433 @@ static void to_sRGB(BYTE *bgr)
 }
 #endif
 
+/* to_sRGB_component() of linear values converted to bytes, as a lookup: srgb_thresholds[i]
+ * is the smallest value that gives i, and srgb_buckets[] the byte for the start of each
+ * of the SRGB_BUCKETS intervals of [0,1], after which at most a couple of thresholds
+ * need to be checked. */
+#define SRGB_BUCKETS 4096
+static float srgb_thresholds[256];
+static BYTE srgb_buckets[SRGB_BUCKETS];
+
+static BYTE to_sRGB_byte_slow(float f)
+{
+    return (BYTE)floorf(to_sRGB_component(f) * 255.0f + 0.51f);
+}
+
+static void init_srgb_tables(void)
+{
+    UINT i, v, lo, hi, mid;
+    float f;
+
+    /* binary search on the bit patterns of the positive floats, which sort like them */
+    for (i = 1; i < 256; i++)
+    {
+        lo = 0;
+        hi = 0x3f800000; /* 1.0f */
+        while (lo < hi)
+        {
+            mid = lo + (hi - lo) / 2;
+            memcpy(&f, &mid, sizeof(f));
+            if (to_sRGB_byte_slow(f) >= i) hi = mid;
+            else lo = mid + 1;
+        }
+        memcpy(&srgb_thresholds[i], &lo, sizeof(float));
+    }
+
+    for (i = v = 0; i < SRGB_BUCKETS; i++)
+    {
+        f = (float)i / SRGB_BUCKETS;
+        while (v < 255 && f >= srgb_thresholds[v + 1]) v++;
+        srgb_buckets[i] = v;
+    }
+}
+
+static inline BYTE to_sRGB_byte(float f)
+{
+    UINT i;
+
+    if (!(f > 0.0f)) return 0;
+    if (f >= 1.0f) return 255;
+    i = srgb_buckets[(UINT)(f * SRGB_BUCKETS)];
+    while (i < 255 && f >= srgb_thresholds[i + 1]) i++;
+    return i;
+}
+
+/* palette colors laid out for the nearest color search, in groups of 4 */
+struct palette_search
+{
+    UINT groups;
+    SHORT rg[2 * 256]; /* red and green components */
+    SHORT b[2 * 256];  /* blue component and 0 */
+};
+
+static void init_palette_search(struct palette_search *search, const WICColor *colors, UINT count)
+{
+    UINT i;
+
+    search->groups = (count + 3) / 4;
+    for (i = 0; i < search->groups * 4; i++)
+    {
+        /* padding entries are farther than any color */
+        search->rg[2 * i] = i < count ? (BYTE)(colors[i] >> 16) : 1000;
+        search->rg[2 * i + 1] = i < count ? (BYTE)(colors[i] >> 8) : 1000;
+        search->b[2 * i] = i < count ? (BYTE)colors[i] : 1000;
+        search->b[2 * i + 1] = 0;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* The SSE2 and SSSE3 row functions below handle the most common conversions. They must
+ * give exactly the same results as the generic loops, and they return the number of
+ * pixels processed, the remaining ones being left to the generic loops. */
+
+#define SSE2_FUNC __attribute__((target("sse2")))
+#define SSSE3_FUNC __attribute__((target("ssse3")))
+
+static BOOL have_sse2, have_ssse3;
+
+static void init_simd(void)
+{
+    have_sse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+    have_ssse3 = have_sse2 && IsProcessorFeaturePresent(PF_SSSE3_INSTRUCTIONS_AVAILABLE);
+}
+
+static SSSE3_FUNC int convert_24bpp_to_32bppBGRA_row_ssse3(DWORD *dst, const BYTE *src, int count, BOOL rgb)
+{
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    const __m128i shuffle = rgb ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i s0, s1, s2;
+    int x;
+
+    for (x = 0; x + 16 <= count; x += 16)
+    {
+        s0 = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+        s1 = _mm_loadu_si128((const __m128i *)(src + 3 * x + 16));
+        s2 = _mm_loadu_si128((const __m128i *)(src + 3 * x + 32));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_shuffle_epi8(s0, shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + x + 4),
+                         _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(s1, s0, 12), shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + x + 8),
+                         _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(s2, s1, 8), shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + x + 12),
+                         _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(s2, 4), shuffle), alpha));
+    }
+    return x;
+}
+
+static SSSE3_FUNC int convert_32bpp_to_24bppBGR_row_ssse3(BYTE *dst, const DWORD *src, int count, BOOL rgb)
+{
+    const __m128i shuffle = rgb ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128i p0, p1, p2, p3;
+    int x;
+
+    for (x = 0; x + 16 <= count; x += 16)
+    {
+        p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + x)), shuffle);
+        p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + x + 4)), shuffle);
+        p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + x + 8)), shuffle);
+        p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + x + 12)), shuffle);
+        _mm_storeu_si128((__m128i *)(dst + 3 * x), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128((__m128i *)(dst + 3 * x + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128((__m128i *)(dst + 3 * x + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+    return x;
+}
+
+/* the high bytes of the 16-bit components are kept */
+static SSSE3_FUNC int convert_48bppRGB_to_32bppBGRA_row_ssse3(DWORD *dst, const BYTE *src, int count)
+{
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    __m128i s0, s1, s2, lo, hi;
+    int x;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        s0 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 6 * x)), 8);
+        s1 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 6 * x + 16)), 8);
+        s2 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 6 * x + 32)), 8);
+        lo = _mm_packus_epi16(s0, s1);
+        hi = _mm_packus_epi16(s2, s2);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_shuffle_epi8(lo, shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + x + 4),
+                         _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(hi, lo, 12), shuffle), alpha));
+    }
+    return x;
+}
+
+static SSE2_FUNC int convert_64bppRGBA_to_32bppBGRA_row_sse2(DWORD *dst, const BYTE *src, int count)
+{
+    const __m128i mask_ag = _mm_set1_epi32(0xff00ff00), mask_b = _mm_set1_epi32(0xff);
+    __m128i s0, s1, p;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        s0 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 8 * x)), 8);
+        s1 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 8 * x + 16)), 8);
+        p = _mm_packus_epi16(s0, s1);
+        p = _mm_or_si128(_mm_and_si128(p, mask_ag),
+                         _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), mask_b),
+                                      _mm_slli_epi32(_mm_and_si128(p, mask_b), 16)));
+        _mm_storeu_si128((__m128i *)(dst + x), p);
+    }
+    return x;
+}
+
+static SSE2_FUNC int set_alpha_row_sse2(DWORD *pixels, int count)
+{
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+        _mm_storeu_si128((__m128i *)(pixels + x),
+                         _mm_or_si128(_mm_loadu_si128((const __m128i *)(pixels + x)), alpha));
+    return x;
+}
+
+/* x / 255 rounded down, for 16-bit values up to 255 * 255 */
+static inline SSE2_FUNC __m128i div255_sse2(__m128i x)
+{
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+static SSE2_FUNC int premultiply_row_sse2(DWORD *pixels, int count)
+{
+    const __m128i zero = _mm_setzero_si128(), alpha_mask = _mm_set1_epi32(0xff000000);
+    __m128i p, lo, hi;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(pixels + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(p, alpha_mask), alpha_mask)) == 0xffff)
+            continue;
+        lo = _mm_unpacklo_epi8(p, zero);
+        hi = _mm_unpackhi_epi8(p, zero);
+        lo = div255_sse2(_mm_mullo_epi16(lo, _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff)));
+        hi = div255_sse2(_mm_mullo_epi16(hi, _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff)));
+        p = _mm_or_si128(_mm_andnot_si128(alpha_mask, _mm_packus_epi16(lo, hi)), _mm_and_si128(p, alpha_mask));
+        _mm_storeu_si128((__m128i *)(pixels + x), p);
+    }
+    return x;
+}
+
+/* c * 255 / alpha truncated to a byte, which single precision computes exactly for these ranges */
+static inline SSE2_FUNC __m128i unpremultiply_sse2(__m128i c, __m128 alpha)
+{
+    __m128 f = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), _mm_set1_ps(255.0f)), alpha);
+    return _mm_and_si128(_mm_cvttps_epi32(f), _mm_set1_epi32(0xff));
+}
+
+static SSE2_FUNC int unpremultiply_row_sse2(DWORD *pixels, int count)
+{
+    const __m128i mask = _mm_set1_epi32(0xff), zero = _mm_setzero_si128();
+    __m128i p, a, keep, b, g, r;
+    __m128 alpha;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(pixels + x));
+        a = _mm_srli_epi32(p, 24);
+        keep = _mm_or_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpeq_epi32(a, mask));
+        if (_mm_movemask_epi8(keep) == 0xffff) continue;
+        /* the pixels that are kept get a non-zero divisor too */
+        alpha = _mm_cvtepi32_ps(_mm_sub_epi32(a, keep));
+        b = unpremultiply_sse2(_mm_and_si128(p, mask), alpha);
+        g = unpremultiply_sse2(_mm_and_si128(_mm_srli_epi32(p, 8), mask), alpha);
+        r = unpremultiply_sse2(_mm_and_si128(_mm_srli_epi32(p, 16), mask), alpha);
+        b = _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(a, 24)));
+        _mm_storeu_si128((__m128i *)(pixels + x), _mm_or_si128(_mm_and_si128(keep, p), _mm_andnot_si128(keep, b)));
+    }
+    return x;
+}
+
+#ifdef __x86_64__
+
+/* converted in place, the floats replacing the pixels; only on x86_64, where the generic
+ * loop also computes in single precision rather than with the x87 unit */
+static SSE2_FUNC int convert_32bppBGR_to_GrayFloat_row_sse2(DWORD *pixels, int count)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i p;
+    __m128 gray;
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(pixels + x));
+        gray = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask)), _mm_set1_ps(0.2126f)),
+                          _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask)), _mm_set1_ps(0.7152f)));
+        gray = _mm_add_ps(gray, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(p, mask)), _mm_set1_ps(0.0722f)));
+        _mm_storeu_ps((float *)(pixels + x), _mm_div_ps(gray, _mm_set1_ps(255.0f)));
+    }
+    return x;
+}
+
+#endif  /* __x86_64__ */
+
+/* same result as rgb_to_palette_index(): the first of the closest colors */
+static SSE2_FUNC int palette_index_row_sse2(BYTE *dst, const BYTE *bgr, int count,
+                                            const struct palette_search *search)
+{
+    const __m128i zero = _mm_setzero_si128(), four = _mm_set1_epi32(4);
+    __m128i color_rg, color_b, diff_rg, diff_b, diff, less, best, best_index, index;
+    int x, diffs[4], indices[4];
+    UINT i;
+
+    for (x = 0; x < count; x++, bgr += 3)
+    {
+        color_rg = _mm_set1_epi32(bgr[2] | (bgr[1] << 16));
+        color_b = _mm_set1_epi32(bgr[0]);
+        best = _mm_set1_epi32(0x7fffffff);
+        best_index = zero;
+        index = _mm_setr_epi32(0, 1, 2, 3);
+
+        for (i = 0; i < search->groups; i++)
+        {
+            diff_rg = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(search->rg + 8 * i)), color_rg);
+            diff_b = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(search->b + 8 * i)), color_b);
+            diff = _mm_add_epi32(_mm_madd_epi16(diff_rg, diff_rg), _mm_madd_epi16(diff_b, diff_b));
+            less = _mm_cmplt_epi32(diff, best);
+            best = _mm_or_si128(_mm_and_si128(less, diff), _mm_andnot_si128(less, best));
+            best_index = _mm_or_si128(_mm_and_si128(less, index), _mm_andnot_si128(less, best_index));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(diff, zero))) break;
+            index = _mm_add_epi32(index, four);
+        }
+
+        _mm_storeu_si128((__m128i *)diffs, best);
+        _mm_storeu_si128((__m128i *)indices, best_index);
+        for (i = 1; i < 4; i++)
+        {
+            if (diffs[i] < diffs[0] || (diffs[i] == diffs[0] && indices[i] < indices[0]))
+            {
+                diffs[0] = diffs[i];
+                indices[0] = indices[i];
+            }
+        }
+        dst[x] = indices[0];
+    }
+    return x;
+}
+
+static inline int convert_24bpp_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count, BOOL rgb)
+{
+    return have_ssse3 ? convert_24bpp_to_32bppBGRA_row_ssse3(dst, src, count, rgb) : 0;
+}
+
+static inline int convert_32bpp_to_24bppBGR_row_simd(BYTE *dst, const DWORD *src, int count, BOOL rgb)
+{
+    return have_ssse3 ? convert_32bpp_to_24bppBGR_row_ssse3(dst, src, count, rgb) : 0;
+}
+
+static inline int convert_48bppRGB_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count)
+{
+    return have_ssse3 ? convert_48bppRGB_to_32bppBGRA_row_ssse3(dst, src, count) : 0;
+}
+
+static inline int convert_64bppRGBA_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count)
+{
+    return have_sse2 ? convert_64bppRGBA_to_32bppBGRA_row_sse2(dst, src, count) : 0;
+}
+
+static inline int set_alpha_row_simd(DWORD *pixels, int count)
+{
+    return have_sse2 ? set_alpha_row_sse2(pixels, count) : 0;
+}
+
+static inline int premultiply_row_simd(DWORD *pixels, int count)
+{
+    return have_sse2 ? premultiply_row_sse2(pixels, count) : 0;
+}
+
+static inline int unpremultiply_row_simd(DWORD *pixels, int count)
+{
+    return have_sse2 ? unpremultiply_row_sse2(pixels, count) : 0;
+}
+
+static inline int convert_32bppBGR_to_GrayFloat_row_simd(DWORD *pixels, int count)
+{
+#ifdef __x86_64__
+    return have_sse2 ? convert_32bppBGR_to_GrayFloat_row_sse2(pixels, count) : 0;
+#else
+    return 0;
+#endif
+}
+
+static inline int palette_index_row_simd(BYTE *dst, const BYTE *bgr, int count,
+                                         const struct palette_search *search)
+{
+    return have_sse2 ? palette_index_row_sse2(dst, bgr, count, search) : 0;
+}
+
+#else  /* __GNUC__ && (__i386__ || __x86_64__) */
+
+static void init_simd(void)
+{
+}
+
+static inline int convert_24bpp_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count, BOOL rgb)
+{
+    return 0;
+}
+
+static inline int convert_32bpp_to_24bppBGR_row_simd(BYTE *dst, const DWORD *src, int count, BOOL rgb)
+{
+    return 0;
+}
+
+static inline int convert_48bppRGB_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count)
+{
+    return 0;
+}
+
+static inline int convert_64bppRGBA_to_32bppBGRA_row_simd(DWORD *dst, const BYTE *src, int count)
+{
+    return 0;
+}
+
+static inline int set_alpha_row_simd(DWORD *pixels, int count)
+{
+    return 0;
+}
+
+static inline int premultiply_row_simd(DWORD *pixels, int count)
+{
+    return 0;
+}
+
+static inline int unpremultiply_row_simd(DWORD *pixels, int count)
+{
+    return 0;
+}
+
+static inline int convert_32bppBGR_to_GrayFloat_row_simd(DWORD *pixels, int count)
+{
+    return 0;
+}
+
+static inline int palette_index_row_simd(BYTE *dst, const BYTE *bgr, int count,
+                                         const struct palette_search *search)
+{
+    return 0;
+}
+
+#endif  /* __GNUC__ && (__i386__ || __x86_64__) */
+
+static INIT_ONCE init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL WINAPI init_converter_tables(INIT_ONCE *once, void *param, void **context)
+{
+    init_srgb_tables();
+    init_simd();
+    return TRUE;
+}
+
 static inline FormatConverter *impl_from_IWICFormatConverter(IWICFormatConverter *iface)
 {
     return CONTAINING_RECORD(iface, FormatConverter, IWICFormatConverter_iface);
@@ -639,9 +1069,10 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
                 srcrow = srcdata;
                 dstrow = pbBuffer;
                 for (y=0; y<prc->Height; y++) {
-                    srcpixel=srcrow;
-                    dstpixel=dstrow;
-                    for (x=0; x<prc->Width; x++) {
+                    x = convert_24bpp_to_32bppBGRA_row_simd((DWORD *)dstrow, srcrow, prc->Width, FALSE);
+                    srcpixel=srcrow+3*x;
+                    dstpixel=dstrow+4*x;
+                    for (; x<prc->Width; x++) {
                         *dstpixel++=*srcpixel++; /* blue */
                         *dstpixel++=*srcpixel++; /* green */
                         *dstpixel++=*srcpixel++; /* red */
@@ -683,9 +1114,10 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
                 srcrow = srcdata;
                 dstrow = pbBuffer;
                 for (y=0; y<prc->Height; y++) {
-                    srcpixel=srcrow;
-                    dstpixel=dstrow;
-                    for (x=0; x<prc->Width; x++) {
+                    x = convert_24bpp_to_32bppBGRA_row_simd((DWORD *)dstrow, srcrow, prc->Width, TRUE);
+                    srcpixel=srcrow+3*x;
+                    dstpixel=dstrow+4*x;
+                    for (; x<prc->Width; x++) {
                         tmppixel[0]=*srcpixel++; /* red */
                         tmppixel[1]=*srcpixel++; /* green */
                         tmppixel[2]=*srcpixel++; /* blue */
@@ -716,7 +1148,7 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
 
             /* set all alpha values to 255 */
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=set_alpha_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                     pbBuffer[cbStride*y+4*x+3] = 0xff;
         }
         return S_OK;
@@ -743,7 +1175,7 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
             if (FAILED(res)) return res;
 
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=unpremultiply_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                 {
                     BYTE alpha = pbBuffer[cbStride*y+4*x+3];
                     if (alpha != 0 && alpha != 255)
@@ -780,9 +1212,10 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
                 srcrow = srcdata;
                 dstrow = pbBuffer;
                 for (y=0; y<prc->Height; y++) {
-                    srcpixel=srcrow;
-                    dstpixel=(DWORD*)dstrow;
-                    for (x=0; x<prc->Width; x++) {
+                    x = convert_48bppRGB_to_32bppBGRA_row_simd((DWORD *)dstrow, srcrow, prc->Width);
+                    srcpixel=srcrow+6*x;
+                    dstpixel=(DWORD*)dstrow+x;
+                    for (; x<prc->Width; x++) {
                         BYTE red, green, blue;
                         srcpixel++; red = *srcpixel++;
                         srcpixel++; green = *srcpixel++;
@@ -824,9 +1257,10 @@ static HRESULT copypixels_to_32bppBGRA(struct FormatConverter *This, const WICRe
                 srcrow = srcdata;
                 dstrow = pbBuffer;
                 for (y=0; y<prc->Height; y++) {
-                    srcpixel=srcrow;
-                    dstpixel=(DWORD*)dstrow;
-                    for (x=0; x<prc->Width; x++) {
+                    x = convert_64bppRGBA_to_32bppBGRA_row_simd((DWORD *)dstrow, srcrow, prc->Width);
+                    srcpixel=srcrow+8*x;
+                    dstpixel=(DWORD*)dstrow+x;
+                    for (; x<prc->Width; x++) {
                         BYTE red, green, blue, alpha;
                         srcpixel++; red = *srcpixel++;
                         srcpixel++; green = *srcpixel++;
@@ -888,7 +1322,7 @@ static HRESULT copypixels_to_32bppRGBA(struct FormatConverter *This, const WICRe
 
             /* set all alpha values to 255 */
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=set_alpha_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                     pbBuffer[cbStride*y+4*x+3] = 0xff;
         }
         return S_OK;
@@ -907,7 +1341,7 @@ static HRESULT copypixels_to_32bppRGBA(struct FormatConverter *This, const WICRe
             if (FAILED(hr)) return hr;
 
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=unpremultiply_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                 {
                     BYTE alpha = pbBuffer[cbStride*y+4*x+3];
                     if (alpha != 0 && alpha != 255)
@@ -978,7 +1412,7 @@ static HRESULT copypixels_to_32bppPBGRA(struct FormatConverter *This, const WICR
             INT x, y;
 
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=premultiply_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                 {
                     BYTE alpha = pbBuffer[cbStride*y+4*x+3];
                     if (alpha != 255)
@@ -1011,7 +1445,7 @@ static HRESULT copypixels_to_32bppPRGBA(struct FormatConverter *This, const WICR
             INT x, y;
 
             for (y=0; y<prc->Height; y++)
-                for (x=0; x<prc->Width; x++)
+                for (x=premultiply_row_simd((DWORD *)(pbBuffer+cbStride*y), prc->Width); x<prc->Width; x++)
                 {
                     BYTE alpha = pbBuffer[cbStride*y+4*x+3];
                     if (alpha != 255)
@@ -1075,9 +1509,10 @@ static HRESULT copypixels_to_24bppBGR(struct FormatConverter *This, const WICRec
                 {
                     for (y = 0; y < prc->Height; y++)
                     {
-                        srcpixel = srcrow;
-                        dstpixel = dstrow;
-                        for (x = 0; x < prc->Width; x++) {
+                        x = convert_32bpp_to_24bppBGR_row_simd(dstrow, (const DWORD *)srcrow, prc->Width, TRUE);
+                        srcpixel = srcrow + 4 * x;
+                        dstpixel = dstrow + 3 * x;
+                        for (; x < prc->Width; x++) {
                             *dstpixel++ = srcpixel[2]; /* blue */
                             *dstpixel++ = srcpixel[1]; /* green */
                             *dstpixel++ = srcpixel[0]; /* red */
@@ -1091,9 +1526,10 @@ static HRESULT copypixels_to_24bppBGR(struct FormatConverter *This, const WICRec
                 {
                     for (y = 0; y < prc->Height; y++)
                     {
-                        srcpixel = srcrow;
-                        dstpixel = dstrow;
-                        for (x = 0; x < prc->Width; x++) {
+                        x = convert_32bpp_to_24bppBGR_row_simd(dstrow, (const DWORD *)srcrow, prc->Width, FALSE);
+                        srcpixel = srcrow + 4 * x;
+                        dstpixel = dstrow + 3 * x;
+                        for (; x < prc->Width; x++) {
                             *dstpixel++ = *srcpixel++; /* blue */
                             *dstpixel++ = *srcpixel++; /* green */
                             *dstpixel++ = *srcpixel++; /* red */
@@ -1137,7 +1573,7 @@ static HRESULT copypixels_to_24bppBGR(struct FormatConverter *This, const WICRec
 
                     for (x = 0; x < prc->Width; x++)
                     {
-                        BYTE gray = (BYTE)floorf(to_sRGB_component(gray_float[x]) * 255.0f + 0.51f);
+                        BYTE gray = to_sRGB_byte(gray_float[x]);
                         *bgr++ = gray;
                         *bgr++ = gray;
                         *bgr++ = gray;
@@ -1246,9 +1682,10 @@ static HRESULT copypixels_to_24bppRGB(struct FormatConverter *This, const WICRec
                 srcrow = srcdata;
                 dstrow = pbBuffer;
                 for (y=0; y<prc->Height; y++) {
-                    srcpixel=srcrow;
-                    dstpixel=dstrow;
-                    for (x=0; x<prc->Width; x++) {
+                    x = convert_32bpp_to_24bppBGR_row_simd(dstrow, (const DWORD *)srcrow, prc->Width, TRUE);
+                    srcpixel=srcrow+4*x;
+                    dstpixel=dstrow+3*x;
+                    for (; x<prc->Width; x++) {
                         tmppixel[0]=*srcpixel++; /* blue */
                         tmppixel[1]=*srcpixel++; /* green */
                         tmppixel[2]=*srcpixel++; /* red */
@@ -1305,7 +1742,10 @@ static HRESULT copypixels_to_32bppGrayFloat(struct FormatConverter *This, const
         for (y = 0; y < prc->Height; y++)
         {
             BYTE *bgr = p;
-            for (x = 0; x < prc->Width; x++)
+
+            x = convert_32bppBGR_to_GrayFloat_row_simd((DWORD *)p, prc->Width);
+            bgr += 4 * x;
+            for (; x < prc->Width; x++)
             {
                 float gray = (bgr[2] * 0.2126f + bgr[1] * 0.7152f + bgr[0] * 0.0722f) / 255.0f;
                 *(float *)bgr = gray;
@@ -1356,7 +1796,7 @@ static HRESULT copypixels_to_8bppGray(struct FormatConverter *This, const WICRec
                     BYTE *dstpixel = dst;
 
                     for (x=0; x < prc->Width; x++)
-                        *dstpixel++ = (BYTE)floorf(to_sRGB_component(*srcpixel++) * 255.0f + 0.51f);
+                        *dstpixel++ = to_sRGB_byte(*srcpixel++);
 
                     src += srcstride;
                     dst += cbStride;
@@ -1392,8 +1832,7 @@ static HRESULT copypixels_to_8bppGray(struct FormatConverter *This, const WICRec
             {
                 float gray = (bgr[2] * 0.2126f + bgr[1] * 0.7152f + bgr[0] * 0.0722f) / 255.0f;
 
-                gray = to_sRGB_component(gray) * 255.0f;
-                dst[x] = (BYTE)floorf(gray + 0.51f);
+                dst[x] = to_sRGB_byte(gray);
                 bgr += 3;
             }
             src += srcstride;
@@ -1444,6 +1883,7 @@ static HRESULT copypixels_to_8bppIndexed(struct FormatConverter *This, const WIC
     HRESULT hr;
     BYTE *srcdata;
     WICColor colors[256];
+    struct palette_search search;
     UINT srcstride, srcdatasize, count;
 
     if (source_format == format_8bppIndexed)
@@ -1462,6 +1902,8 @@ static HRESULT copypixels_to_8bppIndexed(struct FormatConverter *This, const WIC
     hr = IWICPalette_GetColors(This->palette, 256, colors, &count);
     if (hr != S_OK) return hr;
 
+    init_palette_search(&search, colors, count);
+
     srcstride = 3 * prc->Width;
     srcdatasize = srcstride * prc->Height;
 
@@ -1478,7 +1920,9 @@ static HRESULT copypixels_to_8bppIndexed(struct FormatConverter *This, const WIC
         {
             BYTE *bgr = src;
 
-            for (x = 0; x < prc->Width; x++)
+            x = palette_index_row_simd(dst, bgr, prc->Width, &search);
+            bgr += 3 * x;
+            for (; x < prc->Width; x++)
             {
                 dst[x] = rgb_to_palette_index(bgr, colors, count);
                 bgr += 3;
@@ -1849,6 +2293,8 @@ HRESULT FormatConverter_CreateInstance(REFIID iid, void** ppv)
     InitializeCriticalSection(&This->lock);
     This->lock.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": FormatConverter.lock");
 
+    InitOnceExecuteOnce(&init_once, init_converter_tables, NULL, NULL);
+
     ret = IWICFormatConverter_QueryInterface(&This->IWICFormatConverter_iface, iid, ppv);
     IWICFormatConverter_Release(&This->IWICFormatConverter_iface);
 
@@ -1849,6 +1849,149 @@ static void test_converter_8bppIndexed(void)
     DeleteTestBitmap(src_obj);
 }
 
+static WICBitmapPaletteType get_palette_type(UINT bpp)
+{
+    switch (bpp)
+    {
+    case 1: return WICBitmapPaletteTypeFixedBW;
+    case 2: return WICBitmapPaletteTypeFixedGray4;
+    case 4: return WICBitmapPaletteTypeFixedGray16;
+    case 8: return WICBitmapPaletteTypeFixedHalftone256;
+    default: return WICBitmapPaletteTypeCustom;
+    }
+}
+
+static void fill_test_bits(const WICPixelFormatGUID *format, BYTE *bits, UINT size)
+{
+    UINT i;
+
+    for (i = 0; i < size; i++) bits[i] = rand();
+
+    /* the test source only has 8 palette entries */
+    if (IsEqualGUID(format, &GUID_WICPixelFormat8bppIndexed))
+        for (i = 0; i < size; i++) bits[i] &= 0x07;
+    else if (IsEqualGUID(format, &GUID_WICPixelFormat4bppIndexed))
+        for (i = 0; i < size; i++) bits[i] &= 0x77;
+    else if (IsEqualGUID(format, &GUID_WICPixelFormat32bppGrayFloat))
+        for (i = 0; i < size / 4; i++) ((float *)bits)[i] = (rand() % 1001) / 1000.0f;
+}
+
+static void test_all_conversions(void)
+{
+    static const struct
+    {
+        const WICPixelFormatGUID *format;
+        UINT bpp;
+        const char *name;
+    }
+    formats[] =
+    {
+        {&GUID_WICPixelFormat1bppIndexed, 1, "1bppIndexed"},
+        {&GUID_WICPixelFormat2bppIndexed, 2, "2bppIndexed"},
+        {&GUID_WICPixelFormat4bppIndexed, 4, "4bppIndexed"},
+        {&GUID_WICPixelFormat8bppIndexed, 8, "8bppIndexed"},
+        {&GUID_WICPixelFormatBlackWhite, 1, "BlackWhite"},
+        {&GUID_WICPixelFormat2bppGray, 2, "2bppGray"},
+        {&GUID_WICPixelFormat4bppGray, 4, "4bppGray"},
+        {&GUID_WICPixelFormat8bppGray, 8, "8bppGray"},
+        {&GUID_WICPixelFormat16bppGray, 16, "16bppGray"},
+        {&GUID_WICPixelFormat16bppBGR555, 16, "16bppBGR555"},
+        {&GUID_WICPixelFormat16bppBGR565, 16, "16bppBGR565"},
+        {&GUID_WICPixelFormat16bppBGRA5551, 16, "16bppBGRA5551"},
+        {&GUID_WICPixelFormat24bppBGR, 24, "24bppBGR"},
+        {&GUID_WICPixelFormat24bppRGB, 24, "24bppRGB"},
+        {&GUID_WICPixelFormat32bppGrayFloat, 32, "32bppGrayFloat"},
+        {&GUID_WICPixelFormat32bppBGR, 32, "32bppBGR"},
+        {&GUID_WICPixelFormat32bppRGB, 32, "32bppRGB"},
+        {&GUID_WICPixelFormat32bppBGRA, 32, "32bppBGRA"},
+        {&GUID_WICPixelFormat32bppRGBA, 32, "32bppRGBA"},
+        {&GUID_WICPixelFormat32bppPBGRA, 32, "32bppPBGRA"},
+        {&GUID_WICPixelFormat32bppPRGBA, 32, "32bppPRGBA"},
+        {&GUID_WICPixelFormat48bppRGB, 48, "48bppRGB"},
+        {&GUID_WICPixelFormat64bppRGBA, 64, "64bppRGBA"},
+        {&GUID_WICPixelFormat32bppCMYK, 32, "32bppCMYK"},
+    };
+    static const UINT width = 256, height = 128;
+    struct bitmap_data src_data = {NULL, 0, NULL, width, height, 96.0, 96.0};
+    IWICFormatConverter *converter;
+    BitmapTestSrc *src_obj;
+    UINT i, j, y, stride, part_stride;
+    BYTE *bits, *full, *part;
+    BOOL can_convert;
+    WICRect rc;
+    HRESULT hr;
+
+    bits = HeapAlloc(GetProcessHeap(), 0, width * height * 8);
+    full = HeapAlloc(GetProcessHeap(), 0, width * height * 8);
+    part = HeapAlloc(GetProcessHeap(), 0, width * height * 8);
+
+    for (i = 0; i < ARRAY_SIZE(formats); i++)
+    {
+        fill_test_bits(formats[i].format, bits, width * height * formats[i].bpp / 8);
+        src_data.format = formats[i].format;
+        src_data.bpp = formats[i].bpp;
+        src_data.bits = bits;
+        CreateTestBitmap(&src_data, &src_obj);
+
+        for (j = 0; j < ARRAY_SIZE(formats); j++)
+        {
+            hr = IWICImagingFactory_CreateFormatConverter(factory, &converter);
+            ok(hr == S_OK, "CreateFormatConverter error %#x\n", hr);
+
+            can_convert = FALSE;
+            hr = IWICFormatConverter_CanConvert(converter, formats[i].format, formats[j].format, &can_convert);
+            ok(hr == S_OK, "%s -> %s: CanConvert error %#x\n", formats[i].name, formats[j].name, hr);
+            if (hr == S_OK && can_convert)
+                hr = IWICFormatConverter_Initialize(converter, &src_obj->IWICBitmapSource_iface, formats[j].format,
+                                                    WICBitmapDitherTypeNone, NULL, 0.0, get_palette_type(formats[j].bpp));
+            if (hr != S_OK || !can_convert)
+            {
+                IWICFormatConverter_Release(converter);
+                continue;
+            }
+
+            stride = (width * formats[j].bpp + 7) / 8;
+            hr = IWICFormatConverter_CopyPixels(converter, NULL, stride, stride * height, full);
+
+            /* CanConvert also accepts some pairs that can't be converted */
+            if (hr != S_OK)
+            {
+                if (winetest_debug > 1)
+                    trace("%s -> %s: CopyPixels error %#x\n", formats[i].name, formats[j].name, hr);
+                IWICFormatConverter_Release(converter);
+                continue;
+            }
+            /* a part of the image converts to the same pixels, at any alignment */
+            if (formats[j].bpp >= 8)
+            {
+                rc.X = 8;
+                rc.Y = 1;
+                rc.Width = width - 21;
+                rc.Height = height - 2;
+                part_stride = rc.Width * formats[j].bpp / 8;
+                hr = IWICFormatConverter_CopyPixels(converter, &rc, part_stride, part_stride * rc.Height, part);
+                ok(hr == S_OK, "%s -> %s: CopyPixels error %#x\n", formats[i].name, formats[j].name, hr);
+                for (y = 0; hr == S_OK && y < rc.Height; y++)
+                {
+                    if (memcmp(part + y * part_stride, full + (rc.Y + y) * stride + rc.X * formats[j].bpp / 8, part_stride))
+                    {
+                        ok(0, "%s -> %s: row %u differs\n", formats[i].name, formats[j].name, y);
+                        break;
+                    }
+                }
+            }
+
+            IWICFormatConverter_Release(converter);
+        }
+
+        DeleteTestBitmap(src_obj);
+    }
+
+    HeapFree(GetProcessHeap(), 0, part);
+    HeapFree(GetProcessHeap(), 0, full);
+    HeapFree(GetProcessHeap(), 0, bits);
+}
+
 START_TEST(converter)
 {
     HRESULT hr;
@@ -1907,6 +2050,7 @@ START_TEST(converter)
     test_invalid_conversion();
     test_default_converter();
     test_converter_8bppIndexed();
+    test_all_conversions();
 
     test_encoder(&testdata_8bppIndexed, &CLSID_WICGifEncoder,
                  &testdata_8bppIndexed, &CLSID_WICGifDecoder, "GIF encoder 8bppIndexed");
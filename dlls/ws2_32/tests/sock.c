@@ -11372,6 +11372,76 @@ static void test_nonblocking_async_recv(void)
     CloseHandle(overlapped.hEvent);
 }
 
+static void test_queued_async_recv(void)
+{
+    OVERLAPPED overlapped[16], *ovl;
+    char buffer[16], data[16];
+    SOCKET client, server;
+    DWORD flags = 0, size;
+    ULONG_PTR key;
+    WSABUF wsabuf;
+    HANDLE port;
+    int i, ret;
+
+    tcp_socketpair(&client, &server);
+    port = CreateIoCompletionPort((HANDLE)client, NULL, 123, 0);
+    ok(!!port, "failed to create port, error %u\n", GetLastError());
+
+    memset(buffer, 0, sizeof(buffer));
+    for (i = 0; i < ARRAY_SIZE(overlapped); i++)
+    {
+        memset(&overlapped[i], 0, sizeof(overlapped[i]));
+        wsabuf.buf = buffer + i;
+        wsabuf.len = 1;
+        WSASetLastError(0xdeadbeef);
+        ret = WSARecv(client, &wsabuf, 1, NULL, &flags, &overlapped[i], NULL);
+        ok(ret == -1, "got %d\n", ret);
+        ok(WSAGetLastError() == ERROR_IO_PENDING, "got error %u\n", WSAGetLastError());
+    }
+
+    for (i = 0; i < sizeof(data); i++) data[i] = 'a' + i;
+    ret = send(server, data, sizeof(data), 0);
+    ok(ret == sizeof(data), "got %d\n", ret);
+
+    /* the receives are completed in the order they were queued */
+    for (i = 0; i < ARRAY_SIZE(overlapped); i++)
+    {
+        ret = GetQueuedCompletionStatus(port, &size, &key, &ovl, 1000);
+        ok(ret, "got error %u\n", GetLastError());
+        ok(size == 1, "got size %u\n", size);
+        ok(key == 123, "got key %Iu\n", key);
+        ok(ovl == &overlapped[i], "got overlapped %p, expected %p\n", ovl, &overlapped[i]);
+    }
+    ok(!memcmp(buffer, data, sizeof(data)), "got %s\n", debugstr_an(buffer, sizeof(buffer)));
+
+    /* cancelling completes the pending receive */
+    wsabuf.buf = buffer;
+    wsabuf.len = sizeof(buffer);
+    ret = WSARecv(client, &wsabuf, 1, NULL, &flags, &overlapped[0], NULL);
+    ok(ret == -1, "got %d\n", ret);
+    ok(WSAGetLastError() == ERROR_IO_PENDING, "got error %u\n", WSAGetLastError());
+    ret = CancelIoEx((HANDLE)client, &overlapped[0]);
+    ok(ret, "got error %u\n", GetLastError());
+    ret = GetQueuedCompletionStatus(port, &size, &key, &ovl, 1000);
+    ok(!ret, "expected failure\n");
+    ok(GetLastError() == ERROR_OPERATION_ABORTED, "got error %u\n", GetLastError());
+    ok(ovl == &overlapped[0], "got overlapped %p\n", ovl);
+    ok(!size, "got size %u\n", size);
+
+    /* and so does closing the socket */
+    ret = WSARecv(client, &wsabuf, 1, NULL, &flags, &overlapped[1], NULL);
+    ok(ret == -1, "got %d\n", ret);
+    ok(WSAGetLastError() == ERROR_IO_PENDING, "got error %u\n", WSAGetLastError());
+    closesocket(client);
+    ret = GetQueuedCompletionStatus(port, &size, &key, &ovl, 1000);
+    ok(!ret, "expected failure\n");
+    ok(ovl == &overlapped[1], "got overlapped %p\n", ovl);
+    ok(!size, "got size %u\n", size);
+
+    closesocket(server);
+    CloseHandle(port);
+}
+
 static void test_empty_recv(void)
 {
     OVERLAPPED overlapped = {0};
@@ -11930,6 +12000,7 @@ START_TEST( sock )
     test_connecting_socket();
     test_WSAGetOverlappedResult();
     test_nonblocking_async_recv();
+    test_queued_async_recv();
     test_empty_recv();
     test_timeout();
 
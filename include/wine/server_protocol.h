@@ -184,6 +184,59 @@ struct wake_up_reply
 };
 
 
+struct inproc_sync
+{
+    int          state;     /* event: signaled flag, semaphore: count, mutex: owner thread id,
+                               key: modification serial */
+    unsigned int type;
+    unsigned int max;
+    unsigned int count;
+    int          abandoned;
+    int          waiters;
+    int          __pad[2];
+};
+enum inproc_sync_type
+{
+    INPROC_SYNC_NONE,
+    INPROC_SYNC_EVENT,
+    INPROC_SYNC_SEMAPHORE,
+    INPROC_SYNC_MUTEX,
+    INPROC_SYNC_KEY
+};
+#define INPROC_SYNC_BLOCK_SIZE 0x10000
+
+
+
+struct request_shm
+{
+    int                     state;
+    int                     __pad[15];
+    struct request_max_size reply;
+
+};
+enum request_shm_state
+{
+    REQUEST_SHM_IDLE,
+    REQUEST_SHM_PENDING,
+    REQUEST_SHM_WAITING,
+    REQUEST_SHM_REPLIED,
+    REQUEST_SHM_CLOSED
+};
+#define REQUEST_SHM_SIZE      0x10000
+#define REQUEST_SHM_DATA_SIZE (REQUEST_SHM_SIZE - sizeof(struct request_shm))
+
+
+struct request_stats
+{
+    unsigned int     req;
+    unsigned int     count;
+    unsigned __int64 time;
+    unsigned __int64 reply_size;
+    data_size_t      max_reply_size;
+    int              __pad;
+};
+
+
 typedef __int64 timeout_t;
 #define TIMEOUT_INFINITE (((timeout_t)0x7fffffff) << 32 | 0xffffffff)
 
@@ -959,6 +1012,18 @@ struct init_thread_reply
 
 
 
+struct get_request_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_request_shm_reply
+{
+    struct reply_header __header;
+};
+
+
+
 struct terminate_process_request
 {
     struct request_header __header;
@@ -1539,6 +1604,44 @@ struct open_semaphore_reply
 
 
 
+struct get_inproc_sync_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_inproc_sync_shm_reply
+{
+    struct reply_header __header;
+};
+
+
+
+struct get_inproc_sync_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+};
+struct get_inproc_sync_reply
+{
+    struct reply_header __header;
+    unsigned int index;
+    unsigned int access;
+};
+
+
+
+struct wake_inproc_sync_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+};
+struct wake_inproc_sync_reply
+{
+    struct reply_header __header;
+};
+
+
+
 struct create_file_request
 {
     struct request_header __header;
@@ -1901,6 +2004,22 @@ struct get_mapping_info_reply
 
 
 
+struct get_image_relocation_request
+{
+    struct request_header __header;
+    obj_handle_t mapping;
+    client_ptr_t base;
+};
+struct get_image_relocation_reply
+{
+    struct reply_header __header;
+    client_ptr_t base;
+    obj_handle_t file;
+    obj_handle_t wait;
+};
+
+
+
 struct map_view_request
 {
     struct request_header __header;
@@ -2185,6 +2304,8 @@ struct create_key_reply
     struct reply_header __header;
     obj_handle_t hkey;
     int          created;
+    unsigned int inproc_index;
+    unsigned int access;
 };
 
 
@@ -2200,7 +2321,9 @@ struct open_key_reply
 {
     struct reply_header __header;
     obj_handle_t hkey;
-    char __pad_12[4];
+    unsigned int inproc_index;
+    unsigned int access;
+    char __pad_20[4];
 };
 
 
@@ -5419,6 +5542,26 @@ struct get_next_thread_reply
 };
 
 
+
+struct get_request_stats_request
+{
+    struct request_header __header;
+    process_id_t pid;
+    unsigned int flags;
+    char __pad_20[4];
+};
+struct get_request_stats_reply
+{
+    struct reply_header __header;
+    int          enabled;
+    /* VARARG(stats,request_stats); */
+    char __pad_12[4];
+};
+#define REQUEST_STATS_ENABLE  0x01
+#define REQUEST_STATS_DISABLE 0x02
+#define REQUEST_STATS_RESET   0x04
+
+
 enum request
 {
     REQ_new_process,
@@ -5428,6 +5571,7 @@ enum request
     REQ_init_process_done,
     REQ_init_first_thread,
     REQ_init_thread,
+    REQ_get_request_shm,
     REQ_terminate_process,
     REQ_terminate_thread,
     REQ_get_process_info,
@@ -5463,6 +5607,9 @@ enum request
     REQ_release_semaphore,
     REQ_query_semaphore,
     REQ_open_semaphore,
+    REQ_get_inproc_sync_shm,
+    REQ_get_inproc_sync,
+    REQ_wake_inproc_sync,
     REQ_create_file,
     REQ_open_file_object,
     REQ_alloc_file_handle,
@@ -5483,6 +5630,7 @@ enum request
     REQ_create_mapping,
     REQ_open_mapping,
     REQ_get_mapping_info,
+    REQ_get_image_relocation,
     REQ_map_view,
     REQ_unmap_view,
     REQ_get_mapping_committed_range,
@@ -5695,6 +5843,7 @@ enum request
     REQ_suspend_process,
     REQ_resume_process,
     REQ_get_next_thread,
+    REQ_get_request_stats,
     REQ_NB_REQUESTS
 };
 
@@ -5709,6 +5858,7 @@ union generic_request
     struct init_process_done_request init_process_done_request;
     struct init_first_thread_request init_first_thread_request;
     struct init_thread_request init_thread_request;
+    struct get_request_shm_request get_request_shm_request;
     struct terminate_process_request terminate_process_request;
     struct terminate_thread_request terminate_thread_request;
     struct get_process_info_request get_process_info_request;
@@ -5744,6 +5894,9 @@ union generic_request
     struct release_semaphore_request release_semaphore_request;
     struct query_semaphore_request query_semaphore_request;
     struct open_semaphore_request open_semaphore_request;
+    struct get_inproc_sync_shm_request get_inproc_sync_shm_request;
+    struct get_inproc_sync_request get_inproc_sync_request;
+    struct wake_inproc_sync_request wake_inproc_sync_request;
     struct create_file_request create_file_request;
     struct open_file_object_request open_file_object_request;
     struct alloc_file_handle_request alloc_file_handle_request;
@@ -5764,6 +5917,7 @@ union generic_request
     struct create_mapping_request create_mapping_request;
     struct open_mapping_request open_mapping_request;
     struct get_mapping_info_request get_mapping_info_request;
+    struct get_image_relocation_request get_image_relocation_request;
     struct map_view_request map_view_request;
     struct unmap_view_request unmap_view_request;
     struct get_mapping_committed_range_request get_mapping_committed_range_request;
@@ -5976,6 +6130,7 @@ union generic_request
     struct suspend_process_request suspend_process_request;
     struct resume_process_request resume_process_request;
     struct get_next_thread_request get_next_thread_request;
+    struct get_request_stats_request get_request_stats_request;
 };
 union generic_reply
 {
@@ -5988,6 +6143,7 @@ union generic_reply
     struct init_process_done_reply init_process_done_reply;
     struct init_first_thread_reply init_first_thread_reply;
     struct init_thread_reply init_thread_reply;
+    struct get_request_shm_reply get_request_shm_reply;
     struct terminate_process_reply terminate_process_reply;
     struct terminate_thread_reply terminate_thread_reply;
     struct get_process_info_reply get_process_info_reply;
@@ -6023,6 +6179,9 @@ union generic_reply
     struct release_semaphore_reply release_semaphore_reply;
     struct query_semaphore_reply query_semaphore_reply;
     struct open_semaphore_reply open_semaphore_reply;
+    struct get_inproc_sync_shm_reply get_inproc_sync_shm_reply;
+    struct get_inproc_sync_reply get_inproc_sync_reply;
+    struct wake_inproc_sync_reply wake_inproc_sync_reply;
     struct create_file_reply create_file_reply;
     struct open_file_object_reply open_file_object_reply;
     struct alloc_file_handle_reply alloc_file_handle_reply;
@@ -6043,6 +6202,7 @@ union generic_reply
     struct create_mapping_reply create_mapping_reply;
     struct open_mapping_reply open_mapping_reply;
     struct get_mapping_info_reply get_mapping_info_reply;
+    struct get_image_relocation_reply get_image_relocation_reply;
     struct map_view_reply map_view_reply;
     struct unmap_view_reply unmap_view_reply;
     struct get_mapping_committed_range_reply get_mapping_committed_range_reply;
@@ -6255,11 +6415,12 @@ union generic_reply
     struct suspend_process_reply suspend_process_reply;
     struct resume_process_reply resume_process_reply;
     struct get_next_thread_reply get_next_thread_reply;
+    struct get_request_stats_reply get_request_stats_reply;
 };
 
 /* ### protocol_version begin ### */
 
-#define SERVER_PROTOCOL_VERSION 733
+#define SERVER_PROTOCOL_VERSION 741
 
 /* ### protocol_version end ### */
 
@@ -51,27 +51,29 @@ struct type_descr event_type =
 
 struct event
 {
-    struct object  obj;             /* object header */
-    struct list    kernel_object;   /* list of kernel object pointers */
-    int            manual_reset;    /* is it a manual reset event? */
-    int            signaled;        /* event has been signaled */
+    struct object       obj;            /* object header */
+    struct list         kernel_object;  /* list of kernel object pointers */
+    struct inproc_sync *sync;           /* shared state (signaled flag and manual reset flag) */
+    unsigned int        sync_index;     /* index of the shared state */
 };
 
 static void event_dump( struct object *obj, int verbose );
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry );
-static void event_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static int event_signal( struct object *obj, unsigned int access);
 static struct list *event_get_kernel_obj_list( struct object *obj );
+static void event_destroy( struct object *obj );
 
 static const struct object_ops event_ops =
 {
     sizeof(struct event),      /* size */
     &event_type,               /* type */
     event_dump,                /* dump */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    event_add_queue,           /* add_queue */
+    event_remove_queue,        /* remove_queue */
     event_signaled,            /* signaled */
-    event_satisfied,           /* satisfied */
+    no_satisfied,              /* satisfied */
     event_signal,              /* signal */
     no_get_fd,                 /* get_fd */
     default_map_access,        /* map_access */
@@ -84,7 +86,7 @@ static const struct object_ops event_ops =
     no_open_file,              /* open_file */
     event_get_kernel_obj_list, /* get_kernel_obj_list */
     no_close_handle,           /* close_handle */
-    no_destroy                 /* destroy */
+    event_destroy              /* destroy */
 };
 
 
@@ -147,8 +149,13 @@ struct event *create_event( struct object *root, const struct unicode_str *name,
         {
             /* initialize it if it didn't already exist */
             list_init( &event->kernel_object );
-            event->manual_reset = manual_reset;
-            event->signaled     = initial_state;
+            if (!(event->sync = alloc_inproc_sync( INPROC_SYNC_EVENT, &event->sync_index )))
+            {
+                release_object( event );
+                return NULL;
+            }
+            event->sync->max   = manual_reset;
+            event->sync->state = initial_state;
         }
     }
     return event;
@@ -159,24 +166,43 @@ struct event *get_event_obj( struct process *process, obj_handle_t handle, unsig
     return (struct event *)get_handle_obj( process, handle, access, &event_ops );
 }
 
+static inline int is_event_signaled( struct event *event )
+{
+    return __atomic_load_n( &event->sync->state, __ATOMIC_SEQ_CST );
+}
+
 static void pulse_event( struct event *event )
 {
-    event->signaled = 1;
+    int pending;
+
+    __atomic_store_n( &event->sync->state, 1, __ATOMIC_SEQ_CST );
     /* wake up all waiters if manual reset, a single one otherwise */
-    wake_up( &event->obj, !event->manual_reset );
-    event->signaled = 0;
+    wake_up( &event->obj, !event->sync->max );
+    /* in-process waiters notice the pulse through the serial; if no server waiter
+     * took an auto-reset pulse, it is left pending for one of them */
+    pending = __atomic_exchange_n( &event->sync->state, 0, __ATOMIC_SEQ_CST );
+    __atomic_store_n( &event->sync->abandoned, pending, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &event->sync->count, 1, __ATOMIC_SEQ_CST );
+    wake_inproc_sync_clients( event->sync );
 }
 
 void set_event( struct event *event )
 {
-    event->signaled = 1;
+    __atomic_store_n( &event->sync->state, 1, __ATOMIC_SEQ_CST );
     /* wake up all waiters if manual reset, a single one otherwise */
-    wake_up( &event->obj, !event->manual_reset );
+    wake_up( &event->obj, !event->sync->max );
+    if (is_event_signaled( event )) wake_inproc_sync_clients( event->sync );
 }
 
 void reset_event( struct event *event )
 {
-    event->signaled = 0;
+    __atomic_store_n( &event->sync->state, 0, __ATOMIC_SEQ_CST );
+}
+
+unsigned int get_event_inproc_sync( struct object *obj )
+{
+    if (obj->ops != &event_ops) return 0;
+    return ((struct event *)obj)->sync_index;
 }
 
 static void event_dump( struct object *obj, int verbose )
@@ -184,22 +210,30 @@ static void event_dump( struct object *obj, int verbose )
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     fprintf( stderr, "Event manual=%d signaled=%d\n",
-             event->manual_reset, event->signaled );
+             event->sync->max, is_event_signaled( event ) );
 }
 
-static int event_signaled( struct object *obj, struct wait_queue_entry *entry )
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry )
 {
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
-    return event->signaled;
+    add_inproc_sync_waiter( event->sync );
+    return add_queue( obj, entry );
 }
 
-static void event_satisfied( struct object *obj, struct wait_queue_entry *entry )
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry )
 {
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
-    /* Reset if it's an auto-reset event */
-    if (!event->manual_reset) event->signaled = 0;
+    remove_inproc_sync_waiter( event->sync );
+    remove_queue( obj, entry );
+}
+
+static int event_signaled( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    return is_event_signaled( event );
 }
 
 static int event_signal( struct object *obj, unsigned int access )
@@ -222,6 +256,14 @@ static struct list *event_get_kernel_obj_list( struct object *obj )
     return &event->kernel_object;
 }
 
+static void event_destroy( struct object *obj )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+
+    if (event->sync) free_inproc_sync( event->sync_index );
+}
+
 struct keyed_event *create_keyed_event( struct object *root, const struct unicode_str *name,
                                         unsigned int attr, const struct security_descriptor *sd )
 {
@@ -315,7 +357,7 @@ DECL_HANDLER(event_op)
     struct event *event;
 
     if (!(event = get_event_obj( current->process, req->handle, EVENT_MODIFY_STATE ))) return;
-    reply->state = event->signaled;
+    reply->state = is_event_signaled( event );
     switch(req->op)
     {
     case PULSE_EVENT:
@@ -341,8 +383,8 @@ DECL_HANDLER(query_event)
 
     if (!(event = get_event_obj( current->process, req->handle, EVENT_QUERY_STATE ))) return;
 
-    reply->manual_reset = event->manual_reset;
-    reply->state = event->signaled;
+    reply->manual_reset = event->sync->max;
+    reply->state = is_event_signaled( event );
 
     release_object( event );
 }
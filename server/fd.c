@@ -370,14 +370,23 @@ static file_pos_t max_unix_offset = OFF_T_MAX;
 
 struct timeout_user
 {
-    struct list           entry;      /* entry in sorted timeout list */
+    struct list           entry;      /* entry in expired timeouts list */
     abstime_t             when;       /* timeout expiry */
     timeout_callback      callback;   /* callback function */
     void                 *private;    /* callback private data */
+    int                   index;      /* index in the timeouts heap, -1 once expired */
 };
 
-static struct list abs_timeout_list = LIST_INIT(abs_timeout_list); /* sorted absolute timeouts list */
-static struct list rel_timeout_list = LIST_INIT(rel_timeout_list); /* sorted relative timeouts list */
+/* binary min-heap of timeouts, ordered by expiry */
+struct timeout_heap
+{
+    struct timeout_user **users;      /* heap array */
+    unsigned int          count;      /* number of timeouts in the heap */
+    unsigned int          size;       /* allocated size of the array */
+};
+
+static struct timeout_heap abs_timeouts;  /* absolute timeouts */
+static struct timeout_heap rel_timeouts;  /* relative timeouts, i.e. on the monotonic clock */
 timeout_t current_time;
 timeout_t monotonic_time;
 
@@ -454,43 +463,118 @@ void set_current_time(void)
     if (user_shared_data) set_user_shared_data_time();
 }
 
+/* expiry time of a timeout, relative timeouts are stored as negative values */
+static inline timeout_t get_timeout_expiry( const struct timeout_user *user )
+{
+    return user->when > 0 ? user->when : -user->when;
+}
+
+static inline struct timeout_heap *get_timeout_heap( const struct timeout_user *user )
+{
+    return user->when > 0 ? &abs_timeouts : &rel_timeouts;
+}
+
+static inline void set_timeout_heap_entry( struct timeout_heap *heap, unsigned int index,
+                                           struct timeout_user *user )
+{
+    heap->users[index] = user;
+    user->index = index;
+}
+
+/* move a timeout up the heap until its parent expires before it */
+static void timeout_heap_sift_up( struct timeout_heap *heap, unsigned int index )
+{
+    struct timeout_user *user = heap->users[index];
+    timeout_t expiry = get_timeout_expiry( user );
+
+    while (index)
+    {
+        unsigned int parent = (index - 1) / 2;
+        if (get_timeout_expiry( heap->users[parent] ) <= expiry) break;
+        set_timeout_heap_entry( heap, index, heap->users[parent] );
+        index = parent;
+    }
+    set_timeout_heap_entry( heap, index, user );
+}
+
+/* move a timeout down the heap until its children expire after it */
+static void timeout_heap_sift_down( struct timeout_heap *heap, unsigned int index )
+{
+    struct timeout_user *user = heap->users[index];
+    timeout_t expiry = get_timeout_expiry( user );
+
+    for (;;)
+    {
+        unsigned int child = 2 * index + 1;
+
+        if (child >= heap->count) break;
+        if (child + 1 < heap->count &&
+            get_timeout_expiry( heap->users[child + 1] ) < get_timeout_expiry( heap->users[child] ))
+            child++;
+        if (expiry <= get_timeout_expiry( heap->users[child] )) break;
+        set_timeout_heap_entry( heap, index, heap->users[child] );
+        index = child;
+    }
+    set_timeout_heap_entry( heap, index, user );
+}
+
+static int timeout_heap_insert( struct timeout_heap *heap, struct timeout_user *user )
+{
+    if (heap->count == heap->size)
+    {
+        unsigned int new_size = heap->size ? heap->size * 2 : 64;
+        struct timeout_user **new_users;
+
+        if (!(new_users = realloc( heap->users, new_size * sizeof(*new_users) )))
+        {
+            set_error( STATUS_NO_MEMORY );
+            return 0;
+        }
+        heap->users = new_users;
+        heap->size  = new_size;
+    }
+    set_timeout_heap_entry( heap, heap->count++, user );
+    timeout_heap_sift_up( heap, user->index );
+    return 1;
+}
+
+static void timeout_heap_remove( struct timeout_heap *heap, struct timeout_user *user )
+{
+    unsigned int index = user->index;
+    struct timeout_user *last = heap->users[--heap->count];
+
+    user->index = -1;
+    if (last == user) return;
+    set_timeout_heap_entry( heap, index, last );
+    if (index && get_timeout_expiry( heap->users[(index - 1) / 2] ) > get_timeout_expiry( last ))
+        timeout_heap_sift_up( heap, index );
+    else
+        timeout_heap_sift_down( heap, index );
+}
+
 /* add a timeout user */
 struct timeout_user *add_timeout_user( timeout_t when, timeout_callback func, void *private )
 {
     struct timeout_user *user;
-    struct list *ptr;
 
     if (!(user = mem_alloc( sizeof(*user) ))) return NULL;
     user->when     = timeout_to_abstime( when );
     user->callback = func;
     user->private  = private;
 
-    /* Now insert it in the linked list */
-
-    if (user->when > 0)
-    {
-        LIST_FOR_EACH( ptr, &abs_timeout_list )
-        {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-            if (timeout->when >= user->when) break;
-        }
-    }
-    else
+    if (!timeout_heap_insert( get_timeout_heap( user ), user ))
     {
-        LIST_FOR_EACH( ptr, &rel_timeout_list )
-        {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-            if (timeout->when <= user->when) break;
-        }
+        free( user );
+        return NULL;
     }
-    list_add_before( ptr, &user->entry );
     return user;
 }
 
 /* remove a timeout user */
 void remove_timeout_user( struct timeout_user *user )
 {
-    list_remove( &user->entry );
+    if (user->index != -1) timeout_heap_remove( get_timeout_heap( user ), user );
+    else list_remove( &user->entry );  /* expired but its callback hasn't been called yet */
     free( user );
 }
 
@@ -925,34 +1009,24 @@ static int get_next_timeout(void)
 {
     int ret = user_shared_data ? user_shared_data_timeout : -1;
 
-    if (!list_empty( &abs_timeout_list ) || !list_empty( &rel_timeout_list ))
+    if (abs_timeouts.count || rel_timeouts.count)
     {
         struct list expired_list, *ptr;
 
-        /* first remove all expired timers from the list */
+        /* first remove all expired timers from the heaps */
 
         list_init( &expired_list );
-        while ((ptr = list_head( &abs_timeout_list )) != NULL)
+        while (abs_timeouts.count && abs_timeouts.users[0]->when <= current_time)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-
-            if (timeout->when <= current_time)
-            {
-                list_remove( &timeout->entry );
-                list_add_tail( &expired_list, &timeout->entry );
-            }
-            else break;
+            struct timeout_user *timeout = abs_timeouts.users[0];
+            timeout_heap_remove( &abs_timeouts, timeout );
+            list_add_tail( &expired_list, &timeout->entry );
         }
-        while ((ptr = list_head( &rel_timeout_list )) != NULL)
+        while (rel_timeouts.count && -rel_timeouts.users[0]->when <= monotonic_time)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-
-            if (-timeout->when <= monotonic_time)
-            {
-                list_remove( &timeout->entry );
-                list_add_tail( &expired_list, &timeout->entry );
-            }
-            else break;
+            struct timeout_user *timeout = rel_timeouts.users[0];
+            timeout_heap_remove( &rel_timeouts, timeout );
+            list_add_tail( &expired_list, &timeout->entry );
         }
 
         /* now call the callback for all the removed timers */
@@ -965,18 +1039,18 @@ static int get_next_timeout(void)
             free( timeout );
         }
 
-        if ((ptr = list_head( &abs_timeout_list )) != NULL)
+        if (abs_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = abs_timeouts.users[0];
             timeout_t diff = (timeout->when - current_time + 9999) / 10000;
             if (diff > INT_MAX) diff = INT_MAX;
             else if (diff < 0) diff = 0;
             if (ret == -1 || diff < ret) ret = diff;
         }
 
-        if ((ptr = list_head( &rel_timeout_list )) != NULL)
+        if (rel_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = rel_timeouts.users[0];
             timeout_t diff = (-timeout->when - monotonic_time + 9999) / 10000;
             if (diff > INT_MAX) diff = INT_MAX;
             else if (diff < 0) diff = 0;
@@ -2146,6 +2220,12 @@ void set_fd_signaled( struct fd *fd, int signaled )
     if (signaled) wake_up( fd->user, 0 );
 }
 
+/* check the fd signaled state */
+int is_fd_signaled( struct fd *fd )
+{
+    return fd->signaled;
+}
+
 /* check if events are pending and if yes return which one(s) */
 int check_fd_events( struct fd *fd, int events )
 {
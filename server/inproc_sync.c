@@ -0,0 +1,292 @@
+/*
+ * In-process synchronization objects support
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * The state of events, semaphores and mutexes is kept in a shared memory
+ * file that clients map, so that uncontended operations and waits on these
+ * objects can be done with atomic operations and futexes without a server
+ * round trip. The server remains the owner of the state: it updates it for
+ * its own waiters, and clients ask it to wake them up when they change the
+ * state of an object that has server-side waiters.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+
+#include "file.h"
+#include "handle.h"
+#include "request.h"
+#include "thread.h"
+
+#define SLOTS_PER_BLOCK (INPROC_SYNC_BLOCK_SIZE / sizeof(struct inproc_sync))
+#define MAX_BLOCKS      1024
+
+static int shm_fd = -1;                        /* shared memory file, -1 if clients can't use it */
+static struct inproc_sync *blocks[MAX_BLOCKS]; /* mapped blocks of objects */
+static unsigned int nb_blocks;                 /* number of mapped blocks */
+static unsigned int next_index = 1;            /* first never used index (0 is invalid) */
+static unsigned int *free_indices;             /* stack of freed indices */
+static unsigned int nb_free, max_free;
+
+#ifdef __linux__
+
+#define FUTEX_WAKE 1
+
+static inline void futex_wake( int *addr, int count )
+{
+    syscall( __NR_futex, addr, FUTEX_WAKE, count, NULL, 0, 0 );
+}
+
+static int create_shm_file(void)
+{
+    const char *env = getenv( "WINEINPROCSYNC" );
+
+    if (env && !atoi( env )) return -1;
+#ifdef __NR_memfd_create
+    return syscall( __NR_memfd_create, "wine-inproc-sync", 1 /* MFD_CLOEXEC */ );
+#else
+    return -1;
+#endif
+}
+
+#else  /* __linux__ */
+
+static inline void futex_wake( int *addr, int count )
+{
+}
+
+static int create_shm_file(void)
+{
+    return -1;
+}
+
+#endif  /* __linux__ */
+
+/* create the shared memory file, if supported */
+void init_inproc_sync(void)
+{
+    shm_fd = create_shm_file();
+    if (debug_level && shm_fd != -1) fprintf( stderr, "wineserver: using in-process synchronization\n" );
+}
+
+/* map one more block of objects */
+static int grow_inproc_sync(void)
+{
+    void *ptr;
+
+    if (nb_blocks == MAX_BLOCKS)
+    {
+        set_error( STATUS_NO_MEMORY );
+        return 0;
+    }
+    if (shm_fd != -1)
+    {
+        off_t size = (off_t)(nb_blocks + 1) * INPROC_SYNC_BLOCK_SIZE;
+
+        if (ftruncate( shm_fd, size ) == -1 ||
+            (ptr = mmap( NULL, INPROC_SYNC_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         shm_fd, size - INPROC_SYNC_BLOCK_SIZE )) == MAP_FAILED)
+        {
+            file_set_error();
+            return 0;
+        }
+    }
+    else if (!(ptr = mem_alloc( INPROC_SYNC_BLOCK_SIZE ))) return 0;
+
+    memset( ptr, 0, INPROC_SYNC_BLOCK_SIZE );
+    blocks[nb_blocks++] = ptr;
+    return 1;
+}
+
+static inline struct inproc_sync *get_inproc_sync_slot( unsigned int index )
+{
+    return &blocks[index / SLOTS_PER_BLOCK][index % SLOTS_PER_BLOCK];
+}
+
+/* allocate the shared state of a synchronization object */
+struct inproc_sync *alloc_inproc_sync( enum inproc_sync_type type, unsigned int *index )
+{
+    struct inproc_sync *sync;
+
+    if (nb_free) *index = free_indices[--nb_free];
+    else
+    {
+        if (next_index == nb_blocks * SLOTS_PER_BLOCK && !grow_inproc_sync()) return NULL;
+        *index = next_index++;
+    }
+    sync = get_inproc_sync_slot( *index );
+    memset( sync, 0, sizeof(*sync) );
+    sync->type = type;
+    return sync;
+}
+
+/* free the shared state of a synchronization object */
+void free_inproc_sync( unsigned int index )
+{
+    if (nb_free == max_free)
+    {
+        unsigned int new_max = max_free ? max_free * 2 : 64;
+        unsigned int *new_indices = realloc( free_indices, new_max * sizeof(*new_indices) );
+
+        if (!new_indices) return;  /* simply leak the slot */
+        free_indices = new_indices;
+        max_free = new_max;
+    }
+    memset( get_inproc_sync_slot( index ), 0, sizeof(struct inproc_sync) );
+    free_indices[nb_free++] = index;
+}
+
+/* wake up the client-side waiters after a server-side state change */
+void wake_inproc_sync_clients( struct inproc_sync *sync )
+{
+    if (shm_fd != -1) futex_wake( &sync->state, INT_MAX );
+}
+
+/* add a server-side waiter; clients use the count to know when to notify the server */
+void add_inproc_sync_waiter( struct inproc_sync *sync )
+{
+    __atomic_add_fetch( &sync->waiters, 1, __ATOMIC_SEQ_CST );
+}
+
+void remove_inproc_sync_waiter( struct inproc_sync *sync )
+{
+    __atomic_sub_fetch( &sync->waiters, 1, __ATOMIC_SEQ_CST );
+}
+
+/* retrieve the state index of an object, or 0 if it doesn't have one */
+static unsigned int get_inproc_sync_index( struct object *obj )
+{
+    unsigned int index;
+
+    if ((index = get_event_inproc_sync( obj ))) return index;
+    if ((index = get_semaphore_inproc_sync( obj ))) return index;
+    if ((index = get_key_inproc_sync( obj ))) return index;
+    return get_mutex_inproc_sync( obj );
+}
+
+/* retrieve the shared state of an object, or NULL if it doesn't have one */
+struct inproc_sync *get_obj_inproc_sync( struct object *obj )
+{
+    unsigned int index = get_inproc_sync_index( obj );
+
+    return index ? get_inproc_sync_slot( index ) : NULL;
+}
+
+/* take the shared state of a signaled object for a waiting thread */
+/* return 0 if an in-process waiter took it since it was checked */
+int claim_inproc_sync( struct inproc_sync *sync, struct thread *thread )
+{
+    int cur;
+
+    switch (sync->type)
+    {
+    case INPROC_SYNC_EVENT:
+        if (sync->max) return __atomic_load_n( &sync->state, __ATOMIC_SEQ_CST ) != 0;
+        cur = 1;
+        return __atomic_compare_exchange_n( &sync->state, &cur, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    case INPROC_SYNC_SEMAPHORE:
+        cur = __atomic_load_n( &sync->state, __ATOMIC_SEQ_CST );
+        while (cur)
+            if (__atomic_compare_exchange_n( &sync->state, &cur, cur - 1, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST )) return 1;
+        return 0;
+    case INPROC_SYNC_MUTEX:
+        cur = 0;
+        if (!__atomic_compare_exchange_n( &sync->state, &cur, thread->id, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) && cur != thread->id)
+            return 0;
+        sync->count++;  /* FIXME: avoid wrap-around */
+        return 1;
+    }
+    return 1;
+}
+
+/* give back the state taken by claim_inproc_sync() when the rest of the wait can't be satisfied */
+void unclaim_inproc_sync( struct inproc_sync *sync )
+{
+    switch (sync->type)
+    {
+    case INPROC_SYNC_EVENT:
+        if (sync->max) return;
+        __atomic_store_n( &sync->state, 1, __ATOMIC_SEQ_CST );
+        break;
+    case INPROC_SYNC_SEMAPHORE:
+        __atomic_add_fetch( &sync->state, 1, __ATOMIC_SEQ_CST );
+        break;
+    case INPROC_SYNC_MUTEX:
+        if (--sync->count) return;
+        __atomic_store_n( &sync->state, 0, __ATOMIC_SEQ_CST );
+        break;
+    default:
+        return;
+    }
+    wake_inproc_sync_clients( sync );
+}
+
+/* retrieve the shared memory holding the in-process synchronization objects */
+DECL_HANDLER(get_inproc_sync_shm)
+{
+    if (shm_fd == -1) set_error( STATUS_NOT_IMPLEMENTED );
+    else send_client_fd( current->process, shm_fd, 0 );
+}
+
+/* retrieve the in-process synchronization state of an object */
+DECL_HANDLER(get_inproc_sync)
+{
+    struct object *obj;
+
+    if (shm_fd == -1)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+    if ((reply->index = get_inproc_sync_index( obj )))
+        reply->access = get_handle_access( current->process, req->handle );
+    else
+        set_error( STATUS_OBJECT_TYPE_MISMATCH );
+    release_object( obj );
+}
+
+/* wake up the server-side waiters after an in-process state change */
+DECL_HANDLER(wake_inproc_sync)
+{
+    struct object *obj;
+
+    if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+    if (get_inproc_sync_index( obj )) wake_up( obj, 0 );
+    else set_error( STATUS_OBJECT_TYPE_MISMATCH );
+    release_object( obj );
+}
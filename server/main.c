@@ -232,6 +232,8 @@ int main( int argc, char *argv[] )
     if (debug_level) fprintf( stderr, "wineserver: starting (pid=%ld)\n", (long) getpid() );
     set_current_time();
     init_signals();
+    init_inproc_sync();
+    init_request_stats();
     init_directories( load_intl_file() );
     init_registry();
     main_loop();
@@ -123,6 +123,47 @@ static const struct object_ops shared_map_ops =
 
 static struct list shared_map_list = LIST_INIT( shared_map_list );
 
+/* file holding a copy of a PE image relocated to a non-default base */
+struct reloc_map
+{
+    struct object   obj;             /* object header */
+    struct fd      *fd;              /* file descriptor of the mapped PE file */
+    struct file    *file;            /* temp file holding the relocated image, NULL until built */
+    client_ptr_t    base;            /* base address the image is relocated to */
+    struct list     entry;           /* entry in global relocated maps list */
+    int             failed;          /* the copy couldn't be built */
+};
+
+static void reloc_map_dump( struct object *obj, int verbose );
+static int reloc_map_signaled( struct object *obj, struct wait_queue_entry *entry );
+static void reloc_map_destroy( struct object *obj );
+
+static const struct object_ops reloc_map_ops =
+{
+    sizeof(struct reloc_map),  /* size */
+    &no_type,                  /* type */
+    reloc_map_dump,            /* dump */
+    add_queue,                 /* add_queue */
+    remove_queue,              /* remove_queue */
+    reloc_map_signaled,        /* signaled */
+    no_satisfied,              /* satisfied */
+    no_signal,                 /* signal */
+    no_get_fd,                 /* get_fd */
+    default_map_access,        /* map_access */
+    default_get_sd,            /* get_sd */
+    default_set_sd,            /* set_sd */
+    no_get_full_name,          /* get_full_name */
+    no_lookup_name,            /* lookup_name */
+    no_link_name,              /* link_name */
+    NULL,                      /* unlink_name */
+    no_open_file,              /* open_file */
+    no_kernel_obj_list,        /* get_kernel_obj_list */
+    no_close_handle,           /* close_handle */
+    reloc_map_destroy          /* destroy */
+};
+
+static struct list reloc_map_list = LIST_INIT( reloc_map_list );
+
 /* memory view mapped in client address space */
 struct memory_view
 {
@@ -130,6 +171,7 @@ struct memory_view
     struct fd      *fd;              /* fd for mapped file */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct reloc_map *reloc;         /* temp file for relocated PE mapping */
     pe_image_info_t image;           /* image info (for PE image mapping) */
     unsigned int    flags;           /* SEC_* flags */
     client_ptr_t    base;            /* view base address (in process addr space) */
@@ -163,6 +205,7 @@ struct mapping
     pe_image_info_t image;           /* image info (for PE image mapping) */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct reloc_map *reloc;         /* temp file for relocated PE mapping */
 };
 
 static void mapping_dump( struct object *obj, int verbose );
@@ -242,6 +285,28 @@ static void shared_map_destroy( struct object *obj )
     list_remove( &shared->entry );
 }
 
+static void reloc_map_dump( struct object *obj, int verbose )
+{
+    struct reloc_map *reloc = (struct reloc_map *)obj;
+    fprintf( stderr, "Relocated mapping fd=%p file=%p base=%08x%08x\n", reloc->fd, reloc->file,
+             (unsigned int)(reloc->base >> 32), (unsigned int)reloc->base );
+}
+
+static int reloc_map_signaled( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct reloc_map *reloc = (struct reloc_map *)obj;
+    return reloc->file || reloc->failed;
+}
+
+static void reloc_map_destroy( struct object *obj )
+{
+    struct reloc_map *reloc = (struct reloc_map *)obj;
+
+    release_object( reloc->fd );
+    if (reloc->file) release_object( reloc->file );
+    list_remove( &reloc->entry );
+}
+
 /* extend a file beyond the current end of file */
 int grow_file( int unix_fd, file_pos_t new_size )
 {
@@ -421,6 +486,7 @@ static void free_memory_view( struct memory_view *view )
     if (view->fd) release_object( view->fd );
     if (view->committed) release_object( view->committed );
     if (view->shared) release_object( view->shared );
+    if (view->reloc) release_object( view->reloc );
     list_remove( &view->entry );
     free( view );
 }
@@ -630,6 +696,212 @@ static int build_shared_mapping( struct mapping *mapping, int fd,
     return 0;
 }
 
+/* read data from the PE file, allowing for a partial sector at EOF */
+static int read_image_data( int fd, char *buffer, size_t size, off_t pos )
+{
+    size_t toread = size;
+
+    while (toread)
+    {
+        long res = pread( fd, buffer + size - toread, toread, pos );
+        if (!res && toread < 0x200) break;  /* partial sector at EOF is not an error */
+        if (res <= 0) return 0;
+        toread -= res;
+        pos += res;
+    }
+    return 1;
+}
+
+/* apply the base relocations of a PE image loaded at ptr */
+static int apply_relocations( char *ptr, size_t size, size_t va, size_t len, client_ptr_t delta )
+{
+    const IMAGE_BASE_RELOCATION *rel = (const IMAGE_BASE_RELOCATION *)(ptr + va);
+    const char *end = ptr + va + len;
+
+    if (va > size || len > size - va) return 0;
+
+    while ((const char *)(rel + 1) <= end && rel->SizeOfBlock)
+    {
+        const USHORT *relocs = (const USHORT *)(rel + 1);
+        unsigned int count = (rel->SizeOfBlock - sizeof(*rel)) / sizeof(USHORT);
+        char *page = ptr + rel->VirtualAddress;
+
+        if (rel->SizeOfBlock < sizeof(*rel) || (const char *)(relocs + count) > end) return 0;
+        if (rel->VirtualAddress >= size) return 0;
+
+        for ( ; count; count--, relocs++)
+        {
+            unsigned int offset = *relocs & 0xfff;
+
+            if (rel->VirtualAddress + offset + sizeof(LONGLONG) > size) return 0;
+            switch (*relocs >> 12)
+            {
+            case IMAGE_REL_BASED_ABSOLUTE:
+                break;
+            case IMAGE_REL_BASED_HIGH:
+                *(short *)(page + offset) += (unsigned int)delta >> 16;
+                break;
+            case IMAGE_REL_BASED_LOW:
+                *(short *)(page + offset) += delta & 0xffff;
+                break;
+            case IMAGE_REL_BASED_HIGHLOW:
+                *(int *)(page + offset) += delta;
+                break;
+            case IMAGE_REL_BASED_DIR64:
+                *(LONGLONG *)(page + offset) += delta;
+                break;
+            default:  /* let the client loader deal with it */
+                return 0;
+            }
+        }
+        rel = (const IMAGE_BASE_RELOCATION *)relocs;
+    }
+    return 1;
+}
+
+/* work item building a relocated copy of a PE image */
+struct reloc_work
+{
+    struct reloc_map *reloc;         /* map being built, only used from the main loop */
+    client_ptr_t      base;          /* base address to relocate to */
+    pe_image_info_t   image;         /* image information of the mapping */
+    int               image_fd;      /* unix fd of the PE file */
+    int               reloc_fd;      /* unix fd of the temp file for the copy */
+    int               success;       /* was the copy built successfully? */
+};
+
+/* lay out and relocate a PE image into a temp file; runs in a worker thread */
+static void build_reloc_copy( void *arg )
+{
+    struct reloc_work *work = arg;
+    client_ptr_t base = work->base;
+    IMAGE_SECTION_HEADER sec[96];
+    IMAGE_DATA_DIRECTORY dir;
+    IMAGE_NT_HEADERS32 *nt;
+    size_t size = work->image.map_size, header_size, map_size, file_size;
+    off_t file_start;
+    char *ptr;
+    unsigned int i, nb_sec, nt_pos;
+
+    work->success = 0;
+    if (!(ptr = calloc( 1, size ))) return;
+
+    /* lay out the image the same way the client does */
+
+    header_size = min( min( work->image.header_size, work->image.file_size ), size );
+    if (!read_image_data( work->image_fd, ptr, header_size, 0 )) goto done;
+    if (header_size < sizeof(IMAGE_DOS_HEADER)) goto done;
+    nt_pos = ((IMAGE_DOS_HEADER *)ptr)->e_lfanew;
+    if (nt_pos > header_size || header_size - nt_pos < sizeof(IMAGE_NT_HEADERS64)) goto done;
+    nt = (IMAGE_NT_HEADERS32 *)(ptr + nt_pos);
+    nb_sec = nt->FileHeader.NumberOfSections;
+    if (nb_sec > ARRAY_SIZE( sec )) goto done;
+    if ((char *)&nt->OptionalHeader + nt->FileHeader.SizeOfOptionalHeader + nb_sec * sizeof(*sec) >
+        ptr + header_size) goto done;
+    /* the headers may get overwritten by the sections data, so copy what we need */
+    memcpy( sec, (char *)&nt->OptionalHeader + nt->FileHeader.SizeOfOptionalHeader, nb_sec * sizeof(*sec) );
+
+    if (nt->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+        dir = ((IMAGE_NT_HEADERS64 *)nt)->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    else
+        dir = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    if (!dir.Size || !dir.VirtualAddress) goto done;
+
+    /* update the header so that the client loader doesn't relocate the image again */
+    if (nt->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+        ((IMAGE_NT_HEADERS64 *)nt)->OptionalHeader.ImageBase = base;
+    else
+        nt->OptionalHeader.ImageBase = base;
+
+    for (i = 0; i < nb_sec; i++)
+    {
+        get_section_sizes( &sec[i], &map_size, &file_start, &file_size );
+        if (sec[i].VirtualAddress > size || map_size > size - sec[i].VirtualAddress) goto done;
+        if (!sec[i].PointerToRawData || !file_size) continue;
+        if (sec[i].PointerToRawData >= work->image.file_size) goto done;
+        if (!read_image_data( work->image_fd, ptr + sec[i].VirtualAddress, file_size, file_start )) goto done;
+        if (file_size & page_mask)
+            memset( ptr + sec[i].VirtualAddress + file_size, 0, min( ROUND_SIZE( file_size ), map_size ) - file_size );
+    }
+
+    if (!apply_relocations( ptr, size, dir.VirtualAddress, dir.Size, base - work->image.base )) goto done;
+    work->success = pwrite( work->reloc_fd, ptr, size, 0 ) == size;
+
+done:
+    free( ptr );
+}
+
+/* attach the relocated copy to its map and wake up the waiting clients */
+static void reloc_copy_done( void *arg )
+{
+    struct reloc_work *work = arg;
+    struct reloc_map *reloc = work->reloc;
+
+    close( work->image_fd );
+    if (!work->success) close( work->reloc_fd );
+    else if (!(reloc->file = create_file_for_fd( work->reloc_fd, FILE_GENERIC_READ, 0 ))) clear_error();
+
+    if (!reloc->file)
+    {
+        reloc->failed = 1;
+        list_remove( &reloc->entry );
+        list_init( &reloc->entry );
+    }
+    wake_up( &reloc->obj, 0 );
+    release_object( reloc );
+    free( work );
+}
+
+/* find the temp file holding a PE image mapping relocated to a given base, or start building it */
+static struct reloc_map *get_reloc_map( struct mapping *mapping, client_ptr_t base )
+{
+    struct reloc_map *reloc;
+    struct reloc_work *work;
+    int unix_fd;
+
+    LIST_FOR_EACH_ENTRY( reloc, &reloc_map_list, struct reloc_map, entry )
+        if (reloc->base == base && is_same_file_fd( reloc->fd, mapping->fd ))
+            return (struct reloc_map *)grab_object( reloc );
+
+    if ((unix_fd = get_unix_fd( mapping->fd )) == -1) return NULL;
+    if (!(work = mem_alloc( sizeof(*work) ))) return NULL;
+    work->base  = base;
+    work->image = mapping->image;
+    if ((work->image_fd = dup( unix_fd )) == -1)
+    {
+        file_set_error();
+        free( work );
+        return NULL;
+    }
+    if ((work->reloc_fd = create_temp_file( mapping->image.map_size )) == -1)
+    {
+        close( work->image_fd );
+        free( work );
+        return NULL;
+    }
+    if (!(reloc = alloc_object( &reloc_map_ops )))
+    {
+        close( work->image_fd );
+        close( work->reloc_fd );
+        free( work );
+        return NULL;
+    }
+    reloc->fd     = (struct fd *)grab_object( mapping->fd );
+    reloc->file   = NULL;
+    reloc->base   = base;
+    reloc->failed = 0;
+    list_add_head( &reloc_map_list, &reloc->entry );
+
+    /* the copy is built without blocking the server when a worker thread is available */
+    work->reloc = (struct reloc_map *)grab_object( reloc );
+    if (!queue_work( build_reloc_copy, reloc_copy_done, work ))
+    {
+        build_reloc_copy( work );
+        reloc_copy_done( work );
+    }
+    return reloc;
+}
+
 /* load the CLR header from its section */
 static int load_clr_header( IMAGE_COR20_HEADER *hdr, size_t va, size_t size, int unix_fd,
                             IMAGE_SECTION_HEADER *sec, unsigned int nb_sec )
@@ -884,6 +1156,7 @@ static struct mapping *create_mapping( struct object *root, const struct unicode
     mapping->size        = size;
     mapping->fd          = NULL;
     mapping->shared      = NULL;
+    mapping->reloc       = NULL;
     mapping->committed   = NULL;
 
     if (!(mapping->flags = get_mapping_flags( handle, flags ))) goto error;
@@ -973,6 +1246,7 @@ struct mapping *create_fd_mapping( struct object *root, const struct unicode_str
     if (get_error() == STATUS_OBJECT_NAME_EXISTS) return mapping;  /* Nothing else to do */
 
     mapping->shared    = NULL;
+    mapping->reloc     = NULL;
     mapping->committed = NULL;
     mapping->flags     = SEC_FILE;
     mapping->fd        = (struct fd *)grab_object( fd );
@@ -1085,6 +1359,7 @@ static void mapping_destroy( struct object *obj )
     if (mapping->fd) release_object( mapping->fd );
     if (mapping->committed) release_object( mapping->committed );
     if (mapping->shared) release_object( mapping->shared );
+    if (mapping->reloc) release_object( mapping->reloc );
 }
 
 static enum server_fd_type mapping_get_fd_type( struct fd *fd )
@@ -1188,6 +1463,57 @@ DECL_HANDLER(get_mapping_info)
     release_object( mapping );
 }
 
+/* get a copy of a PE image mapping relocated to a given base */
+DECL_HANDLER(get_image_relocation)
+{
+    struct mapping *mapping;
+    struct reloc_map *reloc = NULL;
+
+    if (!(mapping = get_mapping_obj( current->process, req->mapping, SECTION_MAP_READ ))) return;
+
+    if (!(mapping->flags & SEC_IMAGE) || (req->base & page_mask) || req->base == mapping->image.base)
+    {
+        set_error( STATUS_INVALID_PARAMETER );
+        goto done;
+    }
+
+    /* images with shared sections get relocated in place by the client */
+    if (mapping->shared || !(mapping->image.image_charact & IMAGE_FILE_DLL) ||
+        (mapping->image.image_charact & IMAGE_FILE_RELOCS_STRIPPED) ||
+        (mapping->image.image_flags & IMAGE_FLAGS_ImageMappedFlat))
+        goto done;
+
+    if (!req->base)  /* use the base of an existing copy, so that pages can be shared */
+    {
+        LIST_FOR_EACH_ENTRY( reloc, &reloc_map_list, struct reloc_map, entry )
+            if (reloc->file && is_same_file_fd( reloc->fd, mapping->fd )) break;
+        if (&reloc->entry == &reloc_map_list) goto done;
+        grab_object( reloc );
+    }
+    else if (!(reloc = get_reloc_map( mapping, req->base )))
+    {
+        clear_error();  /* the client will relocate the image itself */
+        goto done;
+    }
+
+    if (!reloc->file)
+    {
+        /* the client waits until the copy is built, and then asks again */
+        if (!reloc->failed && (reply->wait = alloc_handle( current->process, reloc, SYNCHRONIZE, 0 )))
+            set_error( STATUS_PENDING );
+        release_object( reloc );
+        goto done;
+    }
+
+    if (mapping->reloc) release_object( mapping->reloc );
+    mapping->reloc = reloc;
+    reply->base = reloc->base;
+    reply->file = alloc_handle( current->process, reloc->file, GENERIC_READ, 0 );
+
+done:
+    release_object( mapping );
+}
+
 /* add a memory view in the current process */
 DECL_HANDLER(map_view)
 {
@@ -1254,6 +1580,9 @@ DECL_HANDLER(map_view)
         view->fd        = !is_fd_removable( mapping->fd ) ? (struct fd *)grab_object( mapping->fd ) : NULL;
         view->committed = mapping->committed ? (struct ranges *)grab_object( mapping->committed ) : NULL;
         view->shared    = mapping->shared ? (struct shared_map *)grab_object( mapping->shared ) : NULL;
+        view->reloc     = NULL;
+        if (mapping->reloc && mapping->reloc->base == view->base)
+            view->reloc = (struct reloc_map *)grab_object( mapping->reloc );
         if (view->flags & SEC_IMAGE) view->image = mapping->image;
         add_process_view( current, view );
         if (view->flags & SEC_IMAGE && view->base != mapping->image.base)
@@ -51,14 +51,17 @@ struct type_descr mutex_type =
 
 struct mutex
 {
-    struct object  obj;             /* object header */
-    struct thread *owner;           /* mutex owner */
-    unsigned int   count;           /* recursion count */
-    int            abandoned;       /* has it been abandoned? */
-    struct list    entry;           /* entry in owner thread mutex list */
+    struct object       obj;         /* object header */
+    struct inproc_sync *sync;        /* shared state (owner thread id, recursion count, abandoned flag) */
+    unsigned int        sync_index;  /* index of the shared state */
+    struct list         entry;       /* entry in the global mutex list */
 };
 
+static struct list mutex_list = LIST_INIT( mutex_list );
+
 static void mutex_dump( struct object *obj, int verbose );
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static void mutex_destroy( struct object *obj );
@@ -69,8 +72,8 @@ static const struct object_ops mutex_ops =
     sizeof(struct mutex),      /* size */
     &mutex_type,               /* type */
     mutex_dump,                /* dump */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    mutex_add_queue,           /* add_queue */
+    mutex_remove_queue,        /* remove_queue */
     mutex_signaled,            /* signaled */
     mutex_satisfied,           /* satisfied */
     mutex_signal,              /* signal */
@@ -89,27 +92,20 @@ static const struct object_ops mutex_ops =
 };
 
 
-/* grab a mutex for a given thread */
-static void do_grab( struct mutex *mutex, struct thread *thread )
+static inline thread_id_t get_mutex_owner( struct mutex *mutex )
 {
-    assert( !mutex->count || (mutex->owner == thread) );
-
-    if (!mutex->count++)  /* FIXME: avoid wrap-around */
-    {
-        assert( !mutex->owner );
-        mutex->owner = thread;
-        list_add_head( &thread->mutex_list, &mutex->entry );
-    }
+    return __atomic_load_n( &mutex->sync->state, __ATOMIC_SEQ_CST );
 }
 
+/* link a mutex to the list of its owner; mutexes released in-process stay in the list
+ * of their last owner until another thread grabs them */
 /* release a mutex once the recursion count is 0 */
 static void do_release( struct mutex *mutex )
 {
-    assert( !mutex->count );
-    /* remove the mutex from the thread list of owned mutexes */
-    list_remove( &mutex->entry );
-    mutex->owner = NULL;
+    assert( !mutex->sync->count );
+    __atomic_store_n( &mutex->sync->state, 0, __ATOMIC_SEQ_CST );
     wake_up( &mutex->obj, 0 );
+    if (!get_mutex_owner( mutex )) wake_inproc_sync_clients( mutex->sync );
 }
 
 static struct mutex *create_mutex( struct object *root, const struct unicode_str *name,
@@ -122,41 +118,79 @@ static struct mutex *create_mutex( struct object *root, const struct unicode_str
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
             /* initialize it if it didn't already exist */
-            mutex->count = 0;
-            mutex->owner = NULL;
-            mutex->abandoned = 0;
-            if (owned) do_grab( mutex, current );
+            list_add_tail( &mutex_list, &mutex->entry );
+            if (!(mutex->sync = alloc_inproc_sync( INPROC_SYNC_MUTEX, &mutex->sync_index )))
+            {
+                release_object( mutex );
+                return NULL;
+            }
+            if (owned) claim_inproc_sync( mutex->sync, current );
         }
     }
     return mutex;
 }
 
+/* clients grab mutexes in-process without telling the server, so look for
+ * the ones that the thread owns in a single pass over all the mutexes */
 void abandon_mutexes( struct thread *thread )
 {
-    struct list *ptr;
+    struct list *ptr = list_head( &mutex_list );
 
-    while ((ptr = list_head( &thread->mutex_list )) != NULL)
+    while (ptr)
     {
         struct mutex *mutex = LIST_ENTRY( ptr, struct mutex, entry );
-        assert( mutex->owner == thread );
-        mutex->count = 0;
-        mutex->abandoned = 1;
+
+        if (!mutex->sync || get_mutex_owner( mutex ) != thread->id)
+        {
+            ptr = list_next( &mutex_list, ptr );
+            continue;
+        }
+        grab_object( mutex );
+        mutex->sync->count = 0;
+        mutex->sync->abandoned = 1;
         do_release( mutex );
+        ptr = list_next( &mutex_list, ptr );
+        release_object( mutex );
     }
 }
 
+unsigned int get_mutex_inproc_sync( struct object *obj )
+{
+    if (obj->ops != &mutex_ops) return 0;
+    return ((struct mutex *)obj)->sync_index;
+}
+
 static void mutex_dump( struct object *obj, int verbose )
 {
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
-    fprintf( stderr, "Mutex count=%u owner=%p\n", mutex->count, mutex->owner );
+    fprintf( stderr, "Mutex count=%u owner=%04x\n", mutex->sync->count, get_mutex_owner( mutex ) );
+}
+
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    assert( obj->ops == &mutex_ops );
+    add_inproc_sync_waiter( mutex->sync );
+    return add_queue( obj, entry );
+}
+
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    assert( obj->ops == &mutex_ops );
+    remove_inproc_sync_waiter( mutex->sync );
+    remove_queue( obj, entry );
 }
 
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct mutex *mutex = (struct mutex *)obj;
+    thread_id_t owner;
+
     assert( obj->ops == &mutex_ops );
-    return (!mutex->count || (mutex->owner == get_wait_queue_thread( entry )));
+    owner = get_mutex_owner( mutex );
+    return (!owner || owner == get_wait_queue_thread( entry )->id);
 }
 
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry )
@@ -164,9 +198,8 @@ static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
 
-    do_grab( mutex, get_wait_queue_thread( entry ));
-    if (mutex->abandoned) make_wait_abandoned( entry );
-    mutex->abandoned = 0;
+    /* the owner and count were already set by check_wait() */
+    if (__atomic_exchange_n( &mutex->sync->abandoned, 0, __ATOMIC_SEQ_CST )) make_wait_abandoned( entry );
 }
 
 static int mutex_signal( struct object *obj, unsigned int access )
@@ -179,12 +212,12 @@ static int mutex_signal( struct object *obj, unsigned int access )
         set_error( STATUS_ACCESS_DENIED );
         return 0;
     }
-    if (!mutex->count || (mutex->owner != current))
+    if (get_mutex_owner( mutex ) != current->id)
     {
         set_error( STATUS_MUTANT_NOT_OWNED );
         return 0;
     }
-    if (!--mutex->count) do_release( mutex );
+    if (!--mutex->sync->count) do_release( mutex );
     return 1;
 }
 
@@ -193,9 +226,8 @@ static void mutex_destroy( struct object *obj )
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
 
-    if (!mutex->count) return;
-    mutex->count = 0;
-    do_release( mutex );
+    list_remove( &mutex->entry );
+    if (mutex->sync) free_inproc_sync( mutex->sync_index );
 }
 
 /* create a mutex */
@@ -239,11 +271,11 @@ DECL_HANDLER(release_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  0, &mutex_ops )))
     {
-        if (!mutex->count || (mutex->owner != current)) set_error( STATUS_MUTANT_NOT_OWNED );
+        if (get_mutex_owner( mutex ) != current->id) set_error( STATUS_MUTANT_NOT_OWNED );
         else
         {
-            reply->prev_count = mutex->count;
-            if (!--mutex->count) do_release( mutex );
+            reply->prev_count = mutex->sync->count;
+            if (!--mutex->sync->count) do_release( mutex );
         }
         release_object( mutex );
     }
@@ -257,10 +289,12 @@ DECL_HANDLER(query_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  MUTANT_QUERY_STATE, &mutex_ops )))
     {
-        reply->count = mutex->count;
-        reply->owned = (mutex->owner == current);
-        reply->abandoned = mutex->abandoned;
+        reply->count = mutex->sync->count;
+        reply->owned = (get_mutex_owner( mutex ) == current->id);
+        reply->abandoned = mutex->sync->abandoned;
 
         release_object( mutex );
     }
 }
+
+/* link a mutex grabbed in-process to the current thread */
@@ -23,10 +23,15 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -65,6 +70,8 @@ struct pipe_end
     struct list          message_queue;
     struct async_queue   read_q;     /* read queue */
     struct async_queue   write_q;    /* write queue */
+    int                  direct;     /* data goes directly between the clients through a socket pair */
+    struct timeout_user *flush_poll; /* timeout polling for the peer to read all the data */
 };
 
 struct pipe_server
@@ -148,6 +155,7 @@ static void pipe_end_flush( struct fd *fd, struct async *async );
 static void pipe_end_get_volume_info( struct fd *fd, struct async *async, unsigned int info_class );
 static void pipe_end_reselect_async( struct fd *fd, struct async_queue *queue );
 static void pipe_end_get_file_info( struct fd *fd, obj_handle_t handle, unsigned int info_class );
+static void pipe_end_queue_async( struct fd *fd, struct async *async, int type, int count );
 
 /* server end functions */
 static void pipe_server_dump( struct object *obj, int verbose );
@@ -198,6 +206,22 @@ static const struct fd_ops pipe_server_fd_ops =
     pipe_end_reselect_async       /* reselect_async */
 };
 
+static const struct fd_ops pipe_server_direct_fd_ops =
+{
+    default_fd_get_poll_events,   /* get_poll_events */
+    default_poll_event,           /* poll_event */
+    pipe_end_get_fd_type,         /* get_fd_type */
+    pipe_end_read,                /* read */
+    pipe_end_write,               /* write */
+    pipe_end_flush,               /* flush */
+    pipe_end_get_file_info,       /* get_file_info */
+    pipe_end_get_volume_info,     /* get_volume_info */
+    pipe_server_ioctl,            /* ioctl */
+    default_fd_cancel_async,      /* cancel_async */
+    pipe_end_queue_async,         /* queue_async */
+    default_fd_reselect_async     /* reselect_async */
+};
+
 /* client end functions */
 static void pipe_client_dump( struct object *obj, int verbose );
 static void pipe_client_ioctl( struct fd *fd, ioctl_code_t code, struct async *async );
@@ -242,6 +266,22 @@ static const struct fd_ops pipe_client_fd_ops =
     pipe_end_reselect_async       /* reselect_async */
 };
 
+static const struct fd_ops pipe_client_direct_fd_ops =
+{
+    default_fd_get_poll_events,   /* get_poll_events */
+    default_poll_event,           /* poll_event */
+    pipe_end_get_fd_type,         /* get_fd_type */
+    pipe_end_read,                /* read */
+    pipe_end_write,               /* write */
+    pipe_end_flush,               /* flush */
+    pipe_end_get_file_info,       /* get_file_info */
+    pipe_end_get_volume_info,     /* get_volume_info */
+    pipe_client_ioctl,            /* ioctl */
+    default_fd_cancel_async,      /* cancel_async */
+    pipe_end_queue_async,         /* queue_async */
+    default_fd_reselect_async     /* reselect_async */
+};
+
 static void named_pipe_device_dump( struct object *obj, int verbose );
 static struct object *named_pipe_device_lookup_name( struct object *obj,
     struct unicode_str *name, unsigned int attr, struct object *root );
@@ -373,6 +413,100 @@ static struct fd *pipe_end_get_fd( struct object *obj )
     return (struct fd *) grab_object( pipe_end->fd );
 }
 
+/* Byte mode pipes transfer their data directly between the client processes
+ * through a unix socket pair; the server only keeps track of the pipe state.
+ * The socket of a server end is replaced every time it gets connected. */
+
+/* a socket buffer can't enforce a quota exactly: writes that don't fit in the
+ * reader quota have to stay pending, so pipes with small quotas, where this is
+ * easily noticed, keep going through the server message queue */
+#define DIRECT_PIPE_MIN_QUOTA 0x10000
+
+static int use_direct_pipes( struct named_pipe *pipe )
+{
+    static int enabled = -1;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEDIRECTPIPES" );
+        enabled = !env || atoi( env );
+    }
+    return enabled && !pipe->message_mode &&
+           pipe->insize >= DIRECT_PIPE_MIN_QUOTA && pipe->outsize >= DIRECT_PIPE_MIN_QUOTA;
+}
+
+/* create the sockets of the server and client ends; the send buffer of each end
+ * is sized from the quota of its peer, so that larger writes stay pending */
+static int create_pipe_sockets( struct named_pipe *pipe, int fds[2] )
+{
+    int size;
+
+    if (socketpair( PF_UNIX, SOCK_STREAM, 0, fds ))
+    {
+        file_set_error();
+        return 0;
+    }
+    fcntl( fds[0], F_SETFL, O_NONBLOCK );
+    fcntl( fds[1], F_SETFL, O_NONBLOCK );
+    size = pipe->outsize;
+    setsockopt( fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size) );
+    setsockopt( fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size) );
+    size = pipe->insize;
+    setsockopt( fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size) );
+    setsockopt( fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size) );
+    return 1;
+}
+
+/* set the socket used by a direct pipe end */
+static int set_pipe_end_socket( struct pipe_end *pipe_end, const struct fd_ops *ops,
+                                int unix_fd, unsigned int options )
+{
+    struct fd *fd;
+
+    if (!(fd = create_anonymous_fd( ops, unix_fd, &pipe_end->obj, options ))) return 0;
+    allow_fd_caching( fd );
+    if (pipe_end->fd)
+    {
+        fd_copy_completion( pipe_end->fd, fd );
+        set_fd_signaled( fd, is_fd_signaled( pipe_end->fd ));
+        release_object( pipe_end->fd );
+    }
+    else set_fd_signaled( fd, 1 );
+    pipe_end->fd = fd;
+    return 1;
+}
+
+/* size of the data available for reading on a direct pipe end */
+static data_size_t get_direct_read_avail( struct pipe_end *pipe_end )
+{
+    int avail;
+
+    if (ioctl( get_unix_fd( pipe_end->fd ), FIONREAD, &avail ) == -1) return 0;
+    return avail;
+}
+
+/* size of the data written to a direct pipe end that hasn't been read by the peer yet */
+static data_size_t get_direct_write_pending( struct pipe_end *pipe_end )
+{
+#ifdef SIOCOUTQ
+    int pending;
+
+    if (!ioctl( get_unix_fd( pipe_end->fd ), SIOCOUTQ, &pending )) return pending;
+#endif
+    return 0;
+}
+
+static void pipe_end_flush_poll( void *private )
+{
+    struct pipe_end *pipe_end = private;
+
+    pipe_end->flush_poll = NULL;
+    if (pipe_end->connection && get_direct_write_pending( pipe_end ))
+        pipe_end->flush_poll = add_timeout_user( -TICKS_PER_SEC / 100, pipe_end_flush_poll, pipe_end );
+    else
+        fd_async_wake_up( pipe_end->fd, ASYNC_TYPE_WAIT, STATUS_SUCCESS );
+}
+
 static struct pipe_message *queue_message( struct pipe_end *pipe_end, struct iosb *iosb )
 {
     struct pipe_message *message;
@@ -415,6 +549,25 @@ static void pipe_end_disconnect( struct pipe_end *pipe_end, unsigned int status
         ? FILE_PIPE_DISCONNECTED_STATE : FILE_PIPE_CLOSING_STATE;
     fd_async_wake_up( pipe_end->fd, ASYNC_TYPE_WAIT, status );
     async_wake_up( &pipe_end->read_q, status );
+    if (pipe_end->direct)
+    {
+        fd_async_wake_up( pipe_end->fd, ASYNC_TYPE_READ, status );
+        fd_async_wake_up( pipe_end->fd, ASYNC_TYPE_WRITE, status );
+        if (pipe_end->flush_poll)
+        {
+            remove_timeout_user( pipe_end->flush_poll );
+            pipe_end->flush_poll = NULL;
+        }
+        if (status == STATUS_PIPE_DISCONNECTED)
+        {
+            /* all the data is lost, the client sees end of file and asks us for the status */
+            int unix_fd = get_unix_fd( pipe_end->fd );
+            char buffer[4096];
+
+            shutdown( unix_fd, SHUT_RDWR );
+            while (recv( unix_fd, buffer, sizeof(buffer), MSG_DONTWAIT ) > 0);
+        }
+    }
     LIST_FOR_EACH_ENTRY_SAFE( message, next, &pipe_end->message_queue, struct pipe_message, entry )
     {
         async = message->async;
@@ -527,7 +680,7 @@ static void named_pipe_device_destroy( struct object *obj )
 {
     struct named_pipe_device *device = (struct named_pipe_device*)obj;
     assert( obj->ops == &named_pipe_device_ops );
-    free( device->pipes );
+    free_namespace( device->pipes );
 }
 
 struct object *create_named_pipe_device( struct object *root, const struct unicode_str *name,
@@ -590,7 +743,16 @@ static void pipe_end_flush( struct fd *fd, struct async *async )
         return;
     }
 
-    if (pipe_end->connection && !list_empty( &pipe_end->connection->message_queue ))
+    if (pipe_end->direct)
+    {
+        /* we don't get notified when the peer reads the data, so poll for it */
+        if (!pipe_end->connection || !get_direct_write_pending( pipe_end )) return;
+        if (!pipe_end->flush_poll)
+            pipe_end->flush_poll = add_timeout_user( -TICKS_PER_SEC / 100, pipe_end_flush_poll, pipe_end );
+        fd_queue_async( pipe_end->fd, async, ASYNC_TYPE_WAIT );
+        set_error( STATUS_PENDING );
+    }
+    else if (pipe_end->connection && !list_empty( &pipe_end->connection->message_queue ))
     {
         fd_queue_async( pipe_end->fd, async, ASYNC_TYPE_WAIT );
         set_error( STATUS_PENDING );
@@ -901,6 +1063,12 @@ static void pipe_end_read( struct fd *fd, struct async *async, file_pos_t pos )
     switch (pipe_end->state)
     {
     case FILE_PIPE_CONNECTED_STATE:
+        if (pipe_end->direct)
+        {
+            /* clients only read through the server once their socket is shut down */
+            set_error( STATUS_PIPE_BROKEN );
+            return;
+        }
         if ((pipe_end->flags & NAMED_PIPE_NONBLOCKING_MODE) && list_empty( &pipe_end->message_queue ))
         {
             set_error( STATUS_PIPE_EMPTY );
@@ -914,7 +1082,7 @@ static void pipe_end_read( struct fd *fd, struct async *async, file_pos_t pos )
         set_error( STATUS_PIPE_LISTENING );
         return;
     case FILE_PIPE_CLOSING_STATE:
-        if (!list_empty( &pipe_end->message_queue )) break;
+        if (!pipe_end->direct && !list_empty( &pipe_end->message_queue )) break;
         set_error( STATUS_PIPE_BROKEN );
         return;
     }
@@ -933,7 +1101,10 @@ static void pipe_end_write( struct fd *fd, struct async *async, file_pos_t pos )
     switch (pipe_end->state)
     {
     case FILE_PIPE_CONNECTED_STATE:
-        break;
+        if (!pipe_end->direct) break;
+        /* clients only write through the server once their socket is shut down */
+        set_error( STATUS_PIPE_CLOSING );
+        return;
     case FILE_PIPE_DISCONNECTED_STATE:
         set_error( STATUS_PIPE_DISCONNECTED );
         return;
@@ -958,6 +1129,36 @@ static void pipe_end_write( struct fd *fd, struct async *async, file_pos_t pos )
     set_error( STATUS_PENDING );
 }
 
+/* queue an async waiting for a direct pipe socket to become ready */
+static void pipe_end_queue_async( struct fd *fd, struct async *async, int type, int count )
+{
+    struct pipe_end *pipe_end = get_fd_user( fd );
+
+    switch (pipe_end->state)
+    {
+    case FILE_PIPE_CONNECTED_STATE:
+        break;
+    case FILE_PIPE_DISCONNECTED_STATE:
+        set_error( STATUS_PIPE_DISCONNECTED );
+        return;
+    case FILE_PIPE_LISTENING_STATE:
+        set_error( STATUS_PIPE_LISTENING );
+        return;
+    case FILE_PIPE_CLOSING_STATE:
+        set_error( type == ASYNC_TYPE_READ ? STATUS_PIPE_BROKEN : STATUS_PIPE_CLOSING );
+        return;
+    }
+
+    if (pipe_end->flags & NAMED_PIPE_NONBLOCKING_MODE)
+    {
+        /* non-blocking writes complete with what was written so far; nothing is
+         * queued and the client completes the request when it gets STATUS_SUCCESS */
+        if (type == ASYNC_TYPE_READ) set_error( STATUS_PIPE_EMPTY );
+        return;
+    }
+    default_fd_queue_async( fd, async, type, count );
+}
+
 static void pipe_end_reselect_async( struct fd *fd, struct async_queue *queue )
 {
     struct pipe_end *pipe_end = get_fd_user( fd );
@@ -995,7 +1196,7 @@ static void pipe_end_peek( struct pipe_end *pipe_end )
     case FILE_PIPE_CONNECTED_STATE:
         break;
     case FILE_PIPE_CLOSING_STATE:
-        if (!list_empty( &pipe_end->message_queue )) break;
+        if (pipe_end->direct ? get_direct_read_avail( pipe_end ) : !list_empty( &pipe_end->message_queue )) break;
         set_error( STATUS_PIPE_BROKEN );
         return;
     default:
@@ -1003,6 +1204,31 @@ static void pipe_end_peek( struct pipe_end *pipe_end )
         return;
     }
 
+    if (pipe_end->direct)
+    {
+        char *data = NULL;
+        int size = 0;
+
+        avail = get_direct_read_avail( pipe_end );
+        reply_size = min( reply_size, avail );
+        if (reply_size)
+        {
+            if (!(data = mem_alloc( reply_size ))) return;
+            size = recv( get_unix_fd( pipe_end->fd ), data, reply_size, MSG_PEEK | MSG_DONTWAIT );
+            if (size < 0) size = 0;
+        }
+        if ((buffer = set_reply_data_size( offsetof( FILE_PIPE_PEEK_BUFFER, Data[size] ))))
+        {
+            buffer->NamedPipeState    = pipe_end->state;
+            buffer->ReadDataAvailable = avail;
+            buffer->NumberOfMessages  = 0;
+            buffer->MessageLength     = 0;
+            if (size) memcpy( buffer->Data, data, size );
+        }
+        free( data );
+        return;
+    }
+
     LIST_FOR_EACH_ENTRY( message, &pipe_end->message_queue, struct pipe_message, entry )
         avail += message->iosb->in_size - message->read_pos;
     reply_size = min( reply_size, avail );
@@ -1222,6 +1448,8 @@ static void init_pipe_end( struct pipe_end *pipe_end, struct named_pipe *pipe,
     init_async_queue( &pipe_end->read_q );
     init_async_queue( &pipe_end->write_q );
     list_init( &pipe_end->message_queue );
+    pipe_end->direct = 0;
+    pipe_end->flush_poll = NULL;
 }
 
 static struct pipe_server *create_pipe_server( struct named_pipe *pipe, unsigned int options,
@@ -1240,29 +1468,66 @@ static struct pipe_server *create_pipe_server( struct named_pipe *pipe, unsigned
     init_async_queue( &server->listen_q );
 
     list_add_tail( &pipe->listeners, &server->entry );
-    if (!(server->pipe_end.fd = alloc_pseudo_fd( &pipe_server_fd_ops, &server->pipe_end.obj, options )))
+    if (use_direct_pipes( pipe ))
     {
-        release_object( server );
-        return NULL;
+        int fds[2];
+
+        /* until it gets connected the server end uses a socket without a peer,
+         * so that the client sees end of file and asks us for the pipe status */
+        server->pipe_end.direct = 1;
+        if (!create_pipe_sockets( pipe, fds ))
+        {
+            release_object( server );
+            return NULL;
+        }
+        close( fds[1] );
+        if (!set_pipe_end_socket( &server->pipe_end, &pipe_server_direct_fd_ops, fds[0], options ))
+        {
+            release_object( server );
+            return NULL;
+        }
+    }
+    else
+    {
+        if (!(server->pipe_end.fd = alloc_pseudo_fd( &pipe_server_fd_ops, &server->pipe_end.obj, options )))
+        {
+            release_object( server );
+            return NULL;
+        }
+        allow_fd_caching( server->pipe_end.fd );
+        set_fd_signaled( server->pipe_end.fd, 1 );
     }
-    allow_fd_caching( server->pipe_end.fd );
-    set_fd_signaled( server->pipe_end.fd, 1 );
     async_wake_up( &pipe->waiters, STATUS_SUCCESS );
     return server;
 }
 
-static struct pipe_end *create_pipe_client( struct named_pipe *pipe, data_size_t buffer_size, unsigned int options )
+static struct pipe_end *create_pipe_client( struct named_pipe *pipe, data_size_t buffer_size,
+                                            unsigned int options, int unix_fd )
 {
     struct pipe_end *client;
 
     client = alloc_object( &pipe_client_ops );
     if (!client)
+    {
+        if (unix_fd != -1) close( unix_fd );
         return NULL;
+    }
 
     init_pipe_end( client, pipe, 0, buffer_size );
     client->state = FILE_PIPE_CONNECTED_STATE;
     client->client_pid = get_process_id( current->process );
 
+    if (unix_fd != -1)
+    {
+        client->direct = 1;
+        if (!set_pipe_end_socket( client, &pipe_client_direct_fd_ops, unix_fd, options ))
+        {
+            release_object( client );
+            return NULL;
+        }
+        return client;
+    }
+
     client->fd = alloc_pseudo_fd( &pipe_client_fd_ops, &client->obj, options );
     if (!client->fd)
     {
@@ -1296,6 +1561,7 @@ static struct object *named_pipe_open_file( struct object *obj, unsigned int acc
     struct pipe_server *server;
     struct pipe_end *client;
     unsigned int pipe_sharing;
+    int fds[2] = { -1, -1 };
 
     if (list_empty( &pipe->listeners ))
     {
@@ -1312,7 +1578,18 @@ static struct object *named_pipe_open_file( struct object *obj, unsigned int acc
         return NULL;
     }
 
-    if ((client = create_pipe_client( pipe, pipe->outsize, options )))
+    if (server->pipe_end.direct)
+    {
+        if (!create_pipe_sockets( pipe, fds )) return NULL;
+        if (!set_pipe_end_socket( &server->pipe_end, &pipe_server_direct_fd_ops, fds[0],
+                                  get_fd_options( server->pipe_end.fd )))
+        {
+            close( fds[1] );
+            return NULL;
+        }
+    }
+
+    if ((client = create_pipe_client( pipe, pipe->outsize, options, fds[1] )))
     {
         async_wake_up( &server->listen_q, STATUS_SUCCESS );
         server->pipe_end.state = FILE_PIPE_CONNECTED_STATE;
@@ -42,10 +42,14 @@
 #include "security.h"
 
 
+#define MIN_HASH_BITS 3   /* smallest hash table size is 8 */
+#define MAX_HASH_BITS 20  /* stop growing at 1M hash entries */
+
 struct namespace
 {
-    unsigned int        hash_size;       /* size of hash table */
-    struct list         names[1];        /* array of hash entry lists */
+    unsigned int        hash_bits;       /* log2 of the size of the hash table */
+    unsigned int        count;           /* number of names in the namespace */
+    struct list        *names;           /* array of hash entry lists */
 };
 
 
@@ -133,11 +137,44 @@ void *memdup( const void *data, size_t len )
 
 /*****************************************************************/
 
+/* get the hash table index of a name hash; the multiplication spreads the bits for the mask */
+static inline unsigned int hash_index( unsigned int hash, unsigned int bits )
+{
+    return (hash * 0x9e3779b1) >> (32 - bits);
+}
+
+/* double the size of the hash table of a namespace that gets too crowded */
+static void grow_namespace( struct namespace *namespace )
+{
+    unsigned int i, bits = namespace->hash_bits + 1;
+    struct object_name *ptr, *next;
+    struct list *names;
+
+    if (bits > MAX_HASH_BITS) return;
+    if (!(names = malloc( sizeof(*names) << bits ))) return;  /* keep using the current table */
+    for (i = 0; i < 1u << bits; i++) list_init( &names[i] );
+
+    for (i = 0; i < 1u << namespace->hash_bits; i++)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( ptr, next, &namespace->names[i], struct object_name, entry )
+        {
+            list_remove( &ptr->entry );
+            list_add_tail( &names[hash_index( ptr->hash, bits )], &ptr->entry );
+        }
+    }
+    free( namespace->names );
+    namespace->names = names;
+    namespace->hash_bits = bits;
+}
+
 void namespace_add( struct namespace *namespace, struct object_name *ptr )
 {
-    unsigned int hash = hash_strW( ptr->name, ptr->len, namespace->hash_size );
+    /* keep the average chain length below 2 */
+    if (++namespace->count > 2u << namespace->hash_bits) grow_namespace( namespace );
 
-    list_add_head( &namespace->names[hash], &ptr->entry );
+    ptr->namespace = namespace;
+    ptr->hash = get_hash_strW( ptr->name, ptr->len );
+    list_add_head( &namespace->names[hash_index( ptr->hash, namespace->hash_bits )], &ptr->entry );
 }
 
 /* allocate a name for an object */
@@ -149,6 +186,7 @@ static struct object_name *alloc_name( const struct unicode_str *name )
     {
         ptr->len = name->len;
         ptr->parent = NULL;
+        ptr->namespace = NULL;
         memcpy( ptr->name, name->str, name->len );
     }
     return ptr;
@@ -448,14 +486,16 @@ struct object *find_object( const struct namespace *namespace, const struct unic
 {
     const struct list *list;
     struct list *p;
+    unsigned int hash;
 
     if (!name || !name->len) return NULL;
 
-    list = &namespace->names[ hash_strW( name->str, name->len, namespace->hash_size ) ];
+    hash = get_hash_strW( name->str, name->len );
+    list = &namespace->names[hash_index( hash, namespace->hash_bits )];
     LIST_FOR_EACH( p, list )
     {
         const struct object_name *ptr = LIST_ENTRY( p, struct object_name, entry );
-        if (ptr->len != name->len) continue;
+        if (ptr->hash != hash || ptr->len != name->len) continue;
         if (attributes & OBJ_CASE_INSENSITIVE)
         {
             if (!memicmp_strW( ptr->name, name->str, name->len ))
@@ -476,7 +516,7 @@ struct object *find_object_index( const struct namespace *namespace, unsigned in
     unsigned int i;
 
     /* FIXME: not efficient at all */
-    for (i = 0; i < namespace->hash_size; i++)
+    for (i = 0; i < 1u << namespace->hash_bits; i++)
     {
         const struct object_name *ptr;
         LIST_FOR_EACH_ENTRY( ptr, &namespace->names[i], const struct object_name, entry )
@@ -488,21 +528,34 @@ struct object *find_object_index( const struct namespace *namespace, unsigned in
     return NULL;
 }
 
-/* allocate a namespace */
+/* allocate a namespace; the hash table grows as names are added */
 struct namespace *create_namespace( unsigned int hash_size )
 {
     struct namespace *namespace;
-    unsigned int i;
+    unsigned int i, bits = MIN_HASH_BITS;
+
+    while (bits < MAX_HASH_BITS && (1u << bits) < hash_size) bits++;
 
-    namespace = mem_alloc( sizeof(*namespace) + (hash_size - 1) * sizeof(namespace->names[0]) );
-    if (namespace)
+    if (!(namespace = mem_alloc( sizeof(*namespace) ))) return NULL;
+    if (!(namespace->names = mem_alloc( sizeof(*namespace->names) << bits )))
     {
-        namespace->hash_size      = hash_size;
-        for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
+        free( namespace );
+        return NULL;
     }
+    namespace->hash_bits = bits;
+    namespace->count     = 0;
+    for (i = 0; i < 1u << bits; i++) list_init( &namespace->names[i] );
     return namespace;
 }
 
+/* free a namespace */
+void free_namespace( struct namespace *namespace )
+{
+    if (!namespace) return;
+    free( namespace->names );
+    free( namespace );
+}
+
 /* functions for unimplemented/default object operations */
 
 int no_add_queue( struct object *obj, struct wait_queue_entry *entry )
@@ -690,6 +743,7 @@ int no_link_name( struct object *obj, struct object_name *name, struct object *p
 void default_unlink_name( struct object *obj, struct object_name *name )
 {
     list_remove( &name->entry );
+    if (name->namespace) name->namespace->count--;
 }
 
 struct object *no_open_file( struct object *obj, unsigned int access, unsigned int sharing,
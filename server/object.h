@@ -131,6 +131,8 @@ struct object_name
     struct list         entry;           /* entry in the hash list */
     struct object      *obj;             /* object owning this name */
     struct object      *parent;          /* parent object */
+    struct namespace   *namespace;       /* namespace containing the name */
+    unsigned int        hash;            /* hash value of the name */
     data_size_t         len;             /* name length in bytes */
     WCHAR               name[1];
 };
@@ -159,6 +161,7 @@ extern void *open_named_object( struct object *parent, const struct object_ops *
                                 const struct unicode_str *name, unsigned int attributes );
 extern void unlink_named_object( struct object *obj );
 extern struct namespace *create_namespace( unsigned int hash_size );
+extern void free_namespace( struct namespace *namespace );
 extern void free_kernel_objects( struct object *obj );
 /* grab/release_object can take any pointer, but you better make sure */
 /* that the thing pointed to starts with a struct object... */
@@ -217,10 +220,28 @@ extern struct event *get_event_obj( struct process *process, obj_handle_t handle
 extern struct keyed_event *get_keyed_event_obj( struct process *process, obj_handle_t handle, unsigned int access );
 extern void set_event( struct event *event );
 extern void reset_event( struct event *event );
+extern unsigned int get_event_inproc_sync( struct object *obj );
 
 /* mutex functions */
 
 extern void abandon_mutexes( struct thread *thread );
+extern unsigned int get_mutex_inproc_sync( struct object *obj );
+
+/* semaphore functions */
+
+extern unsigned int get_semaphore_inproc_sync( struct object *obj );
+
+/* in-process synchronization functions */
+
+extern void init_inproc_sync(void);
+extern struct inproc_sync *alloc_inproc_sync( enum inproc_sync_type type, unsigned int *index );
+extern void free_inproc_sync( unsigned int index );
+extern void wake_inproc_sync_clients( struct inproc_sync *sync );
+extern void add_inproc_sync_waiter( struct inproc_sync *sync );
+extern void remove_inproc_sync_waiter( struct inproc_sync *sync );
+extern struct inproc_sync *get_obj_inproc_sync( struct object *obj );
+extern int claim_inproc_sync( struct inproc_sync *sync, struct thread *thread );
+extern void unclaim_inproc_sync( struct inproc_sync *sync );
 
 /* serial functions */
 
@@ -243,6 +264,7 @@ extern unsigned short supported_machines[8];
 extern unsigned short native_machine;
 extern void init_registry(void);
 extern void flush_registry(void);
+extern unsigned int get_key_inproc_sync( struct object *obj );
 
 static inline int is_machine_32bit( unsigned short machine )
 {
@@ -266,6 +288,12 @@ extern void stop_watchdog(void);
 extern int watchdog_triggered(void);
 extern void init_signals(void);
 
+/* worker thread functions */
+
+typedef void (*work_func)( void *arg );
+extern int queue_work( work_func work, work_func done, void *arg );
+extern void flush_work(void);
+
 /* atom functions */
 
 extern atom_t add_global_atom( struct winstation *winstation, const struct unicode_str *str );
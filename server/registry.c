@@ -33,6 +33,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -91,6 +92,10 @@ struct key
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
+    const struct hive_key *hive;   /* record of the key in the mapped hive file, if any */
+    unsigned int      hive_offset; /* offset of the key record in the hive file being saved */
+    struct inproc_sync *sync;      /* modification serial shared with clients, if any */
+    unsigned int      sync_index;  /* index of the shared state */
 };
 
 /* key flags */
@@ -101,6 +106,7 @@ struct key
 #define KEY_WOW64    0x0010  /* key contains a Wow6432Node subkey */
 #define KEY_WOWSHARE 0x0020  /* key is a Wow64 shared key (used for Software\Classes) */
 #define KEY_PREDEF   0x0040  /* key is marked as predefined */
+#define KEY_UNLOADED 0x0080  /* subkeys and values haven't been loaded from the hive yet */
 
 /* a key value */
 struct key_value
@@ -132,13 +138,27 @@ static const WCHAR symlink_value[] = {'S','y','m','b','o','l','i','c','L','i','n
 static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_value) };
 
 static void set_periodic_save_timer(void);
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index );
+static void load_hive_key( struct key *key );
+static void journal_change( struct key *key, unsigned int op, const struct unicode_str *name,
+                            int type, const void *data, data_size_t len );
+static int save_text_file( const char *path, void (*save)( FILE *f, void *arg ), void *arg );
 
 /* information about where to save a registry branch */
 struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    const char  *hive_path;   /* path of the binary hive file */
+    void        *hive;        /* mapping of the hive file */
+    size_t       hive_size;   /* size of the hive mapping */
+    int          text_stale;  /* whether the text file is older than the hive */
+    unsigned __int64 serial;  /* serial number of the hive file */
+    const char  *journal_path; /* path of the change journal */
+    int          journal_fd;  /* fd of the change journal, -1 if not in use */
+    size_t       journal_size; /* current size of the change journal */
+    unsigned int dirty_periods; /* number of save periods since the hive was last written */
+    struct save_work *saving;  /* hive save in progress, if any */
 };
 
 #define MAX_SAVE_BRANCH_INFO 3
@@ -149,6 +169,139 @@ unsigned int supported_machines_count = 0;
 unsigned short supported_machines[8];
 unsigned short native_machine = 0;
 
+/*
+ * The binary hive format is used to store the registry branches in addition
+ * to the text files. The server maps the hive file and creates the keys
+ * lazily when they are accessed, and saves modified branches to the hive
+ * periodically. The hive and the text file are written by a worker thread
+ * from a snapshot of the branch, and the keys are switched to the new hive
+ * once it's complete; the hive is ignored if the text file was modified
+ * behind our back.
+ *
+ * A hive file starts with a struct hive_header, followed by the record of
+ * the root key of the branch. A key record is followed by the key name and
+ * class, its values with their names and data, the offsets of its subkeys
+ * and then the records of all its subkeys, so that the subtree of a key is
+ * stored in a single contiguous block. All offsets are relative to the start
+ * of the key record, which allows copying the block of an unmodified subtree
+ * as is when saving the hive.
+ *
+ * Changes to a branch are appended to its journal file as they are made, so
+ * that the hive only needs to be rewritten once the journal grows too big.
+ * The journal starts with a struct journal_header holding the serial number
+ * of the hive it applies to, followed by struct journal_record entries that
+ * are replayed on top of the hive at startup.
+ */
+
+#define HIVE_MAGIC      0x45564948  /* "HIVE" */
+#define HIVE_VERSION    1
+#define HIVE_TEXT_STALE 0x0001      /* the text file hasn't been updated with the hive contents */
+
+struct hive_header
+{
+    unsigned int     magic;        /* HIVE_MAGIC */
+    unsigned int     version;      /* HIVE_VERSION */
+    unsigned int     flags;        /* HIVE_* flags */
+    unsigned int     prefix_type;  /* prefix type of the registry */
+    unsigned __int64 size;         /* size of the hive file */
+    unsigned __int64 text_size;    /* size of the corresponding text file */
+    __int64          text_mtime;   /* modification time of the corresponding text file */
+    unsigned __int64 text_ino;     /* inode of the corresponding text file */
+    unsigned __int64 serial;       /* serial number, incremented on every save */
+};
+
+struct hive_key
+{
+    timeout_t        modif;        /* last modification time */
+    unsigned int     size;         /* size of the record including the whole subtree */
+    unsigned int     flags;        /* key flags (KEY_SYMLINK and KEY_WOW64 only) */
+    unsigned short   namelen;      /* length of key name */
+    unsigned short   classlen;     /* length of key class */
+    unsigned int     nb_subkeys;   /* number of subkeys */
+    unsigned int     subkeys;      /* offset of the array of subkey record offsets */
+    unsigned int     nb_values;    /* number of values */
+    unsigned int     values;       /* offset of the array of values */
+    unsigned int     __pad;
+    /* followed by WCHAR name[namelen / sizeof(WCHAR)], class[classlen / sizeof(WCHAR)] */
+};
+
+struct hive_value
+{
+    unsigned int     type;         /* value type */
+    unsigned int     len;          /* value data length in bytes */
+    unsigned int     data;         /* offset of value data */
+    unsigned int     name;         /* offset of value name */
+    unsigned int     namelen;      /* length of value name */
+};
+
+#define JOURNAL_MAGIC   0x4c4e524a  /* "JRNL" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_COMPACT_SIZE  (1024 * 1024)  /* journal size that triggers a hive rewrite */
+#define JOURNAL_MAX_PERIODS   10             /* max save periods before a hive rewrite */
+
+enum journal_op
+{
+    JOURNAL_CREATE_KEY,    /* name is the key class, type the KEY_SYMLINK flag */
+    JOURNAL_DELETE_KEY,
+    JOURNAL_SET_VALUE,
+    JOURNAL_DELETE_VALUE
+};
+
+struct journal_header
+{
+    unsigned int     magic;        /* JOURNAL_MAGIC */
+    unsigned int     version;      /* JOURNAL_VERSION */
+    unsigned __int64 serial;       /* serial number of the corresponding hive */
+};
+
+struct journal_record
+{
+    unsigned int     size;         /* size of the record, aligned to 8 bytes */
+    unsigned int     op;           /* enum journal_op */
+    timeout_t        modif;        /* modification time */
+    unsigned int     pathlen;      /* length of key path relative to the branch root */
+    unsigned int     namelen;      /* length of value name or key class */
+    unsigned int     type;         /* value type or key flags */
+    unsigned int     len;          /* value data length */
+    /* followed by WCHAR path[pathlen / sizeof(WCHAR)], name[namelen / sizeof(WCHAR)], data[len] */
+};
+
+C_ASSERT( sizeof(struct hive_header) == 56 );
+C_ASSERT( sizeof(struct journal_header) == 16 );
+C_ASSERT( sizeof(struct journal_record) == 32 );
+C_ASSERT( sizeof(struct hive_key) == 40 );
+C_ASSERT( sizeof(struct hive_value) == 20 );
+
+/* buffer used to build a hive file */
+struct hive_buffer
+{
+    char        *data;
+    size_t       size;
+    size_t       alloc;
+};
+
+/* hive save running in a worker thread */
+struct save_work
+{
+    struct save_branch_info *info;  /* branch being saved */
+    struct hive_buffer buf;         /* snapshot of the branch in hive format */
+    WCHAR       *root;              /* full path of the branch root key */
+    data_size_t  rootlen;           /* length of the root key path */
+    size_t       journal_pos;       /* size of the journal when the snapshot was taken */
+    int          write_text;        /* whether the text file has to be written too */
+    int          text_saved;        /* whether the text file has been written */
+    void        *map;               /* mapping of the new hive file, NULL on failure */
+};
+
+/* path of a key record while writing a hive to a text file */
+struct hive_path
+{
+    const struct hive_path *parent;
+    const struct hive_key  *key;
+};
+
+static int hive_enabled = 1;  /* whether hive files are used */
+
 /* information about a file being loaded */
 struct file_load_info
 {
@@ -219,6 +372,32 @@ static void dump_path( const struct key *key, const struct key *base, FILE *f )
     dump_strW( key->name, key->namelen, f, "[]" );
 }
 
+/* build the full path of a key, with backslash separators */
+static WCHAR *get_key_path( const struct key *key, data_size_t *len )
+{
+    const struct key *k;
+    data_size_t size = 0;
+    WCHAR *path;
+    char *ptr;
+
+    for (k = key; k; k = k->parent) size += k->namelen + sizeof(WCHAR);
+    size -= sizeof(WCHAR);
+    if (!(path = malloc( size + sizeof(WCHAR) ))) return NULL;
+    ptr = (char *)path + size;
+    for (k = key; k; k = k->parent)
+    {
+        ptr -= k->namelen;
+        memcpy( ptr, k->name, k->namelen );
+        if (ptr > (char *)path)
+        {
+            ptr -= sizeof(WCHAR);
+            *(WCHAR *)ptr = '\\';
+        }
+    }
+    *len = size;
+    return path;
+}
+
 /* dump a value to a text file */
 static void dump_value( const struct key_value *value, FILE *f )
 {
@@ -274,11 +453,12 @@ static void dump_value( const struct key_value *value, FILE *f )
 }
 
 /* save a registry and all its subkeys to a text file */
-static void save_subkeys( const struct key *key, const struct key *base, FILE *f )
+static void save_subkeys( struct key *key, const struct key *base, FILE *f )
 {
     int i;
 
     if (key->flags & KEY_VOLATILE) return;
+    load_hive_key( key );
     /* save key if it has either some values or no subkeys, or needs special options */
     /* keys with no values but subkeys are saved implicitly by saving the subkeys */
     if ((key->last_value >= 0) || (key->last_subkey == -1) || key->class || (key->flags & KEY_SYMLINK))
@@ -450,6 +630,7 @@ static void key_destroy( struct object *obj )
     struct key *key = (struct key *)obj;
     assert( obj->ops == &key_ops );
 
+    if (key->sync) free_inproc_sync( key->sync_index );
     free( key->name );
     free( key->class );
     for (i = 0; i <= key->last_value; i++)
@@ -531,6 +712,10 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->values      = NULL;
         key->modif       = modif;
         key->parent      = NULL;
+        key->hive        = NULL;
+        key->hive_offset = 0;
+        key->sync        = NULL;
+        key->sync_index  = 0;
         list_init( &key->notify_list );
         if (name->len && !(key->name = memdup( name->str, name->len )))
         {
@@ -541,6 +726,154 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
     return key;
 }
 
+/* check that a key record fits in a hive block of a given size */
+static int hive_key_valid( const struct hive_key *hive, unsigned int size )
+{
+    const char *base = (const char *)hive;
+    const struct hive_value *values;
+    const unsigned int *subkeys;
+    unsigned int i;
+
+    if (size < sizeof(*hive) || hive->size > size || hive->size < sizeof(*hive)) return 0;
+    size = hive->size;
+    if (hive->namelen + hive->classlen > size - sizeof(*hive)) return 0;
+    if (hive->nb_values)
+    {
+        if (hive->values > size || hive->nb_values > (size - hive->values) / sizeof(*values)) return 0;
+        values = (const struct hive_value *)(base + hive->values);
+        for (i = 0; i < hive->nb_values; i++)
+        {
+            if (values[i].name > size || values[i].namelen > size - values[i].name) return 0;
+            if (values[i].namelen > MAX_VALUE_LEN * sizeof(WCHAR)) return 0;
+            if (values[i].data > size || values[i].len > size - values[i].data) return 0;
+        }
+    }
+    if (hive->nb_subkeys)
+    {
+        if (hive->subkeys > size || hive->nb_subkeys > (size - hive->subkeys) / sizeof(*subkeys)) return 0;
+        subkeys = (const unsigned int *)(base + hive->subkeys);
+        for (i = 0; i < hive->nb_subkeys; i++)
+        {
+            if (subkeys[i] < sizeof(*hive) || (subkeys[i] & 7)) return 0;
+            if (subkeys[i] > size - sizeof(*hive)) return 0;
+            if (((const struct hive_key *)(base + subkeys[i]))->size > size - subkeys[i]) return 0;
+        }
+    }
+    return 1;
+}
+
+/* create a key object from its hive record */
+static struct key *alloc_hive_key( const struct hive_key *hive )
+{
+    struct unicode_str name;
+    struct key *key;
+
+    name.str = (const WCHAR *)(hive + 1);
+    name.len = hive->namelen;
+    if (!(key = alloc_key( &name, hive->modif ))) return NULL;
+    if (hive->classlen &&
+        (key->class = memdup( (const char *)(hive + 1) + hive->namelen, hive->classlen )))
+        key->classlen = hive->classlen;
+    key->flags = (hive->flags & (KEY_SYMLINK | KEY_WOW64)) | KEY_UNLOADED;
+    key->hive  = hive;
+    return key;
+}
+
+/* create the subkeys and values of a key from its hive record */
+static void load_hive_key( struct key *key )
+{
+    const struct hive_key *hive = key->hive;
+    const char *base = (const char *)hive;
+    const struct hive_value *values;
+    const unsigned int *subkeys;
+    struct key_value *value;
+    struct key *subkey;
+    unsigned int i;
+
+    if (!(key->flags & KEY_UNLOADED)) return;
+    key->flags &= ~KEY_UNLOADED;
+
+    if (!hive_key_valid( hive, hive->size ))
+    {
+        fprintf( stderr, "wineserver: corrupted registry hive, ignoring contents of key " );
+        dump_path( key, NULL, stderr );
+        fprintf( stderr, "\n" );
+        return;
+    }
+
+    if (hive->nb_values)
+    {
+        key->nb_values = max( hive->nb_values, MIN_VALUES );
+        if (!(key->values = mem_alloc( key->nb_values * sizeof(*key->values) )))
+        {
+            key->nb_values = 0;
+            return;
+        }
+        values = (const struct hive_value *)(base + hive->values);
+        for (i = 0; i < hive->nb_values; i++)
+        {
+            value = &key->values[i];
+            value->name    = NULL;
+            value->namelen = values[i].namelen;
+            value->type    = values[i].type;
+            value->data    = NULL;
+            value->len     = values[i].len;
+            if (value->namelen && !(value->name = memdup( base + values[i].name, value->namelen ))) break;
+            if (value->len && !(value->data = memdup( base + values[i].data, value->len )))
+            {
+                free( value->name );
+                break;
+            }
+            key->last_value = i;
+        }
+    }
+
+    if (hive->nb_subkeys)
+    {
+        key->nb_subkeys = max( hive->nb_subkeys, MIN_SUBKEYS );
+        if (!(key->subkeys = mem_alloc( key->nb_subkeys * sizeof(*key->subkeys) )))
+        {
+            key->nb_subkeys = 0;
+            return;
+        }
+        subkeys = (const unsigned int *)(base + hive->subkeys);
+        for (i = 0; i < hive->nb_subkeys; i++)
+        {
+            if (!(subkey = alloc_hive_key( (const struct hive_key *)(base + subkeys[i]) ))) break;
+            subkey->parent = key;
+            key->subkeys[++key->last_subkey] = subkey;
+        }
+    }
+}
+
+/* bump the modification serial of a key, to invalidate the client-side value caches */
+static void key_changed( struct key *key )
+{
+    static unsigned int serial;
+
+    if (!key->sync) return;
+    /* 0 is the state of a free slot, it must never be a valid serial */
+    if (!++serial) serial++;
+    __atomic_store_n( &key->sync->state, serial, __ATOMIC_SEQ_CST );
+}
+
+/* retrieve the index of the shared state of a key, allocating it if needed */
+static unsigned int get_key_sync_index( struct key *key )
+{
+    if (!key->sync && !(key->flags & (KEY_PREDEF | KEY_DELETED)))
+    {
+        if (!(key->sync = alloc_inproc_sync( INPROC_SYNC_KEY, &key->sync_index ))) clear_error();
+        else key_changed( key );
+    }
+    return key->sync ? key->sync_index : 0;
+}
+
+unsigned int get_key_inproc_sync( struct object *obj )
+{
+    if (obj->ops != &key_ops) return 0;
+    return get_key_sync_index( (struct key *)obj );
+}
+
 /* mark a key and all its parents as dirty (modified) */
 static void make_dirty( struct key *key )
 {
@@ -563,6 +896,16 @@ static void make_clean( struct key *key )
     for (i = 0; i <= key->last_subkey; i++) make_clean( key->subkeys[i] );
 }
 
+/* mark all the loaded keys of a subtree as dirty, when their hive records can't be trusted */
+static void make_subtree_dirty( struct key *key )
+{
+    int i;
+
+    if (key->flags & (KEY_VOLATILE | KEY_UNLOADED)) return;
+    key->flags |= KEY_DIRTY;
+    for (i = 0; i <= key->last_subkey; i++) make_subtree_dirty( key->subkeys[i] );
+}
+
 /* go through all the notifications and send them if necessary */
 static void check_notify( struct key *key, unsigned int change, int not_subtree )
 {
@@ -583,6 +926,7 @@ static void touch_key( struct key *key, unsigned int change )
 
     key->modif = current_time;
     make_dirty( key );
+    key_changed( key );
 
     /* do notifications */
     check_notify( key, change, 1 );
@@ -654,10 +998,13 @@ static void free_subkey( struct key *parent, int index )
     assert( index <= parent->last_subkey );
 
     key = parent->subkeys[index];
+    load_hive_key( key );  /* the hive mapping may go away while the key is still in use */
+    key->hive = NULL;
     for (i = index; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
     parent->last_subkey--;
     key->flags |= KEY_DELETED;
     key->parent = NULL;
+    key_changed( key );
     if (is_wow6432node( key->name, key->namelen )) parent->flags &= ~KEY_WOW64;
     release_object( key );
 
@@ -675,11 +1022,12 @@ static void free_subkey( struct key *parent, int index )
 }
 
 /* find the named child of a given key and return its index */
-static struct key *find_subkey( const struct key *key, const struct unicode_str *name, int *index )
+static struct key *find_subkey( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    load_hive_key( key );
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -870,6 +1218,8 @@ static struct key *create_key( struct key *key, const struct unicode_str *name,
         if (!(key->class = memdup( class->str, key->classlen ))) key->classlen = 0;
     }
     touch_key( key->parent, REG_NOTIFY_CHANGE_NAME );
+    if (!(options & REG_OPTION_VOLATILE))
+        journal_change( key, JOURNAL_CREATE_KEY, class, key->flags & KEY_SYMLINK, NULL, 0 );
     grab_object( key );
     return key;
 }
@@ -933,6 +1283,7 @@ static void enum_key( struct key *key, int index, int info_class, struct enum_ke
         return;
     }
 
+    load_hive_key( key );
     if (index != -1)  /* -1 means use the specified key directly */
     {
         if ((index < 0) || (index > key->last_subkey))
@@ -941,6 +1292,7 @@ static void enum_key( struct key *key, int index, int info_class, struct enum_ke
             return;
         }
         key = key->subkeys[index];
+        load_hive_key( key );
     }
 
     namelen = key->namelen;
@@ -1034,6 +1386,7 @@ static int delete_key( struct key *key, int recurse )
         return -1;
     }
 
+    load_hive_key( key );
     while (recurse && (key->last_subkey>=0))
         if (0 > delete_key(key->subkeys[key->last_subkey], 1))
             return -1;
@@ -1050,6 +1403,7 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    journal_change( key, JOURNAL_DELETE_KEY, NULL, 0, NULL, 0 );
     free_subkey( parent, index );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
     return 0;
@@ -1081,11 +1435,12 @@ static int grow_values( struct key *key )
 }
 
 /* find the named value of a given key and return its index in the array */
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index )
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    load_hive_key( key );
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1183,6 +1538,7 @@ static void set_value( struct key *key, const struct unicode_str *name,
     value->len   = len;
     value->data  = ptr;
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
+    journal_change( key, JOURNAL_SET_VALUE, name, type, data, len );
     if (debug_level > 1) dump_operation( key, value, "Set" );
 }
 
@@ -1223,6 +1579,7 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
         return;
     }
 
+    load_hive_key( key );
     if (i < 0 || i > key->last_value) set_error( STATUS_NO_MORE_ENTRIES );
     else
     {
@@ -1287,6 +1644,7 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         return;
     }
     if (debug_level > 1) dump_operation( key, value, "Delete" );
+    journal_change( key, JOURNAL_DELETE_VALUE, name, 0, NULL, 0 );
     free( value->name );
     free( value->data );
     for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
@@ -1645,6 +2003,7 @@ static int load_value( struct key *key, const char *buffer, struct file_load_inf
     value->data = newptr;
     value->len  = len;
     value->type = type;
+    key_changed( key );
     return 1;
 
  error:
@@ -1776,12 +2135,707 @@ static void load_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* reserve space at the end of a hive buffer, return its offset or -1 on failure */
+static size_t hive_alloc( struct hive_buffer *buf, size_t size, size_t align )
+{
+    size_t pos = (buf->size + align - 1) & ~(align - 1);
+
+    if (pos + size > UINT_MAX) return -1;  /* offsets are 32-bit */
+    if (pos + size > buf->alloc)
+    {
+        size_t new_size = max( max( buf->alloc * 2, pos + size ), 65536 );
+        char *new_data;
+
+        if (!(new_data = realloc( buf->data, new_size ))) return -1;
+        buf->data  = new_data;
+        buf->alloc = new_size;
+    }
+    memset( buf->data + buf->size, 0, pos + size - buf->size );
+    buf->size = pos + size;
+    return pos;
+}
+
+/* check whether the hive record of a key is up to date for the whole subtree */
+static int hive_subtree_clean( const struct key *key )
+{
+    int i;
+
+    if (!key->hive || (key->flags & KEY_DIRTY)) return 0;
+    if (key->flags & KEY_UNLOADED) return 1;
+    for (i = 0; i <= key->last_subkey; i++)
+    {
+        if (key->subkeys[i]->flags & KEY_VOLATILE) continue;
+        if (!hive_subtree_clean( key->subkeys[i] )) return 0;
+    }
+    return 1;
+}
+
+/* set the offsets of the records of a subtree that has been copied as is */
+static void set_hive_offsets( struct key *key, size_t offset )
+{
+    int i;
+
+    key->hive_offset = offset;
+    if (key->flags & KEY_UNLOADED) return;
+    for (i = 0; i <= key->last_subkey; i++)
+    {
+        struct key *subkey = key->subkeys[i];
+        if (subkey->flags & KEY_VOLATILE) continue;
+        set_hive_offsets( subkey, offset + ((const char *)subkey->hive - (const char *)key->hive) );
+    }
+}
+
+/* point the keys of a subtree to their records in a new hive mapping */
+static void set_hive_pointers( struct key *key, const char *base )
+{
+    const char *old = (const char *)key->hive;
+    int i;
+
+    key->hive = (const struct hive_key *)(base + key->hive_offset);
+    if (key->flags & KEY_UNLOADED) return;
+    for (i = 0; i <= key->last_subkey; i++)
+    {
+        struct key *subkey = key->subkeys[i];
+
+        if (subkey->flags & KEY_VOLATILE) continue;
+        /* loaded from the previous hive since the snapshot, the parent record was copied as is */
+        if (!subkey->hive_offset && subkey->hive)
+            subkey->hive_offset = key->hive_offset + ((const char *)subkey->hive - old);
+        /* keys created since the snapshot aren't in the hive yet */
+        if (subkey->hive_offset) set_hive_pointers( subkey, base );
+    }
+}
+
+/* save a key and its subtree to a hive buffer */
+static int save_hive_key( struct hive_buffer *buf, struct key *key )
+{
+    struct hive_key *hive;
+    struct hive_value *hv;
+    size_t start, pos, name, data;
+    int i, count;
+
+    if (hive_subtree_clean( key ))
+    {
+        if ((start = hive_alloc( buf, key->hive->size, 8 )) == (size_t)-1) return 0;
+        memcpy( buf->data + start, key->hive, key->hive->size );
+        set_hive_offsets( key, start );
+        return 1;
+    }
+
+    load_hive_key( key );
+    if ((start = hive_alloc( buf, sizeof(*hive) + key->namelen + key->classlen, 8 )) == (size_t)-1)
+        return 0;
+    key->hive_offset = start;
+    hive = (struct hive_key *)(buf->data + start);
+    hive->modif    = key->modif;
+    hive->flags    = key->flags & KEY_SYMLINK;
+    hive->namelen  = key->namelen;
+    hive->classlen = key->classlen;
+    memcpy( hive + 1, key->name, key->namelen );
+    memcpy( (char *)(hive + 1) + key->namelen, key->class, key->classlen );
+
+    if (key->last_value >= 0)
+    {
+        if ((pos = hive_alloc( buf, (key->last_value + 1) * sizeof(*hv), 4 )) == (size_t)-1) return 0;
+        hive = (struct hive_key *)(buf->data + start);
+        hive->nb_values = key->last_value + 1;
+        hive->values = pos - start;
+        for (i = 0; i <= key->last_value; i++)
+        {
+            const struct key_value *value = &key->values[i];
+
+            if ((name = hive_alloc( buf, value->namelen, 2 )) == (size_t)-1) return 0;
+            memcpy( buf->data + name, value->name, value->namelen );
+            if ((data = hive_alloc( buf, value->len, 4 )) == (size_t)-1) return 0;
+            memcpy( buf->data + data, value->data, value->len );
+            hv = (struct hive_value *)(buf->data + pos) + i;
+            hv->type    = value->type;
+            hv->len     = value->len;
+            hv->data    = data - start;
+            hv->name    = name - start;
+            hv->namelen = value->namelen;
+        }
+    }
+
+    for (i = count = 0; i <= key->last_subkey; i++)
+        if (!(key->subkeys[i]->flags & KEY_VOLATILE)) count++;
+    if (count)
+    {
+        if ((pos = hive_alloc( buf, count * sizeof(unsigned int), 4 )) == (size_t)-1) return 0;
+        hive = (struct hive_key *)(buf->data + start);
+        hive->nb_subkeys = count;
+        hive->subkeys = pos - start;
+        for (i = count = 0; i <= key->last_subkey; i++)
+        {
+            struct key *subkey = key->subkeys[i];
+
+            if (subkey->flags & KEY_VOLATILE) continue;
+            if (!save_hive_key( buf, subkey )) return 0;
+            ((unsigned int *)(buf->data + pos))[count++] = subkey->hive_offset - start;
+            if (is_wow6432node( subkey->name, subkey->namelen ) && !is_wow6432node( key->name, key->namelen ))
+                ((struct hive_key *)(buf->data + start))->flags |= KEY_WOW64;
+        }
+    }
+
+    hive = (struct hive_key *)(buf->data + start);
+    hive->size = buf->size - start;
+    return 1;
+}
+
+/* store the identity of the text file of a branch in a hive header */
+static void get_text_file_info( const char *path, struct hive_header *header )
+{
+    struct stat st;
+
+    if (fstatat( config_dir_fd, path, &st, 0 ) == -1) memset( &st, 0, sizeof(st) );
+    header->text_size  = st.st_size;
+    header->text_mtime = st.st_mtime;
+    header->text_ino   = st.st_ino;
+}
+
+static int write_hive_data( int fd, const char *data, size_t size )
+{
+    ssize_t ret;
+
+    while (size)
+    {
+        if ((ret = write( fd, data, size )) == -1)
+        {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return 1;
+}
+
+/* find the saved branch that a key belongs to */
+static struct save_branch_info *get_key_branch( const struct key *key )
+{
+    int i;
+
+    for ( ; key; key = key->parent)
+    {
+        if (key->flags & KEY_VOLATILE) return NULL;
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == key) return &save_branch_info[i];
+    }
+    return NULL;
+}
+
+/* append a change to the journal of the branch containing the key */
+static void journal_change( struct key *key, unsigned int op, const struct unicode_str *name,
+                            int type, const void *data, data_size_t len )
+{
+    struct save_branch_info *info;
+    struct journal_record *rec;
+    const struct key *k;
+    data_size_t pathlen = 0, namelen = name ? name->len : 0;
+    size_t size;
+    char *ptr;
+
+    if (!(info = get_key_branch( key )) || info->journal_fd == -1) return;
+
+    for (k = key; k != info->key; k = k->parent) pathlen += k->namelen + sizeof(WCHAR);
+    if (pathlen) pathlen -= sizeof(WCHAR);
+
+    size = (sizeof(*rec) + pathlen + namelen + len + 7) & ~7;
+    if (!(rec = calloc( 1, size ))) goto failed;
+    rec->size    = size;
+    rec->op      = op;
+    rec->modif   = current_time;
+    rec->pathlen = pathlen;
+    rec->namelen = namelen;
+    rec->type    = type;
+    rec->len     = len;
+
+    /* store the path from the end, starting with the key itself */
+    ptr = (char *)(rec + 1) + pathlen;
+    for (k = key; k != info->key; k = k->parent)
+    {
+        ptr -= k->namelen;
+        memcpy( ptr, k->name, k->namelen );
+        if (ptr > (char *)(rec + 1))
+        {
+            ptr -= sizeof(WCHAR);
+            *(WCHAR *)ptr = '\\';
+        }
+    }
+    ptr = (char *)(rec + 1) + pathlen;
+    if (namelen) memcpy( ptr, name->str, namelen );
+    if (len) memcpy( ptr + namelen, data, len );
+
+    if (write_hive_data( info->journal_fd, (char *)rec, size ))
+    {
+        info->journal_size += size;
+        free( rec );
+        return;
+    }
+    free( rec );
+
+failed:
+    /* fall back to rewriting the hive on the next periodic save */
+    close( info->journal_fd );
+    info->journal_fd = -1;
+}
+
+/* start a new journal for the current hive of a branch */
+static void reset_journal( struct save_branch_info *info )
+{
+    struct journal_header header;
+
+    if (info->journal_fd == -1)
+        info->journal_fd = open( info->journal_path, O_CREAT | O_RDWR | O_APPEND, 0666 );
+    if (info->journal_fd == -1) return;
+
+    header.magic   = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.serial  = info->serial;
+    if (ftruncate( info->journal_fd, 0 ) == -1 ||
+        !write_hive_data( info->journal_fd, (char *)&header, sizeof(header) ))
+    {
+        close( info->journal_fd );
+        info->journal_fd = -1;
+        return;
+    }
+    info->journal_size = sizeof(header);
+}
+
+/* start a new journal for a new hive, keeping the changes made since its snapshot was taken;
+ * returns 0 if some of these changes are only in memory */
+static int restart_journal( struct save_branch_info *info, size_t pos )
+{
+    char *tail = NULL;
+    size_t size = 0;
+    int ret = (info->journal_fd != -1);
+
+    if (ret && info->journal_size > pos)
+    {
+        size = info->journal_size - pos;
+        if (!(tail = malloc( size )) || pread( info->journal_fd, tail, size, pos ) != size) ret = 0;
+    }
+    reset_journal( info );
+    if (ret && size)
+    {
+        if (info->journal_fd != -1 && write_hive_data( info->journal_fd, tail, size ))
+            info->journal_size += size;
+        else
+            ret = 0;
+    }
+    free( tail );
+    return ret;
+}
+
+/* dump the path of a hive key relative to the root of the branch */
+static void dump_hive_path( const struct hive_path *path, FILE *f )
+{
+    if (path->parent->parent)
+    {
+        dump_hive_path( path->parent, f );
+        fprintf( f, "\\\\" );
+    }
+    dump_strW( (const WCHAR *)(path->key + 1), path->key->namelen, f, "[]" );
+}
+
+/* save a hive key and its subkeys to a text file, in the same format as save_subkeys */
+static void save_hive_subkeys( const struct hive_path *path, FILE *f )
+{
+    const struct hive_key *key = path->key;
+    const char *base = (const char *)key;
+    const struct hive_value *hv = (const struct hive_value *)(base + key->values);
+    const unsigned int *subkeys = (const unsigned int *)(base + key->subkeys);
+    struct hive_path subpath;
+    struct key_value value;
+    unsigned int i;
+
+    if (key->nb_values || !key->nb_subkeys || key->classlen || (key->flags & KEY_SYMLINK))
+    {
+        fprintf( f, "\n[" );
+        if (path->parent) dump_hive_path( path, f );
+        fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
+        fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
+        if (key->classlen)
+        {
+            fprintf( f, "#class=\"" );
+            dump_strW( (const WCHAR *)((const char *)(key + 1) + key->namelen), key->classlen, f, "\"\"" );
+            fprintf( f, "\"\n" );
+        }
+        if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+        for (i = 0; i < key->nb_values; i++)
+        {
+            value.name    = (WCHAR *)(base + hv[i].name);
+            value.namelen = hv[i].namelen;
+            value.type    = hv[i].type;
+            value.len     = hv[i].len;
+            value.data    = (void *)(base + hv[i].data);
+            dump_value( &value, f );
+        }
+    }
+    subpath.parent = path;
+    for (i = 0; i < key->nb_subkeys; i++)
+    {
+        subpath.key = (const struct hive_key *)(base + subkeys[i]);
+        save_hive_subkeys( &subpath, f );
+    }
+}
+
+/* write the snapshot of a branch to its text file */
+static void save_hive_text( FILE *f, void *arg )
+{
+    struct save_work *work = arg;
+    const struct hive_header *header = (const struct hive_header *)work->buf.data;
+    struct hive_path root = { NULL, (const struct hive_key *)(header + 1) };
+    data_size_t i, start = 0;
+
+    fprintf( f, "WINE REGISTRY Version 2\n" );
+    fprintf( f, ";; All keys relative to " );
+    for (i = 0; i <= work->rootlen / sizeof(WCHAR); i++)
+    {
+        if (i < work->rootlen / sizeof(WCHAR) && work->root[i] != '\\') continue;
+        if (start) fprintf( f, "\\\\" );
+        dump_strW( work->root + start, (i - start) * sizeof(WCHAR), f, "[]" );
+        start = i + 1;
+    }
+    fprintf( f, "\n" );
+    switch (header->prefix_type)
+    {
+    case PREFIX_32BIT:
+        fprintf( f, "\n#arch=win32\n" );
+        break;
+    case PREFIX_64BIT:
+        fprintf( f, "\n#arch=win64\n" );
+        break;
+    default:
+        break;
+    }
+    save_hive_subkeys( &root, f );
+}
+
+/* write a hive snapshot to disk; runs in a worker thread, so it only uses the snapshot */
+static void save_hive_work( void *arg )
+{
+    struct save_work *work = arg;
+    struct hive_header *header = (struct hive_header *)work->buf.data;
+    const char *hive_path = work->info->hive_path, *path = work->info->path;
+    void *map = MAP_FAILED;
+    char *tmp;
+    int fd, ret;
+
+    work->map = NULL;
+    if (!(tmp = malloc( strlen( hive_path ) + 5 ))) return;
+    sprintf( tmp, "%s.tmp", hive_path );
+    if ((fd = openat( config_dir_fd, tmp, O_CREAT | O_TRUNC | O_RDWR, 0666 )) == -1) goto done;
+    ret = write_hive_data( fd, work->buf.data, work->buf.size );
+
+    /* write the text file before the hive, so that a hive that isn't marked as stale
+     * is never older than the text file */
+    if (ret && work->write_text && save_text_file( path, save_hive_text, work ))
+    {
+        header->flags &= ~HIVE_TEXT_STALE;
+        get_text_file_info( path, header );
+        work->text_saved = (pwrite( fd, header, sizeof(*header), 0 ) == sizeof(*header));
+    }
+    if (ret) map = mmap( NULL, work->buf.size, PROT_READ, MAP_SHARED, fd, 0 );
+    if (close( fd ) == -1 || map == MAP_FAILED ||
+        renameat( config_dir_fd, tmp, config_dir_fd, hive_path ) == -1)
+    {
+        if (map != MAP_FAILED) munmap( map, work->buf.size );
+        unlinkat( config_dir_fd, tmp, 0 );
+        goto done;
+    }
+    work->map = map;
+
+done:
+    free( tmp );
+}
+
+/* switch the keys of a branch to the hive written from the snapshot */
+static void save_hive_done( void *arg )
+{
+    struct save_work *work = arg;
+    struct save_branch_info *info = work->info;
+
+    info->saving = NULL;
+    if (work->map)
+    {
+        set_hive_pointers( info->key, work->map );
+        if (info->hive) munmap( info->hive, info->hive_size );
+        info->hive = work->map;
+        info->hive_size = work->buf.size;
+        info->serial++;
+        info->dirty_periods = 0;
+        if (work->write_text) info->text_stale = !work->text_saved;
+        /* force a hive rewrite on the next save if some changes couldn't be journaled */
+        if (!restart_journal( info, work->journal_pos ) && (info->key->flags & KEY_DIRTY))
+            info->dirty_periods = JOURNAL_MAX_PERIODS;
+    }
+    else make_subtree_dirty( info->key );  /* the snapshot is lost, everything needs to be saved again */
+
+    free( work->root );
+    free( work->buf.data );
+    free( work );
+}
+
+/* save a registry branch to its hive file, and to its text file if requested; the files are
+ * written in a worker thread unless sync is set, and the keys are switched to the new hive */
+static int save_hive( struct save_branch_info *info, int write_text, int sync )
+{
+    struct save_work *work;
+    struct hive_header *header;
+    int ret = 1;
+
+    if (!(work = calloc( 1, sizeof(*work) ))) return 0;
+    if (hive_alloc( &work->buf, sizeof(*header), 8 ) == (size_t)-1 ||
+        !save_hive_key( &work->buf, info->key ) ||
+        !(work->root = get_key_path( info->key, &work->rootlen )))
+    {
+        free( work->buf.data );
+        free( work );
+        return 0;
+    }
+
+    header = (struct hive_header *)work->buf.data;
+    header->magic       = HIVE_MAGIC;
+    header->version     = HIVE_VERSION;
+    header->flags       = write_text ? HIVE_TEXT_STALE : 0;
+    header->prefix_type = prefix_type;
+    header->size        = work->buf.size;
+    header->serial      = info->serial + 1;
+    get_text_file_info( info->path, header );
+
+    if (debug_level > 1)
+    {
+        fprintf( stderr, "%s: ", info->hive_path );
+        dump_operation( info->key, NULL, "saving" );
+    }
+
+    work->info = info;
+    work->write_text = write_text;
+    work->journal_pos = info->journal_size;
+    /* changes made from now on will be saved with the next snapshot */
+    make_clean( info->key );
+    info->saving = work;
+    if (!sync && queue_work( save_hive_work, save_hive_done, work )) return 1;
+
+    save_hive_work( work );
+    ret = work->map && (!write_text || work->text_saved);
+    save_hive_done( work );
+    return ret;
+}
+
+/* mark the hive file of a branch as up to date with the text file */
+static void update_hive_header( struct save_branch_info *info )
+{
+    struct hive_header header;
+    int fd;
+
+    if (!info->hive) return;
+    header = *(const struct hive_header *)info->hive;
+    header.flags &= ~HIVE_TEXT_STALE;
+    get_text_file_info( info->path, &header );
+    if ((fd = openat( config_dir_fd, info->hive_path, O_WRONLY )) == -1) return;
+    pwrite( fd, &header, sizeof(header), 0 );
+    close( fd );
+}
+
+/* load a registry branch from its hive file, if it's up to date with the text file */
+static int load_hive( struct save_branch_info *info )
+{
+    const struct hive_header *header;
+    const struct hive_key *root;
+    struct hive_header text;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!hive_enabled) return 0;
+    if ((fd = open( info->hive_path, O_RDONLY )) == -1) return 0;
+    if (fstat( fd, &st ) == -1 || st.st_size < sizeof(*header) + sizeof(*root) || st.st_size > UINT_MAX)
+    {
+        close( fd );
+        return 0;
+    }
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (map == MAP_FAILED) return 0;
+
+    header = map;
+    root = (const struct hive_key *)(header + 1);
+    get_text_file_info( info->path, &text );
+    if (header->magic != HIVE_MAGIC || header->version != HIVE_VERSION || header->size != st.st_size)
+        goto ignore;
+    /* the text file has been modified, it takes precedence */
+    if (header->text_size != text.text_size || header->text_mtime != text.text_mtime ||
+        header->text_ino != text.text_ino)
+        goto ignore;
+    if (header->prefix_type != PREFIX_UNKNOWN && prefix_type != PREFIX_UNKNOWN &&
+        header->prefix_type != prefix_type)
+        goto ignore;
+    if (!hive_key_valid( root, st.st_size - sizeof(*header) ))
+    {
+        fprintf( stderr, "wineserver: %s is not a valid registry hive\n", info->hive_path );
+        goto ignore;
+    }
+
+    if (header->prefix_type != PREFIX_UNKNOWN) prefix_type = header->prefix_type;
+    info->key->hive   = root;
+    info->key->modif  = root->modif;
+    info->key->flags |= (root->flags & (KEY_SYMLINK | KEY_WOW64)) | KEY_UNLOADED;
+    info->hive        = map;
+    info->hive_size   = st.st_size;
+    info->text_stale  = (header->flags & HIVE_TEXT_STALE) != 0;
+    info->serial      = header->serial;
+    return 1;
+
+ignore:
+    munmap( map, st.st_size );
+    return 0;
+}
+
+/* find the parent of the key designated by a journal path, and return the last path element */
+static struct key *find_journal_parent( struct key *key, const struct unicode_str *path,
+                                        struct unicode_str *last )
+{
+    struct unicode_str token;
+    int index;
+
+    last->str = NULL;
+    last->len = 0;
+    token.str = NULL;
+    if (!get_path_token( path, &token )) return NULL;
+    while (token.len)
+    {
+        if (last->len && !(key = find_subkey( key, last, &index ))) return NULL;
+        *last = token;
+        get_path_token( path, &token );
+    }
+    return key;
+}
+
+/* apply a journal record to the keys of a branch */
+static void replay_journal_record( struct key *branch, const struct journal_record *rec )
+{
+    struct unicode_str path, name, last;
+    struct key *key, *parent;
+    const char *data;
+    int index;
+
+    path.str = (const WCHAR *)(rec + 1);
+    path.len = rec->pathlen;
+    name.str = (const WCHAR *)((const char *)path.str + rec->pathlen);
+    name.len = rec->namelen;
+    data = (const char *)name.str + rec->namelen;
+
+    if (!(parent = find_journal_parent( branch, &path, &last ))) return;
+    key = last.len ? find_subkey( parent, &last, &index ) : parent;
+
+    switch (rec->op)
+    {
+    case JOURNAL_CREATE_KEY:
+        if (!last.len) break;
+        if (!key)
+        {
+            if (!(key = alloc_subkey( parent, &last, index, rec->modif ))) break;
+            if (rec->type & KEY_SYMLINK) key->flags |= KEY_SYMLINK;
+            if (name.len && (key->class = memdup( name.str, name.len ))) key->classlen = name.len;
+        }
+        key->flags |= KEY_DIRTY;
+        parent->modif = rec->modif;
+        make_dirty( parent );
+        break;
+    case JOURNAL_DELETE_KEY:
+        if (!last.len || !key || delete_key( key, 0 )) break;
+        parent->modif = rec->modif;
+        break;
+    case JOURNAL_SET_VALUE:
+        if (!key) break;
+        set_value( key, &name, rec->type, data, rec->len );
+        key->modif = rec->modif;
+        break;
+    case JOURNAL_DELETE_VALUE:
+        if (!key) break;
+        delete_value( key, &name );
+        key->modif = rec->modif;
+        break;
+    }
+    clear_error();
+}
+
+/* replay the journal of a branch on top of its hive, and start appending to it */
+static void replay_journal( struct save_branch_info *info )
+{
+    const struct journal_header *header;
+    const struct journal_record *rec;
+    struct stat st;
+    char *buffer = NULL;
+    size_t pos = 0;
+    int fd;
+
+    if ((fd = open( info->journal_path, O_RDWR | O_APPEND )) == -1) goto reset;
+    if (fstat( fd, &st ) == -1 || st.st_size < sizeof(*header) || !(buffer = malloc( st.st_size )) ||
+        pread( fd, buffer, st.st_size, 0 ) != st.st_size)
+        goto reset;
+
+    header = (const struct journal_header *)buffer;
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+        header->serial != info->serial)
+        goto reset;
+
+    for (pos = sizeof(*header); pos + sizeof(*rec) <= st.st_size; pos += rec->size)
+    {
+        rec = (const struct journal_record *)(buffer + pos);
+        if (rec->size < sizeof(*rec) || rec->size > st.st_size - pos || (rec->size & 7)) break;
+        if ((size_t)rec->pathlen + rec->namelen + rec->len > rec->size - sizeof(*rec)) break;
+        if ((rec->pathlen | rec->namelen) & 1) break;
+        replay_journal_record( info->key, rec );
+    }
+    /* drop a partially written record */
+    if (pos < st.st_size && ftruncate( fd, pos ) == -1) goto reset;
+
+    free( buffer );
+    info->journal_fd = fd;
+    info->journal_size = pos;
+    if (pos > sizeof(*header) && debug_level)
+        fprintf( stderr, "wineserver: replayed registry journal %s\n", info->journal_path );
+    return;
+
+reset:
+    free( buffer );
+    if (fd != -1) close( fd );
+    reset_journal( info );
+}
+
 /* load one of the initial registry files */
-static int load_init_registry_from_file( const char *filename, struct key *key )
+static int load_init_registry_from_file( const char *filename, const char *hive_name,
+                                         const char *journal_name, struct key *key )
 {
+    struct save_branch_info *info;
+    int loaded = 0;
     FILE *f;
 
-    if ((f = fopen( filename, "r" )))
+    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
+
+    info = &save_branch_info[save_branch_count];
+    info->key        = key;
+    info->path       = filename;
+    info->hive_path  = hive_name;
+    info->hive       = NULL;
+    info->hive_size  = 0;
+    info->text_stale = 0;
+    info->serial     = 0;
+    info->journal_path = journal_name;
+    info->journal_fd = -1;
+    info->journal_size = 0;
+    info->dirty_periods = 0;
+    info->saving     = NULL;
+
+    if (load_hive( info ))
+    {
+        replay_journal( info );
+        loaded = 1;
+    }
+    else if ((f = fopen( filename, "r" )))
     {
         load_keys( key, filename, f, 0 );
         fclose( f );
@@ -1790,14 +2844,15 @@ static int load_init_registry_from_file( const char *filename, struct key *key )
             fprintf( stderr, "%s is not a valid registry file\n", filename );
             return 1;
         }
+        /* create the hive right away so that it can be used on next startup */
+        if (hive_enabled) save_hive( info, 0, 1 );
+        loaded = 1;
     }
 
-    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
-
-    save_branch_info[save_branch_count].path = filename;
-    save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
+    save_branch_count++;
+    grab_object( key );
     make_object_permanent( &key->obj );
-    return (f != NULL);
+    return loaded;
 }
 
 static WCHAR *format_user_registry_path( const SID *sid, struct unicode_str *path )
@@ -1872,6 +2927,8 @@ void init_registry(void)
     unsigned int i;
     char *p;
 
+    if ((p = getenv( "WINEREGISTRYHIVE" ))) hive_enabled = atoi( p );
+
     /* switch to the config dir */
 
     if (fchdir( config_dir_fd ) == -1) fatal_error( "chdir to config dir: %s\n", strerror( errno ));
@@ -1886,7 +2943,7 @@ void init_registry(void)
     if (!(hklm = create_key_recursive( root_key, &HKLM_name, current_time )))
         fatal_error( "could not create Machine registry key\n" );
 
-    if (!load_init_registry_from_file( "system.reg", hklm ))
+    if (!load_init_registry_from_file( "system.reg", "system.hive", "system.journal", hklm ))
     {
         if ((p = getenv( "WINEARCH" )) && !strcmp( p, "win32" ))
             prefix_type = PREFIX_32BIT;
@@ -1903,7 +2960,7 @@ void init_registry(void)
     if (!(key = create_key_recursive( root_key, &HKU_name, current_time )))
         fatal_error( "could not create User\\.Default registry key\n" );
 
-    load_init_registry_from_file( "userdef.reg", key );
+    load_init_registry_from_file( "userdef.reg", "userdef.hive", "userdef.journal", key );
     release_object( key );
 
     /* load user.reg into HKEY_CURRENT_USER */
@@ -1914,7 +2971,7 @@ void init_registry(void)
         !(hkcu = create_key_recursive( root_key, &current_user_str, current_time )))
         fatal_error( "could not create HKEY_CURRENT_USER registry key\n" );
     free( current_user_path );
-    load_init_registry_from_file( "user.reg", hkcu );
+    load_init_registry_from_file( "user.reg", "user.hive", "user.journal", hkcu );
 
     /* set the shared flag on Software\Classes\Wow6432Node for all platforms */
     for (i = 1; i < supported_machines_count; i++)
@@ -2015,27 +3072,23 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
-/* save a registry branch to a file */
-static int save_branch( struct key *key, const char *path )
+/* save a registry branch to a text file, the contents being written by a callback; this
+ * doesn't depend on the current directory, as it's also used from worker threads */
+static int save_text_file( const char *path, void (*save)( FILE *f, void *arg ), void *arg )
 {
     struct stat st;
     char *p, *tmp = NULL;
     int fd, count = 0, ret = 0;
     FILE *f;
 
-    if (!(key->flags & KEY_DIRTY))
-    {
-        if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
-        return 1;
-    }
-
     /* test the file type */
 
-    if ((fd = open( path, O_WRONLY )) != -1)
+    if ((fd = openat( config_dir_fd, path, O_WRONLY )) != -1)
     {
         /* if file is not a regular file or has multiple links or is accessed
          * via symbolic links, write directly into it; otherwise use a temp file */
-        if (!lstat( path, &st ) && (!S_ISREG(st.st_mode) || st.st_nlink > 1))
+        if (!fstatat( config_dir_fd, path, &st, AT_SYMLINK_NOFOLLOW ) &&
+            (!S_ISREG(st.st_mode) || st.st_nlink > 1))
         {
             ftruncate( fd, 0 );
             goto save;
@@ -2052,9 +3105,8 @@ static int save_branch( struct key *key, const char *path )
     for (;;)
     {
         sprintf( p, "reg%lx%04x.tmp", (long) getpid(), count++ );
-        if ((fd = open( tmp, O_CREAT | O_EXCL | O_WRONLY, 0666 )) != -1) break;
+        if ((fd = openat( config_dir_fd, tmp, O_CREAT | O_EXCL | O_WRONLY, 0666 )) != -1) break;
         if (errno != EEXIST) goto done;
-        close( fd );
     }
 
     /* now save to it */
@@ -2062,33 +3114,71 @@ static int save_branch( struct key *key, const char *path )
  save:
     if (!(f = fdopen( fd, "w" )))
     {
-        if (tmp) unlink( tmp );
+        if (tmp) unlinkat( config_dir_fd, tmp, 0 );
         close( fd );
         goto done;
     }
 
-    if (debug_level > 1)
-    {
-        fprintf( stderr, "%s: ", path );
-        dump_operation( key, NULL, "saving" );
-    }
-
-    save_all_subkeys( key, f );
+    save( f, arg );
     ret = !fclose(f);
 
     if (tmp)
     {
         /* if successfully written, rename to final name */
-        if (ret) ret = !rename( tmp, path );
-        if (!ret) unlink( tmp );
+        if (ret) ret = !renameat( config_dir_fd, tmp, config_dir_fd, path );
+        if (!ret) unlinkat( config_dir_fd, tmp, 0 );
     }
 
 done:
     free( tmp );
-    if (ret) make_clean( key );
     return ret;
 }
 
+static void save_key_text( FILE *f, void *arg )
+{
+    save_all_subkeys( arg, f );
+}
+
+/* save a registry branch to a text file */
+static int save_text_branch( struct key *key, const char *path )
+{
+    if (debug_level > 1)
+    {
+        fprintf( stderr, "%s: ", path );
+        dump_operation( key, NULL, "saving" );
+    }
+    return save_text_file( path, save_key_text, key );
+}
+
+/* save a registry branch; when flushing, the files are written synchronously */
+static int save_branch( struct save_branch_info *info, int flush )
+{
+    struct key *key = info->key;
+    int dirty = (key->flags & KEY_DIRTY) != 0;
+
+    /* the snapshot being saved will be installed when the worker is done */
+    if (info->saving) return 1;
+
+    if (!dirty && !(flush && info->text_stale))
+    {
+        if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
+        return 1;
+    }
+
+    /* the changes are safe in the journal, wait until it's worth compacting it into the hive */
+    if (hive_enabled && dirty && !flush && info->journal_fd != -1 &&
+        info->journal_size < JOURNAL_COMPACT_SIZE && ++info->dirty_periods < JOURNAL_MAX_PERIODS)
+        return 1;
+
+    if (hive_enabled && dirty) return save_hive( info, 1, flush );
+
+    if (!save_text_branch( key, info->path )) return 0;
+    if (hive_enabled) update_hive_header( info );
+    info->text_stale = 0;
+    make_clean( key );
+    return 1;
+}
+
 /* periodic saving of the registry */
 static void periodic_save( void *arg )
 {
@@ -2097,7 +3187,7 @@ static void periodic_save( void *arg )
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
     for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+        save_branch( &save_branch_info[i], 0 );
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
     set_periodic_save_timer();
 }
@@ -2114,10 +3204,11 @@ void flush_registry(void)
 {
     int i;
 
+    flush_work();
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
-        if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+        if (!save_branch( &save_branch_info[i], 1 ))
         {
             fprintf( stderr, "wineserver: could not save registry branch to %s",
                      save_branch_info[i].path );
@@ -2163,7 +3254,11 @@ DECL_HANDLER(create_key)
         if ((key = create_key( parent, &name, &class, req->options, access,
                                objattr->attributes, sd, &reply->created )))
         {
-            reply->hkey = alloc_handle( current->process, key, access, objattr->attributes );
+            if ((reply->hkey = alloc_handle( current->process, key, access, objattr->attributes )))
+            {
+                reply->inproc_index = get_key_sync_index( key );
+                reply->access = get_handle_access( current->process, reply->hkey );
+            }
             release_object( key );
         }
         release_object( parent );
@@ -2186,7 +3281,11 @@ DECL_HANDLER(open_key)
         get_req_path( &name, !req->parent );
         if ((key = open_key( parent, &name, access, req->attributes )))
         {
-            reply->hkey = alloc_handle( current->process, key, access, req->attributes );
+            if ((reply->hkey = alloc_handle( current->process, key, access, req->attributes )))
+            {
+                reply->inproc_index = get_key_sync_index( key );
+                reply->access = get_handle_access( current->process, reply->hkey );
+            }
             release_object( key );
         }
         release_object( parent );
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #ifdef HAVE_PWD_H
 #include <pwd.h>
 #endif
@@ -31,12 +32,16 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
@@ -252,6 +257,80 @@ void write_reply( struct thread *thread )
         fatal_protocol_error( thread, "reply write: %s\n", strerror( errno ));
 }
 
+#ifdef __linux__
+
+#define FUTEX_WAKE 1
+
+static inline void futex_wake( int *addr, int count )
+{
+    syscall( __NR_futex, addr, FUTEX_WAKE, count, NULL, 0, 0 );
+}
+
+/* create a shared memory file for the requests of a thread, if supported */
+static int create_request_shm_file(void)
+{
+    static int enabled = -1;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEREQUESTSHM" );
+        enabled = !env || atoi( env );
+    }
+    if (!enabled) return -1;
+#ifdef __NR_memfd_create
+    return syscall( __NR_memfd_create, "wine-request-shm", 1 /* MFD_CLOEXEC */ );
+#else
+    return -1;
+#endif
+}
+
+#else  /* __linux__ */
+
+static inline void futex_wake( int *addr, int count )
+{
+}
+
+static int create_request_shm_file(void)
+{
+    return -1;
+}
+
+#endif  /* __linux__ */
+
+/* check whether the data of the current request of a thread goes through shared memory */
+/* the client uses the same rule to decide where to put the data */
+static inline int use_request_shm( struct thread *thread )
+{
+    return thread->request_shm &&
+           thread->req.request_header.request_size <= REQUEST_SHM_DATA_SIZE &&
+           thread->req.request_header.reply_size <= REQUEST_SHM_DATA_SIZE;
+}
+
+/* release the request shared memory of a thread, waking up the client if it's waiting for a reply */
+void close_request_shm( struct thread *thread )
+{
+    struct request_shm *shm = thread->request_shm;
+
+    if (!shm) return;
+    __atomic_store_n( &shm->state, REQUEST_SHM_CLOSED, __ATOMIC_SEQ_CST );
+    futex_wake( &shm->state, INT_MAX );
+    munmap( shm, REQUEST_SHM_SIZE );
+    thread->request_shm = NULL;
+}
+
+/* send a reply to the current thread through its request shared memory */
+static void send_reply_shm( union generic_reply *reply )
+{
+    struct request_shm *shm = current->request_shm;
+
+    memcpy( &shm->reply, reply, sizeof(shm->reply) );
+    if (current->reply_size) memcpy( shm + 1, current->reply_data, current->reply_size );
+    free( current->reply_data );
+    current->reply_data = NULL;
+    if (__atomic_exchange_n( &shm->state, REQUEST_SHM_REPLIED, __ATOMIC_SEQ_CST ) == REQUEST_SHM_WAITING)
+        futex_wake( &shm->state, 1 );
+}
+
 /* send a reply to the current thread */
 static void send_reply( union generic_reply *reply )
 {
@@ -294,11 +373,128 @@ static void send_reply( union generic_reply *reply )
         fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
 }
 
+/* request profiling counters of a process */
+struct process_request_stats
+{
+    struct list          entry;                  /* entry in list of processes with counters */
+    process_id_t         pid;                    /* process id */
+    struct request_stats stats[REQ_NB_REQUESTS]; /* counters of each request */
+};
+
+static int request_stats_enabled;   /* whether request profiling is enabled */
+static struct request_stats request_stats[REQ_NB_REQUESTS];  /* counters for all processes */
+static struct list process_request_stats = LIST_INIT( process_request_stats );
+
+/* enable request profiling if requested in the environment */
+void init_request_stats(void)
+{
+    const char *env = getenv( "WINESERVERPROFILE" );
+
+    request_stats_enabled = env && atoi( env );
+}
+
+/* get a timestamp for the request profiling, in nanoseconds */
+static inline unsigned __int64 get_request_stats_time(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (!clock_gettime( CLOCK_MONOTONIC, &ts ))
+        return (unsigned __int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return monotonic_counter() * 100;
+}
+
+static inline void add_request_stats( struct request_stats *stats, enum request req,
+                                      unsigned __int64 time, data_size_t reply_size )
+{
+    stats->req = req;
+    stats->count++;
+    stats->time += time;
+    stats->reply_size += reply_size;
+    if (reply_size > stats->max_reply_size) stats->max_reply_size = reply_size;
+}
+
+/* record the profiling counters of a request */
+static void update_request_stats( struct thread *thread, enum request req, unsigned __int64 time )
+{
+    struct process *process = thread->process;
+
+    add_request_stats( &request_stats[req], req, time, thread->reply_size );
+
+    if (!process->request_stats)
+    {
+        if (!(process->request_stats = mem_alloc( sizeof(*process->request_stats) ))) return;
+        memset( process->request_stats->stats, 0, sizeof(process->request_stats->stats) );
+        process->request_stats->pid = process->id;
+        list_add_tail( &process_request_stats, &process->request_stats->entry );
+    }
+    add_request_stats( &process->request_stats->stats[req], req, time, thread->reply_size );
+}
+
+/* reset all the request profiling counters */
+static void reset_request_stats(void)
+{
+    struct process_request_stats *stats;
+
+    memset( request_stats, 0, sizeof(request_stats) );
+    LIST_FOR_EACH_ENTRY( stats, &process_request_stats, struct process_request_stats, entry )
+        memset( stats->stats, 0, sizeof(stats->stats) );
+}
+
+/* free the request profiling counters of a process */
+void free_process_request_stats( struct process *process )
+{
+    if (!process->request_stats) return;
+    list_remove( &process->request_stats->entry );
+    free( process->request_stats );
+    process->request_stats = NULL;
+}
+
+static int compare_request_stats( const void *p1, const void *p2 )
+{
+    const struct request_stats *stats1 = p1, *stats2 = p2;
+
+    if (stats1->time != stats2->time) return stats1->time < stats2->time ? 1 : -1;
+    return stats1->req - stats2->req;
+}
+
+/* dump the most expensive requests of a set of counters */
+static void dump_request_stats_table( const struct request_stats *stats, unsigned int max )
+{
+    struct request_stats sorted[REQ_NB_REQUESTS];
+    unsigned int i, count = 0;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++) if (stats[i].count) sorted[count++] = stats[i];
+    qsort( sorted, count, sizeof(*sorted), compare_request_stats );
+
+    for (i = 0; i < min( count, max ); i++)
+        fprintf( stderr, "  %-32s %10u calls %12.3f ms %10.3f us/call %12llu bytes (max %u)\n",
+                 get_request_name( sorted[i].req ), sorted[i].count, sorted[i].time / 1000000.0,
+                 sorted[i].time / 1000.0 / sorted[i].count,
+                 (unsigned long long)sorted[i].reply_size, sorted[i].max_reply_size );
+}
+
+/* dump the request profiling counters to stderr */
+void dump_request_stats(void)
+{
+    struct process_request_stats *stats;
+
+    fprintf( stderr, "wineserver: request profile%s:\n", request_stats_enabled ? "" : " (disabled)" );
+    dump_request_stats_table( request_stats, REQ_NB_REQUESTS );
+    LIST_FOR_EACH_ENTRY( stats, &process_request_stats, struct process_request_stats, entry )
+    {
+        fprintf( stderr, "wineserver: request profile for process %04x:\n", stats->pid );
+        dump_request_stats_table( stats->stats, 10 );
+    }
+}
+
 /* call a request handler */
 static void call_req_handler( struct thread *thread )
 {
     union generic_reply reply;
     enum request req = thread->req.request_header.req;
+    int shm = use_request_shm( thread );
 
     current = thread;
     current->reply_size = 0;
@@ -307,10 +503,17 @@ static void call_req_handler( struct thread *thread )
 
     if (debug_level) trace_request();
 
-    if (req < REQ_NB_REQUESTS)
+    if (req >= REQ_NB_REQUESTS)
+        set_error( STATUS_NOT_IMPLEMENTED );
+    else if (request_stats_enabled)
+    {
+        unsigned __int64 start = get_request_stats_time();
+
         req_handlers[req]( &current->req, &reply );
+        update_request_stats( thread, req, get_request_stats_time() - start );
+    }
     else
-        set_error( STATUS_NOT_IMPLEMENTED );
+        req_handlers[req]( &current->req, &reply );
 
     if (current)
     {
@@ -319,7 +522,8 @@ static void call_req_handler( struct thread *thread )
             reply.reply_header.error = current->error;
             reply.reply_header.reply_size = current->reply_size;
             if (debug_level) trace_reply( req, &reply );
-            send_reply( &reply );
+            if (shm && current->request_shm) send_reply_shm( &reply );
+            else send_reply( &reply );
         }
         else
         {
@@ -351,6 +555,16 @@ void read_request( struct thread *thread )
                                   thread->req_toread, thread->req.request_header.req );
             return;
         }
+        if (use_request_shm( thread ))
+        {
+            /* copy the data so that the client cannot modify it while the request is processed */
+            memcpy( thread->req_data, thread->request_shm + 1, thread->req_toread );
+            thread->req_toread = 0;
+            call_req_handler( thread );
+            free( thread->req_data );
+            thread->req_data = NULL;
+            return;
+        }
     }
 
     /* read the variable sized data */
@@ -964,3 +1178,67 @@ void close_master_socket( timeout_t timeout )
 
     master_timeout = add_timeout_user( timeout, close_socket_timeout, NULL );
 }
+
+/* retrieve the shared memory used to pass request data for the current thread */
+DECL_HANDLER(get_request_shm)
+{
+    struct request_shm *shm;
+    int fd;
+
+    if (current->request_shm)
+    {
+        set_error( STATUS_INVALID_PARAMETER );
+        return;
+    }
+    if ((fd = create_request_shm_file()) == -1)
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return;
+    }
+    if (ftruncate( fd, REQUEST_SHM_SIZE ) == -1 ||
+        (shm = mmap( NULL, REQUEST_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED)
+    {
+        file_set_error();
+        close( fd );
+        return;
+    }
+    current->request_shm = shm;
+    send_client_fd( current->process, fd, 0 );
+    close( fd );
+}
+
+/* retrieve the request profiling counters */
+DECL_HANDLER(get_request_stats)
+{
+    const struct request_stats *stats = request_stats;
+    struct request_stats *data;
+    struct process *process = NULL;
+    unsigned int i, count = 0;
+
+    if (req->pid)
+    {
+        if (!(process = get_process_from_id( req->pid ))) return;
+        stats = process->request_stats ? process->request_stats->stats : NULL;
+    }
+
+    if (stats)
+    {
+        for (i = 0; i < REQ_NB_REQUESTS; i++) if (stats[i].count) count++;
+        count = min( count, get_reply_max_size() / sizeof(*data) );
+        if ((data = set_reply_data_size( count * sizeof(*data) )))
+        {
+            for (i = 0; count && i < REQ_NB_REQUESTS; i++)
+            {
+                if (!stats[i].count) continue;
+                *data++ = stats[i];
+                count--;
+            }
+        }
+    }
+    if (process) release_object( process );
+
+    if (req->flags & REQUEST_STATS_RESET) reset_request_stats();
+    if (req->flags & REQUEST_STATS_ENABLE) request_stats_enabled = 1;
+    if (req->flags & REQUEST_STATS_DISABLE) request_stats_enabled = 0;
+    reply->enabled = request_stats_enabled;
+}
@@ -54,6 +54,10 @@ extern int receive_fd( struct process *process );
 extern int send_client_fd( struct process *process, int fd, obj_handle_t handle );
 extern void read_request( struct thread *thread );
 extern void write_reply( struct thread *thread );
+extern void close_request_shm( struct thread *thread );
+extern void init_request_stats(void);
+extern void free_process_request_stats( struct process *process );
+extern void dump_request_stats(void);
 extern timeout_t monotonic_counter(void);
 extern void open_master_socket(void);
 extern void close_master_socket( timeout_t timeout );
@@ -65,6 +69,7 @@ extern int server_dir_fd, config_dir_fd;
 
 extern void trace_request(void);
 extern void trace_reply( enum request req, const union generic_reply *reply );
+extern const char *get_request_name( enum request req );
 
 /* get current tick count to return to client */
 static inline unsigned int get_tick_count(void)
@@ -126,6 +131,7 @@ DECL_HANDLER(get_startup_info);
 DECL_HANDLER(init_process_done);
 DECL_HANDLER(init_first_thread);
 DECL_HANDLER(init_thread);
+DECL_HANDLER(get_request_shm);
 DECL_HANDLER(terminate_process);
 DECL_HANDLER(terminate_thread);
 DECL_HANDLER(get_process_info);
@@ -161,6 +167,9 @@ DECL_HANDLER(create_semaphore);
 DECL_HANDLER(release_semaphore);
 DECL_HANDLER(query_semaphore);
 DECL_HANDLER(open_semaphore);
+DECL_HANDLER(get_inproc_sync_shm);
+DECL_HANDLER(get_inproc_sync);
+DECL_HANDLER(wake_inproc_sync);
 DECL_HANDLER(create_file);
 DECL_HANDLER(open_file_object);
 DECL_HANDLER(alloc_file_handle);
@@ -181,6 +190,7 @@ DECL_HANDLER(read_change);
 DECL_HANDLER(create_mapping);
 DECL_HANDLER(open_mapping);
 DECL_HANDLER(get_mapping_info);
+DECL_HANDLER(get_image_relocation);
 DECL_HANDLER(map_view);
 DECL_HANDLER(unmap_view);
 DECL_HANDLER(get_mapping_committed_range);
@@ -393,6 +403,7 @@ DECL_HANDLER(terminate_job);
 DECL_HANDLER(suspend_process);
 DECL_HANDLER(resume_process);
 DECL_HANDLER(get_next_thread);
+DECL_HANDLER(get_request_stats);
 
 #ifdef WANT_REQUEST_HANDLERS
 
@@ -406,6 +417,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_init_process_done,
     (req_handler)req_init_first_thread,
     (req_handler)req_init_thread,
+    (req_handler)req_get_request_shm,
     (req_handler)req_terminate_process,
     (req_handler)req_terminate_thread,
     (req_handler)req_get_process_info,
@@ -441,6 +453,9 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_release_semaphore,
     (req_handler)req_query_semaphore,
     (req_handler)req_open_semaphore,
+    (req_handler)req_get_inproc_sync_shm,
+    (req_handler)req_get_inproc_sync,
+    (req_handler)req_wake_inproc_sync,
     (req_handler)req_create_file,
     (req_handler)req_open_file_object,
     (req_handler)req_alloc_file_handle,
@@ -461,6 +476,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_create_mapping,
     (req_handler)req_open_mapping,
     (req_handler)req_get_mapping_info,
+    (req_handler)req_get_image_relocation,
     (req_handler)req_map_view,
     (req_handler)req_unmap_view,
     (req_handler)req_get_mapping_committed_range,
@@ -673,6 +689,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_suspend_process,
     (req_handler)req_resume_process,
     (req_handler)req_get_next_thread,
+    (req_handler)req_get_request_stats,
 };
 
 C_ASSERT( sizeof(abstime_t) == 8 );
@@ -763,6 +780,7 @@ C_ASSERT( FIELD_OFFSET(struct init_thread_request, entry) == 32 );
 C_ASSERT( sizeof(struct init_thread_request) == 40 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, suspend) == 8 );
 C_ASSERT( sizeof(struct init_thread_reply) == 16 );
+C_ASSERT( sizeof(struct get_request_shm_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, exit_code) == 16 );
 C_ASSERT( sizeof(struct terminate_process_request) == 24 );
@@ -973,6 +991,14 @@ C_ASSERT( FIELD_OFFSET(struct open_semaphore_request, rootdir) == 20 );
 C_ASSERT( sizeof(struct open_semaphore_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct open_semaphore_reply, handle) == 8 );
 C_ASSERT( sizeof(struct open_semaphore_reply) == 16 );
+C_ASSERT( sizeof(struct get_inproc_sync_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_inproc_sync_request, handle) == 12 );
+C_ASSERT( sizeof(struct get_inproc_sync_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_inproc_sync_reply, index) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_inproc_sync_reply, access) == 12 );
+C_ASSERT( sizeof(struct get_inproc_sync_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct wake_inproc_sync_request, handle) == 12 );
+C_ASSERT( sizeof(struct wake_inproc_sync_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct create_file_request, access) == 12 );
 C_ASSERT( FIELD_OFFSET(struct create_file_request, sharing) == 16 );
 C_ASSERT( FIELD_OFFSET(struct create_file_request, create) == 20 );
@@ -1098,6 +1124,13 @@ C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, flags) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, shared_file) == 20 );
 C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, total) == 24 );
 C_ASSERT( sizeof(struct get_mapping_info_reply) == 32 );
+C_ASSERT( FIELD_OFFSET(struct get_image_relocation_request, mapping) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_image_relocation_request, base) == 16 );
+C_ASSERT( sizeof(struct get_image_relocation_request) == 24 );
+C_ASSERT( FIELD_OFFSET(struct get_image_relocation_reply, base) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_image_relocation_reply, file) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_image_relocation_reply, wait) == 20 );
+C_ASSERT( sizeof(struct get_image_relocation_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, mapping) == 12 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, access) == 16 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, base) == 24 );
@@ -1173,13 +1206,17 @@ C_ASSERT( FIELD_OFFSET(struct create_key_request, options) == 16 );
 C_ASSERT( sizeof(struct create_key_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct create_key_reply, hkey) == 8 );
 C_ASSERT( FIELD_OFFSET(struct create_key_reply, created) == 12 );
-C_ASSERT( sizeof(struct create_key_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct create_key_reply, inproc_index) == 16 );
+C_ASSERT( FIELD_OFFSET(struct create_key_reply, access) == 20 );
+C_ASSERT( sizeof(struct create_key_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct open_key_request, parent) == 12 );
 C_ASSERT( FIELD_OFFSET(struct open_key_request, access) == 16 );
 C_ASSERT( FIELD_OFFSET(struct open_key_request, attributes) == 20 );
 C_ASSERT( sizeof(struct open_key_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct open_key_reply, hkey) == 8 );
-C_ASSERT( sizeof(struct open_key_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct open_key_reply, inproc_index) == 12 );
+C_ASSERT( FIELD_OFFSET(struct open_key_reply, access) == 16 );
+C_ASSERT( sizeof(struct open_key_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct delete_key_request, hkey) == 12 );
 C_ASSERT( sizeof(struct delete_key_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct flush_key_request, hkey) == 12 );
@@ -2246,6 +2283,11 @@ C_ASSERT( FIELD_OFFSET(struct get_next_thread_request, flags) == 28 );
 C_ASSERT( sizeof(struct get_next_thread_request) == 32 );
 C_ASSERT( FIELD_OFFSET(struct get_next_thread_reply, handle) == 8 );
 C_ASSERT( sizeof(struct get_next_thread_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_request_stats_request, pid) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_request_stats_request, flags) == 16 );
+C_ASSERT( sizeof(struct get_request_stats_request) == 24 );
+C_ASSERT( FIELD_OFFSET(struct get_request_stats_reply, enabled) == 8 );
+C_ASSERT( sizeof(struct get_request_stats_reply) == 16 );
 
 #endif  /* WANT_REQUEST_HANDLERS */
 
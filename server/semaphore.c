@@ -51,25 +51,27 @@ struct type_descr semaphore_type =
 
 struct semaphore
 {
-    struct object  obj;    /* object header */
-    unsigned int   count;  /* current count */
-    unsigned int   max;    /* maximum possible count */
+    struct object       obj;         /* object header */
+    struct inproc_sync *sync;        /* shared state (current and maximum count) */
+    unsigned int        sync_index;  /* index of the shared state */
 };
 
 static void semaphore_dump( struct object *obj, int verbose );
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry );
-static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static int semaphore_signal( struct object *obj, unsigned int access );
+static void semaphore_destroy( struct object *obj );
 
 static const struct object_ops semaphore_ops =
 {
     sizeof(struct semaphore),      /* size */
     &semaphore_type,               /* type */
     semaphore_dump,                /* dump */
-    add_queue,                     /* add_queue */
-    remove_queue,                  /* remove_queue */
+    semaphore_add_queue,           /* add_queue */
+    semaphore_remove_queue,        /* remove_queue */
     semaphore_signaled,            /* signaled */
-    semaphore_satisfied,           /* satisfied */
+    no_satisfied,                  /* satisfied */
     semaphore_signal,              /* signal */
     no_get_fd,                     /* get_fd */
     default_map_access,            /* map_access */
@@ -82,7 +84,7 @@ static const struct object_ops semaphore_ops =
     no_open_file,                  /* open_file */
     no_kernel_obj_list,            /* get_kernel_obj_list */
     no_close_handle,               /* close_handle */
-    no_destroy                     /* destroy */
+    semaphore_destroy              /* destroy */
 };
 
 
@@ -102,55 +104,82 @@ static struct semaphore *create_semaphore( struct object *root, const struct uni
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
             /* initialize it if it didn't already exist */
-            sem->count = initial;
-            sem->max   = max;
+            if (!(sem->sync = alloc_inproc_sync( INPROC_SYNC_SEMAPHORE, &sem->sync_index )))
+            {
+                release_object( sem );
+                return NULL;
+            }
+            sem->sync->state = initial;
+            sem->sync->max   = max;
         }
     }
     return sem;
 }
 
+static inline unsigned int get_semaphore_count( struct semaphore *sem )
+{
+    return __atomic_load_n( &sem->sync->state, __ATOMIC_SEQ_CST );
+}
+
 static int release_semaphore( struct semaphore *sem, unsigned int count,
                               unsigned int *prev )
 {
-    if (prev) *prev = sem->count;
-    if (sem->count + count < sem->count || sem->count + count > sem->max)
-    {
-        set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
-        return 0;
-    }
-    else if (sem->count)
+    int cur = __atomic_load_n( &sem->sync->state, __ATOMIC_SEQ_CST );
+
+    do
     {
-        /* there cannot be any thread to wake up if the count is != 0 */
-        sem->count += count;
-    }
-    else
+        if (prev) *prev = cur;
+        if ((unsigned int)cur + count < (unsigned int)cur || (unsigned int)cur + count > sem->sync->max)
+        {
+            set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n( &sem->sync->state, &cur, cur + count, 0,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ));
+
+    /* there cannot be any thread to wake up if the count was != 0 */
+    if (!cur)
     {
-        sem->count = count;
         wake_up( &sem->obj, count );
+        if (get_semaphore_count( sem )) wake_inproc_sync_clients( sem->sync );
     }
     return 1;
 }
 
+unsigned int get_semaphore_inproc_sync( struct object *obj )
+{
+    if (obj->ops != &semaphore_ops) return 0;
+    return ((struct semaphore *)obj)->sync_index;
+}
+
 static void semaphore_dump( struct object *obj, int verbose )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    fprintf( stderr, "Semaphore count=%d max=%d\n", sem->count, sem->max );
+    fprintf( stderr, "Semaphore count=%d max=%d\n", get_semaphore_count( sem ), sem->sync->max );
 }
 
-static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry )
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    return (sem->count > 0);
+    add_inproc_sync_waiter( sem->sync );
+    return add_queue( obj, entry );
 }
 
-static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry )
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    remove_inproc_sync_waiter( sem->sync );
+    remove_queue( obj, entry );
+}
+
+static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    assert( sem->count );
-    sem->count--;
+    return (get_semaphore_count( sem ) > 0);
 }
 
 static int semaphore_signal( struct object *obj, unsigned int access )
@@ -166,6 +195,14 @@ static int semaphore_signal( struct object *obj, unsigned int access )
     return release_semaphore( sem, 1, NULL );
 }
 
+static void semaphore_destroy( struct object *obj )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+
+    if (sem->sync) free_inproc_sync( sem->sync_index );
+}
+
 /* create a semaphore */
 DECL_HANDLER(create_semaphore)
 {
@@ -220,8 +257,8 @@ DECL_HANDLER(query_semaphore)
     if ((sem = (struct semaphore *)get_handle_obj( current->process, req->handle,
                                                    SEMAPHORE_QUERY_STATE, &semaphore_ops )))
     {
-        reply->current = sem->count;
-        reply->max = sem->max;
+        reply->current = get_semaphore_count( sem );
+        reply->max = sem->sync->max;
         release_object( sem );
     }
 }
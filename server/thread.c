@@ -241,6 +241,7 @@ static inline void init_thread_structure( struct thread *thread )
     thread->request_fd      = NULL;
     thread->reply_fd        = NULL;
     thread->wait_fd         = NULL;
+    thread->request_shm     = NULL;
     thread->state           = RUNNING;
     thread->exit_code       = 0;
     thread->priority        = 0;
@@ -254,7 +255,6 @@ static inline void init_thread_structure( struct thread *thread )
     thread->creation_time = current_time;
     thread->exit_time     = 0;
 
-    list_init( &thread->mutex_list );
     list_init( &thread->system_apc );
     list_init( &thread->user_apc );
     list_init( &thread->kernel_object );
@@ -421,6 +421,7 @@ static void cleanup_thread( struct thread *thread )
     if (thread->request_fd) release_object( thread->request_fd );
     if (thread->reply_fd) release_object( thread->reply_fd );
     if (thread->wait_fd) release_object( thread->wait_fd );
+    close_request_shm( thread );
     cleanup_clipboard_thread(thread);
     destroy_thread_windows( thread );
     free_msg_queue( thread );
@@ -829,6 +830,24 @@ static int wait_on_handles( const select_op_t *select_op, unsigned int count, co
     return ret;
 }
 
+/* take the in-process state of the objects satisfying a wait */
+/* return 0 if in-process waiters took some of it first, the wait then goes on */
+static int claim_wait_objects( struct thread_wait *wait, int start, int count )
+{
+    struct inproc_sync *sync;
+    int i;
+
+    for (i = start; i < start + count; i++)
+    {
+        if (!(sync = get_obj_inproc_sync( wait->queues[i].obj ))) continue;
+        if (claim_inproc_sync( sync, wait->thread )) continue;
+        while (i-- > start)
+            if ((sync = get_obj_inproc_sync( wait->queues[i].obj ))) unclaim_inproc_sync( sync );
+        return 0;
+    }
+    return 1;
+}
+
 /* check if the thread waiting condition is satisfied */
 static int check_wait( struct thread *thread )
 {
@@ -851,12 +870,13 @@ static int check_wait( struct thread *thread )
          * want to do something when signaled, even if others are not */
         for (i = 0, entry = wait->queues; i < wait->count; i++, entry++)
             not_ok |= !entry->obj->ops->signaled( entry->obj, entry );
-        if (!not_ok) return STATUS_WAIT_0;
+        if (!not_ok && claim_wait_objects( wait, 0, wait->count )) return STATUS_WAIT_0;
     }
     else
     {
         for (i = 0, entry = wait->queues; i < wait->count; i++, entry++)
-            if (entry->obj->ops->signaled( entry->obj, entry )) return i;
+            if (entry->obj->ops->signaled( entry->obj, entry ) && claim_wait_objects( wait, i, 1 ))
+                return i;
     }
 
     if ((wait->flags & SELECT_ALERTABLE) && !list_empty(&thread->user_apc)) return STATUS_USER_APC;
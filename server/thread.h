@@ -53,7 +53,6 @@ struct thread
     struct list            proc_entry;    /* entry in per-process thread list */
     struct process        *process;
     thread_id_t            id;            /* thread id */
-    struct list            mutex_list;    /* list of currently owned mutexes */
     unsigned int           system_regs;   /* which system regs have been set */
     struct msg_queue      *queue;         /* message queue */
     struct thread_wait    *wait;          /* current wait condition if sleeping */
@@ -70,6 +69,7 @@ struct thread
     struct fd             *request_fd;    /* fd for receiving client requests */
     struct fd             *reply_fd;      /* fd to send a reply to a client */
     struct fd             *wait_fd;       /* fd to use to wake a sleeping client */
+    struct request_shm    *request_shm;   /* shared memory for request and reply data */
     enum run_state         state;         /* running state */
     int                    exit_code;     /* thread exit code */
     int                    unix_pid;      /* Unix pid of client */
@@ -1432,6 +1432,25 @@ static void dump_varargs_poll_socket_output( const char *prefix, data_size_t siz
     fputc( '}', stderr );
 }
 
+static void dump_varargs_request_stats( const char *prefix, data_size_t size )
+{
+    const struct request_stats *stats;
+
+    fprintf( stderr, "%s{", prefix );
+    while (size >= sizeof(*stats))
+    {
+        stats = cur_data;
+        fprintf( stderr, "{req=%u,count=%u", stats->req, stats->count );
+        dump_uint64( ",time=", &stats->time );
+        dump_uint64( ",reply_size=", &stats->reply_size );
+        fprintf( stderr, ",max_reply_size=%u}", stats->max_reply_size );
+        size -= sizeof(*stats);
+        remove_data( sizeof(*stats) );
+        if (size) fputc( ',', stderr );
+    }
+    fputc( '}', stderr );
+}
+
 typedef void (*dump_func)( const void *req );
 
 /* Everything below this line is generated automatically by tools/make_requests */
@@ -1546,6 +1565,10 @@ static void dump_init_thread_reply( const struct init_thread_reply *req )
     fprintf( stderr, " suspend=%d", req->suspend );
 }
 
+static void dump_get_request_shm_request( const struct get_request_shm_request *req )
+{
+}
+
 static void dump_terminate_process_request( const struct terminate_process_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -1971,6 +1994,26 @@ static void dump_open_semaphore_reply( const struct open_semaphore_reply *req )
     fprintf( stderr, " handle=%04x", req->handle );
 }
 
+static void dump_get_inproc_sync_shm_request( const struct get_inproc_sync_shm_request *req )
+{
+}
+
+static void dump_get_inproc_sync_request( const struct get_inproc_sync_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_get_inproc_sync_reply( const struct get_inproc_sync_reply *req )
+{
+    fprintf( stderr, " index=%08x", req->index );
+    fprintf( stderr, ", access=%08x", req->access );
+}
+
+static void dump_wake_inproc_sync_request( const struct wake_inproc_sync_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
 static void dump_create_file_request( const struct create_file_request *req )
 {
     fprintf( stderr, " access=%08x", req->access );
@@ -2226,6 +2269,19 @@ static void dump_get_mapping_info_reply( const struct get_mapping_info_reply *re
     dump_varargs_unicode_str( ", name=", cur_size );
 }
 
+static void dump_get_image_relocation_request( const struct get_image_relocation_request *req )
+{
+    fprintf( stderr, " mapping=%04x", req->mapping );
+    dump_uint64( ", base=", &req->base );
+}
+
+static void dump_get_image_relocation_reply( const struct get_image_relocation_reply *req )
+{
+    dump_uint64( " base=", &req->base );
+    fprintf( stderr, ", file=%04x", req->file );
+    fprintf( stderr, ", wait=%04x", req->wait );
+}
+
 static void dump_map_view_request( const struct map_view_request *req )
 {
     fprintf( stderr, " mapping=%04x", req->mapping );
@@ -2386,6 +2442,8 @@ static void dump_create_key_reply( const struct create_key_reply *req )
 {
     fprintf( stderr, " hkey=%04x", req->hkey );
     fprintf( stderr, ", created=%d", req->created );
+    fprintf( stderr, ", inproc_index=%08x", req->inproc_index );
+    fprintf( stderr, ", access=%08x", req->access );
 }
 
 static void dump_open_key_request( const struct open_key_request *req )
@@ -2399,6 +2457,8 @@ static void dump_open_key_request( const struct open_key_request *req )
 static void dump_open_key_reply( const struct open_key_reply *req )
 {
     fprintf( stderr, " hkey=%04x", req->hkey );
+    fprintf( stderr, ", inproc_index=%08x", req->inproc_index );
+    fprintf( stderr, ", access=%08x", req->access );
 }
 
 static void dump_delete_key_request( const struct delete_key_request *req )
@@ -4560,6 +4620,18 @@ static void dump_get_next_thread_reply( const struct get_next_thread_reply *req
     fprintf( stderr, " handle=%04x", req->handle );
 }
 
+static void dump_get_request_stats_request( const struct get_request_stats_request *req )
+{
+    fprintf( stderr, " pid=%04x", req->pid );
+    fprintf( stderr, ", flags=%08x", req->flags );
+}
+
+static void dump_get_request_stats_reply( const struct get_request_stats_reply *req )
+{
+    fprintf( stderr, " enabled=%d", req->enabled );
+    dump_varargs_request_stats( ", stats=", cur_size );
+}
+
 static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_new_process_request,
     (dump_func)dump_get_new_process_info_request,
@@ -4568,6 +4640,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_init_process_done_request,
     (dump_func)dump_init_first_thread_request,
     (dump_func)dump_init_thread_request,
+    (dump_func)dump_get_request_shm_request,
     (dump_func)dump_terminate_process_request,
     (dump_func)dump_terminate_thread_request,
     (dump_func)dump_get_process_info_request,
@@ -4603,6 +4676,9 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_release_semaphore_request,
     (dump_func)dump_query_semaphore_request,
     (dump_func)dump_open_semaphore_request,
+    (dump_func)dump_get_inproc_sync_shm_request,
+    (dump_func)dump_get_inproc_sync_request,
+    (dump_func)dump_wake_inproc_sync_request,
     (dump_func)dump_create_file_request,
     (dump_func)dump_open_file_object_request,
     (dump_func)dump_alloc_file_handle_request,
@@ -4623,6 +4699,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_mapping_request,
     (dump_func)dump_open_mapping_request,
     (dump_func)dump_get_mapping_info_request,
+    (dump_func)dump_get_image_relocation_request,
     (dump_func)dump_map_view_request,
     (dump_func)dump_unmap_view_request,
     (dump_func)dump_get_mapping_committed_range_request,
@@ -4835,6 +4912,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_suspend_process_request,
     (dump_func)dump_resume_process_request,
     (dump_func)dump_get_next_thread_request,
+    (dump_func)dump_get_request_stats_request,
 };
 
 static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
@@ -4845,6 +4923,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_init_process_done_reply,
     (dump_func)dump_init_first_thread_reply,
     (dump_func)dump_init_thread_reply,
+    NULL,
     (dump_func)dump_terminate_process_reply,
     (dump_func)dump_terminate_thread_reply,
     (dump_func)dump_get_process_info_reply,
@@ -4880,6 +4959,9 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_release_semaphore_reply,
     (dump_func)dump_query_semaphore_reply,
     (dump_func)dump_open_semaphore_reply,
+    NULL,
+    (dump_func)dump_get_inproc_sync_reply,
+    NULL,
     (dump_func)dump_create_file_reply,
     (dump_func)dump_open_file_object_reply,
     (dump_func)dump_alloc_file_handle_reply,
@@ -4900,6 +4982,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_mapping_reply,
     (dump_func)dump_open_mapping_reply,
     (dump_func)dump_get_mapping_info_reply,
+    (dump_func)dump_get_image_relocation_reply,
     NULL,
     NULL,
     (dump_func)dump_get_mapping_committed_range_reply,
@@ -5112,6 +5195,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     NULL,
     (dump_func)dump_get_next_thread_reply,
+    (dump_func)dump_get_request_stats_reply,
 };
 
 static const char * const req_names[REQ_NB_REQUESTS] = {
@@ -5122,6 +5206,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "init_process_done",
     "init_first_thread",
     "init_thread",
+    "get_request_shm",
     "terminate_process",
     "terminate_thread",
     "get_process_info",
@@ -5157,6 +5242,9 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "release_semaphore",
     "query_semaphore",
     "open_semaphore",
+    "get_inproc_sync_shm",
+    "get_inproc_sync",
+    "wake_inproc_sync",
     "create_file",
     "open_file_object",
     "alloc_file_handle",
@@ -5177,6 +5265,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "create_mapping",
     "open_mapping",
     "get_mapping_info",
+    "get_image_relocation",
     "map_view",
     "unmap_view",
     "get_mapping_committed_range",
@@ -5389,6 +5478,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "suspend_process",
     "resume_process",
     "get_next_thread",
+    "get_request_stats",
 };
 
 static const struct
@@ -5621,3 +5711,8 @@ void trace_reply( enum request req, const union generic_reply *reply )
     else fprintf( stderr, "%04x: %d() = %s\n",
                   current->id, req, get_status_name(current->error) );
 }
+
+const char *get_request_name( enum request req )
+{
+    return req < REQ_NB_REQUESTS ? req_names[req] : "?";
+}
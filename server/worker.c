@@ -0,0 +1,276 @@
+/*
+ * Server worker threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * All the server objects belong to the main loop thread, which is the only
+ * one that handles requests. Worker threads are only used for the blocking
+ * or expensive parts of some requests, which work on private buffers and
+ * unix fds. Once the work is done, its completion callback is called from
+ * the main loop, where the results can be attached to server objects and the
+ * waiting clients woken up.
+ *
+ * Requests themselves are not dispatched to workers: that would need locking
+ * around the object namespace, the handle tables, the desktops and the wait
+ * queues, which the object model doesn't have.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+
+#include "file.h"
+#include "object.h"
+
+#define MAX_WORKERS 8
+
+struct work_item
+{
+    struct list  entry;          /* entry in pending or completed list */
+    work_func    work;           /* function to run in a worker thread */
+    work_func    done;           /* function to run in the main loop afterwards */
+    void        *arg;            /* argument of both functions */
+};
+
+struct work_completion
+{
+    struct object obj;           /* object header */
+    struct fd    *fd;            /* file descriptor for the pipe read side */
+    int           pipe_write;    /* unix fd for the pipe write side */
+};
+
+static void work_completion_dump( struct object *obj, int verbose );
+static void work_completion_destroy( struct object *obj );
+
+static const struct object_ops work_completion_ops =
+{
+    sizeof(struct work_completion), /* size */
+    &no_type,                       /* type */
+    work_completion_dump,           /* dump */
+    no_add_queue,                   /* add_queue */
+    NULL,                           /* remove_queue */
+    NULL,                           /* signaled */
+    NULL,                           /* satisfied */
+    no_signal,                      /* signal */
+    no_get_fd,                      /* get_fd */
+    default_map_access,             /* map_access */
+    default_get_sd,                 /* get_sd */
+    default_set_sd,                 /* set_sd */
+    no_get_full_name,               /* get_full_name */
+    no_lookup_name,                 /* lookup_name */
+    no_link_name,                   /* link_name */
+    NULL,                           /* unlink_name */
+    no_open_file,                   /* open_file */
+    no_kernel_obj_list,             /* get_kernel_obj_list */
+    no_close_handle,                /* close_handle */
+    work_completion_destroy         /* destroy */
+};
+
+static void work_completion_poll_event( struct fd *fd, int event );
+
+static const struct fd_ops work_completion_fd_ops =
+{
+    NULL,                       /* get_poll_events */
+    work_completion_poll_event, /* poll_event */
+    NULL,                       /* flush */
+    NULL,                       /* get_fd_type */
+    NULL,                       /* ioctl */
+    NULL,                       /* queue_async */
+    NULL                        /* reselect_async */
+};
+
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static struct list pending_work = LIST_INIT( pending_work );     /* protected by work_mutex */
+static struct list completed_work = LIST_INIT( completed_work ); /* protected by work_mutex */
+static int completion_pending;                                   /* protected by work_mutex */
+static unsigned int nb_workers;                                  /* protected by work_mutex */
+static unsigned int idle_workers;                                /* protected by work_mutex */
+static unsigned int queued_work;                                 /* protected by work_mutex */
+static int max_workers = -1;
+static struct work_completion *completion;
+
+static void work_completion_dump( struct object *obj, int verbose )
+{
+    struct work_completion *comp = (struct work_completion *)obj;
+    fprintf( stderr, "Worker completion fd=%p\n", comp->fd );
+}
+
+static void work_completion_destroy( struct object *obj )
+{
+    struct work_completion *comp = (struct work_completion *)obj;
+    if (comp->fd) release_object( comp->fd );
+    close( comp->pipe_write );
+}
+
+/* run the completion callbacks of the finished work items */
+static void work_completion_poll_event( struct fd *fd, int event )
+{
+    struct list completed = LIST_INIT( completed );
+    struct work_item *item;
+    char buffer[16];
+
+    pthread_mutex_lock( &work_mutex );
+    read( get_unix_fd( fd ), buffer, sizeof(buffer) );
+    completion_pending = 0;
+    list_move_tail( &completed, &completed_work );
+    pthread_mutex_unlock( &work_mutex );
+
+    while ((item = LIST_ENTRY( list_head( &completed ), struct work_item, entry )))
+    {
+        list_remove( &item->entry );
+        item->done( item->arg );
+        free( item );
+    }
+}
+
+/* main function of the worker threads */
+static void *worker_thread( void *arg )
+{
+    struct work_item *item;
+    char dummy = 0;
+
+    pthread_mutex_lock( &work_mutex );
+    for (;;)
+    {
+        while (!(item = LIST_ENTRY( list_head( &pending_work ), struct work_item, entry )))
+        {
+            idle_workers++;
+            pthread_cond_wait( &work_cond, &work_mutex );
+            idle_workers--;
+        }
+        list_remove( &item->entry );
+        pthread_mutex_unlock( &work_mutex );
+
+        item->work( item->arg );
+
+        pthread_mutex_lock( &work_mutex );
+        list_add_tail( &completed_work, &item->entry );
+        if (!--queued_work) pthread_cond_broadcast( &idle_cond );
+        if (!completion_pending)
+        {
+            completion_pending = 1;
+            write( completion->pipe_write, &dummy, 1 );
+        }
+    }
+    return NULL;
+}
+
+/* create the pipe used to run the completion callbacks in the main loop */
+static int init_workers(void)
+{
+    const char *env = getenv( "WINESERVERWORKERS" );
+    int fd[2];
+
+    if (env) max_workers = min( atoi( env ), MAX_WORKERS );
+    else max_workers = min( sysconf( _SC_NPROCESSORS_ONLN ), MAX_WORKERS );
+    if (max_workers <= 0) return 0;
+
+    if (pipe( fd ) == -1) goto failed;
+    fcntl( fd[0], F_SETFL, O_NONBLOCK );
+    if (!(completion = alloc_object( &work_completion_ops )))
+    {
+        close( fd[0] );
+        close( fd[1] );
+        goto failed;
+    }
+    completion->pipe_write = fd[1];
+    if (!(completion->fd = create_anonymous_fd( &work_completion_fd_ops, fd[0], &completion->obj, 0 )))
+    {
+        release_object( completion );
+        completion = NULL;
+        goto failed;
+    }
+    set_fd_events( completion->fd, POLLIN );
+    make_object_permanent( &completion->obj );
+    return 1;
+
+failed:
+    max_workers = 0;
+    return 0;
+}
+
+/* queue a work item; returns 0 if no worker is available, in which case the caller does the work */
+int queue_work( work_func work, work_func done, void *arg )
+{
+    struct work_item *item;
+    sigset_t sigset, old_sigset;
+    pthread_t thread;
+    int ret = 1;
+
+    if (max_workers == -1 && !init_workers()) return 0;
+    if (!max_workers) return 0;
+    if (!(item = mem_alloc( sizeof(*item) ))) return 0;
+    item->work = work;
+    item->done = done;
+    item->arg  = arg;
+
+    pthread_mutex_lock( &work_mutex );
+    if (!idle_workers && nb_workers < max_workers)
+    {
+        /* signals are handled by the main loop */
+        sigfillset( &sigset );
+        pthread_sigmask( SIG_SETMASK, &sigset, &old_sigset );
+        if (!pthread_create( &thread, NULL, worker_thread, NULL ))
+        {
+            pthread_detach( thread );
+            nb_workers++;
+        }
+        pthread_sigmask( SIG_SETMASK, &old_sigset, NULL );
+    }
+    if (nb_workers)
+    {
+        list_add_tail( &pending_work, &item->entry );
+        queued_work++;
+        pthread_cond_signal( &work_cond );
+    }
+    else ret = 0;
+    pthread_mutex_unlock( &work_mutex );
+
+    if (!ret) free( item );
+    return ret;
+}
+
+/* wait for all the queued work to be done and run its completion callbacks, used on shutdown */
+void flush_work(void)
+{
+    if (!completion) return;
+    pthread_mutex_lock( &work_mutex );
+    while (queued_work) pthread_cond_wait( &idle_cond, &work_mutex );
+    pthread_mutex_unlock( &work_mutex );
+    work_completion_poll_event( completion->fd, POLLIN );
+}